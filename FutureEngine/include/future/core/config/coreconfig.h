@@ -22,6 +22,14 @@
 class IFutureOStream;
 class IFutureIStream;
 
+//! How the thread pool places its worker threads on the cpu
+enum FutureThreadAffinity
+{
+	FutureThreadAffinity_None,	//!< Let the OS schedule workers anywhere
+	FutureThreadAffinity_Node,	//!< Keep each worker on the cores of one NUMA node
+	FutureThreadAffinity_Core,	//!< Pin each worker to a single core
+};
+
 /*!
  *	\brief		Static class containing runtime configurations for the core library
  *
@@ -48,6 +56,12 @@ public:
 	 * Requires TrackMemory and ProfileEnabled to be true.
 	 */
 	static const bool			ProfileMemory() {return m_profileMemory && m_profileEnabled && m_trackMemory; }
+	/* Average number of bytes allocated between two samples of the memory profiler, 0 turns sampling off.
+	 * Sampling works without TrackMemory and is cheap enough to leave on in release, see FutureMemoryProfiler.
+	 */
+	static const u32			MemorySampleInterval() {return m_memorySampleInterval; }
+	//! Sets MemorySampleInterval, can be changed at any time
+	static void					SetMemorySampleInterval(u32 bytes) { m_memorySampleInterval = bytes; }
 
 	//! If true then any allocations that would push the current memory use past InternalMemoryLimit will fail
 	static const bool			ForceInternalMemoryLimit() {return m_forceMemoryLimit; }
@@ -55,6 +69,8 @@ public:
 	static const u32			InternalMemoryLimit() {return m_memoryLimit; }
 	//! The default size of the memory heap, if this is 0 then no heap will be created and all allocations will be passed to malloc
 	static const u32			DefaultMemoryHeapSize() {return m_heapSize; }
+	//! The size of each thread's frame allocator stack, if this is 0 then no frame allocator will be created
+	static const u32			DefaultFrameArenaSize() {return m_frameArenaSize; }
 	//! The number of default pool allocators to create
 	static const u32			DefaultMemoryPoolAllcoators() {return m_numPools; }
 	//! An array of size DefaultMemoryPoolAllcoators() holding the block size for each pool allocator
@@ -75,7 +91,14 @@ public:
 	 */
 	static const bool			ProfileThreadPool() {return m_profileThreadPool && m_profileEnabled; }
 	//! The number of default threads the thread pool should create. This will return 0 in a single threaded environment.
-	static const u8				ThreadPoolThreads() {return m_trackMemory; }
+	static const u8				ThreadPoolThreads() {return m_defaultThreads; }
+	/* Controls where the thread pool's worker threads run, see FutureThreadAffinity.
+	 * With Node or Core the workers are spread over the NUMA nodes in turn, so memory a worker allocates for itself
+	 * stays on its node, and idle workers steal from workers on their own node before trying other nodes.
+	 */
+	static const FutureThreadAffinity	ThreadPoolAffinity() {return m_threadAffinity; }
+	//! Changes the worker placement, only threads created after this call are affected
+	static void					SetThreadPoolAffinity(FutureThreadAffinity affinity) { m_threadAffinity = affinity; }
 
 	/* 	This option controls the entire program flow by determining how threads should operate.
 	 *	If true, then each system will run on a seperate thread. Each system will essentially be single threaded and operate as it's
@@ -129,7 +152,7 @@ public:
 
 	//! Stores resource names and allows access to names by functions in the resource manager: Default - True for debug and profile, false for release
 	static const bool			StoreResourceNames() { return m_storeResourceNames; }
-	//! Allows for accessing resources by name instead of only by id. This is not recommended as it is expensive but here just in case
+	//! Allows for accessing resources by name instead of only by id. Names are found through a hash index, only the hashes are kept if names aren't stored
 	static const bool			SearchResourceNames() { return m_searchResourceNames; }
 
 #ifndef FUTURE_TOOL
@@ -145,15 +168,18 @@ protected:
 	static bool		m_profileEnabled;
 	static bool		m_trackMemory;
 	static bool		m_profileMemory;
+	static u32		m_memorySampleInterval;
 	static bool		m_forceMemoryLimit;
 	static u32		m_memoryLimit;
 	static u32		m_heapSize;
+	static u32		m_frameArenaSize;
 	static u32		m_numPools;
 	static u32 *	m_poolBlockSizes;
 	static u32 *	m_poolNumBlocks;
 	static bool 	m_multithreaded;
 	static bool		m_profileThreadPool;
 	static u8		m_defaultThreads;
+	static FutureThreadAffinity	m_threadAffinity;
 	static bool		m_asyncSystems;
 	static bool		m_autoPopulate;
 	static bool		m_eventDispatching;
@@ -0,0 +1,123 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	FutureTrace records how long scopes of code take on every thread and writes them out
+*	in the Chrome trace event format, which can be opened in chrome://tracing or Perfetto.
+*
+*	Wrap a scope in FUTURE_TRACE_SCOPE("name") to record it. The name must stay valid until
+*	the trace is dumped, string literals work best. FUTURE_TRACE_SCOPE_ARG also records a
+*	number with the event, like a job or resource id. Tracing is always compiled in and off
+*	until FutureTrace::SetEnabled(true) is called, a scope only costs a check of the enabled
+*	flag on entry and on exit while it is off.
+*
+*	Each thread records into its own ring buffer without taking locks, once a buffer is full
+*	the oldest events are overwritten. Dump can be called from any thread, events recorded
+*	while it runs may or may not make it into the output. A job suspended by FutureJobWait
+*	is recorded on the thread it finishes on.
+*/
+
+#ifndef FUTURE_CORE_DEBUG_TRACE_H
+#define FUTURE_CORE_DEBUG_TRACE_H
+
+#include <future/core/type/type.h>
+
+// Events kept for each thread, must be a power of two. Older events are overwritten
+#ifndef FUTURE_TRACE_EVENTS_PER_THREAD
+#	define FUTURE_TRACE_EVENTS_PER_THREAD	8192
+#endif
+
+class FutureBufferedOutputStream;
+
+class FutureTrace
+{
+public:
+	static inline bool	IsEnabled()
+	{
+		return ms_enabled;
+	}
+	static void			SetEnabled(bool enabled);
+
+	// Records a finished scope on the calling thread, times are from FutureTimer::CurrentNanoseconds
+	static void			Record(const char * name, u64 startTime, u64 endTime, u64 arg, bool hasArg);
+
+	// Names the calling thread in the trace, name must stay valid until the trace is dumped
+	static void			SetThreadName(const char * name);
+
+	// Writes every recorded event to stream as Chrome trace JSON. Returns false if a write failed
+	static bool			Dump(FutureBufferedOutputStream * stream);
+
+	// Throws away every recorded event
+	static void			Clear();
+	// Frees every thread's buffer, nothing may be recording while this is called
+	static void			Shutdown();
+
+	// Number of events currently held in all buffers
+	static u32			EventCount();
+
+private:
+	static volatile bool	ms_enabled;
+};
+
+// Records the time from construction to destruction if tracing was enabled at construction
+class FutureTraceScope
+{
+public:
+	inline FutureTraceScope(const char * name)
+		: m_name(NULL)
+	{
+		if(FutureTrace::IsEnabled())
+		{
+			Begin(name, 0, false);
+		}
+	}
+	inline FutureTraceScope(const char * name, u64 arg)
+		: m_name(NULL)
+	{
+		if(FutureTrace::IsEnabled())
+		{
+			Begin(name, arg, true);
+		}
+	}
+	inline ~FutureTraceScope()
+	{
+		if(m_name)
+		{
+			End();
+		}
+	}
+
+private:
+	void			Begin(const char * name, u64 arg, bool hasArg);
+	void			End();
+
+	const char *	m_name;
+	u64				m_startTime;
+	u64				m_arg;
+	bool			m_hasArg;
+};
+
+#define FUTURE_TRACE_CONCAT_INTERNAL(a, b)	a##b
+#define FUTURE_TRACE_CONCAT(a, b)			FUTURE_TRACE_CONCAT_INTERNAL(a, b)
+
+#define FUTURE_TRACE_SCOPE(name)			FutureTraceScope FUTURE_TRACE_CONCAT(futureTraceScope, __LINE__)(name)
+#define FUTURE_TRACE_SCOPE_ARG(name, arg)	FutureTraceScope FUTURE_TRACE_CONCAT(futureTraceScope, __LINE__)(name, (u64)(arg))
+
+#endif
@@ -27,13 +27,26 @@
 #	define _aligned_malloc(bytes, align)	memalign(align, bytes)
 #	define _aligned_free(data)				free(data)
 #elif FUTURE_PLATFORM_OSX || FUTURE_PLATFORM_IOS
-    // Mac is already 16 bit aligned so we don't need to change it
-#	define _aligned_malloc(bytes, align)	(align <= 16 ? malloc(bytes) : NULL)
+    // Mac is already 16 bit aligned so we only need posix_memalign for larger alignments
+inline void * FutureAlignedMalloc(size_t bytes, size_t align)
+{
+	void * data = NULL;
+	if(align <= 16)
+	{
+		return malloc(bytes);
+	}
+	return posix_memalign(&data, align, bytes) == 0 ? data : NULL;
+}
+#	define _aligned_malloc(bytes, align)	FutureAlignedMalloc(bytes, align)
 #	define _aligned_free(data)				free(data)
 #endif
 
+// Every allocator returns blocks aligned to at least this many bytes
+#define FUTURE_DEFAULT_ALIGNMENT	16
+
 // Forward Declares
 struct FutureMemoryParam;
+struct FutureMemoryFragmentation;
 
 /*!
  *	\brief		Interface containing function declarations for memory allocation.
@@ -67,6 +80,38 @@ public:
      *	\return		A pointer to the beginning of the requested memory block or NULL is one could not be found.
      */
 	virtual void *	Alloc(u32 bytes) = 0;
+    /*	\brief		Allocates a block of memory that is at least bytes large and starts at a multiple of alignment
+     *	\details	alignment must be a power of two. Alloc already returns blocks aligned to FUTURE_DEFAULT_ALIGNMENT,
+     *				allocators that can't do better keep this version and should return false from ShouldAllocate
+     *				when FutureMemoryParam::m_alignment is larger. Blocks are freed with Free like any other.
+     *	\param[in]	bytes		The size, in bytes, of the requested block of memory
+     *	\param[in]	alignment	The alignment, in bytes, of the requested block of memory
+     *	\return		A pointer to the beginning of the requested memory block or NULL is one could not be found.
+     */
+	virtual void *	AllocAligned(u32 bytes, u32 alignment)
+	{
+		return alignment <= FUTURE_DEFAULT_ALIGNMENT ? Alloc(bytes) : NULL;
+	}
+    /*	\brief		Grows or shrinks a block allocated by this allocator without moving it
+     *	\details	Allocators that can't change the size of a block in place keep this version. The contents of the
+     *				block are left as they are, when growing the new bytes are not initialized.
+     *	\param[in]	p		A pointer to the beginning of a memory block that was allocated by this allocator
+     *	\param[in]	bytes	The size, in bytes, the block should be able to hold
+     *	\return		true if the block at p now holds at least bytes, false if it was not changed
+     */
+	virtual bool	Resize(void * p, u32 bytes) { return false; }
+    /*	\brief		Grows or shrinks a block allocated by this allocator, moving it if it has to
+     *	\details	The contents are kept up to the smaller of the old and new sizes. If the block can't be resized p
+     *				is left as it was. The default only resizes in place, allocators that can move a block cheaper
+     *				than allocating a new one and copying, like the operating system remapping pages, override it.
+     *	\param[in]	p		A pointer to the beginning of a memory block that was allocated by this allocator
+     *	\param[in]	bytes	The size, in bytes, the block should be able to hold
+     *	\return		A pointer to the block, which may have moved, or NULL if it could not be resized
+     */
+	virtual void *	Realloc(void * p, u32 bytes) { return Resize(p, bytes) ? p : NULL; }
+	//! The number of bytes the block at p can hold, which may be more than was asked for
+	//! \return	0 if the allocator doesn't keep track of the size of its blocks
+	virtual u32		UsableSize(void * p) { return 0; }
     /*	\brief		Frees the previously allocator block
      *	\details	This function requires that the memory be allocator using this allocator. If the provided
      *				pointer references a block of memory that was allocated by this allocator, an assert will
@@ -82,6 +127,18 @@ public:
 	//! Determines if this allocator can and should allocate the memory requested in the memParam
 	//! \param[in] memParam	The FutureMemoryParam for the requested allocation
 	virtual bool	ShouldAllocate(FutureMemoryParam memParam) = 0;
+
+	//! Fills in how this allocator's memory is split between used and free blocks
+	//! \return	false if the allocator doesn't keep track of its blocks
+	virtual bool	GetFragmentation(FutureMemoryFragmentation & fragmentation) { return false; }
+
+	//! Allocators that release memory in bulk instead of through Free return false, the memory
+	//! system won't track or count their allocations as the tracker would never see them freed
+	virtual bool	TrackAllocations() { return true; }
+
+	//! Allocators that hand out blocks from inside a FutureMemoryChunk return true. The memory system
+	//! finds their blocks through the chunk and doesn't add a header, Free is called with the block itself
+	virtual bool	UsesChunks() { return false; }
 };
 
 #endif
\ No newline at end of file
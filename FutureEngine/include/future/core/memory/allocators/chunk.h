@@ -0,0 +1,64 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+/*
+*	Memory chunks let the memory system find the allocator of a block from its address alone,
+*	so allocators that carve small blocks out of chunks don't need a header in front of each one.
+*
+*	A chunk is aligned to FUTURE_MEMORY_CHUNK_SIZE and is a multiple of it in size. The chunk
+*	header sits at the start, the allocator owns everything after it. Every chunk sized slice
+*	of address space covered by a chunk is entered in a global radix map, so looking up the
+*	chunk of any address inside it is two array reads and never takes a lock.
+*/
+
+#ifndef FUTURE_CORE_MEMORY_ALLOCATOR_CHUNK_H
+#define FUTURE_CORE_MEMORY_ALLOCATOR_CHUNK_H
+
+#include <future/core/type/type.h>
+
+class IFutureAllocator;
+
+// Chunks are aligned to and sized in multiples of 64KB
+#define FUTURE_MEMORY_CHUNK_SHIFT		16
+#define FUTURE_MEMORY_CHUNK_SIZE		(1 << FUTURE_MEMORY_CHUNK_SHIFT)
+// The chunk header is padded so the data after it stays aligned
+#define FUTURE_MEMORY_CHUNK_HEADER_SIZE	32
+
+// m_sizeClass of chunks that don't belong to a size class
+#define FUTURE_NO_SIZE_CLASS			0xFF
+
+struct FutureMemoryChunk
+{
+	IFutureAllocator *	m_owner;		// the allocator that Free is called on for blocks in this chunk
+	FutureMemoryChunk *	m_next;			// free for the owner to use, usually to keep a list of its chunks
+	IFutureAllocator *	m_backing;		// the allocator the chunk's memory came from, NULL if it came from the system
+	u32					m_size;			// bytes in the chunk, including the header
+	u8					m_sizeClass;	// the thread cache size class of the owner, FUTURE_NO_SIZE_CLASS if none
+
+	//! Allocates and registers a chunk with room for at least bytes after the header, NULL if out of memory.
+	//! The memory comes from backing if one is given, it must return blocks aligned to FUTURE_MEMORY_CHUNK_SIZE
+	static FutureMemoryChunk *	Create(IFutureAllocator * owner, u32 bytes, IFutureAllocator * backing = NULL);
+	//! Unregisters and frees a chunk, nothing inside it may be used afterwards
+	static void					Destroy(FutureMemoryChunk * chunk);
+	//! Returns the chunk holding p, or NULL if p was not allocated inside a chunk
+	static FutureMemoryChunk *	Find(const void * p);
+
+	u8 *	Data()	{ return (u8*)this + FUTURE_MEMORY_CHUNK_HEADER_SIZE; }
+	u8 *	End()	{ return (u8*)this + m_size; }
+};
+
+#endif
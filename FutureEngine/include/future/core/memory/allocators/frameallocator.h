@@ -0,0 +1,127 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+#ifndef FUTURE_CORE_MEMORY_ALLOCATOR_FRAME_H
+#define FUTURE_CORE_MEMORY_ALLOCATOR_FRAME_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/allocators/allocator.h>
+#include <future/core/memory/allocators/stackallocator.h>
+#include <future/core/memory/memory.h>
+
+struct FutureFrameArena;
+
+// A position in the calling thread's frame arena, only valid on that thread during the frame it was taken.
+// A job that suspends can resume on another worker, so a marker must not be held across FutureJobWait
+struct FutureFrameMarker
+{
+	FutureStackMarker	m_marker;
+	s32					m_frame;
+	FutureFrameArena *	m_arena;	// the arena the marker was taken in, freeing to it in any other does nothing
+};
+
+/*!
+ *	\brief		A per thread scratch arena for memory that only lives until the end of the frame
+ *
+ *	\details 	Each thread allocates from its own FutureStackAllocator, so allocating is a pointer bump
+ *				without locks or atomics. Memory is never freed one allocation at a time, Free does nothing.
+ *				EndFrame releases everything allocated during the frame: it only advances the frame counter
+ *				and each thread rewinds its own arena the next time it allocates, so it is safe to call while
+ *				other threads are still running. Memory allocated during a frame stays valid until its thread
+ *				allocates again after EndFrame.
+ *
+ *				The memory system creates the frame allocator and calls EndFrame at the end of every
+ *				FutureSystemController::PostSynchronizeAll. It is never chosen automatically, request it with
+ *				FUTURE_ALLOC_ALLOCATOR(size, type, FutureFrameAllocator::GetInstance()) or FUTURE_FRAME_ALLOC.
+ *				Allocations from it are never tracked as they are released without going through the tracker.
+ *
+ *				Use FutureScopedArenaMarker to release scratch memory before the end of the frame.
+ *
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		August 2013
+ */
+class FutureFrameAllocator : public IFutureAllocator
+{
+public:
+	//! Returns the frame allocator, NULL if the memory system hasn't created one
+	static FutureFrameAllocator *	GetInstance();
+	//! Hands the calling thread's arena to the next thread that needs one, called when a thread finishes
+	static void						ReleaseThread();
+
+	/*	\brief	FutureFrameAllocator Constructor, only one frame allocator can exist at a time
+	 *	\param	stackSize	The size of each thread's stack, the arena grows by this much when it runs out
+	 */
+	FutureFrameAllocator(u32 stackSize = 1024 * 1024);
+	virtual ~FutureFrameAllocator();
+
+	//! Returns memory from the calling thread's arena that is valid until the end of the frame
+	virtual void *	Alloc(u32 bytes);
+	//! Alloc aligned to alignment bytes
+	virtual void *	AllocAligned(u32 bytes, u32 alignment);
+	//! Does nothing, memory is released by EndFrame or a marker
+	virtual void	Free(void * p);
+
+	//! Never chosen by the memory system without being requested
+	virtual u8		Priority();
+	virtual bool	ShouldAllocate(FutureMemoryParam memParam);
+	virtual bool	TrackAllocations();
+	virtual bool	UsesChunks();
+
+	//! Releases every allocation made during the current frame on every thread
+	void				EndFrame();
+	s32					Frame();
+
+	FutureFrameMarker	GetMarker();
+	//! Releases everything the calling thread allocated after the marker was taken
+	void				FreeToMarker(const FutureFrameMarker & marker);
+
+	//! Bytes the calling thread has allocated this frame
+	u32					BytesUsed();
+
+private:
+	friend struct FutureFrameArena;
+
+	FutureFrameArena *	GetArena();
+
+	u32					m_stackSize;
+	volatile s32		m_frame;
+	void * volatile		m_arenas;
+};
+
+/*!
+ *	\brief		Releases everything the calling thread allocated from the frame allocator inside a scope
+ *
+ *	\details	Takes a marker when created and rewinds the thread's arena to it when destroyed. Markers
+ *				can be nested, inner scopes must end first. If the frame ends while the marker exists
+ *				the arena has already been reset and the rewind does nothing.
+ */
+class FutureScopedArenaMarker
+{
+public:
+	FutureScopedArenaMarker(FutureFrameAllocator * allocator = FutureFrameAllocator::GetInstance());
+	~FutureScopedArenaMarker();
+
+private:
+	FutureFrameAllocator *	m_allocator;
+	FutureFrameMarker		m_marker;
+};
+
+// Allocates memory that is released at the end of the frame, never free it
+#define FUTURE_FRAME_ALLOC(size, type)		FUTURE_ALLOC_ALLOCATOR(size, type, FutureFrameAllocator::GetInstance())
+
+#endif
@@ -23,10 +23,20 @@
 #include <future/core/object/threadsafeobject.h>
 
 struct FutureMemoryParam;
-class FuturePoolAllocator;
+struct FutureMemoryFragmentation;
+class FutureVirtualAllocator;
+
+// Blocks are aligned to and a multiple of 1 << FUTURE_HEAP_ALIGN_LOG2 bytes
+#define FUTURE_HEAP_ALIGN_LOG2		4
+// Every power of two size range is split into 1 << FUTURE_HEAP_SL_LOG2 free lists
+#define FUTURE_HEAP_SL_LOG2			4
+#define FUTURE_HEAP_SL_COUNT		(1 << FUTURE_HEAP_SL_LOG2)
+// Blocks smaller than this all share the first level, one list per aligned size
+#define FUTURE_HEAP_FL_SHIFT		(FUTURE_HEAP_SL_LOG2 + FUTURE_HEAP_ALIGN_LOG2)
+#define FUTURE_HEAP_FL_COUNT		(32 - FUTURE_HEAP_FL_SHIFT + 1)
 
 /*!
- *	\brief		A standard heap allocator
+ *	\brief		A two level segregated fit (TLSF) heap allocator
  *
  *	\details 	This alloctor first requests a large chunk of data from the operating system then hands out variable
  *				sized blocks upon request. Requested block sizes must be less than the heap size or the allocation will
@@ -36,6 +46,17 @@ class FuturePoolAllocator;
  *				the entire game. Expanding the heap is expensive and often not needed. The default heap size is 10mb, 
  *				large enough to handle most requests. Some platforms (phones) may need to lower the heap size to handle 
  *				device memory limits.
+ *
+ *				Free blocks are kept in a free list per size range. The first level splits sizes by power of two, the
+ *				second level splits each power of two into FUTURE_HEAP_SL_COUNT ranges, and a bitmap per level records
+ *				which lists have blocks. Alloc finds a list that is guaranteed to fit the request with two bit scans,
+ *				so both Alloc and Free take the same time no matter how many blocks the heap holds. Every block starts
+ *				with a boundary tag holding its size and whether it and the block before it are free, free blocks also
+ *				store their size in their last bytes. Free uses these tags to merge a block with free neighbours
+ *				straight away, so the heap never holds two free blocks next to each other.
+ *
+ *				When used by the memory system the boundary tag is the FutureAllocHeader, the size is kept in
+ *				m_allocatorData. Otherwise the allocator adds its own 16 byte tag in front of each allocation.
  *	
  *	\author		Lucas Stufflebeam
  *	\version 	1.0
@@ -47,48 +68,72 @@ public:
 	/*	\brief	FutureHeapAllocator Constructor
 	 *	\param	heapSize	The size of each heap this allocator uses, defaulted to 10mb
 	 *	\param	usingHeaders	True if this allocator will be used by the memory system and false if it will not
+	 *	\param	backing		The allocator heaps are allocated from, NULL to use the system allocator. Heaps from a
+	 *						FutureVirtualAllocator give their pages back when every block in them is freed
 	 */
-	FutureHeapAllocator(u32 heapSize = 1024 * 1024 * 10, bool usingHeaders = true);
+	FutureHeapAllocator(u32 heapSize = 1024 * 1024 * 10, bool usingHeaders = true, FutureVirtualAllocator * backing = NULL);
 
 	//! FutureHeapAllocator Destructor
 	virtual ~FutureHeapAllocator();
 
 	//! Returns a pointer to a 16 bit aligned block of memory that is at least bytes large
 	virtual void *	Alloc(u32 bytes);
-	//! Frees the block at p so it cna used for future allocations
+	//! Returns a pointer aligned to alignment bytes, a free block is split off the front of the block to align it
+	virtual void *	AllocAligned(u32 bytes, u32 alignment);
+	//! Frees the block at p so it cna used for future allocations, merging it with any free neighbours
 	virtual void	Free(void * p);
+	//! Shrinks the block, or grows it into the block after it if that block is free and big enough
+	virtual bool	Resize(void * p, u32 bytes);
+	//! The size of the block at p without its tag
+	virtual u32		UsableSize(void * p);
 
 	//! The priority when used with the memory system. This will always return 200, the last step before the malloc allocator
 	virtual u8		Priority();
 	//! Returns true for any allocation that is less than 1/4 of the heap size
 	virtual bool	ShouldAllocate(FutureMemoryParam memParam);
 
+	//! Walks every block in every heap, fills in how much memory is used and how the free memory is split up
+	virtual bool	GetFragmentation(FutureMemoryFragmentation & fragmentation);
+
+	//! Gives the pages of every idle heap back to the backing allocator, including the first heap which Free keeps
+	void			Trim();
+
 private:
 
-	//! Stucture used to keep track of free blocks within a heap in a linked list style
+	//! The boundary tag at the start of every block, laid out the same as FutureAllocHeader
 	struct Block
 	{
-		Block * m_next;	//! A pointer to the next free block
-		void *	m_data; //! A pointer to the heap data contained in this block
-		u32		m_size;	//! The size, in bytes, of this block
+		Block *	m_nextFree;		//! The next block in the same free list, belongs to the memory system while the block is used
+		size_t	m_size;			//! The size of the block including this tag, the low bits hold BlockFree and PrevFree
+		Block *	m_prevFree;		//! The previous block in the same free list, only valid while the block is free
 	};
 
-	//! Structure used to keep track of all heaps in a linked list style
+	//! Structure used to keep track of all heaps in a linked list style, stored at the front of each heap
 	struct Heap
 	{
 		Heap *	m_next;			//! A pointer to the next heap in the list
-		Block * m_freeBlocks;	//! A linked list of free bmemory blocks within this heap
-		void *	m_data;			//!	A pointer to the memory chunk allodated by this heap, used to ensure the heap is freed properly
 	};
 
 	u32		m_heapSize;			//! The size of each heap
 	Heap *	m_heaps;			//! A linked list of the heaps contained in this allocator
 	bool	m_usingHeaders;		//! True if the requested memory contains space for a FutureMemoryHeader and false if the heap should add it's own header
+	FutureVirtualAllocator *	m_backing;	//! Where new heaps are allocated from, NULL for the system allocator
+
+	u32		m_flBitmap;										//! Bit fl is set if any list in m_slBitmap[fl] has blocks
+	u32		m_slBitmap[FUTURE_HEAP_FL_COUNT];				//! Bit sl is set if m_freeLists[fl][sl] has blocks
+	Block *	m_freeLists[FUTURE_HEAP_FL_COUNT][FUTURE_HEAP_SL_COUNT];
 
-	FuturePoolAllocator * m_poolAllocator;		//! A pool allocator used to quickly allocator Block and Heap structures
+	//! Allocates a new heap and adds it to the free lists as a single block, returns that block or NULL
+	Block *	AddHeap();
 
-	//! Allocates a new heap and sets it up to handle new allocations
-	void	AddHeap();
+	//! Returns a free block of at least size bytes and removes it from its list, or NULL
+	Block *	FindFreeBlock(u32 size);
+	void	InsertFreeBlock(Block * block);
+	void	RemoveFreeBlock(Block * block);
+	//! Marks a free block as free, writes its size at its end and tells the next block
+	void	SetFree(Block * block, size_t size);
+	//! Gives the pages under a free block that covers a whole heap back to the backing allocator
+	void	DecommitHeap(Block * block);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -47,8 +47,14 @@ public:
 
 	//! Returns a 16 bit sligned memory block by passing the request to the operating system
 	virtual void *	Alloc(u32 bytes);
+	//! Passes the request to the operating system with the requested alignment
+	virtual void *	AllocAligned(u32 bytes, u32 alignment);
 	//! Takes a block of memory allocated by this allocator and requests that the OS free that memory block
 	virtual void	Free(void * p);
+	//! Passes the request to realloc, which remaps the pages of large blocks instead of copying them
+	virtual void *	Realloc(void * p, u32 bytes);
+	//! Asks the OS how large the block at p is
+	virtual u32		UsableSize(void * p);
 
 	//! Gets the priority of this allocator, FutureMallocAllocator always returns 255, the last possible allocator
 	virtual u8		Priority() = 0;
@@ -21,8 +21,16 @@
 
 #include <future/core/memory/allocators/allocator.h>
 #include <future/core/object/threadsafeobject.h>
+#include <future/core/thread/atomic/atomic.h>
 
 struct FutureMemoryParam;
+struct FutureMemoryChunk;
+class FutureVirtualAllocator;
+
+// Blocks are aligned to the largest power of two that divides the block size, up to this
+#ifndef FUTURE_POOL_NATURAL_ALIGNMENT
+#	define FUTURE_POOL_NATURAL_ALIGNMENT	64
+#endif
 
 /*!
  *	\brief		A Pool or FreeList allocator
@@ -36,6 +44,15 @@ struct FutureMemoryParam;
  *				returned. This can cause a lot of memory waste if done carelessly. If the pool allocator
  *				runs out of free blocks, it will automatically expand. This is expensive so the default
  *				starting blocks should be large enough to handle all requests.
+ *
+ *				Blocks are carved out of memory chunks and carry no header, the memory system finds the
+ *				pool of a block through its chunk. Free blocks are linked through their first bytes.
+ *
+ *				The free list is a lock free stack, allocating and freeing a block is a single compare exchange
+ *				on its head. The head carries a counter next to the address of the top block that changes on
+ *				every push and pop, so a thread that read the head before another thread popped the top block
+ *				and pushed it back fails its exchange instead of corrupting the list. Only expanding the pool
+ *				takes the lock.
  *	
  *	\author		Lucas Stufflebeam
  *	\version 	1.0
@@ -45,44 +62,74 @@ class FuturePoolAllocator : public IFutureAllocator, public FutureThreadSafeObje
 {
 public:
 	/*	\brief	FuturePoolAllocator Constructor
-	 *	\param	poolSize	The size, in bytes, of each block
+	 *	\param	poolSize	The size, in bytes, of each block, rounded up to a multiple of 16 and of alignment
 	 *	\param	startingBlocks	The number of blocks to allocate. Allocating additional blocks is expensive.
-	 *	\param	usingHeaders	True if this allocator will be used by the memory system and false if it will not
+	 *	\param	alignment	The least alignment of every block, a power of two. Blocks are also aligned to the
+	 *						largest power of two their size is a multiple of, up to FUTURE_POOL_NATURAL_ALIGNMENT
+	 *	\param	backing		The allocator the pool's chunks are allocated from, NULL to use the system allocator
 	 */
-	FuturePoolAllocator(u16 blockSize, u32 startingBlocks = 4096, bool accountForHeaders = true);
+	FuturePoolAllocator(u16 blockSize, u32 startingBlocks = 4096, u16 alignment = FUTURE_DEFAULT_ALIGNMENT, FutureVirtualAllocator * backing = NULL);
 	//! FuturePoolAllocator Desctructor
 	virtual ~FuturePoolAllocator();
 
-	//! Returns a pointer to the next free block
+	//! Pops the next free block, never locks unless the pool has to expand
 	virtual void *	Alloc(u32 bytes);
-	//! Added the used block back into the free block list
+	//! Returns a pointer to the next free block if the pool's blocks are aligned well enough, NULL if not
+	virtual void *	AllocAligned(u32 bytes, u32 alignment);
+	//! Pushes the block back onto the free list
 	virtual void	Free(void * p);
+	//! Every block is the same size, returns true if bytes fits in one
+	virtual bool	Resize(void * p, u32 bytes);
+	//! Always the block size
+	virtual u32		UsableSize(void * p);
 
 	//! The priority of this allocator, which is 100 + (blockSize / 16) so that smaller pools are checked first
 	virtual u8		Priority();
-	//! Returns true if the requested size is less than or equal to the block size
+	//! Returns true if the requested size is less than or equal to the block size and the blocks are aligned well enough
 	virtual bool	ShouldAllocate(FutureMemoryParam memParam);
+	virtual bool	UsesChunks();
+
+	//! Takes up to count blocks, expanding if the pool is empty. Returns the number taken
+	u32				AllocBatch(void ** blocks, u32 count);
+	//! Returns count blocks from Alloc or AllocBatch with a single push
+	void			FreeBatch(void ** blocks, u32 count);
+
+	//! The size of each block in bytes
+	u32				BlockSize();
+	//! The alignment of every block in bytes
+	u32				Alignment();
+
+	//! Marks the pool's chunks as belonging to a thread cache size class, set by FutureThreadCache::AddSizeClass
+	void			SetSizeClass(u8 sizeClass);
 
 private:
 
-	//! A block of memory 
+	//! A free block of memory, only exists while the block is on the free list
 	struct Block
 	{
-		Block * m_next;	//! A pointer to the next block of memory
-		void * 	m_data;	//! The data contained within this block
+		Block * m_next;	//! A pointer to the next free block
 	};
 
-	Block *	m_freeList;	//! The list of the free memory blocks
+	volatile s64	m_freeList;	//! The top of the free block stack packed with a counter, see FuturePoolHead in the source
+	u8				m_pad[FUTURE_CACHE_LINE_SIZE - sizeof(s64)];	//! Keeps the settings below off the line every thread writes
 
 	u32		m_blocks;		//! The total number of allocated blocks
 	u32		m_blockSize;	//! The size of each memory block
+	u32		m_alignment;	//! The alignment of each memory block
 	u16		m_poolSize;		//! The number of blocks in each pool
-	bool	m_usingHeaders;	//! True if this allocator is being used by the memory system, false if it is not
+	u8		m_sizeClass;	//! The size class stored in each chunk
 
-	Block *	m_poolList;		//! A linked list of all active pools
+	FutureMemoryChunk *	m_chunks;	//! A linked list of all active pools
+	FutureVirtualAllocator *	m_backing;	//! Where new pools are allocated from, NULL for the system allocator
 
-	//! Allocates a new pool, splits it up into blocks, and adds the blocks to the free list
-	void	AddPool();
+	//! Pops the top of the free list, NULL if it is empty
+	Block *	Pop();
+	//! Pushes the chain of blocks from first to last onto the free list
+	void	Push(Block * first, Block * last);
+	//! Adds a pool unless another thread refilled the free list while this one waited for the lock, false if out of memory
+	bool	Expand();
+	//! Allocates a new pool, splits it up into blocks, and adds the blocks to the free list. Called from the constructor or with the lock held
+	bool	AddPool();
 };
 
 #endif
\ No newline at end of file
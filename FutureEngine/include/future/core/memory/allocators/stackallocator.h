@@ -20,55 +20,72 @@
 *	and deallocation. Only downside is allocations must be freed is the opposite order they
 *	were allocated in. This allocator will only be used if specifically requested as objects
 *	must be handled very carefully when using this.
+*
+*	Allocating only moves a pointer forward. Instead of freeing each allocation the stack
+*	can be rewound to a marker taken earlier, or reset completely, which releases everything
+*	allocated since in one step. When the current stack runs out a new one is added, stacks
+*	are kept after a rewind so they can be reused without going back to the system. Each stack
+*	is a memory chunk, so allocations carry no header.
+*
+*	The stack allocator does not lock, each stack must only be used by one thread at a time.
+*	FutureFrameAllocator gives every thread its own stack.
 */
 
 
 #ifndef FUTURE_CORE_MEMORY_ALLOCATOR_STACK_H
 #define FUTURE_CORE_MEMORY_ALLOCATOR_STACK_H
 
+#include <future/core/type/type.h>
 #include <future/core/memory/allocators/allocator.h>
-#include <future/core/memory/allocators/poolallocator.h>
-#include <future/core/objects/threadsafeobject.h>
 
 struct FutureMemoryParam;
-class FuturePoolAllocator;
+struct FutureMemoryChunk;
 
-class FutureStackAllocator : public IFutureAllocator, public FutureThreadSafeObject
+// A position in a FutureStackAllocator, everything allocated after it can be released at once
+struct FutureStackMarker
+{
+	void *	m_stack;
+	u8 *	m_position;
+};
+
+class FutureStackAllocator : public IFutureAllocator
 {
 public:
-	FutureStackAllocator(u32 stackSize = 1024 * 1024, bool usingHeaders = true);
+	//! owner is the allocator the memory system frees this stack's blocks through, this stack if NULL
+	FutureStackAllocator(u32 stackSize = 1024 * 1024, IFutureAllocator * owner = NULL);
+	virtual ~FutureStackAllocator();
 
+	// Returns a 16 byte aligned block, allocations larger than the stack size get a stack of their own
 	virtual void *	Alloc(u32 bytes);
+	// Skips ahead to the next multiple of alignment, the skipped bytes are released along with the block
+	virtual void *	AllocAligned(u32 bytes, u32 alignment);
+	// Releases p and everything allocated after it
 	virtual void	Free(void * p);
 
 	// highest priority, always returns false.
 	virtual u8		Priority();
 	virtual bool	ShouldAllocate(FutureMemoryParam memParam);
+	virtual bool	UsesChunks();
 
-private:
+	FutureStackMarker	GetMarker();
+	// Releases everything allocated after the marker was taken
+	void				FreeToMarker(const FutureStackMarker & marker);
+	// Releases everything, the stacks are kept for the next allocations
+	void				Reset();
 
-	struct Block
-	{
-		Block * m_next;
-		u32		m_size;
-	};
+	// Bytes allocated since the last reset, including alignment and the unused end of full stacks
+	u32					BytesUsed();
 
-	struct Stack
-	{
-		Stack *	m_next;
-		Block * m_blocks;
-
-		void *	m_position;
-		void *	m_data;
-	};
-
-	u32		m_stackSize;
-	Stack *	m_stacks;
-	bool	m_usingHeaders;
+private:
 
-	FuturePoolAllocator * m_poolAllocator;
+	u32					m_stackSize;
+	IFutureAllocator *	m_owner;
+	FutureMemoryChunk *	m_stacks;		// the first stack, Reset rewinds to it
+	FutureMemoryChunk *	m_current;		// the stack being allocated from, any after it are spare
+	u8 *				m_position;		// the next free byte in m_current
 
-	void	AddStack();
+	// Creates a stack that can hold at least bytes and places it after the current stack
+	FutureMemoryChunk *	AddStack(u32 bytes);
 };
 
-#endif
\ No newline at end of file
+#endif
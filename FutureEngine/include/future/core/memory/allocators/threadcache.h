@@ -0,0 +1,113 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+#ifndef FUTURE_CORE_MEMORY_ALLOCATOR_THREADCACHE_H
+#define FUTURE_CORE_MEMORY_ALLOCATOR_THREADCACHE_H
+
+#include <future/core/memory/allocators/allocator.h>
+#include <future/core/thread/atomic/atomic.h>
+
+class FuturePoolAllocator;
+struct FutureThreadCacheSet;
+
+// Most size classes a thread can cache, one per pool allocator
+#ifndef FUTURE_THREAD_CACHE_MAX_CLASSES
+#	define FUTURE_THREAD_CACHE_MAX_CLASSES 16
+#endif
+
+// Blocks moved between a magazine and its pool at once
+#ifndef FUTURE_THREAD_CACHE_BATCH_SIZE
+#	define FUTURE_THREAD_CACHE_BATCH_SIZE 32
+#endif
+
+// Free blocks a magazine may hold before it gives a batch back to its pool
+#ifndef FUTURE_THREAD_CACHE_MAGAZINE_SIZE
+#	define FUTURE_THREAD_CACHE_MAGAZINE_SIZE (FUTURE_THREAD_CACHE_BATCH_SIZE * 2)
+#endif
+
+/*!
+ *	\brief		A per thread magazine of free blocks in front of a pool allocator
+ *
+ *	\details 	Every pool allocator the memory system creates is registered as a size class. Each thread
+ *				that allocates gets one FutureThreadCache per size class, small allocations are taken from
+ *				the calling thread's magazine without taking the pool's lock.
+ *				An empty magazine takes FUTURE_THREAD_CACHE_BATCH_SIZE blocks from its pool under a single
+ *				lock, a magazine holding more than FUTURE_THREAD_CACHE_MAGAZINE_SIZE blocks gives a batch back.
+ *
+ *				Blocks have no header, the memory system finds the size class of a block through the chunk
+ *				it lives in and gives it to the freeing thread's magazine, whichever thread allocated it.
+ *				Threads that free more than they allocate give the surplus back to the pool in batches.
+ *
+ *				When a thread finishes its magazines are returned to the pools and its caches are handed to
+ *				the next thread that needs them.
+ */
+class FutureThreadCache : public IFutureAllocator
+{
+public:
+	//! Adds a pool allocator as the next size class, returns false if there are already
+	//! FUTURE_THREAD_CACHE_MAX_CLASSES. Must be called before any thread allocates
+	static bool					AddSizeClass(FuturePoolAllocator * pool);
+	//! Returns the pool allocator for a size class
+	static FuturePoolAllocator *	SizeClassPool(u32 sizeClass);
+	//! Returns the calling thread's cache for a size class, the memory system picks the size class
+	static FutureThreadCache *	GetCache(u32 sizeClass);
+	//! Returns the calling thread's magazines to their pools, called when a thread finishes
+	static void					ReleaseThread();
+	//! Frees every cache and forgets every size class. Called by the memory system when it is destroyed
+	static void					Shutdown();
+
+	static u32					NumSizeClasses();
+
+	//! Returns a block from this magazine, may only be called by the owning thread
+	virtual void *	Alloc(u32 bytes);
+	//! Alloc if the pool's blocks are aligned well enough, NULL if not
+	virtual void *	AllocAligned(u32 bytes, u32 alignment);
+	//! Returns a block to this magazine, may only be called by the owning thread
+	virtual void	Free(void * p);
+
+	//! Caches are never added to the allocator list
+	virtual u8		Priority();
+	virtual bool	ShouldAllocate(FutureMemoryParam memParam);
+	virtual bool	UsesChunks();
+	//! The pool's block size, so a block is charged to the budgets the same as when it is freed through the pool
+	virtual u32		UsableSize(void * p);
+
+	//! Blocks in this magazine, only exact on the owning thread
+	u32				Size();
+
+private:
+	friend struct FutureThreadCacheSet;
+
+	FutureThreadCache();
+
+	bool			IsOwner();
+	//! Takes a batch from the pool, returns false if the pool is out of memory
+	bool			Refill();
+	//! Returns count blocks from the magazine to the pool
+	void			Flush(u32 count);
+
+	// only touched by the owning thread, free blocks are linked through their first bytes
+	void *					m_free;
+	u32						m_count;
+	FuturePoolAllocator *	m_pool;
+	FutureThreadCacheSet *	m_set;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+#ifndef FUTURE_CORE_MEMORY_ALLOCATOR_VIRTUAL_H
+#define FUTURE_CORE_MEMORY_ALLOCATOR_VIRTUAL_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/allocators/allocator.h>
+#include <future/core/object/threadsafeobject.h>
+
+struct FutureMemoryParam;
+struct FutureMemoryFragmentation;
+
+// Regions are aligned to and sized in multiples of 64KB, the same as memory chunks
+#define FUTURE_VIRTUAL_GRANULE_SHIFT	16
+#define FUTURE_VIRTUAL_GRANULE_SIZE		(1 << FUTURE_VIRTUAL_GRANULE_SHIFT)
+// Size of a huge page, regions at least this large are aligned to it so they can be backed by one
+#define FUTURE_VIRTUAL_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+// Address space reserved by default
+#ifndef FUTURE_VIRTUAL_DEFAULT_RESERVE
+#	ifdef FUTURE_X64
+#		define FUTURE_VIRTUAL_DEFAULT_RESERVE	((u64)4 * 1024 * 1024 * 1024)
+#	else
+#		define FUTURE_VIRTUAL_DEFAULT_RESERVE	((u64)256 * 1024 * 1024)
+#	endif
+#endif
+
+// Smallest allocation the allocator takes when used with the memory system
+#ifndef FUTURE_VIRTUAL_MIN_ALLOCATION
+#	define FUTURE_VIRTUAL_MIN_ALLOCATION	(256 * 1024)
+#endif
+
+/*!
+ *	\brief		An allocator that hands out large regions of virtual memory
+ *
+ *	\details 	This allocator reserves one large range of address space up front and hands out regions of it.
+ *				Reserving costs no memory, pages are only committed when a region is allocated and the operating
+ *				system only backs them with physical memory the first time they are touched. Freed regions are
+ *				returned to the operating system straight away but keep their addresses, so the reserved range
+ *				never fragments the rest of the address space.
+ *
+ *				With huge pages on, regions of 2MB or more are aligned to 2MB. On Linux they are mapped with
+ *				MAP_HUGETLB when the system has huge pages set aside and marked with MADV_HUGEPAGE otherwise, so
+ *				transparent huge pages can back them. A huge page needs one TLB entry where 512 small pages need
+ *				512, which matters for large heaps that are touched all over.
+ *
+ *				It is mostly meant as the backing store of FutureHeapAllocator and FuturePoolAllocator, which
+ *				take one in their constructors, but it can also be added to the memory system to handle very
+ *				large allocations. Decommit lets an owner return pages it isn't using without freeing them.
+ *
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		June 2013
+ */
+class FutureVirtualAllocator : public IFutureAllocator, public FutureThreadSafeObject
+{
+public:
+	/*	\brief	FutureVirtualAllocator Constructor
+	 *	\param	reserveBytes	The address space to reserve, rounded up to a multiple of 64KB. No region can be larger
+	 *	\param	hugePages		True to back regions of 2MB or more with huge pages where the platform supports it
+	 */
+	FutureVirtualAllocator(u64 reserveBytes = FUTURE_VIRTUAL_DEFAULT_RESERVE, bool hugePages = true);
+
+	//! FutureVirtualAllocator Destructor, releases the whole reserved range
+	virtual ~FutureVirtualAllocator();
+
+	//! Commits a region of at least bytes, aligned to 64KB or to 2MB for huge regions. The memory reads as zero
+	virtual void *	Alloc(u32 bytes);
+	//! Commits a region aligned to alignment bytes, alignment must be a power of two
+	virtual void *	AllocAligned(u32 bytes, u32 alignment);
+	//! Returns the region's pages to the operating system and makes its addresses available again
+	virtual void	Free(void * p);
+	//! Grows a region into the granules after it if they are free, shrinking keeps the region as it is
+	virtual bool	Resize(void * p, u32 bytes);
+	//! The size of the region at p
+	virtual u32		UsableSize(void * p);
+
+	//! The priority when used with the memory system, always 250 so the heaps are checked first
+	virtual u8		Priority();
+	//! Returns true for allocations of FUTURE_VIRTUAL_MIN_ALLOCATION or more
+	virtual bool	ShouldAllocate(FutureMemoryParam memParam);
+
+	//! Fills in how much of the reserved range is used by regions
+	virtual bool	GetFragmentation(FutureMemoryFragmentation & fragmentation);
+
+	/*	\brief		Returns the pages inside a range of a region to the operating system
+	 *	\details	The range stays committed, the pages read as zero the next time they are touched. Only whole
+	 *				pages inside the range are returned, so it is safe to pass a range that shares pages with data
+	 *				that is still in use. Used by owners to give back memory they are holding on to but not using.
+	 */
+	void			Decommit(void * p, u32 bytes);
+
+	//! True if p is inside the range reserved by this allocator
+	bool			Owns(const void * p);
+	//! Bytes of the reserved range handed out as regions
+	u64				BytesCommitted();
+	//! Bytes of address space reserved
+	u64				BytesReserved();
+	//! True if huge pages were requested and the platform has a way of providing them
+	bool			UsesHugePages();
+
+private:
+
+	u8 *	m_base;				//! The start of the reserved range
+	u32		m_granules;			//! The number of 64KB granules in the reserved range
+	u32		m_usedGranules;		//! Granules handed out as regions
+	u32		m_searchStart;		//! Every granule before this one is used, where the search for a free run starts
+	u32		m_pageSize;			//! Decommit returns pages of this size, 2MB with huge pages
+	bool	m_hugePages;		//! True if regions of 2MB or more are backed by huge pages
+	bool	m_hugeTLB;			//! True while the system has huge pages set aside for MAP_HUGETLB
+
+	u64 *	m_usedMap;			//! A bit per granule, set while the granule is part of a region
+	u32 *	m_regions;			//! The granules in the region starting at each granule, 0 if none starts there
+
+	//! Finds and marks count free granules starting at a multiple of align granules, returns the first or m_granules
+	u32		ClaimGranules(u32 count, u32 align);
+	//! Clears the used bits of count granules starting at first
+	void	ReleaseGranules(u32 first, u32 count);
+};
+
+#endif
@@ -54,8 +54,35 @@
 
 struct FutureMemoryParam;
 struct FutureMemoryStatistics;
+struct FutureMemoryFragmentation;
 struct FutureMemoryParamDebug;
 class IFutureAllocator;
+class FuturePoolAllocator;
+class FutureBufferedOutputStream;
+
+// Named memory budgets. Each budget has its own set of allocators and counts the bytes its allocators have
+// handed out, allocations are given a budget through FUTURE_ALLOC_BUDGET
+enum FutureMemoryBudgetID
+{
+	FutureMemoryBudget_Default,		// the shared allocators, only has the hard limit set by InternalMemoryLimit
+	FutureMemoryBudget_Graphics,
+	FutureMemoryBudget_Resources,
+	FutureMemoryBudget_Audio,
+	FutureMemoryBudget_Scratch,
+
+	FutureMemoryBudget_Max,
+};
+
+enum FutureMemoryPressure
+{
+	FutureMemoryPressure_Soft,		// the budget went past its soft limit, a good time to start trimming caches
+	FutureMemoryPressure_Hard,		// an allocation would go past the hard limit and fails unless memory is freed
+	FutureMemoryPressure_Critical,	// the operating system is running out of memory, free everything that can be
+};
+
+// Called when a budget is under pressure, bytes is how much has to be freed to get back under the limit, 0 for
+// critical pressure. May be called from any thread that allocates, and may allocate and free memory itself
+typedef void (*FutureMemoryPressureCallback)(FutureMemoryBudgetID budget, FutureMemoryPressure pressure, u64 bytes, void * data);
 
 class FutureMemory
 {
@@ -68,6 +95,11 @@ public:
 	static void *	Alloc(const FutureMemoryParam & memParam);
 	static void *	Track(const FutureMemoryParamDebug & memParam);
 	static void		Free(void * p);
+	// Grows or shrinks the allocation at p to memParam.m_bytes and returns it, keeping its contents. The block
+	// is resized in place when its allocator can, otherwise it is moved to a new block and p is freed. A NULL p
+	// allocates and a size of 0 frees. If there isn't enough memory NULL is returned and p is left as it was
+	static void *	Realloc(void * p, const FutureMemoryParam & memParam);
+	static void *	TrackRealloc(void * p, const FutureMemoryParamDebug & memParam);
 
 	// The total bytes needed for an allocation
 	static u32		BytesForAllocation(const FutureMemoryParam & memParam);
@@ -76,37 +108,72 @@ public:
 	// to free memory. The allocator with the lowest priority that returns
 	// true for ShouldAllocate will be used for each allocation.
 	static void						AddAllocator(IFutureAllocator * allocator);
+	// Adds an allocator to a budget, allocations for the budget are only taken by its own allocators.
+	// The budget counts UsableSize of every block its allocators hand out, allocations its allocators
+	// don't take fall back to the shared ones and aren't counted
+	static void						AddAllocator(IFutureAllocator * allocator, FutureMemoryBudgetID budget);
 	static IFutureAllocator *		GetAllocator(u32 i);
+	// The allocator a block returned by Alloc or Track belongs to
+	static IFutureAllocator *		AllocatorOf(void * p);
+	static u32						NumAllocators();
+	// Adds a pool allocator as a size class. Allocations that fit a size class are looked
+	// up in a table instead of walking the allocators and are served from the calling
+	// thread's cache, unless an allocator with a lower priority is checked before the pool.
+	// Must be called before any thread allocates from the memory system
+	static void						AddSizeClass(FuturePoolAllocator * pool);
+
+	// Sets the limits of a budget in bytes, 0 turns a limit off. Crossing the soft limit calls the budget's
+	// pressure callbacks once, an allocation that would cross the hard limit calls them and only fails
+	// if they didn't free enough memory. The default budget only has a hard limit, InternalMemoryLimit
+	static void						SetBudgetLimits(FutureMemoryBudgetID budget, u64 softBytes, u64 hardBytes);
+	static void						AddPressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data = NULL);
+	static void						RemovePressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data = NULL);
+	// Bytes currently allocated from a budget's allocators. The default budget counts every tracked allocation,
+	// whichever budget it belongs to, and is what InternalMemoryLimit is checked against
+	static u64						BudgetUsage(FutureMemoryBudgetID budget);
+	// Calls every budget's pressure callbacks with FutureMemoryPressure_Critical. Called by the application
+	// when it receives FutureApplicationEvent_LowMemory
+	static void						LowMemory();
 
 	// Debugging functions, can be called from non debug/profile builds but will do nothing
 	static FutureMemoryStatistics	GetStatistics();
 
-	static void						LogStatistics();
+	// Also logs the call sites with the most sampled memory in use when sampling is on, and writes
+	// the samples to heapProfile as a pprof heap profile if it isn't NULL, see FutureMemoryProfiler
+	static void						LogStatistics(FutureBufferedOutputStream * heapProfile = NULL);
 	static void						LogAllocations();
 	static void						LogAllocation(void *);
 
+	// How the memory of the allocators is split up, works with tracking turned off
+	static FutureMemoryFragmentation	GetFragmentation();
+	static void							LogFragmentation();
+
 	/*******************************************************************/
 	// helper functions
 
-	static u32 						HeaderSize(); // return the size of the header added to each allocation in bytes
+	static u32 						HeaderSize(); // return the size of the header added to allocations from allocators that don't use chunks
 };
 
 
 struct FutureMemoryParam
 {	
-	FutureMemoryParam(u32 bytes, IFutureAllocator * allocator = 0)
+	FutureMemoryParam(u32 bytes, IFutureAllocator * allocator = 0, u32 alignment = 0, FutureMemoryBudgetID budget = FutureMemoryBudget_Default)
 		: m_bytes(bytes),
-		  m_allocator(allocator)
+		  m_allocator(allocator),
+		  m_alignment(alignment),
+		  m_budget(budget)
 	{ ; }
 
 	u32 				m_bytes;		// bytes needed in allocation
 	IFutureAllocator *	m_allocator; 	// forces the use of a specific allocator
+	u32					m_alignment;	// power of two the allocation must be aligned to, 0 for FUTURE_DEFAULT_ALIGNMENT
+	FutureMemoryBudgetID	m_budget;	// the budget whose allocators are checked first
 };
 
 struct FutureMemoryParamDebug : FutureMemoryParam
 {	
-	FutureMemoryParam(u32 bytes, const char * type = 0, const char * file = 0, u32 line = 0, IFutureAllocator * allocator = 0)
-		: FutureMemoryParam(bytes, allocator),
+	FutureMemoryParam(u32 bytes, const char * type = 0, const char * file = 0, u32 line = 0, IFutureAllocator * allocator = 0, u32 alignment = 0, FutureMemoryBudgetID budget = FutureMemoryBudget_Default)
+		: FutureMemoryParam(bytes, allocator, alignment, budget),
 		  m_type(type),
 		  m_file(file),
 		  m_line(line)
@@ -124,8 +191,27 @@ struct FutureMemoryParamDebug : FutureMemoryParam
 #define FUTURE_NOTRACK(size)							(FutureMemory::Track(FutureMemoryParam(size))
 #define FUTURE_NOTRACK_ALLOCATOR(size, allocator)		(FutureMemory::Track(FutureMemoryParamD(size, allocator)))
 
-#define FUTURE_ALLOC(size, type)						(FutureCoreConfig::TrackMemory() ? FUTURE_TRACK(size, type) : FUTURE_NOTRACK(size))
-#define FUTURE_ALLOC_ALLOCATOR(size, type, allocator)	(FutureCoreConfig::TrackMemory() ? FUTURE_TRACK_ALLOCATOR(size, type, allocator) : FUTURE_NOTRACK_ALLOCATOR(size, allocator))
+// allocations go through Track while either the tracker or the sampling profiler needs their type, file and line
+#define FUTURE_ALLOC_TRACKED()							(FutureCoreConfig::TrackMemory() || FutureCoreConfig::MemorySampleInterval() != 0)
+#define FUTURE_ALLOC(size, type)						(FUTURE_ALLOC_TRACKED() ? FUTURE_TRACK(size, type) : FUTURE_NOTRACK(size))
+#define FUTURE_ALLOC_ALLOCATOR(size, type, allocator)	(FUTURE_ALLOC_TRACKED() ? FUTURE_TRACK_ALLOCATOR(size, type, allocator) : FUTURE_NOTRACK_ALLOCATOR(size, allocator))
+
+// returns a pointer to a new allocation aligned to align bytes, align must be a power of two
+#define FUTURE_TRACK_ALIGNED(size, align, type)							(FutureMemory::Track(FutureMemoryParamDebug(size, type, __FILE__, __LINE__, 0, align)))
+#define FUTURE_TRACK_ALIGNED_ALLOCATOR(size, align, type, allocator)	(FutureMemory::Track(FutureMemoryParamDebug(size, type, __FILE__, __LINE__, allocator, align)))
+#define FUTURE_NOTRACK_ALIGNED(size, align)								(FutureMemory::Alloc(FutureMemoryParam(size, 0, align)))
+#define FUTURE_NOTRACK_ALIGNED_ALLOCATOR(size, align, allocator)		(FutureMemory::Alloc(FutureMemoryParam(size, allocator, align)))
+
+#define FUTURE_ALLOC_ALIGNED(size, align, type)							(FUTURE_ALLOC_TRACKED() ? FUTURE_TRACK_ALIGNED(size, align, type) : FUTURE_NOTRACK_ALIGNED(size, align))
+#define FUTURE_ALLOC_ALIGNED_ALLOCATOR(size, align, type, allocator)	(FUTURE_ALLOC_TRACKED() ? FUTURE_TRACK_ALIGNED_ALLOCATOR(size, align, type, allocator) : FUTURE_NOTRACK_ALIGNED_ALLOCATOR(size, align, allocator))
+
+// returns a pointer to a new allocation from one of budget's allocators
+#define FUTURE_TRACK_BUDGET(size, type, budget)		(FutureMemory::Track(FutureMemoryParamDebug(size, type, __FILE__, __LINE__, 0, 0, budget)))
+#define FUTURE_NOTRACK_BUDGET(size, budget)			(FutureMemory::Alloc(FutureMemoryParam(size, 0, 0, budget)))
+#define FUTURE_ALLOC_BUDGET(size, type, budget)		(FUTURE_ALLOC_TRACKED() ? FUTURE_TRACK_BUDGET(size, type, budget) : FUTURE_NOTRACK_BUDGET(size, budget))
+
+// resizes an allocation, returns a pointer to it which may have moved
+#define FUTURE_REALLOC(p, size, type)					(FUTURE_ALLOC_TRACKED() ? FutureMemory::TrackRealloc((void *)p, FutureMemoryParamDebug(size, type, __FILE__, __LINE__)) : FutureMemory::Realloc((void *)p, FutureMemoryParam(size)))
 
 // frees the allocated memory
 #define FUTURE_FREE(p)						(FutureMemory::Free((void *)p))
@@ -150,6 +236,29 @@ public:																			\
 		FUTURE_ASSERT(p);														\
 		FUTURE_FREE(p);															\
 	}																			\
-	inline void*  operator new(size_t, void* p)	{ return p; }
+	inline void*  operator new(size_t, void* p)	{ return p; }					\
+	FUTURE_DECLARE_ALIGNED_MEMORY_OPERATORS(type)
+
+// Types aligned past FUTURE_DEFAULT_ALIGNMENT are given their alignment through the C++17 aligned new
+#if defined(__cpp_aligned_new)
+#	define FUTURE_DECLARE_ALIGNED_MEMORY_OPERATORS(type)												\
+	inline void * operator new(size_t bytes, std::align_val_t alignment)								\
+	{																									\
+		FUTURE_ASSERT(bytes > 0);																		\
+		return FUTURE_ALLOC_ALIGNED((u32)bytes, (u32)alignment, STRINGIFY(type));						\
+	}																									\
+	inline void * operator new(size_t bytes, std::align_val_t alignment, IFutureAllocator * allocator)	\
+	{																									\
+		FUTURE_ASSERT(bytes > 0);																		\
+		return FUTURE_ALLOC_ALIGNED_ALLOCATOR((u32)bytes, (u32)alignment, STRINGIFY(type), allocator);	\
+	}																									\
+	inline void operator delete(void * p, std::align_val_t)											\
+	{																									\
+		FUTURE_ASSERT(p);																				\
+		FUTURE_FREE(p);																					\
+	}
+#else
+#	define FUTURE_DECLARE_ALIGNED_MEMORY_OPERATORS(type)
+#endif
 
 #endif
\ No newline at end of file
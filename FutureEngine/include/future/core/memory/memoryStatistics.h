@@ -20,6 +20,7 @@
 
 /*
 *	FutureMemoryStatistics contains useful statistics on memory
+*	FutureMemoryFragmentation describes how the memory of an allocator is split up
 *	
 */
 
@@ -40,6 +41,20 @@ public:
 		u32			m_averageAllocationSize;
 		f32			m_averageTimeForAllocation;
 };
+
+struct FutureMemoryFragmentation
+{
+public:
+		u32			m_heaps;			// number of separate chunks requested from the system
+		u32			m_totalBytes;
+		u32			m_usedBytes;		// bytes in used blocks, including headers and padding
+		u32			m_usedBlocks;
+		u32			m_freeBytes;
+		u32			m_freeBlocks;
+		u32			m_largestFreeBlock;
+		// 0 when free memory is in as few blocks as possible, approaches 1 as it is split into more small blocks
+		f32			m_fragmentation;
+};
 	
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+/*
+*	A sampling memory profiler.
+*	Unlike FutureMemoryTracker this does not record every allocation, it records roughly one
+*	allocation for every FutureCoreConfig::MemorySampleInterval() bytes allocated, so it is
+*	cheap enough to leave on in release builds. Each thread counts down the bytes until its
+*	next sample, the distance between samples is random so allocation patterns that repeat
+*	don't line up with it.
+*
+*	A sampled allocation records a backtrace along with the type, file and line it was made
+*	from. Samples with the same call site are added up in a fixed size table, call sites are
+*	claimed with a compare exchange and counted with atomic adds so nothing takes a lock.
+*	Sampled allocations that are still alive are kept in a second table so freeing them can
+*	take them back out of the in use totals.
+*
+*	WriteHeapProfile writes the call sites in the legacy text heap format that pprof reads,
+*	with the sampling interval in the header so pprof can scale the samples back up.
+*/
+
+#ifndef FUTURE_CORE_MEMORY_PROFILER_H
+#define FUTURE_CORE_MEMORY_PROFILER_H
+
+#include <future/core/type/type.h>
+
+// Call sites the profiler can tell apart, must be a power of two. Samples from any more are dropped
+#ifndef FUTURE_MEMORY_PROFILER_MAX_SITES
+#	define FUTURE_MEMORY_PROFILER_MAX_SITES		4096
+#endif
+// Sampled allocations that can be alive at once, must be a power of two
+#ifndef FUTURE_MEMORY_PROFILER_MAX_LIVE
+#	define FUTURE_MEMORY_PROFILER_MAX_LIVE		65536
+#endif
+// Deepest backtrace recorded for a sample
+#ifndef FUTURE_MEMORY_PROFILER_MAX_FRAMES
+#	define FUTURE_MEMORY_PROFILER_MAX_FRAMES	32
+#endif
+
+struct FutureMemoryParamDebug;
+class FutureBufferedOutputStream;
+
+// The samples recorded for one call site
+struct FutureMemoryProfileSite
+{
+	volatile s64	m_hash;			// 0 while the site is free
+	volatile s32	m_ready;		// set once the fields below are filled in
+
+	const char *	m_type;
+	const char *	m_file;
+	u32				m_line;
+	u32				m_numFrames;
+	void *			m_frames[FUTURE_MEMORY_PROFILER_MAX_FRAMES];
+
+	volatile s64	m_allocObjects;	// samples ever taken here
+	volatile s64	m_allocBytes;
+	volatile s64	m_inUseObjects;	// samples taken here that have not been freed
+	volatile s64	m_inUseBytes;
+};
+
+class FutureMemoryProfiler
+{
+public:
+	// Called by the memory system for every allocation made while sampling is on,
+	// records p if the calling thread has allocated enough bytes since its last sample
+	static void		RecordAllocation(const FutureMemoryParamDebug & memParam, void * p);
+	// Called by the memory system for every free, takes p out of the in use totals if it was sampled
+	static void		RecordFree(void * p);
+
+	// Writes every call site to stream as a pprof heap profile. Returns false if a write failed
+	static bool		WriteHeapProfile(FutureBufferedOutputStream * stream);
+	// Logs the call sites with the most bytes in use, estimated from the samples
+	static void		LogSites(u32 count);
+
+	// Number of samples ever taken
+	static u64		NumSamples();
+	// Number of sampled allocations that have not been freed
+	static u32		NumLiveSamples();
+	// Number of samples thrown away because one of the tables was full
+	static u64		NumDroppedSamples();
+
+	// Frees the tables, nothing may allocate or free through the memory system while this is called
+	static void		Shutdown();
+};
+
+#endif
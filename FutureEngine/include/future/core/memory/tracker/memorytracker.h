@@ -23,9 +23,11 @@
 *	shutdown without all allocations being deleted first.
 *
 *	This tracker also has the nice feature of taking no overhead in a
-*	production build. All tracking and leak checking is disabled and
-*	only allocation required headers of 4 bytes are added. Be careful
+*	production build. All tracking and leak checking is disabled. Be careful
 *	as this tracker will perform minimal error checking in Release
+*
+*	Nothing is stored in the allocations themselves, each tracked allocation
+*	has a record in a hash table keyed by its address.
 *	
 */
 
@@ -37,7 +39,10 @@
 
 struct FutureMemoryParam;
 struct FutureMemoryStatistics;
+struct FutureMemoryFragmentation;
+struct FutureMemoryParamDebug;
 class IFutureAllocator;
+class FuturePoolAllocator;
 
 		
 // If we aren't tracking memory, we still need to keep track of which
@@ -49,23 +54,19 @@ public:
 	size_t				m_allocatorData;
 };
 
-// this keeps track of all allocations in a linked list style
-// each header is placed directly before the memory it is tracking
-struct FutureAllocHeaderDebug : public FutureAllocHeader
+// The tracking information for a single allocation
+struct FutureAllocRecord
 {
 public:
-	u32							m_headerCheck;
-
-	u32 						m_line;
-	u32 						m_bytes;
+	void *					m_address;
 
-	const char *				m_type;
-	const char *				m_file;
+	u32 					m_line;
+	u32 					m_bytes;
 
-	FutureAllocHeaderDebug *	m_next;
-	FutureAllocHeaderDebug *	m_previous;
+	const char *			m_type;
+	const char *			m_file;
 
-	u32							m_checkSum;
+	FutureAllocRecord *		m_next;		// the next record in the same hash bucket
 };
 
 // Memory Tracker
@@ -82,14 +83,18 @@ public:
 	// call to malloc or through a system that does not use this allocator, these
 	// functions can be called to track the memory. Make sure that enough memory is
 	// allocated before hand by using BytesForAllocation.
-	void					Track(const FutureMemoryParam & memParam, FutureAllocHeaderDebug * header, f32 timeCreated);
-	void					Untrack(FutureAllocHeader * header);
+	void					Track(const FutureMemoryParamDebug & memParam, void * p, f32 timeCreated);
+	void					Untrack(void * p);
 
 	// Debugging functions, can be called from non debug/profile builds but will do nothing
 	FutureMemoryStatistics	GetStatistics();
 	void					LogStatistics();
 	void					LogAllocations();
-	void					LogAllocation(FutureAllocHeaderDebug * header);
+	void					LogAllocation(void * p);
+
+	// Adds up the fragmentation of every allocator that reports it, these work without tracking
+	FutureMemoryFragmentation	GetFragmentation();
+	void						LogFragmentation();
 
 private:
 	FutureMemoryTracker();
@@ -97,13 +102,17 @@ private:
 
 	static FutureMemoryTracker * instance;
 
-	void	VerifyAllocations();
+	// Returns the bucket a record for p would be in
+	FutureAllocRecord **	Bucket(void * p);
+	// Doubles the number of buckets once there are more records than buckets
+	void					Grow();
 
-	void	SetChecksum(FutureAllocHeaderDebug * header);
-	void	VerifyChecksum(FutureAllocHeaderDebug * header);
+	FutureAllocRecord **		m_buckets;
+	u32							m_bucketShift;		// the table has 1 << m_bucketShift buckets
+	FuturePoolAllocator *		m_records;
 
-	FutureAllocHeaderDebug		m_headerRoot;
-	FutureAllocHeaderDebug *	m_headerTail;
+	u32							m_currentAllocations;
+	u32							m_currentBytes;
 
 	u64							m_totalBytesAllocated;
 	u32							m_totalAllocations;
@@ -136,6 +136,11 @@ public:
     void                AddRef();
     //! Removes a reference counter from this resource. If all references are released, this resource will be unloaded as soon as possible
     void                Release();
+
+    //! The bytes this resource uses while loaded, counted against the resource manager's residency budget.
+    //! Returning 0 counts the size of the data it was loaded from instead
+    virtual u64         MemoryUsage() const
+    { return 0; }
 	
 protected:
 	friend class FutureResourceManager;
@@ -22,13 +22,41 @@
 #include <future/core/type/type.h>
 #include <future/core/memory/memory.h>
 #include <future/core/util/container/array.h>
+#include <future/core/util/container/nameindex.h>
 #include <future/core/resource/resource.h>
+#include <future/core/resource/resourcepack.h>
+#include <future/core/util/ioscheduler.h>
 #include <future/core/object/threadsafeobject.h>
 
+// How the residency manager picks which unreferenced resources to unload when it is over budget
+enum FutureResidencyPolicy
+{
+    ResidencyPolicy_LRU,                // The resources used longest ago go first
+    ResidencyPolicy_PriorityDistance,   // Time since use scaled up by distance and down by priority, see SetResidencyHint
+};
+
+// Counters kept by the residency manager, reset with ResetResidencyStats
+struct FutureResidencyStats
+{
+    u64     m_requests;         // GetResource calls
+    u64     m_hits;             // Requests for resources that were already loaded or loading
+    u64     m_reloads;          // Requests that had to load a resource the residency manager had unloaded
+    u64     m_evictions;        // Resources unloaded to stay in budget or because memory ran low
+    u64     m_bytesEvicted;     // Resident bytes of the evicted resources
+    u64     m_residentBytes;    // Bytes of every loaded resource right now
+    u64     m_budget;           // The residency budget, 0 if it is off
+    f32     m_averageReloadTime;// Seconds from requesting an evicted resource to it being loaded again
+    f32     m_maxReloadTime;    // The longest of those
+
+    f32     HitRate() const
+    { return m_requests ? (f32)m_hits / (f32)m_requests : 1.0f; }
+};
+
 class FutureResourceManager : public FutureThreadSafeObject
 {
 protected:
     friend class FutureApplication;
+    friend class FutureResourceTests;
 
 	static void CreateInstance();
 	static void DestroyInstance();
@@ -105,22 +133,74 @@ public:
 
     // Should be called by the main thread, may take some time
     void                    CleanUpResources();
+    // Unloads every resource that isn't referenced or part of a loaded group, called when memory runs low.
+    // Resources that are loading or locked by another thread are skipped, CleanUpResources deletes them later
+    void                    UnloadUnreferenced();
+
+    // Residency, with a budget set unreferenced resources stay loaded until the bytes of everything loaded go over it,
+    // then the coldest unreferenced resources are unloaded. GetResource loads them again when they're asked for.
+    // A budget of 0 turns residency off, unreferenced resources are unloaded by UnloadGroup and CleanUpResources
+    void                    SetResidencyBudget(u64 bytes);
+    u64                     GetResidencyBudget();
+    void                    SetResidencyPolicy(FutureResidencyPolicy policy);
+    u64                     GetResidentBytes();
+    // Used by ResidencyPolicy_PriorityDistance, higher priorities and shorter distances are kept longer
+    void                    SetResidencyHint(ResourceID resource, s32 priority, f32 distance);
+    // Should be called once a frame by the main thread, marks referenced resources as used and unloads down to the budget
+    void                    UpdateResidency();
+    void                    GetResidencyStats(FutureResidencyStats * stats);
+    void                    ResetResidencyStats();
+
+    // True if resources are being loaded out of the resource pack instead of their own files
+    bool                    UsesResourcePack();
+
+#if defined(FUTURE_TOOL)
+    // Packs every resource file into one resource pack, the resources of each group are written next to each other
+    bool                    PackResources(const char * file = FUTURE_RESOURCE_PACK_FILE);
+#endif
 
 protected:
 
+    // Registered for the resources and default memory budgets, unloads unreferenced resources before an allocation fails
+    static void             OnMemoryPressure(FutureMemoryBudgetID budget, FutureMemoryPressure pressure, u64 bytes, void * data);
+    // Called on the thread pool when the I/O scheduler has read a resource for LoadGroup
+    static void             OnResourceRead(void * buffer, u32 bytes, bool success, void * payload);
+
+    // Counts a resource that finished loading against the residency budget
+    void                    AddResidency(ResourceID resource, FutureResource * res, u64 loadedBytes);
+    // Takes an unloaded resource off the residency budget, evicted if the residency manager or low memory unloaded it
+    void                    RemoveResidency(ResourceID resource, bool evicted);
+    // Orders eviction candidates coldest first
+    static int              CompareEvictionCandidates(const void * a, const void * b);
+
+    // LoadResourceSync, fileData is the resource's file if it has already been read, NULL to read it here
+    bool                    LoadResourceData(ResourceID resource, LoadFinishedCallback callback, Language language, void * fileData, u32 fileSize);
+
     void                    EnsureResource(ResourceID resource);
     FutureResource *        CreateResource(ResourceID resource);
 
     struct ResourceInfo
     {
-        const char *                        m_name;
         FutureResource *                    m_resource;
         FutureArray<LoadFinishedCallback>   m_loadFinishedCallbacks;
+        // kept here rather than in the resource, CleanUpResources deletes resources that aren't loaded
+        volatile s64                        m_residentBytes;        // Counted against the residency budget while loaded, changed with atomics
+        u32                                 m_lastUsedFrame;        // The last residency frame it was requested or referenced
+        s32                                 m_residencyPriority;
+        f32                                 m_residencyDistance;
+        f32                                 m_reloadStart;          // When an evicted resource was requested again, negative if it wasn't
+        bool                                m_evicted;              // Unloaded by the residency manager or low memory
     };
+
+    // Sets a resource's resident bytes and moves total by the difference
+    static void             ChargeResidency(ResourceInfo & info, volatile s64 * total, u64 bytes);
+    // Takes a resource's resident bytes off total and returns them, a second caller racing for the same bytes gets 0
+    static u64              ReleaseResidency(ResourceInfo & info, volatile s64 * total);
+    // How cold an unreferenced resource is for the policy, higher is evicted first
+    static f32              EvictionScore(FutureResidencyPolicy policy, u32 framesUnused, s32 priority, f32 distance);
     
     struct GroupInfo
     {
-        const char *                        m_name;
         bool                                m_loadAttempted;
         u32                                 m_loadCounter;
         FutureArray<ResourceID>             m_resources;
@@ -129,13 +209,11 @@ protected:
 
     struct StringInfo
     {
-        const char *    m_tag;
         const char *    m_strings[];
     };
 
     struct ValueInfo
     {
-        const char *    m_name;
         union
         {
             bool        m_bool;
@@ -156,10 +234,41 @@ protected:
     };
 
     u32                         m_languages;
+    FutureResourcePack *        m_pack;         // Opened with the system resources, NULL if there is no pack
+    FutureIOFile                m_packFile;     // The pack opened for the I/O scheduler, group loads read it ahead of decoding
     FutureArray<ResourceInfo>   m_resources;
     FutureArray<GroupInfo>      m_groups;
     FutureArray<StringInfo>     m_strings;
     FutureArray<ValueInfo>      m_values;
+
+    // Name lookups for each of the lists above, built with the system resources. They hold the names if
+    // StoreResourceNames is on, otherwise only their hashes so SearchResourceNames still works
+    FutureNameIndex             m_resourceNames;
+    FutureNameIndex             m_groupNames;
+    FutureNameIndex             m_stringTags;
+    FutureNameIndex             m_valueNames;
+
+    struct EvictionCandidate
+    {
+        ResourceID      m_resource;
+        f32             m_score;        // Higher is colder, the coldest are unloaded first
+    };
+
+    u64                             m_residencyBudget;
+    FutureResidencyPolicy           m_residencyPolicy;
+    u32                             m_frame;                // Counts UpdateResidency calls
+    volatile s64                    m_residentBytes;
+    FutureArray<EvictionCandidate>  m_evictionCandidates;   // Kept between updates so UpdateResidency doesn't allocate
+
+    // Updated with atomics, unloads and loads happen on any thread holding different locks
+    volatile s64                    m_statRequests;
+    volatile s64                    m_statHits;
+    volatile s64                    m_statReloads;
+    volatile s64                    m_statEvictions;
+    volatile s64                    m_statBytesEvicted;
+    volatile s64                    m_statReloadsFinished;
+    volatile s64                    m_statReloadMicros;
+    volatile s64                    m_statMaxReloadMicros;
 };
 
 
@@ -0,0 +1,240 @@
+/*
+ *  Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef FUTURE_CORE_RESOURCE_PACK_H
+#define FUTURE_CORE_RESOURCE_PACK_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/memory.h>
+#include <future/core/util/container/array.h>
+#include <future/core/util/file.h>
+#include <future/core/resource/resource.h>
+
+// Forward Declares
+class FutureMappedInputStream;
+
+// 'FPAK' when read as a little endian u32
+#define FUTURE_RESOURCE_PACK_MAGIC		0x4B415046
+#define FUTURE_RESOURCE_PACK_VERSION	1
+// Every payload starts on a multiple of this, so data written aligned inside a payload is aligned in memory
+#define FUTURE_RESOURCE_PACK_ALIGNMENT	64
+
+#ifndef FUTURE_RESOURCE_PACK_FILE
+#	define FUTURE_RESOURCE_PACK_FILE	"assets/resources.pak"
+#endif
+
+/*!
+ *	\brief		The header at the start of a resource pack
+ *
+ *	\details 	A pack is laid out as the header, the table of contents and then the payloads. The table has an
+ *				entry for every resource in every language, the entry for a resource in a language is at
+ *				resource * m_numLanguages + language. Each payload is exactly what the resource's Load function
+ *				reads and starts on a multiple of FUTURE_RESOURCE_PACK_ALIGNMENT bytes.
+ */
+struct FutureResourcePackHeader
+{
+	u32		m_magic;			//! FUTURE_RESOURCE_PACK_MAGIC
+	u32		m_version;			//! FUTURE_RESOURCE_PACK_VERSION when the pack was written
+	u32		m_buildVersion;		//! FUTURE_VERSION_CODE of the tools that wrote the pack
+	u32		m_numResources;		//! The number of resources in the table, resource IDs go from 0 to m_numResources - 1
+	u32		m_numLanguages;		//! The number of languages in the table
+	u32		m_checkSum;			//! FUTURE_CHECKSUM
+	u64		m_tableOffset;		//! The byte offset of the table of contents
+	u64		m_size;				//! The size of the whole pack, catches packs that were cut short
+};
+
+/*!
+ *	\brief		An entry in the table of contents of a resource pack
+ *
+ *	\details 	Languages a resource has no data for point at the resource's default language payload.
+ *				Resources that aren't in the pack have a size of 0.
+ */
+struct FutureResourcePackEntry
+{
+	u64		m_offset;			//! The byte offset of the payload from the start of the pack
+	u32		m_size;				//! The size of the payload in bytes
+	u32		m_reserved;			//! Always 0, pads the entry to 16 bytes
+};
+
+
+/*!
+ *	\brief		Reads resources out of a memory mapped resource pack
+ *
+ *	\details 	Loading resources from their own files costs an open, a few reads and a copy into a chunk buffer
+ *				for every resource. A pack holds every resource in one file that is mapped once when it is
+ *				opened, after that finding a resource is a lookup in the table of contents and reading it is a
+ *				page fault, or nothing at all if its pages are already in memory. Resources loaded through a pack
+ *				stream can use ReadInPlace to keep pointers into the pack instead of copying their data, the
+ *				pointers are valid until the pack is closed.
+ *
+ *				An open pack is read only and can be read by any number of threads at once.
+ *
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		August 2013
+ */
+class FutureResourcePack
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureResourcePack);
+
+	//! FutureResourcePack Constructor
+	FutureResourcePack();
+	//! FutureResourcePack Destructor, closes the pack if it is open
+	virtual ~FutureResourcePack();
+
+	/*!	\brief		Maps the pack and checks its header and table of contents
+	 *	\param[in]	file	The relative path to the pack
+	 *	\return		True if the pack was opened and is valid, false otherwise
+	 */
+	bool			Open(const char * file);
+	//! Unmaps the pack, every pointer into it is invalid afterwards
+	void			Close();
+
+	//! Returns true if the pack is open
+	bool			IsOpen() const
+	{ return m_header != NULL; }
+
+	//! The number of resources in the table of contents
+	u32				NumResources() const
+	{ return m_header ? m_header->m_numResources : 0; }
+	//! The number of languages in the table of contents
+	u32				NumLanguages() const
+	{ return m_header ? m_header->m_numLanguages : 0; }
+
+	//! Returns true if the pack has data for the resource in the language or in the default language
+	bool			Contains(ResourceID resource, Language language) const;
+
+	/*!	\brief		Returns the payload of a resource without copying it
+	 *	\param[in]	resource	The resource to find
+	 *	\param[in]	language	The language of the payload, falls back to the default language
+	 *	\param[out]	sizeOut		Places the size of the payload in bytes in sizeOut
+	 *	\return		A pointer to the payload, valid until the pack is closed, or NULL if the resource isn't in the pack
+	 */
+	const void *	GetData(ResourceID resource, Language language, u32 * sizeOut) const;
+
+	/*!	\brief		Opens a stream over the payload of a resource
+	 *	\param[in]	resource	The resource to find
+	 *	\param[in]	language	The language of the payload, falls back to the default language
+	 *	\param[out]	stream		A closed stream to open over the payload
+	 *	\return		True if the stream was opened, false if the resource isn't in the pack
+	 */
+	bool			OpenStream(ResourceID resource, Language language, FutureMappedInputStream * stream) const;
+
+	/*!	\brief		Finds where the payload of a resource is in the pack file
+	 *	\details	Lets the payload be read through the I/O scheduler before it is loaded through the mapping
+	 *	\param[in]	resource	The resource to find
+	 *	\param[in]	language	The language of the payload, falls back to the default language
+	 *	\param[out]	offsetOut	Places the byte offset of the payload from the start of the pack in offsetOut
+	 *	\param[out]	sizeOut		Places the size of the payload in bytes in sizeOut
+	 *	\return		True if the resource is in the pack, false otherwise
+	 */
+	bool			GetRange(ResourceID resource, Language language, u64 * offsetOut, u32 * sizeOut) const;
+
+	/*!	\brief		Starts reading the payloads of several resources in the background
+	 *	\details	Used before loading a group so the group's pages are read in a few large requests instead of
+	 *				being faulted in one at a time. Payloads next to each other in the pack are prefetched as one
+	 *				range, which is why the packer writes the resources of a group together.
+	 *	\param[in]	resources	The resources to prefetch
+	 *	\param[in]	count		The number of resources
+	 *	\param[in]	language	The language of the payloads, falls back to the default language
+	 */
+	void			Prefetch(const ResourceID * resources, u32 count, Language language) const;
+
+protected:
+
+	//! Returns the table entry for a resource, NULL if it has no data in the language or in the default language
+	const FutureResourcePackEntry *	FindEntry(ResourceID resource, Language language) const;
+
+	FutureMappedFile					m_file;		//! The mapped pack
+	const FutureResourcePackHeader *	m_header;	//! The header at the start of the mapping, NULL if the pack isn't open
+	const FutureResourcePackEntry *		m_table;	//! The table of contents inside the mapping
+};
+
+
+/*!
+ *	\brief		Writes resource packs
+ *
+ *	\details 	The packer collects the payloads of every resource then writes the pack in one go. Payloads are
+ *				written in the order they are added, so adding the resources of a group one after another keeps
+ *				them next to each other in the pack and lets a group load prefetch them as one range. Resources
+ *				compiled into their own files can be added with AddResourceFile, which pulls the payload for
+ *				each language out of the file.
+ *
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		August 2013
+ */
+class FutureResourcePackWriter
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureResourcePackWriter);
+
+	/*!	\brief		FutureResourcePackWriter Constructor
+	 *	\param[in]	numResources	The number of resources the table of contents has room for
+	 *	\param[in]	numLanguages	The number of languages the table of contents has room for
+	 */
+	FutureResourcePackWriter(u32 numResources, u32 numLanguages);
+	//! FutureResourcePackWriter Destructor, frees every payload that was added
+	virtual ~FutureResourcePackWriter();
+
+	/*!	\brief		Adds the payload of a resource in one language
+	 *	\details	The data is copied, it can be freed as soon as this returns. A payload that was already
+	 *				added for the resource and language is replaced.
+	 *	\param[in]	resource	The resource the payload belongs to
+	 *	\param[in]	language	The language of the payload
+	 *	\param[in]	data		The payload, exactly what the resource's Load function reads
+	 *	\param[in]	size		The size of the payload in bytes
+	 *	\return		True if the payload was added, false if the resource or language is out of range
+	 */
+	bool			AddResource(ResourceID resource, Language language, const void * data, u32 size);
+
+	/*!	\brief		Adds every language of a resource that was compiled into its own file
+	 *	\details	Reads the file header written by the resource compiler, checks the check sum in front of
+	 *				every language and adds what follows it as that language's payload.
+	 *	\param[in]	resource	The resource in the file
+	 *	\param[in]	file		The relative path to the file, usually assets/_<resource>.dat
+	 *	\return		True if the file was read and every language was added, false otherwise
+	 */
+	bool			AddResourceFile(ResourceID resource, const char * file);
+
+	//! Returns true if a payload has been added for the resource in any language
+	bool			HasResource(ResourceID resource);
+
+	/*!	\brief		Writes the pack
+	 *	\param[in]	file	The relative path of the pack to write, an existing file is replaced
+	 *	\return		True if the whole pack was written, false otherwise
+	 */
+	bool			Write(const char * file);
+
+protected:
+
+	struct Payload
+	{
+		ResourceID	m_resource;		//! The resource the payload belongs to
+		Language	m_language;		//! The language of the payload
+		u32			m_size;			//! The size of the payload in bytes
+		u8 *		m_data;			//! A copy of the payload
+	};
+
+	u32						m_numResources;	//! The number of resources in the table of contents
+	u32						m_numLanguages;	//! The number of languages in the table of contents
+	FutureArray<Payload>	m_payloads;		//! The payloads in the order they will be written
+	u32 *					m_slots;		//! For every table entry, the index of its payload plus one or 0 if it has none
+};
+
+#endif
@@ -152,6 +152,10 @@ public:
 	virtual FutureSystemController *	GetSystemController();
 	virtual IFutureWindow *				GetWindow() = 0;
 
+	// Called by the platform when it sends FutureApplicationEvent_LowMemory, calls every memory budget's
+	// pressure callbacks so the resource manager and other caches can give memory back
+	virtual void						OnLowMemory();
+
 protected:
 	friend class FutureApplicationImpl;
 
@@ -51,6 +51,12 @@ public:
 	void	PostSynchronizeCore();
 	void	PostSynchronizeCustom();
 
+	// Runs PreSync, Update and PostSync for every system as one graph of jobs.
+	// Runs every PreSync on the calling thread, then every Update as a job on the ThreadPool,
+	// then every PostSync on the calling thread once all of the updates have finished.
+	// The calling thread executes jobs while it waits on the updates.
+	void	RunFrame();
+
 	void	SetCoreSystem(FutureSystemType type, FutureSystemBase * system);
 	bool	HasCoreSystem(FutureSystemType);
 
@@ -63,6 +69,9 @@ protected:
 	FutureSystemController();
 	~FutureSystemController();
 
+	// Releases everything allocated from the frame allocator, called once PostSync has finished
+	void	EndFrame();
+
 	FutureSystemBase *				m_systems[FutureSystemType_Max];
 	FutureArray<FutureSystemBase*>	m_customSystems;
 
@@ -22,12 +22,26 @@
 #define FUTURE_CORE_TESTS_ALLOCATOR_H
 
 #include <future/core/debug/debug.h>
+#include <future/core/memory/allocators/frameallocator.h>
 #include <future/core/memory/allocators/mallocallocator.h>
 #include <future/core/memory/allocators/poolallocator.h>
 #include <future/core/memory/allocators/heapallocator.h>
 #include <future/core/memory/allocators/stackallocator.h>
+#include <future/core/memory/allocators/threadcache.h>
+#include <future/core/memory/allocators/virtualallocator.h>
+#include <future/core/memory/memory.h>
+#include <future/core/memory/memoryStatistics.h>
+#include <future/core/thread/thread/thread.h>
 #include <future/core/utils/timer/timer.h>
 #include <new>
+#include <stdlib.h>
+
+#if FUTURE_PLATFORM_LINUX
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
 
 class FutureAllocatorTests
 {
@@ -77,7 +91,7 @@ public:
 	static void TestPoolAllocator()
 	{
 		f32 start = FutureTimer::CurrentTime();
-		FuturePoolAllocator * allocator = new FuturePoolAllocator(16, sizeof(MemoryTestStruct), TEST_OBJECTS);
+		FuturePoolAllocator * allocator = new FuturePoolAllocator(sizeof(MemoryTestStruct), TEST_OBJECTS);
 		TestAllocator(allocator);
 		allocator->Release();
 		f32 runtime = FutureTimer::TimeSince(start);
@@ -94,15 +108,585 @@ public:
 		FUTURE_LOG_DEBUG(L"Heap Allocator took %f seconds to allocate and free %u elements", runtime, TEST_OBJECTS);
 	};
 	
+	// Allocates and frees random sizes through the memory system in a random order, then
+	// checks the heap's block walk agrees with what is still allocated and that freeing
+	// everything merges each heap back into a single block
+	static void TestHeapFragmentation()
+	{
+		const u32 slots = 4096;
+		const u32 operations = 1024 * 1024;
+
+		FutureMemory::CreateMemory();
+		FutureHeapAllocator * heap = new FutureHeapAllocator(1024 * 1024);
+		FutureMemory::AddAllocator(heap);
+
+		void * blocks[slots];
+		u32 sizes[slots];
+		for(u32 i = 0; i < slots; ++i)
+		{
+			blocks[i] = NULL;
+			sizes[i] = 0;
+		}
+
+		srand(1);
+		u32 live = 0;
+		f32 start = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < operations; ++i)
+		{
+			u32 slot = (u32)rand() % slots;
+			if(blocks[slot])
+			{
+				FUTURE_ASSERT(((u8*)blocks[slot])[sizes[slot] - 1] == (u8)slot);
+				FUTURE_FREE(blocks[slot]);
+				blocks[slot] = NULL;
+				--live;
+			}
+			else
+			{
+				sizes[slot] = 16 + (u32)rand() % 4080;
+				blocks[slot] = FUTURE_ALLOC_ALLOCATOR(sizes[slot], "TestHeapFragmentation", heap);
+				FUTURE_ASSERT(blocks[slot] && ((size_t)blocks[slot] & 15) == 0);
+				((u8*)blocks[slot])[sizes[slot] - 1] = (u8)slot;
+				++live;
+			}
+		}
+		f32 runtime = FutureTimer::TimeSince(start);
+		FUTURE_LOG_DEBUG(L"Heap Allocator took %f seconds for %u random allocations and frees", runtime, operations);
+
+		FutureMemoryFragmentation fragmentation;
+		bool measured = heap->GetFragmentation(fragmentation);
+		FUTURE_ASSERT(measured);
+		FUTURE_ASSERT(fragmentation.m_usedBlocks == live);
+		FUTURE_ASSERT(fragmentation.m_usedBytes + fragmentation.m_freeBytes == fragmentation.m_totalBytes);
+		FutureMemory::LogFragmentation();
+
+		for(u32 i = 0; i < slots; ++i)
+		{
+			if(blocks[i])
+			{
+				FUTURE_FREE(blocks[i]);
+			}
+		}
+
+		measured = heap->GetFragmentation(fragmentation);
+		FUTURE_ASSERT(measured);
+		FUTURE_ASSERT(fragmentation.m_usedBlocks == 0);
+		FUTURE_ASSERT(fragmentation.m_freeBlocks == fragmentation.m_heaps);
+		FUTURE_ASSERT(fragmentation.m_fragmentation == 0.0f);
+		FutureMemory::LogFragmentation();
+
+		FutureMemory::DestroyMemory();
+	}
+	
 	static void TestStackAllocator()
 	{
 		f32 start = FutureTimer::CurrentTime();
-		FutureStackAllocator * allocator = new FutureStackAllocator(16, 1024 * 1024, false);
+		FutureStackAllocator * allocator = new FutureStackAllocator(1024 * 1024);
 		TestAllocator(allocator);
 		allocator->Release();
 		f32 runtime = FutureTimer::TimeSince(start);
 		FUTURE_LOG_DEBUG(L"Stack Allocator took %f seconds to allocate and free %u elements", runtime, TEST_OBJECTS);
 	};
+
+	// Allocates a frame's worth of scratch memory and compares it to allocating and freeing
+	// the same blocks through the heap, checking markers and the end of frame release memory
+	static void TestFrameAllocator()
+	{
+		const u32 frames = 100;
+		const u32 allocations = 10000;
+
+		FutureMemory::CreateMemory();
+		FutureHeapAllocator * heap = new FutureHeapAllocator(1024 * 1024 * 4);
+		FutureFrameAllocator * frameAllocator = new FutureFrameAllocator(64 * 1024);
+		FutureMemory::AddAllocator(heap);
+		FutureMemory::AddAllocator(frameAllocator);
+		FUTURE_ASSERT(FutureFrameAllocator::GetInstance() == frameAllocator);
+
+		void ** blocks = (void**)malloc(sizeof(void*) * allocations);
+
+		f32 start = FutureTimer::CurrentTime();
+		for(u32 frame = 0; frame < frames; ++frame)
+		{
+			for(u32 i = 0; i < allocations; ++i)
+			{
+				blocks[i] = FUTURE_ALLOC_ALLOCATOR(16 + (i % 16) * 8, "TestFrameAllocator", heap);
+			}
+			for(u32 i = 0; i < allocations; ++i)
+			{
+				FUTURE_FREE(blocks[i]);
+			}
+		}
+		f32 heapTime = FutureTimer::TimeSince(start);
+
+		start = FutureTimer::CurrentTime();
+		for(u32 frame = 0; frame < frames; ++frame)
+		{
+			for(u32 i = 0; i < allocations; ++i)
+			{
+				blocks[i] = FUTURE_FRAME_ALLOC(16 + (i % 16) * 8, "TestFrameAllocator");
+				FUTURE_ASSERT(blocks[i] && ((size_t)blocks[i] & 15) == 0);
+			}
+			frameAllocator->EndFrame();
+		}
+		f32 frameTime = FutureTimer::TimeSince(start);
+
+		FUTURE_LOG_DEBUG(L"%u frames of %u allocations: heap %f seconds, frame allocator %f seconds", frames, allocations, heapTime, frameTime);
+
+		// the first allocation after the frame ended starts from the beginning of the arena
+		FUTURE_ASSERT(frameAllocator->BytesUsed() == 0);
+		u32 * persistent = (u32*)FUTURE_FRAME_ALLOC(sizeof(u32), "TestFrameAllocator");
+		*persistent = 42;
+		u32 used = frameAllocator->BytesUsed();
+		{
+			FutureScopedArenaMarker outer;
+			FUTURE_FRAME_ALLOC(1024, "TestFrameAllocator");
+			{
+				FutureScopedArenaMarker inner;
+				// bigger than a stack, gets a stack of its own
+				FUTURE_FRAME_ALLOC(128 * 1024, "TestFrameAllocator");
+			}
+			FUTURE_ASSERT(frameAllocator->BytesUsed() > used && frameAllocator->BytesUsed() < used + 128 * 1024);
+		}
+		FUTURE_ASSERT(frameAllocator->BytesUsed() == used);
+		FUTURE_ASSERT(*persistent == 42);
+
+		// a marker that outlives the frame doesn't rewind the next frame's memory
+		{
+			FutureScopedArenaMarker marker;
+			frameAllocator->EndFrame();
+			FUTURE_FRAME_ALLOC(256, "TestFrameAllocator");
+			used = frameAllocator->BytesUsed();
+		}
+		FUTURE_ASSERT(frameAllocator->BytesUsed() == used);
+
+		free(blocks);
+		FutureMemory::DestroyMemory();
+		FUTURE_ASSERT(FutureFrameAllocator::GetInstance() == NULL);
+	}
+
+	static const u32 THREAD_CACHE_THREADS = 4;
+	static const u32 THREAD_CACHE_POOLS = 4;
+
+	enum ThreadCacheTestMode
+	{
+		ThreadCacheTest_Malloc,		// glibc or the platform's malloc
+		ThreadCacheTest_Pool,		// straight from the pools' lock free free lists
+		ThreadCacheTest_Cache		// FUTURE_ALLOC through the calling thread's cache
+	};
+
+	struct ThreadCacheTestData
+	{
+		ThreadCacheTestMode		m_mode;
+		u32						m_count;
+		u32						m_rounds;
+		FuturePoolAllocator **	m_pools;
+		void **					m_blocks;	// left allocated after the last round
+		void **					m_remote;	// another thread's blocks to free
+	};
+
+	// mixes sizes from 8 to 207 bytes so every size class is used
+	static u32 ThreadCacheTestSize(u32 i)
+	{
+		return 8 + (i * 40) % 200;
+	}
+
+	static void * ThreadCacheTestAlloc(ThreadCacheTestData * test, u32 bytes)
+	{
+		if(test->m_mode == ThreadCacheTest_Malloc)
+		{
+			return malloc(bytes);
+		}
+		if(test->m_mode == ThreadCacheTest_Pool)
+		{
+			u32 i = 0;
+			while(test->m_pools[i]->BlockSize() < bytes)
+			{
+				++i;
+			}
+			return test->m_pools[i]->Alloc(bytes);
+		}
+		return FUTURE_ALLOC(bytes, "Thread cache test");
+	}
+
+	static void ThreadCacheTestFree(ThreadCacheTestData * test, void * p)
+	{
+		if(test->m_mode == ThreadCacheTest_Malloc)
+		{
+			free(p);
+			return;
+		}
+		if(test->m_mode == ThreadCacheTest_Pool)
+		{
+			FutureMemory::AllocatorOf(p)->Free(p);
+			return;
+		}
+		FUTURE_FREE(p);
+	}
+
+	// Allocates and frees m_count blocks m_rounds times, then allocates them once more and keeps them
+	static void ThreadCacheTest(void * data)
+	{
+		ThreadCacheTestData * test = (ThreadCacheTestData*)data;
+		for(u32 round = 0; round <= test->m_rounds; ++round)
+		{
+			for(u32 i = 0; i < test->m_count; ++i)
+			{
+				test->m_blocks[i] = ThreadCacheTestAlloc(test, ThreadCacheTestSize(i));
+				FUTURE_ASSERT(test->m_blocks[i] != NULL);
+				*(u8*)test->m_blocks[i] = (u8)i;
+			}
+			if(round == test->m_rounds)
+			{
+				break;
+			}
+			for(u32 i = 0; i < test->m_count; ++i)
+			{
+				ThreadCacheTestFree(test, test->m_blocks[i]);
+			}
+		}
+	}
+
+	// Frees the blocks another thread kept
+	static void ThreadCacheRemoteFreeTest(void * data)
+	{
+		ThreadCacheTestData * test = (ThreadCacheTestData*)data;
+		for(u32 i = 0; i < test->m_count; ++i)
+		{
+			FUTURE_ASSERT(*(u8*)test->m_remote[i] == (u8)i);
+			ThreadCacheTestFree(test, test->m_remote[i]);
+		}
+	}
+
+	// Runs ThreadCacheTest on every thread, then has each thread free its neighbour's blocks.
+	// Returns the time taken in nanoseconds
+	static u64 RunThreadCacheTest(ThreadCacheTestMode mode, u32 count, u32 rounds, FuturePoolAllocator ** pools)
+	{
+		ThreadCacheTestData data[THREAD_CACHE_THREADS];
+		IFutureThread * threads[THREAD_CACHE_THREADS];
+		void ** blocks = (void**)malloc(sizeof(void*) * count * THREAD_CACHE_THREADS);
+		for(u32 i = 0; i < THREAD_CACHE_THREADS; ++i)
+		{
+			data[i].m_mode = mode;
+			data[i].m_count = count;
+			data[i].m_rounds = rounds;
+			data[i].m_pools = pools;
+			data[i].m_blocks = blocks + count * i;
+			data[i].m_remote = blocks + count * ((i + 1) % THREAD_CACHE_THREADS);
+		}
+
+		u64 time = FutureTimer::CurrentNanoseconds();
+		for(u32 i = 0; i < THREAD_CACHE_THREADS; ++i)
+		{
+			threads[i] = FutureCreateThread();
+			threads[i]->Start(ThreadCacheTest, &data[i]);
+		}
+		for(u32 i = 0; i < THREAD_CACHE_THREADS; ++i)
+		{
+			FutureDestroyThread(threads[i]);
+		}
+		for(u32 i = 0; i < THREAD_CACHE_THREADS; ++i)
+		{
+			threads[i] = FutureCreateThread();
+			threads[i]->Start(ThreadCacheRemoteFreeTest, &data[i]);
+		}
+		for(u32 i = 0; i < THREAD_CACHE_THREADS; ++i)
+		{
+			FutureDestroyThread(threads[i]);
+		}
+		time = FutureTimer::CurrentNanoseconds() - time;
+
+		free(blocks);
+		return time;
+	}
+
+	// Compares small allocations from several threads at once through malloc, the locked
+	// pools and the thread caches in front of them
+	static void TestThreadCache()
+	{
+		const u32 count = 4096;
+		const u32 rounds = 200;
+
+		FutureMemory::CreateMemory();
+		FuturePoolAllocator * pools[THREAD_CACHE_POOLS];
+		for(u32 i = 0; i < THREAD_CACHE_POOLS; ++i)
+		{
+			pools[i] = new FuturePoolAllocator((u16)(32 << i), count);
+			FutureMemory::AddSizeClass(pools[i]);
+		}
+		FUTURE_ASSERT(FutureThreadCache::NumSizeClasses() == THREAD_CACHE_POOLS);
+
+		u64 mallocTime = RunThreadCacheTest(ThreadCacheTest_Malloc, count, rounds, pools);
+		u64 poolTime = RunThreadCacheTest(ThreadCacheTest_Pool, count, rounds, pools);
+		u64 cacheTime = RunThreadCacheTest(ThreadCacheTest_Cache, count, rounds, pools);
+
+		FUTURE_LOG_DEBUG(L"%u threads allocating and freeing %u blocks %u times: malloc %f ms, pools %f ms, thread caches %f ms",
+			THREAD_CACHE_THREADS, count, rounds + 1, mallocTime / 1000000.0, poolTime / 1000000.0, cacheTime / 1000000.0);
+
+		FutureMemory::DestroyMemory();
+	}
+
+	static const u32 POOL_CONTENTION_MAX_THREADS = 32;
+	static const u32 POOL_CONTENTION_BATCH = 64;
+
+	struct PoolContentionTestData
+	{
+		FuturePoolAllocator *	m_pool;		// NULL to use malloc
+		u32						m_thread;
+		u32						m_rounds;
+	};
+
+	// Allocates a batch of blocks, stamps each with the thread and its index, checks nothing else
+	// wrote to them and frees them again, m_rounds times
+	static void PoolContentionTest(void * data)
+	{
+		PoolContentionTestData * test = (PoolContentionTestData*)data;
+		void * blocks[POOL_CONTENTION_BATCH];
+		for(u32 round = 0; round < test->m_rounds; ++round)
+		{
+			for(u32 i = 0; i < POOL_CONTENTION_BATCH; ++i)
+			{
+				blocks[i] = test->m_pool ? test->m_pool->Alloc(64) : malloc(64);
+				FUTURE_ASSERT(blocks[i] != NULL);
+				((u32*)blocks[i])[0] = test->m_thread;
+				((u32*)blocks[i])[1] = i;
+			}
+			for(u32 i = 0; i < POOL_CONTENTION_BATCH; ++i)
+			{
+				FUTURE_ASSERT_MSG(((u32*)blocks[i])[0] == test->m_thread && ((u32*)blocks[i])[1] == i, L"Two threads were given the same pool block");
+				if(test->m_pool)
+				{
+					test->m_pool->Free(blocks[i]);
+				}
+				else
+				{
+					free(blocks[i]);
+				}
+			}
+		}
+	}
+
+	// Runs PoolContentionTest on numThreads threads at once, returns the time taken in nanoseconds
+	static u64 RunPoolContentionTest(FuturePoolAllocator * pool, u32 numThreads, u32 rounds)
+	{
+		PoolContentionTestData data[POOL_CONTENTION_MAX_THREADS];
+		IFutureThread * threads[POOL_CONTENTION_MAX_THREADS];
+		for(u32 i = 0; i < numThreads; ++i)
+		{
+			data[i].m_pool = pool;
+			data[i].m_thread = i;
+			data[i].m_rounds = rounds;
+		}
+
+		u64 time = FutureTimer::CurrentNanoseconds();
+		for(u32 i = 0; i < numThreads; ++i)
+		{
+			threads[i] = FutureCreateThread();
+			threads[i]->Start(PoolContentionTest, &data[i]);
+		}
+		for(u32 i = 0; i < numThreads; ++i)
+		{
+			FutureDestroyThread(threads[i]);
+		}
+		return FutureTimer::CurrentNanoseconds() - time;
+	}
+
+	// Hammers one pool from 1 to 32 threads at once and compares it with malloc. The pool starts
+	// too small for 32 threads so it also expands while the others are allocating
+	static void TestPoolContention()
+	{
+		const u32 rounds = 20000;
+
+		FutureMemory::CreateMemory();
+		FuturePoolAllocator * pool = new FuturePoolAllocator(64, 1024);
+
+		for(u32 numThreads = 1; numThreads <= POOL_CONTENTION_MAX_THREADS; numThreads *= 2)
+		{
+			u64 poolTime = RunPoolContentionTest(pool, numThreads, rounds);
+			u64 mallocTime = RunPoolContentionTest(NULL, numThreads, rounds);
+			f64 operations = (f64)numThreads * rounds * POOL_CONTENTION_BATCH * 2;
+			FUTURE_LOG_DEBUG(L"%u threads: pool %f ns, malloc %f ns per allocation or free",
+				numThreads, poolTime / operations, mallocTime / operations);
+		}
+
+		// a corrupted free list hands out the same block twice, which shows up as an overwritten stamp
+		const u32 count = POOL_CONTENTION_MAX_THREADS * POOL_CONTENTION_BATCH;
+		void ** blocks = (void**)malloc(sizeof(void*) * count);
+		for(u32 i = 0; i < count; ++i)
+		{
+			blocks[i] = pool->Alloc(64);
+			*(u32*)blocks[i] = i;
+		}
+		for(u32 i = 0; i < count; ++i)
+		{
+			FUTURE_ASSERT(*(u32*)blocks[i] == i);
+		}
+		pool->FreeBatch(blocks, count);
+		free(blocks);
+
+		delete pool;
+		FutureMemory::DestroyMemory();
+	}
+	// Opens a counter of the data TLB misses of the calling thread, -1 if the platform or kernel doesn't allow it
+	static int OpenTLBMissCounter()
+	{
+#if FUTURE_PLATFORM_LINUX
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+		return -1;
+#endif
+	}
+
+	static void StartCounter(int counter)
+	{
+#if FUTURE_PLATFORM_LINUX
+		if(counter >= 0)
+		{
+			ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+			ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	static u64 StopCounter(int counter)
+	{
+		u64 value = 0;
+#if FUTURE_PLATFORM_LINUX
+		if(counter >= 0)
+		{
+			ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+			if(read(counter, &value, sizeof(value)) != sizeof(value))
+			{
+				value = 0;
+			}
+		}
+#endif
+		return value;
+	}
+
+	// Reads one u32 from a random page of data, touches times, so nearly every read needs a new TLB entry
+	static u32 TouchRandomPages(u8 * data, u32 bytes, u32 touches)
+	{
+		u32 pages = bytes / 4096;
+		u32 state = 2463534242U;
+		u32 sum = 0;
+		for(u32 i = 0; i < touches; ++i)
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			sum += *(volatile u32*)(data + (size_t)(state % pages) * 4096 + (i & 1023) * 4);
+		}
+		return sum;
+	}
+
+	// Checks regions are committed, reused and given back, that heaps and pools can be backed by the
+	// virtual allocator, then compares random reads over a heap backed by malloc and by huge pages
+	static void TestVirtualAllocator()
+	{
+		FutureVirtualAllocator * virtualAllocator = new FutureVirtualAllocator((u64)1024 * 1024 * 1024);
+		FUTURE_ASSERT(virtualAllocator->BytesReserved() == (u64)1024 * 1024 * 1024);
+
+		u8 * small = (u8*)virtualAllocator->Alloc(100000);
+		FUTURE_ASSERT(small && ((size_t)small & (FUTURE_VIRTUAL_GRANULE_SIZE - 1)) == 0 && small[99999] == 0);
+		memset(small, 0xAB, 100000);
+		u8 * large = (u8*)virtualAllocator->Alloc(8 * 1024 * 1024);
+		FUTURE_ASSERT(large && virtualAllocator->Owns(large + 8 * 1024 * 1024 - 1));
+		if(virtualAllocator->UsesHugePages())
+		{
+			FUTURE_ASSERT(((size_t)large & (FUTURE_VIRTUAL_HUGE_PAGE_SIZE - 1)) == 0);
+		}
+		memset(large, 0xCD, 8 * 1024 * 1024);
+		FUTURE_ASSERT(virtualAllocator->BytesCommitted() == 8 * 1024 * 1024 + 2 * FUTURE_VIRTUAL_GRANULE_SIZE);
+
+		// decommitted pages read as zero, the pages around them are untouched
+		virtualAllocator->Decommit(large + 1, 8 * 1024 * 1024 - 2);
+		FUTURE_ASSERT(large[0] == 0xCD && large[4 * 1024 * 1024] == 0 && large[8 * 1024 * 1024 - 1] == 0xCD);
+
+		// freed regions are handed out again
+		virtualAllocator->Free(small);
+		u8 * reused = (u8*)virtualAllocator->Alloc(100000);
+		FUTURE_ASSERT(reused == small && small[0] == 0);
+		virtualAllocator->Free(small);
+		virtualAllocator->Free(large);
+		FUTURE_ASSERT(virtualAllocator->BytesCommitted() == 0);
+
+		// a second heap is added when the first is full and gives its pages back once it is empty
+		FutureHeapAllocator * heap = new FutureHeapAllocator(1024 * 1024, false, virtualAllocator);
+		void * blocks[3];
+		for(u32 i = 0; i < 3; ++i)
+		{
+			blocks[i] = heap->Alloc(400 * 1024);
+			FUTURE_ASSERT(blocks[i] && virtualAllocator->Owns(blocks[i]));
+			memset(blocks[i], (int)i, 400 * 1024);
+		}
+		FutureMemoryFragmentation fragmentation;
+		heap->GetFragmentation(fragmentation);
+		FUTURE_ASSERT(fragmentation.m_heaps == 2 && fragmentation.m_usedBlocks == 3);
+		for(u32 i = 0; i < 3; ++i)
+		{
+			FUTURE_ASSERT(((u8*)blocks[i])[400 * 1024 - 1] == (u8)i);
+			heap->Free(blocks[i]);
+		}
+		heap->Trim();
+		heap->GetFragmentation(fragmentation);
+		FUTURE_ASSERT(fragmentation.m_usedBlocks == 0 && fragmentation.m_freeBlocks == 2);
+		void * regrown = heap->Alloc(1000);
+		FUTURE_ASSERT(regrown != NULL);
+		delete heap;
+
+		FuturePoolAllocator * pool = new FuturePoolAllocator(64, 4096, FUTURE_DEFAULT_ALIGNMENT, virtualAllocator);
+		void * block = pool->Alloc(64);
+		FUTURE_ASSERT(virtualAllocator->Owns(block));
+		pool->Free(block);
+		delete pool;
+		FUTURE_ASSERT(virtualAllocator->BytesCommitted() == 0);
+
+		// random reads over a large heap need a TLB entry for nearly every read, huge pages need 512 times fewer
+		const u32 heapSize = 1024 * 1024 * 256;
+		const u32 touches = 1024 * 1024 * 16;
+		int counter = OpenTLBMissCounter();
+		f32 times[2];
+		u64 misses[2];
+		for(u32 test = 0; test < 2; ++test)
+		{
+			FutureHeapAllocator * benchHeap = new FutureHeapAllocator(heapSize, false, test == 0 ? NULL : virtualAllocator);
+			u8 * data = (u8*)benchHeap->Alloc(heapSize - 4096);
+			FUTURE_ASSERT(data);
+			memset(data, 1, heapSize - 4096);
+
+			f32 start = FutureTimer::CurrentTime();
+			StartCounter(counter);
+			u32 sum = TouchRandomPages(data, heapSize - 4096, touches);
+			misses[test] = StopCounter(counter);
+			times[test] = FutureTimer::TimeSince(start);
+			FUTURE_ASSERT(sum == touches);
+
+			benchHeap->Free(data);
+			delete benchHeap;
+		}
+		if(counter < 0)
+		{
+			FUTURE_LOG_DEBUG(L"Data TLB misses can't be counted here, only timing the reads");
+		}
+#if FUTURE_PLATFORM_LINUX
+		else
+		{
+			close(counter);
+		}
+#endif
+		FUTURE_LOG_DEBUG(L"%u random reads over %u MB: malloc heap %f seconds %llu dTLB misses, huge page heap %f seconds %llu dTLB misses",
+			touches, heapSize / (1024 * 1024), times[0], (unsigned long long)misses[0], times[1], (unsigned long long)misses[1]);
+
+		delete virtualAllocator;
+	}
 };
 	
 
@@ -25,14 +25,23 @@
 #ifndef FUTURE_CORE_TESTS_MEMORY_H
 #define FUTURE_CORE_TESTS_MEMORY_H
 
+#include <future/core/config/coreconfig.h>
 #include <future/core/debug/debug.h>
 #include <future/core/utils/timer/timer.h>
 #include <future/core/memory/memory.h>
+#include <future/core/memory/tracker/memoryprofiler.h>
 #include <future/core/memory/tracker/memorytracker.h>
 #include <future/core/memory/memoryStatistics.h>
+#include <future/core/memory/allocators/chunk.h>
+#include <future/core/memory/allocators/mallocallocator.h>
 #include <future/core/memory/allocators/poolallocator.h>
 #include <future/core/memory/allocators/heapallocator.h>
+#include <future/core/memory/allocators/threadcache.h>
+#include <future/core/util/container/array.h>
+#include <future/core/util/stream.h>
 #include <new>
+#include <stdlib.h>
+#include <string.h>
 
 class FutureMemoryTests
 {
@@ -64,6 +73,15 @@ public:
 		u32		m_array[32];
 	};
 
+#if defined(__cpp_aligned_new)
+	struct alignas(64) MemoryTestAlignedStruct
+	{
+		FUTURE_DECLARE_MEMORY_OPERATORS(MemoryTestAlignedStruct);
+
+		f32		m_values[16];
+	};
+#endif
+
 	static void TestDefaultTracking()
 	{
 		f32 startTime = FutureTimer::CurrentTime();
@@ -92,7 +110,7 @@ public:
 		}
 
 		FUTURE_FREE(test);
-		FutureMemoryTracker::GetInstance()->Untrack((FutureAllocHeader *)((u32)test2 - FutureMemory::HeaderSize()));
+		FutureMemoryTracker::GetInstance()->Untrack(test2);
 
 		FutureMemory::LogAllocations();
 		FutureMemory::LogStatistics();
@@ -102,5 +120,397 @@ public:
 		FUTURE_LOG_DEBUG(L"Took %f second to allocate and free 16384 objects", endTime);
 	}
 
+	// Takes every allocation of exactly m_bytes and is checked before the pools
+	class SizeClassTestAllocator : public IFutureAllocator
+	{
+	public:
+		SizeClassTestAllocator(u32 bytes)
+			: m_bytes(bytes)
+		{}
+
+		virtual void *	Alloc(u32 bytes)							{ return malloc(bytes); }
+		virtual void	Free(void * p)								{ free(p); }
+		virtual u8		Priority()									{ return 50; }
+		virtual bool	ShouldAllocate(FutureMemoryParam memParam)	{ return memParam.m_bytes == m_bytes; }
+
+		u32		m_bytes;
+	};
+
+	// Allocates and frees a 16 byte object count times, returns the time taken in seconds
+	static f32 TimeSmallAllocations(u32 count)
+	{
+		f32 startTime = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; ++i)
+		{
+			void * p = FUTURE_ALLOC(16, "Size class test");
+			FUTURE_FREE(p);
+		}
+		return FutureTimer::TimeSince(startTime);
+	}
+
+	static void TestSizeClasses()
+	{
+		const u32 count = 1024 * 1024;
+
+		FutureMemory::CreateMemory();
+		FuturePoolAllocator * small = new FuturePoolAllocator(32, 1024);
+		FuturePoolAllocator * large = new FuturePoolAllocator(128, 1024);
+		FutureHeapAllocator * heap = new FutureHeapAllocator(1024 * 1024);
+		FutureMemory::AddSizeClass(small);
+		FutureMemory::AddSizeClass(large);
+		FutureMemory::AddAllocator(heap);
+
+		// sizes that fit a pool come from this thread's cache, anything bigger falls back to the heap or malloc
+		void * smallBlock = FUTURE_ALLOC(16, "Size class test");
+		void * largeBlock = FUTURE_ALLOC(100, "Size class test");
+		void * heapBlock = FUTURE_ALLOC(4000, "Size class test");
+		void * mallocBlock = FUTURE_ALLOC(1024 * 1024, "Size class test");
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(smallBlock) == small);
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(largeBlock) == large);
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(heapBlock) == heap);
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(mallocBlock) != heap && FutureMemory::AllocatorOf(mallocBlock) != large);
+		FUTURE_FREE(smallBlock);
+		FUTURE_FREE(largeBlock);
+		FUTURE_FREE(heapBlock);
+		FUTURE_FREE(mallocBlock);
+
+		// a cached block is charged and given back at the pool's block size, the default budget ends where it started
+		u64 startUsage = FutureMemory::BudgetUsage(FutureMemoryBudget_Default);
+		for(u32 i = 0; i < 10000; ++i)
+		{
+			void * block = FUTURE_ALLOC(1 + i % 128, "Size class test");
+			FUTURE_ASSERT(block);
+			FUTURE_FREE(block);
+		}
+		FUTURE_ASSERT(FutureMemory::BudgetUsage(FutureMemoryBudget_Default) == startUsage);
+		f32 tableTime = TimeSmallAllocations(count);
+
+		// an allocator checked before the pools still sees every allocation,
+		// so the sizes it turns down have to walk the list again
+		SizeClassTestAllocator * custom = new SizeClassTestAllocator(40);
+		FutureMemory::AddAllocator(custom);
+		void * customBlock = FUTURE_ALLOC(40, "Size class test");
+		smallBlock = FUTURE_ALLOC(16, "Size class test");
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(customBlock) == custom);
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(smallBlock) == small);
+		FUTURE_FREE(customBlock);
+		FUTURE_FREE(smallBlock);
+		f32 walkTime = TimeSmallAllocations(count);
+
+		FUTURE_LOG_DEBUG(L"%u small allocations took %f seconds through the size class table and %f seconds walking the allocators", count, tableTime, walkTime);
+		FutureMemory::DestroyMemory();
+	}
+
+	// Pool blocks have no header, they sit next to each other and are found through their chunk,
+	// allocations from the heap still get one
+	static void TestHeaderlessBlocks()
+	{
+		FutureMemory::CreateMemory();
+		FuturePoolAllocator * pool = new FuturePoolAllocator(32, 1024);
+		FutureHeapAllocator * heap = new FutureHeapAllocator(1024 * 1024);
+		FutureMemory::AddSizeClass(pool);
+		FutureMemory::AddAllocator(heap);
+
+		u8 * first = (u8*)FUTURE_ALLOC_ALLOCATOR(32, "Headerless test", pool);
+		u8 * second = (u8*)FUTURE_ALLOC_ALLOCATOR(32, "Headerless test", pool);
+		FUTURE_ASSERT(second - first == 32);
+		FUTURE_ASSERT(FutureMemoryChunk::Find(first) != NULL && FutureMemoryChunk::Find(first) == FutureMemoryChunk::Find(second));
+		FUTURE_ASSERT(FutureMemoryChunk::Find(first)->m_owner == pool);
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(first) == pool);
+
+		void * heapBlock = FUTURE_ALLOC(4000, "Headerless test");
+		FUTURE_ASSERT(FutureMemoryChunk::Find(heapBlock) == NULL);
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(heapBlock) == heap);
+
+		// a block freed on this thread goes to its cache and is the next one handed out
+		FUTURE_FREE(first);
+		void * reused = FUTURE_ALLOC(24, "Headerless test");
+		FUTURE_ASSERT(reused == first);
+
+		FUTURE_FREE(reused);
+		FUTURE_FREE(second);
+		FUTURE_FREE(heapBlock);
+		FutureMemory::DestroyMemory();
+	}
+
+	static void TestAlignedAllocations()
+	{
+		FutureMemory::CreateMemory();
+		FuturePoolAllocator * pool = new FuturePoolAllocator(64, 1024);
+		FutureHeapAllocator * heap = new FutureHeapAllocator(1024 * 1024);
+		FutureMemory::AddSizeClass(new FuturePoolAllocator(32, 1024));
+		FutureMemory::AddSizeClass(pool);
+		FutureMemory::AddAllocator(heap);
+		FutureMemory::AddAllocator(new FutureMallocAllocator());
+		FUTURE_ASSERT(pool->Alignment() == 64);
+
+		// small blocks come from the first pool that is aligned well enough
+		void * cacheLine = FUTURE_ALLOC_ALIGNED(24, 64, "Aligned test");
+		FUTURE_ASSERT(((size_t)cacheLine & 63) == 0 && FutureMemory::AllocatorOf(cacheLine) == pool);
+
+		const u32 alignments[] = {16, 32, 64, 256, 4096};
+		const u32 sizes[] = {8, 100, 3000, 300000};
+		void * blocks[5][4];
+		for(u32 a = 0; a < 5; ++a)
+		{
+			for(u32 s = 0; s < 4; ++s)
+			{
+				u8 * p = (u8*)FUTURE_ALLOC_ALIGNED(sizes[s], alignments[a], "Aligned test");
+				FUTURE_ASSERT(p != NULL && ((size_t)p & (alignments[a] - 1)) == 0);
+				memset(p, (int)(a * 4 + s), sizes[s]);
+				blocks[a][s] = p;
+			}
+		}
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(blocks[3][2]) == heap);
+		for(u32 a = 0; a < 5; ++a)
+		{
+			for(u32 s = 0; s < 4; ++s)
+			{
+				FUTURE_ASSERT(((u8*)blocks[a][s])[sizes[s] - 1] == (u8)(a * 4 + s));
+				FUTURE_FREE(blocks[a][s]);
+			}
+		}
+		FUTURE_FREE(cacheLine);
+
+		// the blocks split off the front for alignment merge back when everything is freed
+		FutureMemoryFragmentation fragmentation;
+		heap->GetFragmentation(fragmentation);
+		FUTURE_ASSERT(fragmentation.m_usedBlocks == 0 && fragmentation.m_freeBlocks == fragmentation.m_heaps);
+
+#if defined(__cpp_aligned_new)
+		MemoryTestAlignedStruct * aligned = new MemoryTestAlignedStruct();
+		FUTURE_ASSERT(((size_t)aligned & 63) == 0);
+		delete aligned;
+#endif
+
+		FutureMemory::DestroyMemory();
+	}
+
+	static void TestRealloc()
+	{
+		FutureMemory::CreateMemory();
+		FuturePoolAllocator * pool = new FuturePoolAllocator(64, 1024);
+		FutureHeapAllocator * heap = new FutureHeapAllocator(1024 * 1024);
+		FutureMemory::AddSizeClass(pool);
+		FutureMemory::AddAllocator(heap);
+
+		// a pool block holds anything up to the block size, larger sizes move to the heap
+		u8 * small = (u8*)FUTURE_ALLOC(40, "Realloc test");
+		memset(small, 7, 40);
+		void * same = FUTURE_REALLOC(small, 64, "Realloc test");
+		FUTURE_ASSERT(same == small);
+		small = (u8*)FUTURE_REALLOC(small, 200, "Realloc test");
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(small) == heap && small[0] == 7 && small[39] == 7);
+
+		// heap blocks grow into the free block after them and move once that is taken
+		u8 * grown = (u8*)FUTURE_ALLOC(1000, "Realloc test");
+		memset(grown, 3, 1000);
+		void * inPlace = FUTURE_REALLOC(grown, 3000, "Realloc test");
+		FUTURE_ASSERT(inPlace == grown);
+		void * blocker = FUTURE_ALLOC(1000, "Realloc test");
+		inPlace = FUTURE_REALLOC(grown, 2000, "Realloc test");
+		FUTURE_ASSERT(inPlace == grown);
+		u8 * moved = (u8*)FUTURE_REALLOC(grown, 8000, "Realloc test");
+		FUTURE_ASSERT(moved != grown && moved[0] == 3 && moved[999] == 3);
+		FUTURE_FREE(blocker);
+
+		// over aligned blocks keep their alignment when they move
+		u8 * aligned = (u8*)FUTURE_ALLOC_ALIGNED(100, 256, "Realloc test");
+		memset(aligned, 5, 100);
+		void * blockers[4];
+		for(u32 i = 0; i < 4; ++i)
+		{
+			blockers[i] = FUTURE_ALLOC(4000, "Realloc test");
+		}
+		aligned = (u8*)FUTURE_REALLOC(aligned, 50000, "Realloc test");
+		FUTURE_ASSERT(((size_t)aligned & 255) == 0 && aligned[99] == 5);
+
+		// large blocks come from the default malloc allocator, which remaps their pages instead of copying them
+		u8 * large = (u8*)FUTURE_ALLOC(4 * 1024 * 1024, "Realloc test");
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(large) != heap);
+		large[4 * 1024 * 1024 - 1] = 9;
+		large = (u8*)FUTURE_REALLOC(large, 64 * 1024 * 1024, "Realloc test");
+		FUTURE_ASSERT(large && large[4 * 1024 * 1024 - 1] == 9 && ((size_t)large & 15) == 0);
+
+		void * freed = FUTURE_REALLOC(small, 0, "Realloc test");
+		FUTURE_ASSERT(freed == NULL);
+		FUTURE_FREE(moved);
+		FUTURE_FREE(aligned);
+		FUTURE_FREE(large);
+		for(u32 i = 0; i < 4; ++i)
+		{
+			FUTURE_FREE(blockers[i]);
+		}
+
+		// arrays of plain values grow through realloc, anything else is copied element by element
+		{
+			const u32 count = 200000;
+			FutureArray<u32> values;
+			for(u32 i = 0; i < count; ++i)
+			{
+				values.Add(i);
+			}
+			for(u32 i = 0; i < count; i += 997)
+			{
+				FUTURE_ASSERT(values[i] == i);
+			}
+			values.Shrink();
+			FUTURE_ASSERT(values.Size() == count && values[count - 1] == count - 1);
+		}
+
+		FutureMemoryFragmentation fragmentation;
+		heap->GetFragmentation(fragmentation);
+		FUTURE_ASSERT(fragmentation.m_usedBlocks == 0);
+
+		FutureMemory::DestroyMemory();
+	}
+
+	static void TestMemorySampling()
+	{
+		FutureMemory::CreateMemory();
+		FutureMemory::AddSizeClass(new FuturePoolAllocator(64, 4096));
+		FutureMemory::AddAllocator(new FutureHeapAllocator(1024 * 1024));
+
+		const u32 count = 10000;
+		void ** blocks = (void**)malloc(sizeof(void*) * count);
+		FutureCoreConfig::SetMemorySampleInterval(4096);
+		for(u32 i = 0; i < count; ++i)
+		{
+			blocks[i] = FUTURE_ALLOC(64, "Sampling test");
+		}
+
+		// each block is sampled with a chance of 1 - e^(-64 / 4096), about 155 samples in all
+		u64 samples = FutureMemoryProfiler::NumSamples();
+		FUTURE_ASSERT_MSG(samples > 75 && samples < 310, L"Sampled far more or fewer allocations than expected");
+		FUTURE_ASSERT(FutureMemoryProfiler::NumLiveSamples() + FutureMemoryProfiler::NumDroppedSamples() == samples);
+
+		for(u32 i = 0; i < count; ++i)
+		{
+			FUTURE_FREE(blocks[i]);
+		}
+		free(blocks);
+		FUTURE_ASSERT(FutureMemoryProfiler::NumLiveSamples() == 0);
+
+		FutureMemoryOutputStream * stream = new FutureMemoryOutputStream();
+		stream->Open();
+		FutureMemory::LogStatistics(stream);
+		FutureCoreConfig::SetMemorySampleInterval(0);
+		const char * profile = (const char*)stream->GetData();
+		FUTURE_ASSERT(stream->Size() > 32 && strncmp(profile, "heap profile: ", 14) == 0);
+		stream->Close();
+		delete stream;
+
+		FutureMemory::DestroyMemory();
+	}
+
+	struct MemoryBudgetTestState
+	{
+		u32		m_soft;
+		u32		m_hard;
+		u32		m_critical;
+		void *	m_held[4];	// blocks the callback frees when the budget is full
+		u32		m_numHeld;
+	};
+
+	static void MemoryBudgetTestCallback(FutureMemoryBudgetID budget, FutureMemoryPressure pressure, u64 bytes, void * data)
+	{
+		MemoryBudgetTestState * state = (MemoryBudgetTestState*)data;
+		FUTURE_ASSERT(budget == FutureMemoryBudget_Graphics);
+		if(pressure == FutureMemoryPressure_Soft)
+		{
+			++state->m_soft;
+		}
+		else if(pressure == FutureMemoryPressure_Hard)
+		{
+			FUTURE_ASSERT(bytes > 0);
+			++state->m_hard;
+			for(u32 i = 0; i < state->m_numHeld; ++i)
+			{
+				FUTURE_FREE(state->m_held[i]);
+			}
+			state->m_numHeld = 0;
+		}
+		else
+		{
+			++state->m_critical;
+		}
+	}
+
+	static void TestMemoryBudgets()
+	{
+		const u32 blockSize = 64 * 1024;
+
+		FutureMemory::CreateMemory();
+		FutureHeapAllocator * graphics = new FutureHeapAllocator(1024 * 1024);
+		FutureMemory::AddAllocator(graphics, FutureMemoryBudget_Graphics);
+		FutureMemory::SetBudgetLimits(FutureMemoryBudget_Graphics, 4 * blockSize, 8 * blockSize);
+
+		MemoryBudgetTestState state;
+		memset(&state, 0, sizeof(state));
+		FutureMemory::AddPressureCallback(FutureMemoryBudget_Graphics, MemoryBudgetTestCallback, &state);
+
+		// only allocations for the budget come from its allocators and are counted
+		void * shared = FUTURE_ALLOC(blockSize, "Budget test");
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(shared) != graphics);
+		FUTURE_ASSERT(FutureMemory::BudgetUsage(FutureMemoryBudget_Graphics) == 0);
+		FUTURE_FREE(shared);
+
+		// the fourth block crosses the soft limit, the callbacks hear about it once
+		void * blocks[8];
+		for(u32 i = 0; i < 4; ++i)
+		{
+			blocks[i] = FUTURE_ALLOC_BUDGET(blockSize, "Budget test", FutureMemoryBudget_Graphics);
+			FUTURE_ASSERT(FutureMemory::AllocatorOf(blocks[i]) == graphics);
+			FUTURE_ASSERT(state.m_soft == (i < 3 ? 0 : 1));
+			state.m_held[state.m_numHeld++] = blocks[i];
+		}
+		FUTURE_ASSERT(FutureMemory::BudgetUsage(FutureMemoryBudget_Graphics) >= 4 * blockSize);
+
+		// the eighth block would cross the hard limit, the callback frees the held blocks and it goes ahead
+		for(u32 i = 4; i < 8; ++i)
+		{
+			blocks[i] = FUTURE_ALLOC_BUDGET(blockSize, "Budget test", FutureMemoryBudget_Graphics);
+			FUTURE_ASSERT(blocks[i] != NULL);
+		}
+		FUTURE_ASSERT(state.m_hard == 1 && state.m_numHeld == 0);
+		// freeing the held blocks dropped the budget under the soft limit, the last block crossed it again
+		FUTURE_ASSERT(state.m_soft == 2);
+
+		// with nothing left to free the allocation fails instead
+		void * extra[3];
+		for(u32 i = 0; i < 3; ++i)
+		{
+			extra[i] = FUTURE_ALLOC_BUDGET(blockSize, "Budget test", FutureMemoryBudget_Graphics);
+			FUTURE_ASSERT(extra[i] != NULL);
+		}
+		void * refused = FUTURE_ALLOC_BUDGET(blockSize, "Budget test", FutureMemoryBudget_Graphics);
+		FUTURE_ASSERT(refused == NULL);
+		FUTURE_ASSERT(state.m_hard == 2);
+
+		FutureMemory::LowMemory();
+		FUTURE_ASSERT(state.m_critical == 1);
+
+		for(u32 i = 0; i < 3; ++i)
+		{
+			FUTURE_FREE(extra[i]);
+		}
+		for(u32 i = 4; i < 8; ++i)
+		{
+			FUTURE_FREE(blocks[i]);
+		}
+		FUTURE_ASSERT(FutureMemory::BudgetUsage(FutureMemoryBudget_Graphics) == 0);
+
+		// a reallocated block stays in its budget and is counted at its new size
+		u8 * grown = (u8*)FUTURE_ALLOC_BUDGET(1000, "Budget test", FutureMemoryBudget_Graphics);
+		grown = (u8*)FUTURE_REALLOC(grown, 100000, "Budget test");
+		FUTURE_ASSERT(FutureMemory::AllocatorOf(grown) == graphics);
+		FUTURE_ASSERT(FutureMemory::BudgetUsage(FutureMemoryBudget_Graphics) >= 100000);
+		FUTURE_FREE(grown);
+		FUTURE_ASSERT(FutureMemory::BudgetUsage(FutureMemoryBudget_Graphics) == 0);
+
+		FutureMemory::RemovePressureCallback(FutureMemoryBudget_Graphics, MemoryBudgetTestCallback, &state);
+		FutureMemory::DestroyMemory();
+	}
+
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,519 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Contains Units tests for resource loading
+*/
+
+#ifndef FUTURE_CORE_TESTS_RESOURCE_H
+#define FUTURE_CORE_TESTS_RESOURCE_H
+
+#include <future/core/debug/debug.h>
+#include <future/core/memory/memory.h>
+#include <future/core/resource/resourcepack.h>
+#include <future/core/resource/resourcemanager.h>
+#include <future/core/util/file.h>
+#include <future/core/util/stream.h>
+#include <future/core/util/ioscheduler.h>
+#include <future/core/util/container/nameindex.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/utils/timer/timer.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RESOURCE_PACK_TEST_COUNT		10000
+#define RESOURCE_PACK_TEST_FILE			"_resourcepacktest.pak"
+#define IO_SCHEDULER_TEST_COUNT			2000
+#define NAME_INDEX_TEST_COUNT			10000
+
+// A resource that is already loaded and reports a fixed size, so the residency manager can be driven without files
+class FutureTestResource : public FutureResource
+{
+public:
+	FutureTestResource(ResourceID id, u64 bytes)
+		: m_bytes(bytes)
+	{
+		m_id = id;
+		m_valid = true;
+		m_loaded = true;
+	}
+
+	virtual u64 MemoryUsage() const
+	{ return m_bytes; }
+
+protected:
+	u64		m_bytes;
+};
+
+class FutureResourceTests
+{
+public:
+
+	// Writes a payload the way a resource dumps itself, an id then a size prefixed u32 array.
+	// Two bytes of padding before the size put the array on a 4 byte boundary inside the payload
+	static u32 WriteTestPayload(u32 resource, u8 * out)
+	{
+		u16 count = (u16)(16 + (resource * 37) % 240);
+		memcpy(out, &resource, 4);
+		memset(out + 4, 0, 2);
+		memcpy(out + 6, &count, 2);
+		for(u32 i = 0; i < count; ++i)
+		{
+			u32 value = resource + i;
+			memcpy(out + 8 + i * 4, &value, 4);
+		}
+		return 8 + count * 4;
+	}
+
+	// Writes the file the resource compiler makes for a resource with one language
+	static bool WriteTestResourceFile(u32 resource, const char * file)
+	{
+		u8 data[8 + 256 * 4];
+		u32 size = WriteTestPayload(resource, data);
+
+		u8 header[18];
+		u32 fileSize = 18 + size;
+		u32 version = FUTURE_VERSION_CODE;
+		u16 numLanguages = 1;
+		u32 offset = 0;
+		u32 checkSum = FUTURE_CHECKSUM;
+		memcpy(header, &fileSize, 4);
+		memcpy(header + 4, &version, 4);
+		memcpy(header + 8, &numLanguages, 2);
+		memcpy(header + 10, &offset, 4);
+		memcpy(header + 14, &checkSum, 4);
+
+		FutureFile out;
+		if(!out.OpenForWrite(file, true, false))
+		{
+			return false;
+		}
+		bool result = out.Write(header, 18) && out.Write(data, size);
+		out.Close();
+		return result;
+	}
+
+	static void TestResourcePack()
+	{
+		FutureMemory::CreateMemory();
+
+		const u32 count = RESOURCE_PACK_TEST_COUNT;
+		char file[64];
+		for(u32 i = 0; i < count; ++i)
+		{
+			sprintf(file, "_resourcepacktest_%u.dat", i);
+			bool written = WriteTestResourceFile(i, file);
+			FUTURE_ASSERT(written);
+		}
+
+		// one file per resource, read through a chunked stream and copied out the same way LoadResourceSync does
+		f32 startTime = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; ++i)
+		{
+			sprintf(file, "_resourcepacktest_%u.dat", i);
+			FutureFileInputStream stream;
+			bool opened = stream.Open(file, 4096, false);
+			FUTURE_ASSERT(opened);
+			stream.ReadU32();
+			stream.ReadU32();
+			u32 numLanguages;
+			u32 * offsets = stream.ReadU32Array(&numLanguages);
+			stream.Skip(offsets[0]);
+			FUTURE_FREE(offsets);
+			stream.VerifyCheckSum();
+
+			FUTURE_ASSERT(stream.ReadU32() == i);
+			stream.Skip(2);
+			u32 elements;
+			u32 * values = stream.ReadU32Array(&elements);
+			FUTURE_ASSERT(values[0] == i && values[elements - 1] == i + elements - 1);
+			FUTURE_FREE(values);
+			stream.Close();
+		}
+		f32 fileTime = FutureTimer::TimeSince(startTime);
+
+		// the packer converts the same files
+		startTime = FutureTimer::CurrentTime();
+		{
+			FutureResourcePackWriter writer(count, 1);
+			for(u32 i = 0; i < count; ++i)
+			{
+				sprintf(file, "_resourcepacktest_%u.dat", i);
+				bool added = writer.AddResourceFile((ResourceID)i, file);
+				FUTURE_ASSERT(added);
+			}
+			bool written = writer.Write(RESOURCE_PACK_TEST_FILE);
+			FUTURE_ASSERT(written);
+		}
+		f32 packTime = FutureTimer::TimeSince(startTime);
+
+		for(u32 i = 0; i < count; ++i)
+		{
+			sprintf(file, "_resourcepacktest_%u.dat", i);
+			remove(file);
+		}
+
+		// one mapping for every resource, the arrays are used where they are in the pack
+		startTime = FutureTimer::CurrentTime();
+		FutureResourcePack pack;
+		bool opened = pack.Open(RESOURCE_PACK_TEST_FILE);
+		FUTURE_ASSERT(opened);
+		FUTURE_ASSERT(pack.NumResources() == count && pack.NumLanguages() == 1);
+		for(u32 i = 0; i < count; ++i)
+		{
+			FutureMappedInputStream stream;
+			bool found = pack.OpenStream((ResourceID)i, Language_Default, &stream);
+			FUTURE_ASSERT(found);
+
+			FUTURE_ASSERT(stream.ReadU32() == i);
+			stream.Skip(2);
+			u32 elements;
+			const u32 * values = (const u32*)stream.ReadArrayInPlace(4, &elements);
+			FUTURE_ASSERT(values && ((size_t)values & 3) == 0);
+			FUTURE_ASSERT(values[0] == i && values[elements - 1] == i + elements - 1);
+			stream.Close();
+		}
+		f32 mappedTime = FutureTimer::TimeSince(startTime);
+
+		// payloads are aligned and missing resources or languages fall back or fail cleanly
+		u32 size;
+		const void * data = pack.GetData((ResourceID)17, Language_Null, &size);
+		FUTURE_ASSERT(data && ((size_t)data % FUTURE_RESOURCE_PACK_ALIGNMENT) == 0 && *(const u32*)data == 17);
+		FUTURE_ASSERT(!pack.Contains((ResourceID)count, Language_Default));
+		pack.Close();
+
+		// a pack with an entry that runs past its end is refused rather than read out of bounds later
+		FILE * corrupt = fopen(RESOURCE_PACK_TEST_FILE, "r+b");
+		FUTURE_ASSERT(corrupt);
+		FutureResourcePackHeader header;
+		FutureResourcePackEntry entry;
+		size_t items = fread(&header, sizeof(header), 1, corrupt);
+		FUTURE_ASSERT(items == 1);
+		fseek(corrupt, (long)(header.m_tableOffset + 17 * sizeof(entry)), SEEK_SET);
+		items = fread(&entry, sizeof(entry), 1, corrupt);
+		FUTURE_ASSERT(items == 1);
+		entry.m_offset = header.m_size - entry.m_size / 2;
+		fseek(corrupt, (long)(header.m_tableOffset + 17 * sizeof(entry)), SEEK_SET);
+		items = fwrite(&entry, sizeof(entry), 1, corrupt);
+		FUTURE_ASSERT(items == 1);
+		fclose(corrupt);
+		opened = pack.Open(RESOURCE_PACK_TEST_FILE);
+		FUTURE_ASSERT(!opened);
+
+		FUTURE_LOG_DEBUG(L"Loading %u resources took %f seconds from their own files and %f seconds from a mapped pack, packing took %f seconds", count, fileTime, mappedTime, packTime);
+
+		remove(RESOURCE_PACK_TEST_FILE);
+		FutureMemory::DestroyMemory();
+	}
+
+	static volatile s32 & IOSchedulerTestReads()
+	{
+		static volatile s32 reads = 0;
+		return reads;
+	}
+
+	// A whole resource file, checks the id at the start of the payload
+	static void OnTestFileRead(void * buffer, u32 bytes, bool success, void * payload)
+	{
+		u32 resource = *(u32*)payload;
+		FUTURE_ASSERT(success && buffer && bytes > 22);
+		FUTURE_ASSERT(memcmp((u8*)buffer + 18, &resource, 4) == 0);
+		FUTURE_FREE(buffer);
+		FutureAtomicAdd(&IOSchedulerTestReads(), 1);
+	}
+
+	// A range of the pack read to bring it into memory, there is no buffer to check
+	static void OnTestPackRead(void * buffer, u32 bytes, bool success, void * payload)
+	{
+		FUTURE_ASSERT(success && !buffer && bytes > 0);
+		FutureAtomicAdd(&IOSchedulerTestReads(), 1);
+	}
+
+	// Asks for more than is left in the file, the data that was there is still read
+	static void OnTestShortRead(void * buffer, u32 bytes, bool success, void * payload)
+	{
+		FUTURE_ASSERT(!success && buffer && bytes == 4);
+		FutureAtomicAdd(&IOSchedulerTestReads(), 1);
+	}
+
+	static void TestIOScheduler()
+	{
+		FutureMemory::CreateMemory();
+
+		const u32 count = IO_SCHEDULER_TEST_COUNT;
+		char file[64];
+		for(u32 i = 0; i < count; ++i)
+		{
+			sprintf(file, "_ioschedulertest_%u.dat", i);
+			bool written = WriteTestResourceFile(i, file);
+			FUTURE_ASSERT(written);
+		}
+
+		// what a load job does today, open, read and close each file while the thread waits
+		f32 startTime = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; ++i)
+		{
+			sprintf(file, "_ioschedulertest_%u.dat", i);
+			FutureFile in;
+			bool opened = in.OpenForRead(file);
+			FUTURE_ASSERT(opened);
+			u32 size = in.Size();
+			u8 * data = (u8*)FUTURE_ALLOC(size, "I/O scheduler test");
+			u32 bytesRead = in.Read(size, data);
+			FUTURE_ASSERT(bytesRead == size && memcmp(data + 18, &i, 4) == 0);
+			FUTURE_FREE(data);
+			in.Close();
+		}
+		f32 blockingTime = FutureTimer::TimeSince(startTime);
+
+		FutureIOScheduler::CreateInstance();
+		FutureIOScheduler * io = FutureIOScheduler::GetInstance();
+
+		// the same files queued as one batch, the callbacks check the data
+		IOSchedulerTestReads() = 0;
+		startTime = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; ++i)
+		{
+			sprintf(file, "_ioschedulertest_%u.dat", i);
+			bool queued = io->ReadFile(file, OnTestFileRead, &i, sizeof(i));
+			FUTURE_ASSERT(queued);
+		}
+		io->WaitForIdle();
+		f32 scheduledTime = FutureTimer::TimeSince(startTime);
+		FUTURE_ASSERT(FutureAtomicLoad(&IOSchedulerTestReads()) == (s32)count);
+		FUTURE_ASSERT(io->PendingRequests() == 0);
+
+		// pack ranges queued back to front come out sorted by offset, every one is only advised into the file cache
+		FutureResourcePackWriter * writer = new FutureResourcePackWriter(count, 1);
+		for(u32 i = 0; i < count; ++i)
+		{
+			sprintf(file, "_ioschedulertest_%u.dat", i);
+			bool added = writer->AddResourceFile((ResourceID)i, file);
+			FUTURE_ASSERT(added);
+			remove(file);
+		}
+		bool written = writer->Write(RESOURCE_PACK_TEST_FILE);
+		FUTURE_ASSERT(written);
+		delete writer;
+
+		FutureResourcePack pack;
+		bool opened = pack.Open(RESOURCE_PACK_TEST_FILE);
+		FUTURE_ASSERT(opened);
+		u64 packSize = 0;
+		FutureIOFile packFile = FutureIOScheduler::OpenFile(RESOURCE_PACK_TEST_FILE, &packSize);
+		FUTURE_ASSERT(packFile != FutureIOFile_NULL && packSize > 0);
+
+		IOSchedulerTestReads() = 0;
+		startTime = FutureTimer::CurrentTime();
+		for(u32 i = count; i > 0; --i)
+		{
+			u64 offset;
+			u32 size;
+			bool found = pack.GetRange((ResourceID)(i - 1), Language_Default, &offset, &size);
+			bool queued = found && io->Read(packFile, offset, size, NULL, OnTestPackRead);
+			FUTURE_ASSERT(queued);
+		}
+		io->WaitForIdle();
+		f32 packTime = FutureTimer::TimeSince(startTime);
+		FUTURE_ASSERT(FutureAtomicLoad(&IOSchedulerTestReads()) == (s32)count);
+
+		// a read past the end of the file finishes short and reports it
+		IOSchedulerTestReads() = 0;
+		u32 buffer[4];
+		bool queued = io->Read(packFile, packSize - 4, sizeof(buffer), buffer, OnTestShortRead);
+		FUTURE_ASSERT(queued);
+		io->WaitForIdle();
+		FUTURE_ASSERT(FutureAtomicLoad(&IOSchedulerTestReads()) == 1);
+
+		FUTURE_LOG_DEBUG(L"Reading %u files took %f seconds blocking and %f seconds through the I/O scheduler (%ls), %u pack ranges took %f seconds",
+			count, blockingTime, scheduledTime, io->UsesIOUring() ? L"io_uring" : L"threads", count, packTime);
+
+		FutureIOScheduler::CloseFile(packFile);
+		pack.Close();
+		FutureIOScheduler::DestroyInstance();
+		remove(RESOURCE_PACK_TEST_FILE);
+		FutureMemory::DestroyMemory();
+	}
+
+	static void TestNameIndex()
+	{
+		FutureMemory::CreateMemory();
+
+		const u32 count = NAME_INDEX_TEST_COUNT;
+		char ** names = (char**)FUTURE_ALLOC(sizeof(char*) * count, "Name index test");
+		for(u32 i = 0; i < count; ++i)
+		{
+			names[i] = (char*)FUTURE_ALLOC(48, "Name index test");
+			sprintf(names[i], "resources/levels/level_%u/texture_%u", i / 100, i);
+		}
+
+		FutureNameIndex stored;
+		FutureNameIndex hashed;
+		stored.Reset(count, true);
+		hashed.Reset(count, false);
+		for(u32 i = 0; i < count; ++i)
+		{
+			bool storedSet = stored.SetName(i, names[i]);
+			bool hashedSet = hashed.SetName(i, names[i]);
+			FUTURE_ASSERT(storedSet && hashedSet);
+		}
+
+		// the lookup the resource manager used to do
+		u32 found = 0;
+		f32 startTime = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; i += 10)
+		{
+			for(u32 j = 0; j < count; ++j)
+			{
+				if(strcmp(names[j], names[i]) == 0)
+				{
+					++found;
+					break;
+				}
+			}
+		}
+		f32 scanTime = FutureTimer::TimeSince(startTime);
+		FUTURE_ASSERT(found == count / 10);
+
+		startTime = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; i += 10)
+		{
+			FUTURE_ASSERT(stored.Find(names[i]) == i);
+		}
+		f32 indexTime = FutureTimer::TimeSince(startTime);
+
+		// every name is found either way, only the stored index can give names back
+		for(u32 i = 0; i < count; ++i)
+		{
+			FUTURE_ASSERT(stored.Find(names[i]) == i && hashed.Find(names[i]) == i);
+			FUTURE_ASSERT(strcmp(stored.Name(i), names[i]) == 0 && hashed.Name(i) == NULL);
+		}
+		FUTURE_ASSERT(stored.Find("resources/levels/missing") == FUTURE_NAME_INDEX_NULL);
+		FUTURE_ASSERT(hashed.Find("resources/levels/missing") == FUTURE_NAME_INDEX_NULL);
+		FUTURE_ASSERT(stored.Name(count) == NULL);
+
+		// a hash written by a tool finds the same id as the name it came from
+		FutureNameIndex tool;
+		tool.Reset(2, false);
+		bool hashSet = tool.SetHash(1, FutureNameIndex::Hash(names[7]));
+		FUTURE_ASSERT(hashSet);
+		FUTURE_ASSERT(tool.Find(names[7]) == 1 && tool.Find(names[8]) == FUTURE_NAME_INDEX_NULL);
+
+		FUTURE_LOG_DEBUG(L"Finding %u of %u names took %f seconds scanning and %f seconds through the index, %u bytes with names and %u bytes with only hashes",
+			count / 10, count, scanTime, indexTime, stored.MemoryUsage(), hashed.MemoryUsage());
+
+		for(u32 i = 0; i < count; ++i)
+		{
+			FUTURE_FREE(names[i]);
+		}
+		FUTURE_FREE(names);
+		stored.Clear();
+		hashed.Clear();
+		tool.Clear();
+		FutureMemory::DestroyMemory();
+	}
+
+	// Touches a loaded resource through GetResource the way a game would for a frame, without keeping the reference
+	static void UseForTest(FutureResourceManager * manager, ResourceID resource)
+	{
+		FutureResource * res = manager->GetResource(resource, false);
+		FUTURE_ASSERT(res && res->IsLoaded());
+		res->Release();
+	}
+
+	static void TestResidency()
+	{
+		FutureMemory::CreateMemory();
+
+		// a manager with four loaded stub resources of 100, 200, 300 and 400 bytes, counted the way a finished load counts them
+		FutureResourceManager * manager = new FutureResourceManager();
+		manager->m_groups.SetSize(1);
+		manager->m_groups[0].m_loadAttempted = false;
+		manager->m_groups[0].m_loadCounter = 0;
+		manager->m_resources.SetSize(4);
+		FutureTestResource * resources[4];
+		for(u32 i = 0; i < 4; ++i)
+		{
+			resources[i] = new FutureTestResource((ResourceID)i, (i + 1) * 100);
+			manager->m_resources[i].m_resource = resources[i];
+			manager->m_resources[i].m_residentBytes = 0;
+			manager->m_resources[i].m_lastUsedFrame = 0;
+			manager->m_resources[i].m_residencyPriority = 0;
+			manager->m_resources[i].m_residencyDistance = 0.0f;
+			manager->m_resources[i].m_reloadStart = -1.0f;
+			manager->m_resources[i].m_evicted = false;
+			manager->AddResidency((ResourceID)i, resources[i], 0);
+		}
+		FUTURE_ASSERT(manager->GetResidentBytes() == 1000);
+
+		// without a budget nothing is evicted, the frames only age the resources. 2 is left the oldest, then 0, 3 and 1
+		manager->UpdateResidency();
+		UseForTest(manager, (ResourceID)0);
+		manager->UpdateResidency();
+		UseForTest(manager, (ResourceID)3);
+		manager->UpdateResidency();
+		UseForTest(manager, (ResourceID)1);
+
+		FutureResidencyStats stats;
+		manager->GetResidencyStats(&stats);
+		FUTURE_ASSERT(stats.m_requests == 3 && stats.m_hits == 3 && stats.m_evictions == 0);
+		FUTURE_ASSERT(stats.m_residentBytes == 1000 && stats.m_budget == 0);
+
+		// least recently used goes first and nothing more is evicted once it fits. 2 is the oldest but it is referenced
+		FutureResource * held = manager->GetResource((ResourceID)2, false);
+		manager->SetResidencyBudget(600);
+		manager->SetResidencyPolicy(ResidencyPolicy_LRU);
+		manager->UpdateResidency();
+		manager->GetResidencyStats(&stats);
+		FUTURE_ASSERT(stats.m_evictions == 2 && stats.m_bytesEvicted == 500 && stats.m_residentBytes == 500);
+		FUTURE_ASSERT(!resources[0]->IsLoaded() && !resources[3]->IsLoaded());
+		FUTURE_ASSERT(resources[1]->IsLoaded() && resources[2]->IsLoaded());
+		FUTURE_ASSERT(manager->m_resources[0].m_evicted && !manager->m_resources[1].m_evicted);
+
+		// an evicted resource that is asked for again is a reload rather than a hit. There is no file
+		// behind the stub so the load fails, the request is still counted
+		FutureResource * reloaded = manager->GetResource((ResourceID)3, true, false);
+		FUTURE_ASSERT(reloaded == resources[3]);
+		reloaded->Release();
+		manager->GetResidencyStats(&stats);
+		FUTURE_ASSERT(stats.m_requests == 5 && stats.m_hits == 4 && stats.m_reloads == 1);
+		FUTURE_ASSERT(stats.HitRate() == 0.8f);
+
+		// priority keeps 1 around even though 2 was used more recently
+		held->Release();
+		manager->SetResidencyHint((ResourceID)1, 2, 0.0f);
+		manager->SetResidencyBudget(250);
+		manager->SetResidencyPolicy(ResidencyPolicy_PriorityDistance);
+		manager->UpdateResidency();
+		manager->GetResidencyStats(&stats);
+		FUTURE_ASSERT(stats.m_evictions == 3 && stats.m_bytesEvicted == 800 && stats.m_residentBytes == 200);
+		FUTURE_ASSERT(resources[1]->IsLoaded() && !resources[2]->IsLoaded());
+
+		manager->ResetResidencyStats();
+		manager->GetResidencyStats(&stats);
+		FUTURE_ASSERT(stats.m_requests == 0 && stats.m_evictions == 0 && stats.m_residentBytes == 200);
+
+		// the manager unloads and deletes the stubs
+		delete manager;
+		FutureMemory::DestroyMemory();
+	}
+};
+
+#endif
@@ -26,10 +26,17 @@
 #define FUTURE_CORE_TESTS_THREADPOOL_H
 
 #include <future/core/debug/debug.h>
+#include <future/core/debug/trace.h>
 #include <future/core/thread/pool/job.h>
 #include <future/core/thread/pool/threadpool.h>
+#include <future/core/thread/pool/parallelfor.h>
+#include <future/core/thread/thread/cputopology.h>
+#include <future/core/memory/memoryStatistics.h>
 #include <future/core/utils/timer/timer.h>
+#include <future/core/util/stream.h>
 #include <new>
+#include <string.h>
+#include <stdlib.h>
 
 class FutureThreadPoolTests
 {
@@ -67,6 +74,652 @@ protected:
 
 		FUTURE_LOG_DEBUG(L"Took %f seconds for thread pool with %i threads", FutureTimer::TimeSince(time), threads);
 	}
+
+	// Adds child jobs from inside a worker so they go through the worker's deque and get stolen
+	static void SpawnTest(void* data)
+	{
+		for(int i = 0; i < 16; ++i)
+		{
+			FutureThreadPool::GetInstance()->AddJob(new FutureThreadJob(FutureThreadPoolTests::ThreadTest, data));
+		}
+	}
+
+	static void RunScalingTest(u32 threads)
+	{
+		u64 timeout = 100000;
+		u32 jobs = 256;
+
+		FutureThreadPool::GetInstance()->SetNumThreads(threads);
+
+		f32 time = FutureTimer::CurrentTime();
+
+		for(u32 i = 0; i < jobs; ++i)
+		{
+			FutureThreadPool::GetInstance()->AddJob(new FutureThreadJob(FutureThreadPoolTests::SpawnTest, &timeout));
+		}
+
+		FutureThreadPool::GetInstance()->WaitForCompletion();
+
+		f32 elapsed = FutureTimer::TimeSince(time);
+		FUTURE_LOG_DEBUG(L"Scaling: %i threads ran %i jobs in %f seconds (%f jobs per second)", threads, jobs * 17, elapsed, (f32)(jobs * 17) / elapsed);
+	}
+	static void EmptyTest(void* data)
+	{
+	}
+
+	// The sorted list insert the shared queue used before it was split into priority buckets
+	struct SortedListNode
+	{
+		u32					m_priority;
+		SortedListNode *	m_next;
+	};
+
+	static void RunEnqueueTest(u32 count)
+	{
+		const u32 priorities[] = 
+		{
+			FutureThreadJob::JobPriority_Normal,
+			FutureThreadJob::JobPriority_Low,
+			FutureThreadJob::JobPriority_High,
+			FutureThreadJob::JobPriority_Normal,
+			FutureThreadJob::JobPriority_VeryLow,
+		};
+		u32 numPriorities = sizeof(priorities) / sizeof(priorities[0]);
+
+		SortedListNode * nodes = (SortedListNode*)FUTURE_ALLOC(sizeof(SortedListNode) * count, "SortedListNode");
+		SortedListNode * head = NULL;
+		f32 time = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; ++i)
+		{
+			SortedListNode * node = &nodes[i];
+			node->m_priority = priorities[i % numPriorities];
+			SortedListNode * last = NULL;
+			SortedListNode * n = head;
+			for(; n && n->m_priority >= node->m_priority; n = n->m_next)
+			{
+				last = n;
+			}
+			node->m_next = n;
+			if(last)
+			{
+				last->m_next = node;
+			}
+			else
+			{
+				head = node;
+			}
+		}
+		f32 listTime = FutureTimer::TimeSince(time);
+		FUTURE_FREE(nodes);
+
+		FutureThreadJob ** jobs = (FutureThreadJob**)FUTURE_ALLOC(sizeof(FutureThreadJob*) * count, "FutureThreadJob array");
+		for(u32 i = 0; i < count; ++i)
+		{
+			jobs[i] = new FutureThreadJob(FutureThreadPoolTests::EmptyTest, NULL, (FutureThreadJob::FutureThreadJobPriority)priorities[i % numPriorities]);
+		}
+		FutureThreadPool::GetInstance()->SetNumThreads(1);
+		time = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; ++i)
+		{
+			FutureThreadPool::GetInstance()->AddJob(jobs[i]);
+		}
+		f32 bucketTime = FutureTimer::TimeSince(time);
+		FutureThreadPool::GetInstance()->WaitForCompletion();
+		FUTURE_FREE(jobs);
+
+		FUTURE_LOG_DEBUG(L"Enqueueing %i jobs: sorted list %f seconds, priority buckets %f seconds", count, listTime, bucketTime);
+	}
+	// Records the order jobs finished in
+	struct DependencyTestData
+	{
+		volatile s32 *	m_counter;
+		s32				m_order;
+	};
+
+	static void DependencyTest(void* data)
+	{
+		DependencyTestData * test = (DependencyTestData*)data;
+		u64 spin = 100000;
+		ThreadTest(&spin);
+		test->m_order = FutureAtomicIncrement(test->m_counter);
+	}
+
+	static void RunDependencyTest()
+	{
+		// a diamond, first -> (left, right) -> last
+		volatile s32 counter = 0;
+		DependencyTestData data[4];
+		FutureThreadJob * jobs[4];
+		for(u32 i = 0; i < 4; ++i)
+		{
+			data[i].m_counter = &counter;
+			data[i].m_order = 0;
+			jobs[i] = new FutureThreadJob(FutureThreadPoolTests::DependencyTest, &data[i]);
+		}
+		jobs[3]->SetAutoDelete(false);
+
+		jobs[1]->AddDependency(jobs[0]);
+		jobs[2]->AddDependency(jobs[0]);
+		jobs[3]->AddDependency(jobs[1]);
+		jobs[3]->AddDependency(jobs[2]);
+
+		// add in reverse so the queue order can't hide a missing dependency
+		for(s32 i = 3; i >= 0; --i)
+		{
+			FutureThreadPool::GetInstance()->AddJob(jobs[i]);
+		}
+		FutureThreadPool::GetInstance()->WaitForJob(jobs[3]);
+		delete jobs[3];
+
+		FUTURE_ASSERT(data[0].m_order == 1);
+		FUTURE_ASSERT(data[1].m_order > 1 && data[1].m_order < 4);
+		FUTURE_ASSERT(data[2].m_order > 1 && data[2].m_order < 4);
+		FUTURE_ASSERT(data[3].m_order == 4);
+		FUTURE_LOG_DEBUG(L"Job dependencies finished in order %i %i %i %i", data[0].m_order, data[1].m_order, data[2].m_order, data[3].m_order);
+	}
+	// Writes the square of every element of one array into another
+	struct ParallelForSquare
+	{
+		const u32 *	m_values;
+		u32 *		m_squares;
+
+		void operator()(u32 begin, u32 end) const
+		{
+			for(u32 i = begin; i < end; ++i)
+			{
+				m_squares[i] = m_values[i] * m_values[i];
+			}
+		}
+	};
+
+	// Sums the elements of an array, the array isn't changed
+	struct ParallelReduceSum
+	{
+		const u32 * m_values;
+
+		u64 operator()(u32 begin, u32 end, u64 sum) const
+		{
+			for(u32 i = begin; i < end; ++i)
+			{
+				sum += m_values[i];
+			}
+			return sum;
+		}
+	};
+
+	static u64 ParallelReduceJoin(u64 left, u64 right)
+	{
+		return left + right;
+	}
+
+	static void RunParallelForTest(u32 count)
+	{
+		u32 grainSize = 4096;
+		u32 * values = (u32*)FUTURE_ALLOC(sizeof(u32) * count, "ParallelFor test values");
+		u32 * serialSquares = (u32*)FUTURE_ALLOC(sizeof(u32) * count, "ParallelFor test squares");
+		u32 * parallelSquares = (u32*)FUTURE_ALLOC(sizeof(u32) * count, "ParallelFor test squares");
+		for(u32 i = 0; i < count; ++i)
+		{
+			values[i] = i % 100;
+			parallelSquares[i] = 0;
+		}
+
+		ParallelForSquare square;
+		square.m_values = values;
+		ParallelReduceSum sum;
+
+		f32 time = FutureTimer::CurrentTime();
+		square.m_squares = serialSquares;
+		square(0, count);
+		sum.m_values = serialSquares;
+		u64 serialSum = sum(0, count, 0);
+		f32 serialTime = FutureTimer::TimeSince(time);
+
+		time = FutureTimer::CurrentTime();
+		square.m_squares = parallelSquares;
+		FutureParallelFor(0, count, grainSize, square);
+		sum.m_values = parallelSquares;
+		u64 parallelSum = FutureParallelReduce(0, count, grainSize, (u64)0, sum, ParallelReduceJoin);
+		f32 parallelTime = FutureTimer::TimeSince(time);
+
+		// every chunk has to have run exactly once for both of these to match
+		FUTURE_ASSERT(memcmp(serialSquares, parallelSquares, sizeof(u32) * count) == 0);
+		FUTURE_ASSERT(parallelSum == serialSum);
+		FUTURE_LOG_DEBUG(L"ParallelFor %i elements: serial %f seconds (sum %llu), parallel %f seconds (sum %llu)", count, serialTime, serialSum, parallelTime, parallelSum);
+
+		FUTURE_FREE(values);
+		FUTURE_FREE(serialSquares);
+		FUTURE_FREE(parallelSquares);
+	}
+	// Stores the time the job started running
+	static void LatencyTest(void* data)
+	{
+		FutureAtomicStore((volatile s64*)data, (s64)FutureTimer::CurrentNanoseconds());
+	}
+
+	static int CompareLatency(const void * a, const void * b)
+	{
+		s64 left = *(const s64*)a;
+		s64 right = *(const s64*)b;
+		return left < right ? -1 : (left > right ? 1 : 0);
+	}
+
+	// Measures the time from AddJob until the job starts, with millisPause between jobs
+	// so workers have time to stop spinning and fall asleep
+	static void RunLatencyTest(u32 count, u32 millisPause)
+	{
+		s64 * latencies = (s64*)FUTURE_ALLOC(sizeof(s64) * count, "Latency test results");
+		for(u32 i = 0; i < count; ++i)
+		{
+			volatile s64 started = 0;
+			s64 added = (s64)FutureTimer::CurrentNanoseconds();
+			FutureThreadPool::GetInstance()->AddJob(new FutureThreadJob(FutureThreadPoolTests::LatencyTest, (void*)&started));
+			// don't help with the job, we want to know how long a worker takes to pick it up
+			while(FutureAtomicLoad(&started) == 0)
+			{
+				FutureAtomicPause();
+			}
+			latencies[i] = started - added;
+			FutureThreadPool::GetInstance()->WaitForCompletion();
+			if(millisPause)
+			{
+				Sleep(millisPause);
+			}
+		}
+
+		qsort(latencies, count, sizeof(s64), CompareLatency);
+		FUTURE_LOG_DEBUG(L"Submit to start latency with %ims between jobs: p50 %ius, p99 %ius", millisPause, 
+			(s32)(latencies[count / 2] / 1000), (s32)(latencies[(count * 99) / 100] / 1000));
+		FUTURE_FREE(latencies);
+	}
+
+	struct AllocationTestData
+	{
+		volatile s32 *	m_sum;
+		s32				m_value;
+	};
+
+	// Adds up the payload copied into the job
+	static void AllocationTest(void* data)
+	{
+		AllocationTestData * test = (AllocationTestData*)data;
+		FutureAtomicAdd(test->m_sum, test->m_value);
+	}
+
+	// Adds count pairs of jobs with a payload, the second job of each pair depending on the first
+	static void RunAllocationRound(u32 count, volatile s32 * sum)
+	{
+		AllocationTestData data;
+		data.m_sum = sum;
+		data.m_value = 1;
+
+		for(u32 i = 0; i < count; ++i)
+		{
+			FutureThreadJob * first = new FutureThreadJob(FutureThreadPoolTests::AllocationTest);
+			first->SetPayload(&data, sizeof(data));
+			FutureThreadJob * second = new FutureThreadJob(FutureThreadPoolTests::AllocationTest);
+			second->SetPayload(&data, sizeof(data));
+			second->AddDependency(first);
+
+			FutureThreadPool::GetInstance()->AddJob(second);
+			FutureThreadPool::GetInstance()->AddJob(first);
+		}
+		FutureThreadPool::GetInstance()->WaitForCompletion();
+	}
+
+	// Checks creating and finishing jobs doesn't allocate once the job caches are warm
+	static void RunAllocationTest(u32 count, u32 rounds)
+	{
+		// a round can have every job and continuation alive at once, make sure this
+		// thread's cache has that many slots before measuring anything
+		FutureThreadJob ** jobs = (FutureThreadJob**)FUTURE_ALLOC(sizeof(FutureThreadJob*) * count * 3, "Allocation test jobs");
+		for(u32 i = 0; i < count * 3; ++i)
+		{
+			jobs[i] = new FutureThreadJob();
+		}
+		for(u32 i = 0; i < count * 3; ++i)
+		{
+			delete jobs[i];
+		}
+		FUTURE_FREE(jobs);
+
+		volatile s32 sum = 0;
+		RunAllocationRound(count, &sum);
+
+		FutureMemoryStatistics before = FutureMemory::GetStatistics();
+		u32 blocks = FutureJobAllocator::BlocksAllocated();
+		for(u32 i = 0; i < rounds; ++i)
+		{
+			RunAllocationRound(count, &sum);
+		}
+		FutureMemoryStatistics after = FutureMemory::GetStatistics();
+
+		FUTURE_ASSERT(sum == (s32)(count * 2 * (rounds + 1)));
+		FUTURE_ASSERT(FutureJobAllocator::BlocksAllocated() == blocks);
+		FUTURE_ASSERT(after.m_totalAllocations == before.m_totalAllocations);
+		FUTURE_LOG_DEBUG(L"%i jobs made %i allocations after warming up, %i job blocks in use", count * 2 * rounds, 
+			after.m_totalAllocations - before.m_totalAllocations, FutureJobAllocator::BlocksAllocated());
+	}
+
+	// Creates a job from the worker, so every worker that runs one needs a job cache
+	static void AllocationSpawnTest(void* data)
+	{
+		FutureThreadJob * job = new FutureThreadJob(FutureThreadPoolTests::AllocationTest);
+		job->SetPayload(data, sizeof(AllocationTestData));
+		FutureThreadPool::GetInstance()->AddJob(job);
+	}
+
+	// Checks workers that exit hand their job caches to the workers that replace them
+	static void RunThreadChurnTest(u32 count, u32 threads, u32 rounds)
+	{
+		volatile s32 sum = 0;
+		AllocationTestData data;
+		data.m_sum = &sum;
+		data.m_value = 1;
+
+		u32 blocks = FutureJobAllocator::BlocksAllocated();
+		for(u32 round = 0; round < rounds; ++round)
+		{
+			FutureThreadPool::GetInstance()->SetNumThreads(threads);
+			for(u32 i = 0; i < count; ++i)
+			{
+				FutureThreadJob * job = new FutureThreadJob(FutureThreadPoolTests::AllocationSpawnTest);
+				job->SetPayload(&data, sizeof(data));
+				FutureThreadPool::GetInstance()->AddJob(job);
+			}
+			FutureThreadPool::GetInstance()->WaitForCompletion();
+			FutureThreadPool::GetInstance()->SetNumThreads(1);
+		}
+
+		// a round has at most two jobs alive per spawn, without reuse each round's new workers would add blocks of their own
+		u32 blockLimit = (threads + 1) * ((count * 2 + FUTURE_JOB_SLOTS_PER_BLOCK - 1) / FUTURE_JOB_SLOTS_PER_BLOCK);
+		FUTURE_ASSERT(sum == (s32)(count * rounds));
+		FUTURE_ASSERT(FutureJobAllocator::BlocksAllocated() - blocks <= blockLimit);
+		FUTURE_LOG_DEBUG(L"%i rounds of %i workers starting and exiting added %i job blocks, at most %i expected", rounds, threads,
+			FutureJobAllocator::BlocksAllocated() - blocks, blockLimit);
+	}
+
+	struct JobWaitTestData
+	{
+		volatile s32 *	m_gate;
+		volatile s32 *	m_started;
+		volatile s32 *	m_finished;
+	};
+
+	// Waits for the gate to open, suspended while it waits when running on a fiber
+	static void JobWaitTest(void* data)
+	{
+		JobWaitTestData * test = (JobWaitTestData*)data;
+		FutureAtomicIncrement(test->m_started);
+		FutureJobWait(test->m_gate);
+		FutureAtomicIncrement(test->m_finished);
+	}
+
+	// Starts count jobs that all wait on the same gate before opening it, far more
+	// jobs than threads so they can only all start if waiting jobs give their thread back
+	static void RunJobWaitTest(u32 count)
+	{
+		volatile s32 gate = 1;
+		volatile s32 started = 0;
+		volatile s32 finished = 0;
+		JobWaitTestData data;
+		data.m_gate = &gate;
+		data.m_started = &started;
+		data.m_finished = &finished;
+
+		f32 time = FutureTimer::CurrentTime();
+		for(u32 i = 0; i < count; ++i)
+		{
+			FutureThreadJob * job = new FutureThreadJob(FutureThreadPoolTests::JobWaitTest);
+			job->SetPayload(&data, sizeof(data));
+			FutureThreadPool::GetInstance()->AddJob(job);
+		}
+		while(FutureAtomicLoad(&started) < (s32)count)
+		{
+			Sleep(1);
+		}
+		f32 startTime = FutureTimer::TimeSince(time);
+
+		FutureAtomicStore(&gate, 0);
+		FutureThreadPool::GetInstance()->WaitForCompletion();
+
+		FUTURE_ASSERT(finished == (s32)count);
+		FUTURE_LOG_DEBUG(L"%i waiting jobs on %i threads all started in %f seconds, finished in %f seconds", count, 
+			FutureThreadPool::GetInstance()->GetNumThreads(), startTime, FutureTimer::TimeSince(time));
+	}
+
+	// Uses about 4KB of stack per level, the bottom level joins a parallel loop so other jobs run on top of it
+	static u32 DeepStackRecurse(u32 depth, volatile s32 * sum)
+	{
+		volatile u8 buffer[4096];
+		buffer[0] = (u8)depth;
+		buffer[sizeof(buffer) - 1] = (u8)depth;
+		if(depth == 0)
+		{
+			DeepStackBody body;
+			body.m_sum = sum;
+			FutureParallelFor(0, 64, 1, body);
+			return buffer[0];
+		}
+		return DeepStackRecurse(depth - 1, sum) + buffer[sizeof(buffer) - 1];
+	}
+
+	struct DeepStackBody
+	{
+		volatile s32 * m_sum;
+
+		void operator()(u32 begin, u32 end) const
+		{
+			volatile u8 buffer[16 * 1024];
+			buffer[0] = 1;
+			FutureAtomicAdd(m_sum, (s32)(end - begin) * buffer[0]);
+		}
+	};
+
+	static void DeepStackTest(void* data)
+	{
+		DeepStackRecurse(48, (volatile s32*)data);
+	}
+
+	// Jobs that go a couple of hundred KB deep and wait inside that, which used to run off the end of a fiber's stack
+	static void RunDeepStackTest(u32 count)
+	{
+		volatile s32 sum = 0;
+		for(u32 i = 0; i < count; ++i)
+		{
+			FutureThreadPool::GetInstance()->AddJob(new FutureThreadJob(FutureThreadPoolTests::DeepStackTest, (void*)&sum));
+		}
+		FutureThreadPool::GetInstance()->WaitForCompletion();
+
+		FUTURE_ASSERT(sum == (s32)(count * 64));
+		FUTURE_LOG_DEBUG(L"%i jobs ran %iKB deep on fiber stacks of %iKB", count, 48 * 4 + 16, FUTURE_THREAD_POOL_FIBER_STACK_SIZE / 1024);
+	}
+
+	// Records the core each element ran on
+	struct AffinityTestBody
+	{
+		u32 * m_cpus;
+
+		void operator()(u32 begin, u32 end) const
+		{
+			u64 count = 0;
+			while(count < 100000)
+			{
+				++count;
+			}
+			for(u32 i = begin; i < end; ++i)
+			{
+				m_cpus[i] = FutureCpuTopology::CurrentCpu();
+			}
+		}
+	};
+
+	// Runs a parallel loop with the workers pinned and reports where its chunks ran
+	static void RunAffinityTest(FutureThreadAffinity affinity, u32 count)
+	{
+		FutureCoreConfig::SetThreadPoolAffinity(affinity);
+		FutureThreadPool::GetInstance()->SetNumThreads(FutureCpuTopology::NumCpus());
+
+		u32 * cpus = (u32*)FUTURE_ALLOC(sizeof(u32) * count, "RunAffinityTest");
+		AffinityTestBody body;
+		body.m_cpus = cpus;
+		u32 localSteals = FutureThreadPool::GetInstance()->StealsWithinNode();
+		u32 remoteSteals = FutureThreadPool::GetInstance()->StealsAcrossNodes();
+
+		f32 time = FutureTimer::CurrentTime();
+		FutureParallelFor(0, count, 16, body);
+		time = FutureTimer::TimeSince(time);
+
+		u32 nodeCounts[FUTURE_MAX_NUMA_NODES] = {0};
+		for(u32 i = 0; i < count; ++i)
+		{
+			if(cpus[i] != (u32)-1)
+			{
+				FUTURE_ASSERT(FutureCpuTopology::NodeOfCpu(cpus[i]) < FutureCpuTopology::NumNodes());
+				++nodeCounts[FutureCpuTopology::NodeOfCpu(cpus[i])];
+			}
+		}
+		for(u32 i = 0; i < FutureCpuTopology::NumNodes(); ++i)
+		{
+			FUTURE_LOG_DEBUG(L"Node %u has %u cores and ran %u elements", i, FutureCpuTopology::NumCpusInNode(i), nodeCounts[i]);
+		}
+		FUTURE_LOG_DEBUG(L"Affinity %u ran %u elements in %f seconds, %u steals within a node, %u across nodes", affinity, count, time,
+			FutureThreadPool::GetInstance()->StealsWithinNode() - localSteals, FutureThreadPool::GetInstance()->StealsAcrossNodes() - remoteSteals);
+
+		FUTURE_FREE(cpus);
+		// workers keep their placement until they are recreated
+		FutureThreadPool::GetInstance()->SetNumThreads(0);
+	}
+
+	// Checks the histogram's percentiles stay within one sub bucket of the real values
+	static void RunHistogramTest()
+	{
+		FutureTimeHistogram histogram;
+		for(u64 i = 1; i <= 100000; ++i)
+		{
+			histogram.Record(i * 10, false);
+		}
+		FUTURE_ASSERT(histogram.Count() == 100000);
+		FUTURE_ASSERT(histogram.Min() == 10 && histogram.Max() == 1000000);
+		FUTURE_ASSERT(histogram.Mean() == 500005);
+
+		f32 percentiles[] = {1.f, 50.f, 90.f, 99.f, 99.9f, 100.f};
+		for(u32 i = 0; i < sizeof(percentiles) / sizeof(f32); ++i)
+		{
+			u64 expected = (u64)(percentiles[i] * 1000.f + 0.5f) * 10;
+			u64 value = histogram.Percentile(percentiles[i]);
+			FUTURE_ASSERT(value >= expected && value <= expected + expected / FUTURE_TIME_HISTOGRAM_SUB_BUCKETS);
+		}
+	}
+
+	// Runs count jobs spread over every priority level and reports the profile
+	static void RunProfileTest(u32 count)
+	{
+		FutureThreadJob::FutureThreadJobPriority priorities[] = 
+		{
+			FutureThreadJob::JobPriority_Idle,
+			FutureThreadJob::JobPriority_VeryLow,
+			FutureThreadJob::JobPriority_Low,
+			FutureThreadJob::JobPriority_Normal,
+			FutureThreadJob::JobPriority_High,
+			FutureThreadJob::JobPriority_VeryHigh,
+			FutureThreadJob::JobPriority_Critical,
+		};
+		u64 work = 10000;
+
+		FutureThreadPoolProfile * before = new FutureThreadPoolProfile();
+		FutureThreadPoolProfile * after = new FutureThreadPoolProfile();
+		FutureThreadPool::GetInstance()->GetProfile(before);
+
+		for(u32 i = 0; i < count; ++i)
+		{
+			FutureThreadJob * job = new FutureThreadJob(FutureThreadPoolTests::ThreadTest, &work, priorities[i % FUTURE_THREAD_POOL_PRIORITY_LEVELS]);
+			FutureThreadPool::GetInstance()->AddJob(job);
+		}
+		FutureThreadPool::GetInstance()->WaitForCompletion();
+		FutureThreadPool::GetInstance()->GetProfile(after);
+
+		if(!FutureCoreConfig::ProfileThreadPool())
+		{
+			FUTURE_ASSERT(after->m_jobsExecuted == before->m_jobsExecuted);
+			FUTURE_LOG_DEBUG(L"Thread pool profiling is off, nothing was recorded");
+		}
+		else
+		{
+			FUTURE_ASSERT(after->m_jobsAdded - before->m_jobsAdded == count);
+			FUTURE_ASSERT(after->m_jobsExecuted - before->m_jobsExecuted == count);
+			for(u32 level = 0; level < FUTURE_THREAD_POOL_PRIORITY_LEVELS; ++level)
+			{
+				FUTURE_LOG_DEBUG(L"Priority level %u: %u jobs, wait p50 %u ns p99 %u ns max %u ns, execute p50 %u ns p99 %u ns max %u ns", level, 
+					(u32)(after->m_executeTimes[level].Count() - before->m_executeTimes[level].Count()), 
+					(u32)after->m_waitTimes[level].Percentile(50.f), (u32)after->m_waitTimes[level].Percentile(99.f), (u32)after->m_waitTimes[level].Max(),
+					(u32)after->m_executeTimes[level].Percentile(50.f), (u32)after->m_executeTimes[level].Percentile(99.f), (u32)after->m_executeTimes[level].Max());
+			}
+			for(u32 i = 0; i <= after->m_numWorkers; ++i)
+			{
+				FutureThreadPoolProfile::Thread & thread = after->m_threads[i];
+				FUTURE_LOG_DEBUG(L"Thread %u: %u jobs, executing %f seconds, idle %f seconds, overhead %f seconds, %u steals", i, (u32)thread.m_jobsExecuted,
+					(f32)thread.m_executeTime / 1000000000.f, (f32)thread.m_idleTime / 1000000000.f, (f32)thread.m_overheadTime / 1000000000.f,
+					(u32)(thread.m_localSteals + thread.m_remoteSteals));
+			}
+		}
+
+		delete before;
+		delete after;
+	}
+
+	// Times count traced scopes while tracing is off
+	static void RunTraceOverheadTest(u32 count)
+	{
+		FutureTrace::SetEnabled(false);
+		u32 events = FutureTrace::EventCount();
+		volatile u32 sum = 0;
+
+		u64 time = FutureTimer::CurrentNanoseconds();
+		for(u32 i = 0; i < count; ++i)
+		{
+			sum += i;
+		}
+		u64 plainTime = FutureTimer::CurrentNanoseconds() - time;
+
+		time = FutureTimer::CurrentNanoseconds();
+		for(u32 i = 0; i < count; ++i)
+		{
+			FUTURE_TRACE_SCOPE("RunTraceOverheadTest");
+			sum += i;
+		}
+		u64 tracedTime = FutureTimer::CurrentNanoseconds() - time;
+
+		FUTURE_ASSERT(FutureTrace::EventCount() == events);
+		FUTURE_LOG_DEBUG(L"%u disabled trace scopes took %f ns each, %f ns each without them", count, 
+			(f64)tracedTime / (f64)count, (f64)plainTime / (f64)count);
+	}
+
+	// Traces count jobs and checks they come out as Chrome trace json
+	static void RunTraceTest(u32 count)
+	{
+		u64 work = 10000;
+		FutureTrace::Clear();
+		FutureTrace::SetThreadName("Main");
+		FutureTrace::SetEnabled(true);
+		for(u32 i = 0; i < count; ++i)
+		{
+			FutureThreadPool::GetInstance()->AddJob(new FutureThreadJob(FutureThreadPoolTests::ThreadTest, &work));
+		}
+		FutureThreadPool::GetInstance()->WaitForCompletion();
+		FutureTrace::SetEnabled(false);
+		FUTURE_ASSERT(FutureTrace::EventCount() >= count);
+
+		FutureMemoryOutputStream * stream = new FutureMemoryOutputStream();
+		stream->Open();
+		FUTURE_ASSERT(FutureTrace::Dump(stream));
+		const char * json = (const char*)stream->GetData();
+		u32 size = stream->Size();
+		FUTURE_ASSERT(size > 20 && strncmp(json, "{\"traceEvents\":[", 16) == 0 && strncmp(json + size - 4, "\n]}\n", 4) == 0);
+		FUTURE_LOG_DEBUG(L"Traced %u events into %u bytes of json", FutureTrace::EventCount(), size);
+		stream->Close();
+		delete stream;
+	}
 public:
 	static void TestThreadPool()
 	{
@@ -85,6 +738,141 @@ public:
 		FutureThreadPool::DestroyInstance();
 		FutureMemory::DestroyMemory();
 	};
+
+	static void TestThreadPoolScaling()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+
+		for(u32 threads = 1; threads <= 64; threads *= 2)
+		{
+			RunScalingTest(threads);
+		}
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestJobDependencies()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+
+		for(u32 threads = 1; threads <= 8; threads *= 2)
+		{
+			FutureThreadPool::GetInstance()->SetNumThreads(threads);
+			RunDependencyTest();
+		}
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestParallelFor()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+		FutureThreadPool::GetInstance()->SetNumThreads(FutureCoreConfig::ThreadPoolThreads());
+
+		for(u32 count = 1000; count <= 10000000; count *= 10)
+		{
+			RunParallelForTest(count);
+		}
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestThreadPoolLatency()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+		FutureThreadPool::GetInstance()->SetNumThreads(4);
+
+		RunLatencyTest(1000, 0);
+		RunLatencyTest(200, 20);
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestJobAllocations()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+		FutureThreadPool::GetInstance()->SetNumThreads(4);
+
+		RunAllocationTest(1000, 10);
+		RunThreadChurnTest(200, 4, 50);
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestJobWait()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+		FutureThreadPool::GetInstance()->SetNumThreads(4);
+
+		RunJobWaitTest(200);
+		RunDeepStackTest(32);
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestThreadPoolAffinity()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+
+		RunAffinityTest(FutureThreadAffinity_None, 10000);
+		RunAffinityTest(FutureThreadAffinity_Node, 10000);
+		RunAffinityTest(FutureThreadAffinity_Core, 10000);
+		FutureCoreConfig::SetThreadPoolAffinity(FutureThreadAffinity_None);
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestThreadPoolProfile()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+		FutureThreadPool::GetInstance()->SetNumThreads(4);
+
+		RunHistogramTest();
+		RunProfileTest(7000);
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestJobTrace()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+		FutureThreadPool::GetInstance()->SetNumThreads(4);
+
+		RunTraceOverheadTest(10000000);
+		RunTraceTest(1000);
+
+		FutureThreadPool::DestroyInstance();
+		FutureTrace::Shutdown();
+		FutureMemory::DestroyMemory();
+	};
+
+	static void TestThreadPoolEnqueue()
+	{
+		FutureMemory::CreateMemory();
+		FutureThreadPool::CreateInstance();
+
+		RunEnqueueTest(100000);
+
+		FutureThreadPool::DestroyInstance();
+		FutureMemory::DestroyMemory();
+	};
 };
 	
 
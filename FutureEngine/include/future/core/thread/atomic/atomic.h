@@ -0,0 +1,127 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	A small set of atomic operations used by the lock free parts of the engine.
+*	Loads have acquire semantics, stores have release semantics and all read-modify-write
+*	operations (Increment, Add, Exchange, CompareExchange) are full barriers.
+*
+*	When multithreading is disabled these become plain memory operations.
+*/
+
+#ifndef FUTURE_CORE_THREAD_ATOMIC_H
+#define FUTURE_CORE_THREAD_ATOMIC_H
+
+#include <future/core/type/type.h>
+
+// Size used to pad data written by different threads onto separate cache lines
+#ifndef FUTURE_CACHE_LINE_SIZE
+#	define FUTURE_CACHE_LINE_SIZE 64
+#endif
+
+#if FUTURE_ENABLE_MULTITHREADED && defined(_MSC_VER)
+#	include <intrin.h>
+#	include <emmintrin.h>
+#endif
+
+#if !FUTURE_ENABLE_MULTITHREADED
+
+inline s32		FutureAtomicLoad(const volatile s32 * p)								{ return *p; }
+inline s64		FutureAtomicLoad(const volatile s64 * p)								{ return *p; }
+inline void *	FutureAtomicLoadPtr(void * const volatile * p)							{ return *p; }
+inline void		FutureAtomicStore(volatile s32 * p, s32 value)							{ *p = value; }
+inline void		FutureAtomicStore(volatile s64 * p, s64 value)							{ *p = value; }
+inline void		FutureAtomicStorePtr(void * volatile * p, void * value)				{ *p = value; }
+inline s32		FutureAtomicAdd(volatile s32 * p, s32 value)							{ return *p += value; }
+inline s64		FutureAtomicAdd(volatile s64 * p, s64 value)							{ return *p += value; }
+inline s32		FutureAtomicExchange(volatile s32 * p, s32 value)						{ s32 old = *p; *p = value; return old; }
+inline void *	FutureAtomicExchangePtr(void * volatile * p, void * value)				{ void * old = *p; *p = value; return old; }
+inline bool		FutureAtomicCompareExchange(volatile s32 * p, s32 expected, s32 value)	{ if(*p != expected) return false; *p = value; return true; }
+inline bool		FutureAtomicCompareExchange(volatile s64 * p, s64 expected, s64 value)	{ if(*p != expected) return false; *p = value; return true; }
+inline bool		FutureAtomicCompareExchangePtr(void * volatile * p, void * expected, void * value) { if(*p != expected) return false; *p = value; return true; }
+inline void		FutureAtomicFence()														{}
+inline void		FutureAtomicPause()														{}
+
+#elif defined(_MSC_VER)
+
+inline s32		FutureAtomicLoad(const volatile s32 * p)								{ s32 v = *p; _ReadWriteBarrier(); return v; }
+inline s64		FutureAtomicLoad(const volatile s64 * p)
+{
+#	if defined(FUTURE_X64)
+	s64 v = *p; _ReadWriteBarrier(); return v;
+#	else
+	return _InterlockedCompareExchange64((volatile __int64*)p, 0, 0);
+#	endif
+}
+inline void *	FutureAtomicLoadPtr(void * const volatile * p)							{ void * v = *p; _ReadWriteBarrier(); return v; }
+inline void		FutureAtomicStore(volatile s32 * p, s32 value)							{ _ReadWriteBarrier(); *p = value; }
+inline void		FutureAtomicStore(volatile s64 * p, s64 value)
+{
+#	if defined(FUTURE_X64)
+	_ReadWriteBarrier(); *p = value;
+#	else
+	_InterlockedExchange64((volatile __int64*)p, value);
+#	endif
+}
+inline void		FutureAtomicStorePtr(void * volatile * p, void * value)				{ _ReadWriteBarrier(); *p = value; }
+inline s32		FutureAtomicAdd(volatile s32 * p, s32 value)							{ return _InterlockedExchangeAdd((volatile long*)p, value) + value; }
+inline s64		FutureAtomicAdd(volatile s64 * p, s64 value)							{ return _InterlockedExchangeAdd64((volatile __int64*)p, value) + value; }
+inline s32		FutureAtomicExchange(volatile s32 * p, s32 value)						{ return _InterlockedExchange((volatile long*)p, value); }
+inline void *	FutureAtomicExchangePtr(void * volatile * p, void * value)				{ return _InterlockedExchangePointer(p, value); }
+inline bool		FutureAtomicCompareExchange(volatile s32 * p, s32 expected, s32 value)	{ return _InterlockedCompareExchange((volatile long*)p, value, expected) == expected; }
+inline bool		FutureAtomicCompareExchange(volatile s64 * p, s64 expected, s64 value)	{ return _InterlockedCompareExchange64((volatile __int64*)p, value, expected) == expected; }
+inline bool		FutureAtomicCompareExchangePtr(void * volatile * p, void * expected, void * value) { return _InterlockedCompareExchangePointer(p, value, expected) == expected; }
+inline void		FutureAtomicFence()														{ _mm_mfence(); }
+inline void		FutureAtomicPause()														{ _mm_pause(); }
+
+#else // gcc and clang
+
+inline s32		FutureAtomicLoad(const volatile s32 * p)								{ return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline s64		FutureAtomicLoad(const volatile s64 * p)								{ return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline void *	FutureAtomicLoadPtr(void * const volatile * p)							{ return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline void		FutureAtomicStore(volatile s32 * p, s32 value)							{ __atomic_store_n(p, value, __ATOMIC_RELEASE); }
+inline void		FutureAtomicStore(volatile s64 * p, s64 value)							{ __atomic_store_n(p, value, __ATOMIC_RELEASE); }
+inline void		FutureAtomicStorePtr(void * volatile * p, void * value)				{ __atomic_store_n(p, value, __ATOMIC_RELEASE); }
+inline s32		FutureAtomicAdd(volatile s32 * p, s32 value)							{ return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST); }
+inline s64		FutureAtomicAdd(volatile s64 * p, s64 value)							{ return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST); }
+inline s32		FutureAtomicExchange(volatile s32 * p, s32 value)						{ return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST); }
+inline void *	FutureAtomicExchangePtr(void * volatile * p, void * value)				{ return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST); }
+inline bool		FutureAtomicCompareExchange(volatile s32 * p, s32 expected, s32 value)	{ return __atomic_compare_exchange_n(p, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+inline bool		FutureAtomicCompareExchange(volatile s64 * p, s64 expected, s64 value)	{ return __atomic_compare_exchange_n(p, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+inline bool		FutureAtomicCompareExchangePtr(void * volatile * p, void * expected, void * value) { return __atomic_compare_exchange_n(p, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+inline void		FutureAtomicFence()														{ __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+inline void		FutureAtomicPause()
+{
+#	if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#	elif defined(__arm__) || defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#	endif
+}
+
+#endif
+
+// Convenience functions built on the ones above
+inline s32		FutureAtomicIncrement(volatile s32 * p)		{ return FutureAtomicAdd(p, 1); }
+inline s32		FutureAtomicDecrement(volatile s32 * p)		{ return FutureAtomicAdd(p, -1); }
+inline s64		FutureAtomicIncrement(volatile s64 * p)		{ return FutureAtomicAdd(p, (s64)1); }
+inline s64		FutureAtomicDecrement(volatile s64 * p)		{ return FutureAtomicAdd(p, (s64)-1); }
+
+#endif
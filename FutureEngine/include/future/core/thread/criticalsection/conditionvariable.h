@@ -0,0 +1,104 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	A Condition Variable and the lock it waits with. Lets a thread sleep until
+*	another thread tells it something has changed instead of polling.
+*
+*	Lock the Condition Variable, check the condition being waited on and call Wait
+*	while it isn't met. Wait unlocks while the thread is asleep and locks again before
+*	returning. Threads can wake without being signaled so always check the condition
+*	again after Wait returns. Threads changing the condition should change it while
+*	locked, or at least Lock and Unlock before calling Signal, so a thread can't miss
+*	the change between checking the condition and going to sleep.
+*
+*	The lock is not recursive.
+*/
+
+#ifndef FUTURE_CORE_THREAD_CONDITIONVARIABLE_H
+#define FUTURE_CORE_THREAD_CONDITIONVARIABLE_H
+
+#include <future/core/type/type.h>
+
+#if FUTURE_ENABLE_MULTITHREADED
+#	if FUTURE_PLATFORM_WINDOWS
+#		include <windows.h>
+#	elif defined(FUTURE_USES_PTHREAD)
+#		include <pthread.h>
+#	else
+#		error Platform thread type is not defined!
+#	endif
+#endif
+
+class FutureConditionVariable
+{
+public:
+	FutureConditionVariable();
+	~FutureConditionVariable();
+
+	void			Lock();
+	void			Unlock();
+
+	/*	Sleeps until signaled or until milliTimeOut has passed. Must be locked.
+	*
+	*	@return - FR_OK if woken, FR_TIMEOUT if the time ran out
+	*/
+	FutureResult	Wait(u32 milliTimeOut = -1);
+
+	/*	Wakes one sleeping thread
+	*/
+	void			Signal();
+
+	/*	Wakes every sleeping thread
+	*/
+	void			Broadcast();
+
+private:
+#if FUTURE_ENABLE_MULTITHREADED
+#	if FUTURE_PLATFORM_WINDOWS
+	CRITICAL_SECTION	m_mutex;
+	CONDITION_VARIABLE	m_condition;
+#	elif defined(FUTURE_USES_PTHREAD)
+	pthread_mutex_t		m_mutex;
+	pthread_cond_t		m_condition;
+#	endif
+#endif
+};
+
+// Without threads there is nothing to wait for
+#if !FUTURE_ENABLE_MULTITHREADED
+inline FutureConditionVariable::FutureConditionVariable()
+{}
+inline FutureConditionVariable::~FutureConditionVariable()
+{}
+inline void FutureConditionVariable::Lock()
+{}
+inline void FutureConditionVariable::Unlock()
+{}
+inline FutureResult FutureConditionVariable::Wait(u32 milliTimeOut)
+{return FR_OK;}
+inline void FutureConditionVariable::Signal()
+{}
+inline void FutureConditionVariable::Broadcast()
+{}
+
+#endif
+
+#endif
@@ -0,0 +1,93 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	A Fiber is an execution context with its own stack that is switched to by hand
+*	instead of being scheduled by the OS. Switching saves the registers of the running
+*	fiber and loads those of the next one, so a fiber can stop half way through a
+*	function and carry on later, from the same or a different thread.
+*
+*	A thread must be converted into a fiber before it can switch to one. Uses Win32
+*	fibers on Windows and ucontext everywhere else.
+*
+*	Only available when FUTURE_ENABLE_FIBERS is set.
+*/
+
+#ifndef FUTURE_CORE_THREAD_FIBER_H
+#define FUTURE_CORE_THREAD_FIBER_H
+
+#include <future/core/type/type.h>
+#include <future/core/debug/debug.h>
+#include <future/core/memory/memory.h>
+
+#if FUTURE_ENABLE_FIBERS
+
+class FutureFiber
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureFiber);
+
+	typedef void (*FiberFunction)(void*);
+
+	FutureFiber();
+	~FutureFiber();
+
+	/*	Creates the fiber's stack. function is called with data the first time the fiber
+	*	is switched to and must never return, switch to another fiber instead.
+	*
+	*	stackSize is only reserved, pages are committed as the stack grows into them. A
+	*	guard page below the stack makes an overflow fault instead of running into
+	*	whatever memory sits below it.
+	*
+	*	@return - true if the fiber was created
+	*/
+	bool	Create(FiberFunction function, void * data, u32 stackSize);
+
+	/*	Turns the calling thread into a fiber so it can switch to other fibers. Call
+	*	ConvertToThread on the same thread before it exits.
+	*
+	*	@return - true if the thread was converted
+	*/
+	bool	ConvertFromThread();
+	void	ConvertToThread();
+
+	/*	Saves the calling thread's context in this fiber and switches to fiber. Must be
+	*	called on this fiber. Returns once something switches back to this fiber.
+	*/
+	void	SwitchTo(FutureFiber * fiber);
+
+private:
+	// Entry point of every created fiber, calls m_function
+#if FUTURE_PLATFORM_WINDOWS
+	static void __stdcall	StartFiber(void * data);
+#else
+	static void				StartFiber(int high, int low);
+#endif
+
+	void *					m_context;	// the Win32 fiber or the ucontext
+	void *					m_stack;	// stack created by Create, NULL for converted threads
+	size_t					m_stackBytes;	// bytes mapped for the stack including the guard page
+	FiberFunction			m_function;
+	void *					m_data;
+};
+
+#endif
+
+#endif
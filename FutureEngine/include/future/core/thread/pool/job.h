@@ -23,21 +23,46 @@
 *	the ThreaPool JobQueue where they will be given to the next available
 *	thread. Jobs with higher priority will be executed first.
 *
+*	Jobs can depend on other jobs with AddDependency. A job with unfinished
+*	dependencies can be added to the ThreadPool at any time, it waits outside
+*	the queue and is queued by whichever thread finishes its last dependency.
+*
+*	Jobs are allocated from FutureJobAllocator and carry no lock of their own, the
+*	state only changes through atomic operations. Small amounts of data can be
+*	copied into the job with SetPayload so the caller doesn't need to allocate it.
+*
 */
 
 #ifndef FUTURE_CORE_THREAD_JOB_H
 #define FUTURE_CORE_THREAD_JOB_H
 
 #include <future/core/type/type.h>
-#include <future/core/object/threadsafeobject.h>
+#include <future/core/debug/debug.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/thread/pool/joballocator.h>
+
+// Bytes of data that can be stored inside a job with SetPayload
+#ifndef FUTURE_JOB_PAYLOAD_SIZE
+#	define FUTURE_JOB_PAYLOAD_SIZE 64
+#endif
 
 class IFutureThread;
 class FutureThreadPool;
 
-class FutureThreadJob : public FutureThreadSafeObject
+class FutureThreadJob
 {
 public:
-	FUTURE_DECLARE_MEMORY_OPERATORS(FutureThreadJob);
+	// Jobs and anything derived from them come from FutureJobAllocator
+	inline void * operator new(size_t bytes)
+	{
+		return FutureJobAllocator::Allocate((u32)bytes);
+	}
+	inline void operator delete(void * p, size_t bytes)
+	{
+		FutureJobAllocator::Free(p, (u32)bytes);
+	}
+	inline void * operator new(size_t, void * p)	{ return p; }
 
 	// Enum to determine the job's priority. Priority can be any u32 but
 	// these are the suggested values.
@@ -60,6 +85,7 @@ public:
 	{
 		JobState_Created,
 		JobState_ToBeAdded,
+		JobState_WaitingOnDependencies,
 		JobState_InQueue,
 		JobState_Executing,
 		JobState_Finished,
@@ -89,6 +115,9 @@ public:
 	// The data to be sent to the job function
 	void *					GetData();
 	void					SetData(void * data);
+	// Copies bytes of payload into the job and sets it as the job's data, bytes
+	// must be no more than FUTURE_JOB_PAYLOAD_SIZE. Returns the job's copy
+	void *					SetPayload(const void * payload, u32 bytes);
 
 	// Set the functions this job should call
 	void					SetJobFunction(JobFunction function);
@@ -103,14 +132,56 @@ public:
 	// The thread that is executing this job, only valid during state = executing
 	IFutureThread *			GetThread();
 
+	// This job will not be executed until job has finished. Must be called before this job
+	// is added to the ThreadPool. job may already be queued or running, but it must not be
+	// deleted while this is called so either add it to the ThreadPool afterwards or turn off
+	// its auto delete. If job has already finished the dependency is already satisfied.
+	void					AddDependency(FutureThreadJob * job);
+
+	// The number of dependencies that haven't finished yet
+	u32						UnfinishedDependencies();
+
 protected:
 	friend class FutureWorkerThread;
 	friend class FutureThreadPool;
 
+	// A job waiting on this job, jobs can wait on more than one job so these can't be intrusive
+	struct Continuation
+	{
+		inline void * operator new(size_t bytes)
+		{
+			return FutureJobAllocator::Allocate((u32)bytes);
+		}
+		inline void operator delete(void * p, size_t bytes)
+		{
+			FutureJobAllocator::Free(p, (u32)bytes);
+		}
+
+		FutureThreadJob *	m_job;
+		Continuation *		m_next;
+	};
+
 	// executes this job
 	void		Execute(IFutureThread * thread);
 
-	FutureThreadJobState	m_state;
+	void		SetState(FutureThreadJobState state);
+	// Moves the job from expected to state, returns false if another thread changed it first
+	bool		ChangeState(FutureThreadJobState expected, FutureThreadJobState state);
+
+	// Called by the ThreadPool when this job is added, returns true if all dependencies have finished
+	bool				ReleaseAddHold();
+	// Called by the ThreadPool when this job finishes. Returns the jobs that were only waiting
+	// on this job, linked through m_next, they need to be queued by the caller
+	FutureThreadJob *	FinishContinuations();
+	// Lets a finished job be used as a dependency again
+	void				ResetDependencies();
+
+	// Number of unfinished dependencies, plus one until the job is added to the ThreadPool
+	volatile s32			m_unfinishedDependencies;
+	// Jobs waiting on this one, set to a closed marker once this job has finished
+	void * volatile			m_continuations;
+
+	volatile s32			m_state;
 	IFutureThread *			m_thread;
 	u32						m_id;
 	FutureThreadJobPriority	m_priority;
@@ -120,15 +191,17 @@ protected:
 	// Much cheaper than using a FutureLinkedList
 	FutureThreadJob *		m_next;
 
-	f32						m_timeAdded;
-	f32						m_timeStarted;
-	f32						m_timeCompleted;
+	// nanosecond timestamps, only set while the ThreadPool is being profiled
+	u64						m_timeQueued;
+	u64						m_timeStarted;
+	u64						m_timeCompleted;
 
 private:
 	JobFunction					m_function;
 	FinishedCallbackFunction	m_onFinished;
 	void *						m_data;
-	
+
+	u64							m_payload[FUTURE_JOB_PAYLOAD_SIZE / sizeof(u64)];
 };
 
 #endif
\ No newline at end of file
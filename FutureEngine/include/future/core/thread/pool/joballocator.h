@@ -0,0 +1,107 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Fixed size slots for FutureThreadJob objects. Every thread that creates jobs
+*	gets its own cache of free slots so allocating a job never takes a lock. A job
+*	freed by the thread that owns its slot goes straight back on that thread's free
+*	list, a job freed by any other thread is pushed onto the owner's remote free list,
+*	which the owner takes back in one go once its own list runs out. Only the
+*	owner ever pops so the remote list can't suffer from ABA.
+*
+*	New blocks of slots are only allocated while the caches warm up, after that
+*	creating and finishing jobs doesn't touch the heap. Objects larger than a slot
+*	fall back to FUTURE_ALLOC.
+*
+*	A thread that exits hands its cache back with ReleaseThread, the next thread
+*	that needs a cache adopts it along with its free slots and anything freed
+*	into it since, so threads coming and going don't keep adding blocks.
+*/
+
+#ifndef FUTURE_CORE_THREAD_JOBALLOCATOR_H
+#define FUTURE_CORE_THREAD_JOBALLOCATOR_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+
+// Usable bytes in a slot, anything bigger is allocated from the heap
+#ifndef FUTURE_JOB_SLOT_SIZE
+#	define FUTURE_JOB_SLOT_SIZE 256
+#endif
+
+// Slots allocated at once when a thread's cache is empty
+#ifndef FUTURE_JOB_SLOTS_PER_BLOCK
+#	define FUTURE_JOB_SLOTS_PER_BLOCK 64
+#endif
+
+class FutureJobAllocator
+{
+public:
+	// Returns memory for an object of bytes size
+	static void *	Allocate(u32 bytes);
+	// Frees memory returned by Allocate, bytes must be the size that was allocated
+	static void		Free(void * p, u32 bytes);
+
+	// Gives the calling thread's cache to the next thread that needs one,
+	// called by threads that create jobs before they exit
+	static void		ReleaseThread();
+
+	// Frees every block, all jobs must have been freed already. If any slot
+	// is still in use nothing is freed, as a job deleted later would touch it.
+	// Called by the ThreadPool when it is destroyed
+	static void		Shutdown();
+
+	// Number of blocks allocated so far, useful for checking the caches have warmed up
+	static u32		BlocksAllocated();
+
+private:
+	struct Cache;
+
+	struct Slot
+	{
+		Cache *		m_owner;
+		Slot *		m_next;
+	};
+
+	struct Block
+	{
+		Block *		m_next;
+		Slot *		m_slots;
+	};
+
+	struct Cache
+	{
+		// only touched by the owning thread
+		Slot *					m_free;
+		u8						m_pad[FUTURE_CACHE_LINE_SIZE - sizeof(Slot*)];
+		// slots freed by other threads
+		void * volatile			m_remoteFree;
+		// 1 while no thread owns this cache
+		volatile s32			m_orphaned;
+
+		Cache *					m_nextCache;
+	};
+
+	static Cache *		GetCache();
+	static Slot *		AllocateBlock(Cache * cache);
+};
+
+#endif
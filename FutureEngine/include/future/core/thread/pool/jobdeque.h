@@ -0,0 +1,74 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	A fixed size Chase-Lev work stealing deque. Each worker thread owns one of these.
+*	The owning thread pushes and pops jobs from the bottom without taking a lock, any
+*	other thread may steal jobs from the top. Only the owner may call Push and Pop,
+*	Steal and Size are safe to call from any thread.
+*
+*	Push fails when the deque is full, the caller should fall back to the ThreadPool's
+*	shared queue in that case.
+*/
+
+#ifndef FUTURE_CORE_THREAD_JOBDEQUE_H
+#define FUTURE_CORE_THREAD_JOBDEQUE_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+
+class FutureThreadJob;
+
+class FutureJobDeque
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureJobDeque);
+
+	FutureJobDeque();
+	~FutureJobDeque();
+
+	// Allocates room for capacity jobs, capacity must be a power of two.
+	// Must be called before the owning thread starts
+	void				Initialize(u32 capacity);
+	bool				IsInitialized();
+
+	// Owner only. Returns false if the deque is full
+	bool				Push(FutureThreadJob * job);
+	// Owner only. Returns the most recently pushed job or NULL if empty
+	FutureThreadJob *	Pop();
+
+	// Any thread. Returns the oldest job or NULL if empty or another thread won the race
+	FutureThreadJob *	Steal();
+
+	// Any thread. Only an estimate while other threads are using the deque
+	u32					Size();
+
+private:
+	volatile s64		m_top;
+	u8					m_pad0[FUTURE_CACHE_LINE_SIZE - sizeof(s64)];
+	volatile s64		m_bottom;
+	u8					m_pad1[FUTURE_CACHE_LINE_SIZE - sizeof(s64)];
+
+	void * volatile *	m_buffer;
+	s64					m_mask;
+};
+
+#endif
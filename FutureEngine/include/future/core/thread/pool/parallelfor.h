@@ -0,0 +1,185 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Data parallel loops on top of the ThreadPool.
+*
+*	FutureParallelFor(begin, end, grainSize, body) calls body(chunkBegin, chunkEnd) for
+*	every chunk of [begin, end). Chunks start at begin + n * grainSize and hold at most
+*	grainSize elements. The range is split in half recursively, the upper half becomes a
+*	job on the current thread's deque where idle workers can steal it, and the calling
+*	thread keeps splitting the lower half until it is left with a single chunk to run
+*	itself. The call returns once every chunk has run, the calling thread executes other
+*	jobs while it waits instead of sleeping.
+*
+*	FutureParallelReduce(begin, end, grainSize, identity, body, join) calls
+*	body(chunkBegin, chunkEnd, identity) for every chunk and combines the results in
+*	order with join(left, right), so the result doesn't depend on how chunks were scheduled.
+*
+*	body and join can be function pointers or function objects, they are called from
+*	several threads at once.
+*/
+
+#ifndef FUTURE_CORE_THREAD_PARALLELFOR_H
+#define FUTURE_CORE_THREAD_PARALLELFOR_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/thread/pool/job.h>
+#include <future/core/thread/pool/threadpool.h>
+
+template<typename Body>
+void FutureParallelForRange(u32 begin, u32 end, u32 grainSize, const Body & body, volatile s32 * counter);
+
+// A job running one half of a split range
+template<typename Body>
+class FutureParallelForJob : public FutureThreadJob
+{
+public:
+	FutureParallelForJob(u32 begin, u32 end, u32 grainSize, const Body & body, volatile s32 * counter)
+		: FutureThreadJob(&FutureParallelForJob<Body>::Run),
+		  m_begin(begin),
+		  m_end(end),
+		  m_grainSize(grainSize),
+		  m_body(&body),
+		  m_counter(counter)
+	{
+		SetData(this);
+	}
+
+	static void Run(void * data)
+	{
+		FutureParallelForJob<Body> * job = (FutureParallelForJob<Body>*)data;
+		FutureParallelForRange(job->m_begin, job->m_end, job->m_grainSize, *job->m_body, job->m_counter);
+		FutureAtomicDecrement(job->m_counter);
+	}
+
+private:
+	u32				m_begin;
+	u32				m_end;
+	u32				m_grainSize;
+	const Body *	m_body;
+	volatile s32 *	m_counter;
+};
+
+template<typename Body>
+void FutureParallelForRange(u32 begin, u32 end, u32 grainSize, const Body & body, volatile s32 * counter)
+{
+	u32 chunks = (end - begin + grainSize - 1) / grainSize;
+	while(chunks > 1)
+	{
+		// split on a chunk boundary so every chunk starts at begin + n * grainSize
+		u32 mid = begin + (chunks / 2) * grainSize;
+		FutureAtomicIncrement(counter);
+		FutureThreadPool::GetInstance()->AddJob(new FutureParallelForJob<Body>(mid, end, grainSize, body, counter));
+
+		end = mid;
+		chunks = chunks / 2;
+	}
+	body(begin, end);
+}
+
+template<typename Body>
+void FutureParallelFor(u32 begin, u32 end, u32 grainSize, const Body & body)
+{
+	if(end <= begin)
+	{
+		return;
+	}
+	if(grainSize == 0)
+	{
+		grainSize = 1;
+	}
+
+	FutureThreadPool * pool = FutureThreadPool::GetInstance();
+	if(pool == NULL || end - begin <= grainSize)
+	{
+		for(u32 i = begin; i < end; i += grainSize)
+		{
+			body(i, end - i > grainSize ? i + grainSize : end);
+		}
+		return;
+	}
+
+	volatile s32 counter = 0;
+	FutureParallelForRange(begin, end, grainSize, body, &counter);
+	pool->WaitForCounter(&counter);
+}
+
+// Runs the reduce body on one chunk and stores the result in that chunk's slot
+template<typename T, typename Body>
+class FutureParallelReduceBody
+{
+public:
+	FutureParallelReduceBody(u32 begin, u32 grainSize, const T & identity, const Body & body, T * results)
+		: m_begin(begin),
+		  m_grainSize(grainSize),
+		  m_identity(identity),
+		  m_body(body),
+		  m_results(results)
+	{}
+
+	void operator()(u32 begin, u32 end) const
+	{
+		m_results[(begin - m_begin) / m_grainSize] = m_body(begin, end, m_identity);
+	}
+
+private:
+	u32				m_begin;
+	u32				m_grainSize;
+	const T &		m_identity;
+	const Body &	m_body;
+	T *				m_results;
+};
+
+template<typename T, typename Body, typename Join>
+T FutureParallelReduce(u32 begin, u32 end, u32 grainSize, const T & identity, const Body & body, const Join & join)
+{
+	if(end <= begin)
+	{
+		return identity;
+	}
+	if(grainSize == 0)
+	{
+		grainSize = 1;
+	}
+
+	u32 chunks = (end - begin + grainSize - 1) / grainSize;
+	T * results = (T*)FUTURE_ALLOC(sizeof(T) * chunks, "FutureParallelReduce results");
+	for(u32 i = 0; i < chunks; ++i)
+	{
+		new(&results[i]) T(identity);
+	}
+
+	FutureParallelFor(begin, end, grainSize, FutureParallelReduceBody<T, Body>(begin, grainSize, identity, body, results));
+
+	T result = results[0];
+	results[0].~T();
+	for(u32 i = 1; i < chunks; ++i)
+	{
+		result = join(result, results[i]);
+		results[i].~T();
+	}
+	FUTURE_FREE(results);
+	return result;
+}
+
+#endif
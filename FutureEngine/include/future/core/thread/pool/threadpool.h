@@ -23,6 +23,33 @@
 *	keeps a list of jobs in a Priority Queue and pulls jobs off the queue whenever
 *	a thread becomes available. Jobs with higher priority are executed first.
 *
+*	Each worker thread also owns a work stealing deque. Jobs added from inside a
+*	running job go onto that worker's deque without taking the pool lock and are
+*	executed by the same worker, newest first. Workers that run out of work steal
+*	the oldest jobs from the other workers. Critical and Idle jobs, and jobs added
+*	from threads outside the pool, always go through the shared Priority Queue.
+*	A worker checks for queued Critical jobs before its own deque, and only takes
+*	Idle jobs once there is nothing left to steal.
+*
+*	The shared Priority Queue keeps a FIFO list for each of the suggested priority
+*	levels so adding and removing jobs doesn't depend on the number of queued jobs.
+*	Priorities between two levels are queued with the lower level.
+*
+*	FutureCoreConfig::ThreadPoolAffinity can pin workers to cores or NUMA nodes. Workers
+*	are spread over the nodes in turn and idle workers steal from workers on their own
+*	node before trying the others.
+*
+*	When fibers are enabled workers run jobs on fibers owned by the pool. A job that
+*	calls FutureJobWait is suspended, its fiber is parked with the counter it is waiting
+*	on and the worker carries on with a fresh fiber. Workers resume parked fibers whose
+*	counters have reached zero before taking new jobs, so a suspended job may finish on
+*	a different thread than it started on. A handful of threads can keep hundreds of
+*	waiting jobs in flight this way, limited by FUTURE_THREAD_POOL_MAX_FIBERS.
+*
+*	With FutureCoreConfig::ProfileThreadPool on, each thread records how long jobs wait and
+*	run, broken down by priority, into its own counters. GetProfile gathers them into a
+*	snapshot without taking any locks.
+*
 *	When running in a single threaded application, ThreadPool executes each job
 *	on the main thread, when WaitForCompletion is called. If a timeout is specified
 *	then ThreadPool will execute as many jobs as possible within the allotted time
@@ -36,13 +63,104 @@
 #include <future/core/object/singleton.h>
 #include <future/core/thread/thread/thread.h>
 #include <future/core/thread/pool/job.h>
+#include <future/core/thread/pool/jobdeque.h>
+#include <future/core/thread/pool/threadpoolprofile.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/thread/criticalsection/conditionvariable.h>
+#include <future/core/thread/criticalsection/criticalsection.h>
+#include <future/core/thread/fiber/fiber.h>
 
 #undef AddJob
 #undef GetJob
 
-// TODO: add multiple job queues so threads don't have to wait on each other to get a new job
+// The most worker threads the pool will create
+#ifndef FUTURE_THREAD_POOL_MAX_THREADS
+#	define FUTURE_THREAD_POOL_MAX_THREADS	64
+#endif
+
+// The number of jobs each worker's deque can hold before spilling into the shared queue
+#ifndef FUTURE_THREAD_POOL_QUEUE_SIZE
+#	define FUTURE_THREAD_POOL_QUEUE_SIZE	1024
+#endif
+
+// How many times an idle worker checks for new work before going to sleep, the
+// actual count adapts between these depending on how often spinning finds work
+#ifndef FUTURE_THREAD_POOL_MIN_SPIN
+#	define FUTURE_THREAD_POOL_MIN_SPIN		64
+#endif
+#ifndef FUTURE_THREAD_POOL_MAX_SPIN
+#	define FUTURE_THREAD_POOL_MAX_SPIN		4096
+#endif
+
+// The most fibers the pool will create, each suspended job holds on to one
+#ifndef FUTURE_THREAD_POOL_MAX_FIBERS
+#	define FUTURE_THREAD_POOL_MAX_FIBERS	256
+#endif
+
+// Stack size of each fiber, jobs run on these stacks. Only reserved, the pages a job
+// doesn't reach are never committed, and a guard page catches anything that goes deeper
+#ifndef FUTURE_THREAD_POOL_FIBER_STACK_SIZE
+#	define FUTURE_THREAD_POOL_FIBER_STACK_SIZE	(512 * 1024)
+#endif
+
 class FutureWorkerThread;
 
+// A snapshot of FutureThreadPoolCounters, filled in by FutureThreadPool::GetProfile
+struct FutureThreadPoolProfile
+{
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureThreadPoolProfile);
+
+	struct Thread
+	{
+		u64		m_jobsExecuted;
+		u64		m_executeTime;
+		u64		m_overheadTime;
+		u64		m_idleTime;
+		u64		m_localSteals;
+		u64		m_remoteSteals;
+	};
+
+	// m_threads[i] is worker i, m_threads[m_numWorkers] is every thread outside the pool.
+	// Workers that have been removed keep their counts, a new worker at the same index adds to them
+	u32					m_numWorkers;
+	Thread				m_threads[FUTURE_THREAD_POOL_MAX_THREADS + 1];
+
+	// totals over all threads
+	u64					m_jobsAdded;
+	u64					m_jobsExecuted;
+	u64					m_executeTime;
+	u64					m_waitTime;
+	u64					m_overheadTime;
+	u64					m_idleTime;
+	u64					m_localSteals;
+	u64					m_remoteSteals;
+
+	// all threads merged, indexed by priority level
+	FutureTimeHistogram	m_waitTimes[FUTURE_THREAD_POOL_PRIORITY_LEVELS];
+	FutureTimeHistogram	m_executeTimes[FUTURE_THREAD_POOL_PRIORITY_LEVELS];
+};
+
+
+#if FUTURE_ENABLE_FIBERS
+// A fiber the pool runs jobs on
+struct FutureJobFiber
+{
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureJobFiber);
+
+	FutureFiber			m_fiber;
+	volatile s32 *		m_waitCounter;	// what the suspended job is waiting on
+	FutureJobFiber *	m_next;
+};
+#endif
+
+/*	Waits until counter reaches zero. When called from a job running on a fiber the job
+*	is suspended and the worker is free to run other jobs until the counter reaches zero,
+*	the job may continue on a different worker. Don't keep pointers to thread local data
+*	across the call. Anywhere else this executes other jobs while it waits, like
+*	FutureThreadPool::WaitForCounter.
+*/
+void FutureJobWait(volatile s32 * counter);
+
 class FutureThreadPool : public FutureThreadSafeObject
 {
 private:
@@ -77,6 +195,7 @@ public:
 	void				ClearJobQueue();
 
 	// Gets the job with the provided id
+	// Only jobs waiting in the shared queue can be found, jobs on a worker's deque are not visible
 	FutureThreadJob *	GetJob(u32 id);
 	// returns the number of jobs in the queue
 	u32					ActiveJobs();
@@ -89,35 +208,152 @@ public:
 	void				WaitForCompletion(f32 secondsTimeOut = -1);
 	void				WaitForCompletion(u32 millisTimeOut);
 
+	// Executes other jobs until job has finished. job must not be set to auto delete
+	void				WaitForJob(FutureThreadJob * job);
+
+	// Executes other jobs until counter reaches zero. Spins rather than sleeps when there
+	// is nothing to execute, so only use it to join short lived work like FutureParallelFor
+	void				WaitForCounter(volatile s32 * counter);
+
 	// functions for getting and setting the number of active threads
 	u32					GetNumThreads();
 	void				SetNumThreads(u32 thread);
 
-	// Profiling information
+	// Profiling information, only collected while FutureCoreConfig::ProfileThreadPool is on.
+	// Fills in profile with the counters of every thread, safe to call from any thread at any time
+	void				GetProfile(FutureThreadPoolProfile * profile);
+
+	// Shortcuts for a few totals from GetProfile, times are in seconds
 	u32					TotalJobsExecuted();
 	f32					AverageWaitTime();
 	f32					TimeOnMainThread();
 	f32					TimeSpentExecutingJobs();
+	// Jobs stolen from a worker on the same NUMA node as the thief, and from other nodes
+	u32					StealsWithinNode();
+	u32					StealsAcrossNodes();
 
 protected:
 	friend class FutureWorkerThread;
 	friend class FutureSingleton<FutureThreadPool>;
+	friend void FutureJobWait(volatile s32 * counter);
 
 	FutureThreadPool();
 	~FutureThreadPool();
 
-	FutureThreadJob *	GetNextJob();
+	// thread is the worker asking for a job, or NULL when called from outside the pool
+	FutureThreadJob *	GetNextJob(FutureWorkerThread * thread = NULL);
 	void				JobFinished(FutureThreadJob * job);
 
+	// Puts a job whose dependencies have finished on the current worker's deque or the shared queue
+	void				QueueJob(FutureThreadJob * job);
+
+	// Wakes one sleeping thread, or all of them, if any are asleep
+	void				WakeThreads(bool all);
+	// Sleeps unless m_wakeCount has changed from wakeCount. The caller must increment
+	// m_sleepingThreads and check for work again before calling this
+	void				SleepUntilWoken(s32 wakeCount, u32 milliTimeOut = -1);
+	// Called by an idle worker. Spins, then sleeps until woken, returns a job if one was found
+	FutureThreadJob *	WaitForNextJob(FutureWorkerThread * thread);
+
+	// The shared queue keeps one list per suggested priority level, see FutureThreadJobPriority
+	enum JobBucket
+	{
+		JobBucket_Idle,
+		JobBucket_VeryLow,
+		JobBucket_Low,
+		JobBucket_Normal,
+		JobBucket_High,
+		JobBucket_VeryHigh,
+		JobBucket_Critical,
+		JobBucket_Count,
+	};
+
+	struct JobList
+	{
+		FutureThreadJob *	m_head;
+		FutureThreadJob *	m_tail;
+	};
+
+	static JobBucket	BucketForPriority(FutureThreadJob::FutureThreadJobPriority priority);
+
+	// The shared queue, protected by the pool's lock
+	void				AddSharedJob(FutureThreadJob * job);
+	FutureThreadJob *	PopSharedJob(bool includeIdle);
 #if FUTURE_ENABLE_MULTITHREADED
-	FutureWorkerThread *	m_threads;
+	// Tries each worker's deque once, starting with the worker at index start.
+	// Deques of workers on node are tried before the rest. Steals are counted in counters unless it is NULL
+	FutureThreadJob *	StealJob(u32 start, u32 node, FutureThreadPoolCounters * counters);
 #endif
-	FutureThreadJob *		m_jobs;
-	u32						m_totalJobs;
+	void				StartJob(FutureThreadJob * job, FutureThreadPoolCounters * counters, u64 startTime);
 
-	f32						m_threadTime;
-	f32						m_jobTime;
-	f32						m_waitTime;
+	// The counters thread writes to, thread is NULL for threads outside the pool
+	FutureThreadPoolCounters *	GetCounters(FutureWorkerThread * thread);
+	// Sums one counter over every thread
+	u64					SumCounters(volatile s64 FutureThreadPoolCounters::* counter);
+
+#if FUTURE_ENABLE_FIBERS
+	// What happens to the fiber a worker is leaving, done once the switch is complete so
+	// another worker can't resume the fiber while it is still running
+	enum FiberSwitch
+	{
+		FiberSwitch_Free,	// put it back in the free list
+		FiberSwitch_Wait,	// park it until its m_waitCounter reaches zero
+	};
+
+	// Called by a worker thread, runs jobs on the pool's fibers until the worker is released
+	void				RunFibers(FutureWorkerThread * thread);
+	// Entry point for the pool's fibers
+	static void			FiberMain(void * data);
+
+	// Suspends the calling job until counter reaches zero, returns false if the job
+	// isn't running on a fiber or there are no fibers left to switch to
+	bool				SuspendJob(volatile s32 * counter);
+
+	// Switches the calling worker to another fiber, current is the fiber being left and
+	// NULL when leaving the thread's own context
+	void				SwitchFiber(FutureJobFiber * current, FutureFiber * to, FiberSwitch action);
+	// Called right after switching to current, finishes the action of the fiber that was left
+	void				FinishSwitch(FutureJobFiber * current);
+
+	FutureJobFiber *	AcquireFiber();
+	// Creates a new fiber unless there are already FUTURE_THREAD_POOL_MAX_FIBERS, m_fiberLock must be held
+	FutureJobFiber *	CreateFiber();
+	// Removes and returns a parked fiber whose counter has reached zero
+	FutureJobFiber *	PopReadyFiber();
+#endif
+
+#if FUTURE_ENABLE_MULTITHREADED
+	FutureWorkerThread *	m_threads[FUTURE_THREAD_POOL_MAX_THREADS];
+	// m_queues[i] belongs to m_threads[i]. Queues are never freed while the pool exists
+	// so other threads can steal from them without holding the lock
+	FutureJobDeque			m_queues[FUTURE_THREAD_POOL_MAX_THREADS];
+	volatile s32			m_numThreads;
+	volatile s32			m_numQueues;		// number of initialized queues, never shrinks
+	u32						m_queueNodes[FUTURE_THREAD_POOL_MAX_THREADS];	// NUMA node of each queue's worker
+#endif
+	JobList					m_jobs[JobBucket_Count];
+	u32						m_usedBuckets;		// bit n is set when m_jobs[n] is not empty
+	volatile s32			m_criticalJobs;		// Critical jobs waiting in m_jobs
+	volatile s32			m_queuedJobs;		// jobs in m_jobs or a deque
+	volatile s32			m_pendingJobs;		// jobs added but not yet finished
+
+	FutureConditionVariable	m_wakeCondition;
+	volatile s32			m_sleepingThreads;	// threads asleep or about to sleep on m_wakeCondition
+	volatile s32			m_wakeCount;		// incremented every time sleeping threads are woken
+	volatile s32			m_totalJobs;
+
+	// m_counters[i] belongs to m_threads[i] and lives as long as its queue, the last one is
+	// shared by every thread outside the pool
+	FutureThreadPoolCounters *	m_counters[FUTURE_THREAD_POOL_MAX_THREADS + 1];
+
+#if FUTURE_ENABLE_FIBERS
+	FutureCriticalSection	m_fiberLock;		// protects the fiber lists
+	FutureJobFiber *		m_fibers[FUTURE_THREAD_POOL_MAX_FIBERS];
+	u32						m_numFibers;
+	FutureJobFiber *		m_freeFibers;
+	FutureJobFiber *		m_waitingFibers;	// parked fibers, may be ready to resume
+	volatile s32			m_numWaitingFibers;
+#endif
 };
 
 #endif
\ No newline at end of file
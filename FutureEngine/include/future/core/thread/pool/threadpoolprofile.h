@@ -0,0 +1,113 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Profiling data for the ThreadPool.
+*
+*	Every worker thread writes its own FutureThreadPoolCounters, threads outside the
+*	pool share one more set. Times are measured in nanoseconds with
+*	FutureTimer::CurrentNanoseconds, so they are wall clock times rather than cpu time.
+*	The counters only ever grow and every field is read with an atomic load, so any
+*	thread can take a snapshot at any time without stopping the workers. A snapshot
+*	taken while jobs are running may be a few jobs out of date.
+*
+*	FutureTimeHistogram keeps counts in log-linear buckets, the way HDR histograms do.
+*	Each power of two is split into FUTURE_TIME_HISTOGRAM_SUB_BUCKETS buckets, so
+*	percentiles are accurate to within 1 / FUTURE_TIME_HISTOGRAM_SUB_BUCKETS of the value.
+*/
+
+#ifndef FUTURE_CORE_THREAD_THREADPOOLPROFILE_H
+#define FUTURE_CORE_THREAD_THREADPOOLPROFILE_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+
+// Number of suggested priority levels, from FutureThreadJob::JobPriority_Idle to JobPriority_Critical.
+// Profiles keep one histogram per level, priorities between two levels count towards the lower one
+#define FUTURE_THREAD_POOL_PRIORITY_LEVELS	7
+
+// Buckets per power of two, must be a power of two
+#ifndef FUTURE_TIME_HISTOGRAM_SUB_BUCKET_BITS
+#	define FUTURE_TIME_HISTOGRAM_SUB_BUCKET_BITS	3
+#endif
+#define FUTURE_TIME_HISTOGRAM_SUB_BUCKETS	(1 << FUTURE_TIME_HISTOGRAM_SUB_BUCKET_BITS)
+// Values up to 2^40 nanoseconds, about 18 minutes, anything longer goes in the last bucket
+#define FUTURE_TIME_HISTOGRAM_BUCKETS		((40 - FUTURE_TIME_HISTOGRAM_SUB_BUCKET_BITS + 1) * FUTURE_TIME_HISTOGRAM_SUB_BUCKETS)
+
+class FutureTimeHistogram
+{
+public:
+	FutureTimeHistogram();
+
+	void		Clear();
+
+	// Adds a value. shared must be true if more than one thread records into this histogram
+	void		Record(u64 nanoseconds, bool shared);
+	// Adds the counts of other to this histogram, other may be written to while this is called
+	void		Merge(const FutureTimeHistogram & other);
+
+	u64			Count() const;
+	u64			Total() const;
+	u64			Min() const;
+	u64			Max() const;
+	u64			Mean() const;
+	// Returns an upper bound for the value below which percentile percent of the values fall
+	u64			Percentile(f32 percentile) const;
+
+	static u32	BucketForValue(u64 nanoseconds);
+	// The largest value that goes in bucket
+	static u64	BucketUpperBound(u32 bucket);
+
+private:
+	volatile s32	m_counts[FUTURE_TIME_HISTOGRAM_BUCKETS];
+	volatile s64	m_count;
+	volatile s64	m_total;
+	volatile s64	m_min;
+	volatile s64	m_max;
+};
+
+// Written by one thread of the pool, or by every thread outside the pool when m_shared is set
+struct FutureThreadPoolCounters
+{
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureThreadPoolCounters);
+
+	FutureThreadPoolCounters(bool shared);
+
+	void				Add(volatile s64 * counter, s64 value);
+
+	bool				m_shared;
+	volatile s64		m_jobsAdded;
+	volatile s64		m_jobsExecuted;
+	volatile s64		m_overheadTime;		// time spent adding, finding and finishing jobs
+	volatile s64		m_idleTime;			// time spent spinning or asleep waiting for work
+	volatile s64		m_localSteals;		// jobs stolen from a worker on the same NUMA node
+	volatile s64		m_remoteSteals;		// jobs stolen from a worker on another node
+
+	// indexed by priority level. Wait time is from being queued until starting, execute time
+	// is from starting until finishing and includes any time the job spent suspended
+	FutureTimeHistogram	m_waitTime[FUTURE_THREAD_POOL_PRIORITY_LEVELS];
+	FutureTimeHistogram	m_executeTime[FUTURE_THREAD_POOL_PRIORITY_LEVELS];
+
+	// the next thread's counters start on a new cache line
+	u8					m_pad[FUTURE_CACHE_LINE_SIZE];
+};
+
+#endif
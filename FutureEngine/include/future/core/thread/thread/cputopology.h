@@ -0,0 +1,77 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Describes the cpu cores available to the process and which NUMA node each of them
+*	belongs to, and lets a thread pin itself to a core or a node. The topology is read
+*	once, the first time it is needed.
+*
+*	Linux and Android read the nodes from /sys, Windows asks for the NUMA node processor
+*	masks. Everywhere else all cores are treated as one node and pinning is not supported.
+*/
+
+#ifndef FUTURE_CORE_THREAD_CPUTOPOLOGY_H
+#define FUTURE_CORE_THREAD_CPUTOPOLOGY_H
+
+#include <future/core/type/type.h>
+
+// The most cores and nodes that are tracked, anything past these is ignored
+#ifndef FUTURE_MAX_CPUS
+#	define FUTURE_MAX_CPUS	256
+#endif
+#ifndef FUTURE_MAX_NUMA_NODES
+#	define FUTURE_MAX_NUMA_NODES	16
+#endif
+
+class FutureCpuTopology
+{
+public:
+	// Number of cores the process may run on
+	static u32	NumCpus();
+	// Number of NUMA nodes with at least one of those cores, at least 1
+	static u32	NumNodes();
+
+	static u32	NumCpusInNode(u32 node);
+	// Returns the OS id of the index'th core in node
+	static u32	CpuInNode(u32 node, u32 index);
+	// Returns the node the core with the OS id cpu belongs to
+	static u32	NodeOfCpu(u32 cpu);
+
+	// Returns the OS id of the core the calling thread is running on, -1 if unknown
+	static u32	CurrentCpu();
+
+	// Restricts the calling thread to one core, or to every core of a node.
+	// Returns false if pinning isn't supported or failed
+	static bool	PinCurrentThread(u32 cpu);
+	static bool	PinCurrentThreadToNode(u32 node);
+
+private:
+	static void	Initialize();
+
+	static volatile bool	ms_initialized;
+	static u32				ms_numCpus;
+	static u32				ms_numNodes;
+	static u32				ms_nodeCpuCount[FUTURE_MAX_NUMA_NODES];
+	static u32				ms_nodeFirstCpu[FUTURE_MAX_NUMA_NODES];	// index into ms_cpus
+	static u32				ms_cpus[FUTURE_MAX_CPUS];				// core ids grouped by node
+	static u8				ms_cpuNode[FUTURE_MAX_CPUS];			// node of each core id
+};
+
+#endif
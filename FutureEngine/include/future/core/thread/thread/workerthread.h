@@ -26,6 +26,9 @@
 #define FUTURE_CORE_THREAD_THREAD_WORKER_H
 
 #include <future/core/type/type.h>
+#include <future/core/config/coreconfig.h>
+#include <future/core/thread/criticalsection/conditionvariable.h>
+#include <future/core/thread/fiber/fiber.h>
 
 #if FUTURE_ENABLE_MULTITHREADED
 #	if FUTURE_PLATFORM_WINDOWS
@@ -39,6 +42,8 @@
 #	include <future/core/thread/thread/null_thread.h>
 #endif
 
+struct FutureJobFiber;
+
 class FutureWorkerThread : public FutureThread
 {
 public:
@@ -50,17 +55,44 @@ public:
 	FutureResult	WaitForJob(u32 milliTimeOut = -1);
 	void			Release();
 
+	// Returns the worker running on the calling thread, NULL if called from outside the thread pool.
+	// A job suspended by FutureJobWait can resume on another worker, so call this again afterwards
+	static FutureWorkerThread *	GetCurrent();
+
 protected:
 	friend class FutureThreadPool;
 
 	virtual void	OnRunThread();
 	virtual void	OnFinished();
 
+	// Sets m_idle and wakes anyone in WaitForJob
+	void			SetIdle(bool idle);
+
+	// Executes the next job, waiting for one if there is nothing to do
+	void			RunNextJob();
+
 	volatile bool			m_running;
 	volatile bool			m_idle;
+	FutureConditionVariable	m_idleCondition;
 
-	// keep track of threads in a linked list.
-	FutureWorkerThread *	m_next;
+	// how long to spin before sleeping, adjusted by the thread pool
+	u32						m_spinCount;
+
+	// index of this thread's job deque in the thread pool
+	u32						m_index;
+
+	// where the thread pool placed this thread, applied when the thread starts
+	FutureThreadAffinity	m_affinity;
+	u32						m_node;
+	u32						m_cpu;
+
+#if FUTURE_ENABLE_FIBERS
+	FutureFiber				m_threadFiber;		// the thread's own context
+	FutureJobFiber *		m_currentFiber;		// the pool fiber this thread is running, if any
+	// the fiber this thread just switched away from and what to do with it
+	FutureJobFiber *		m_switchedFrom;
+	u32						m_switchAction;
+#endif
 };
 
 #endif
\ No newline at end of file
@@ -97,6 +97,16 @@
 #	define FUTURE_ENABLE_MULTITHREADED 1
 #endif
 
+//! Enables jobs that can suspend themselves with FutureJobWait. Jobs run on fibers with their own stack
+//! so a worker thread can pick up other jobs while one is suspended. Needs Win32 fibers or ucontext.
+#ifndef FUTURE_ENABLE_FIBERS
+#	if FUTURE_ENABLE_MULTITHREADED && (FUTURE_PLATFORM_WINDOWS_DESKTOP || FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_MAC)
+#		define FUTURE_ENABLE_FIBERS 1
+#	else
+#		define FUTURE_ENABLE_FIBERS 0
+#	endif
+#endif
+
 
 /****************************************************************************************************/
 	// UTILITY DEFINES
@@ -124,6 +134,15 @@
 #	define FUTURE_CHECKSUM	0xF07012E9
 #endif
 
+//! Declares a variable with one instance per thread
+#ifndef FUTURE_THREAD_LOCAL
+#	if defined(_MSC_VER)
+#		define FUTURE_THREAD_LOCAL __declspec(thread)
+#	else
+#		define FUTURE_THREAD_LOCAL __thread
+#	endif
+#endif
+
 //! Convert the argument into a string
 #ifndef TOSTRING
 #	define STRINGIFY(x)	#x
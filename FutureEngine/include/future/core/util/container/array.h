@@ -28,6 +28,15 @@
 #include <future/core/object/threadsafeobject.h>
 #include <future/core/memory/memory.h>
 
+// True for element types that can be moved with memcpy, arrays of these grow through FUTURE_REALLOC
+#ifndef FUTURE_IS_TRIVIALLY_COPYABLE
+#	if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1700)
+#		include <type_traits>
+#		define FUTURE_IS_TRIVIALLY_COPYABLE(T)	(std::is_trivially_copyable<T>::value)
+#	else
+#		define FUTURE_IS_TRIVIALLY_COPYABLE(T)	(__has_trivial_copy(T) && __has_trivial_destructor(T))
+#	endif
+#endif
 
 
 /*!
@@ -102,6 +111,7 @@ public:
 	u32 IndexOf(const T & t);
 
 	//! Expands the array until it is large enough to hold the specified number of elements. The array will most likely be larger than this.
+	//! Arrays of trivially copyable types are grown in place when the memory system can, without copying the elements.
 	void EnsureSize(u32 count);
 	
 	//! Reduces any extra space being used so the internal size of the array is exactly the size needed for the current number of elements.
@@ -152,6 +152,15 @@ void FutureArray< T >::Shrink()
 	m_allocated = m_size;
 
 	u32 bytes = m_allocated * sizeof(T);
+	if(FUTURE_IS_TRIVIALLY_COPYABLE(T))
+	{
+		T * aNew = static_cast<T *>(FUTURE_REALLOC(m_a, bytes, "FutureArray"));
+		FUTURE_ASSERT(aNew);
+		m_a = aNew;
+		Unlock();
+		return;
+	}
+
 	T * aNew = static_cast<T *>(FUTURE_ALLOC(bytes, "FutureArray"));
 	FUTURE_ASSERT(aNew);
 
@@ -328,6 +337,15 @@ void FutureArray< T >::EnsureSizeNoLock(u32 size)
 	}
 
 	u32 bytes = m_allocated * sizeof(T);
+	if(FUTURE_IS_TRIVIALLY_COPYABLE(T))
+	{
+		// the memory system extends the block in place if it can and only copies the bytes if it has to
+		T * aNew = static_cast<T *>(FUTURE_REALLOC(m_a, bytes, "FutureArray"));
+		FUTURE_ASSERT(aNew);
+		m_a = aNew;
+		return;
+	}
+
 	T * aNew = static_cast<T *>(FUTURE_ALLOC(bytes, "FutureArray"));
 	FUTURE_ASSERT(aNew);
 
@@ -0,0 +1,108 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+/*
+*	Contains an index from names to the ids 0 to count - 1, built once and then
+*	only read.
+*/
+
+#ifndef FUTURE_CORE_UTIL_NAMEINDEX_H
+#define FUTURE_CORE_UTIL_NAMEINDEX_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/memory.h>
+
+// Returned by Find when no id has the name
+#define FUTURE_NAME_INDEX_NULL		0xFFFFFFFF
+
+/*!
+ *	\brief		Finds ids by name in constant time
+ *
+ *	\details 	Every id has a 64 bit hash of its name and the index is an open addressing table of ids keyed by
+ *				those hashes, kept at most half full so a lookup touches a slot or two. The names themselves are
+ *				optional. When they are kept they are copied into one block owned by the index and a lookup
+ *				compares the name it lands on, when they aren't only the hashes are kept and a matching hash is
+ *				taken as a match. Two names in one index sharing a 64 bit hash is reported when it is built.
+ *
+ *				Set every name with SetName, or SetHash if only the hash is known, after Reset and before any
+ *				lookups. Once built the index is read only and can be read by any number of threads.
+ *
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		August 2013
+ */
+class FutureNameIndex
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureNameIndex);
+
+	//! FutureNameIndex Constructor, the index is empty
+	FutureNameIndex();
+	//! FutureNameIndex Destructor, frees the table and names
+	~FutureNameIndex();
+
+	//! The hash used for names, FNV-1a. Tools writing hashes for SetHash must use the same one
+	static u64		Hash(const char * name);
+
+	/*!	\brief		Empties the index and makes room for count ids
+	 *	\param[in]	count		The number of ids, ids go from 0 to count - 1
+	 *	\param[in]	storeNames	If true names passed to SetName are copied so Name can return them
+	 */
+	void			Reset(u32 count, bool storeNames);
+	//! Frees everything, the index is empty afterwards
+	void			Clear();
+
+	/*!	\brief		Adds an id to the index
+	 *	\param[in]	id		The id, less than the count the index was reset with
+	 *	\param[in]	name	The name of the id, NULL if it has no name
+	 *	\return		False if the name's hash is already used by another id
+	 */
+	bool			SetName(u32 id, const char * name);
+	//! Adds an id to the index by the hash of its name, Name returns NULL for it
+	bool			SetHash(u32 id, u64 hash);
+
+	/*!	\brief		Finds an id by name
+	 *	\return		The id, or FUTURE_NAME_INDEX_NULL if no id has the name
+	 */
+	u32				Find(const char * name) const;
+
+	//! Returns the name of an id, NULL if names aren't stored, the id has none or is out of range
+	const char *	Name(u32 id) const;
+
+	//! The number of ids the index was reset with
+	u32				Count() const
+	{ return m_count; }
+
+	//! Bytes used by the table, hashes and names
+	u32				MemoryUsage() const;
+
+protected:
+
+	// Places the id in the table, false if another id has the same hash
+	bool			Insert(u32 id, u64 hash);
+
+	u32			m_count;		//! The number of ids
+	u32			m_mask;			//! The number of slots minus one, the number of slots is a power of two
+	u32 *		m_slots;		//! The table, each slot holds an id plus one or 0 if it is empty
+	u64 *		m_hashes;		//! The hash of each id's name, 0 if the id has no name
+	u32 *		m_nameOffsets;	//! Where each id's name starts in m_names, NULL if names aren't stored
+	char *		m_names;		//! Every stored name one after another, each with its terminator
+	u32			m_namesSize;	//! Bytes used in m_names
+	u32			m_namesCapacity;//! Bytes allocated for m_names
+};
+
+#endif
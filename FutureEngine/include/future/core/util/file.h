@@ -149,4 +149,73 @@ private:
 #endif
 };
 
+
+/*!
+ *	\brief		Maps a whole file into memory for reading
+ *
+ *	\details 	Instead of copying the file into buffers with read calls the operating system maps the file's
+ *				pages straight into the address space. Nothing is read when the file is mapped, each page is
+ *				faulted in from the file cache the first time it is touched, and pages that are no longer needed
+ *				can be dropped by the system without being written anywhere. Data read from the mapping can be
+ *				used where it is without being copied, it stays valid until the file is unmapped.
+ *
+ *				The mapping is read only and can be read by any number of threads at once. Mapping is not
+ *				supported for Android assets, which live inside the package, so Map always fails there and
+ *				callers should fall back to FutureFile.
+ *	
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		August 2013
+ */
+class FutureMappedFile
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureMappedFile);
+
+	//! FutureMappedFile Constructor
+	FutureMappedFile();
+	//! FutureMappedFile Destructor, unmaps the file if it is still mapped
+	virtual	 ~FutureMappedFile();
+
+	/*!	\brief		Maps the file at the provided location
+	 *	\details	The file path provided should be relative to the current working directory, the same as
+	 *				FutureFile::OpenForRead. Empty files can't be mapped.
+	 *	\param[in]	file	The relative path to the file.
+	 *	\return		True if the file was mapped, false otherwise.
+	 */
+	bool		Map(const char * file);
+	//! Unmaps the file, any pointers into the mapping are invalid afterwards
+	void		Unmap();
+
+	//! Returns true if a file is currently mapped
+	bool		IsMapped() const
+	{ return m_data != NULL; }
+
+	//! The first byte of the file
+	const u8 *	Data() const
+	{ return m_data; }
+	//! The size of the file in bytes
+	u64			Size() const
+	{ return m_size; }
+
+	/*!	\brief		Asks the operating system to start reading a range of the file in the background
+	 *	\details	Touching a page that isn't in memory yet blocks on a read from the disk. Prefetching a range
+	 *				that is about to be used lets the reads happen ahead of time, and lets the system read a
+	 *				large range in a few big requests instead of one page at a time.
+	 *	\param[in]	offset	The byte offset into the file of the start of the range
+	 *	\param[in]	bytes	The size of the range in bytes
+	 */
+	void		Prefetch(u64 offset, u64 bytes) const;
+
+private:
+
+	const u8 *	m_data;		//! The start of the mapping, NULL if no file is mapped
+	u64			m_size;		//! The size of the mapping in bytes
+
+#if FUTURE_PLATFORM_WINDOWS
+	void *		m_file;		//! The handle of the mapped file
+	void *		m_mapping;	//! The handle of the file mapping object
+#endif
+};
+
 #endif
\ No newline at end of file
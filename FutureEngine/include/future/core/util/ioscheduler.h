@@ -0,0 +1,214 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+#ifndef FUTURE_CORE_UTIL_IOSCHEDULER_H
+#define FUTURE_CORE_UTIL_IOSCHEDULER_H
+
+#include <future/core/type/type.h>
+#include <future/core/memory/memory.h>
+#include <future/core/util/container/array.h>
+#include <future/core/thread/criticalsection/conditionvariable.h>
+#include <future/core/thread/pool/job.h>
+
+// Forward Declares
+class IFutureThread;
+struct FutureIORing;
+
+//! Reads are submitted through io_uring on Linux, one thread keeps a batch of them in flight.
+//! Kernels without io_uring, or builds that turn this off, fall back to FUTURE_IO_THREADS threads calling pread
+#ifndef FUTURE_ENABLE_IO_URING
+#	if FUTURE_ENABLE_MULTITHREADED && FUTURE_PLATFORM_LINUX
+#		define FUTURE_ENABLE_IO_URING 1
+#	else
+#		define FUTURE_ENABLE_IO_URING 0
+#	endif
+#endif
+
+// The number of threads blocking on reads when io_uring isn't used
+#ifndef FUTURE_IO_THREADS
+#	define FUTURE_IO_THREADS		2
+#endif
+
+// The number of reads the io_uring thread keeps in flight at once
+#ifndef FUTURE_IO_QUEUE_DEPTH
+#	define FUTURE_IO_QUEUE_DEPTH	64
+#endif
+
+// Bytes of caller data that can be stored in a read and handed back to its callback.
+// Goes into the completion job's payload next to the buffer and callback, so it has to leave room for them
+#define FUTURE_IO_PAYLOAD_SIZE		32
+
+// A file opened for the scheduler, an fd or a HANDLE depending on the platform
+typedef s64 FutureIOFile;
+#define FutureIOFile_NULL			((FutureIOFile)-1)
+
+/*!
+ *	\brief		Reads files in the background and hands the data to jobs on the thread pool
+ *
+ *	\details 	Reading in a thread pool job blocks one of the workers in the kernel for as long as the read
+ *				takes, and a batch of jobs reading at once hits the disk in whatever order the workers pick them
+ *				up. The scheduler keeps reads off the workers. Reads are queued with Read or ReadFile and
+ *				nothing happens until Submit is called, so a whole batch is sorted together. Higher priority
+ *				reads go first, reads of the same priority are ordered by file then offset so a batch of reads
+ *				from one archive sweeps through it front to back.
+ *
+ *				On Linux a single thread submits the reads through io_uring and keeps up to FUTURE_IO_QUEUE_DEPTH
+ *				of them in flight. Everywhere else, or if the kernel doesn't support io_uring, FUTURE_IO_THREADS
+ *				threads take reads off the queue and block on them. When a read finishes its callback is posted
+ *				to the thread pool as a job with the read's priority, so decoding the data happens on the workers
+ *				while the next reads are already in flight. Without a thread pool, or in a single threaded build,
+ *				the callback is called where the read finished.
+ *
+ *				Read, ReadFile and Submit can be called from any thread.
+ *
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		August 2013
+ */
+class FutureIOScheduler
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureIOScheduler);
+
+	/*!	\brief		Called on the thread pool once a read has finished
+	 *	\param[in]	buffer	The buffer the data was read into. NULL if the read was only to get the data into the
+	 *						file cache, or if a ReadFile failed. A buffer allocated by ReadFile belongs to the callback
+	 *						and must be freed with FUTURE_FREE
+	 *	\param[in]	bytes	The number of bytes that were read
+	 *	\param[in]	success	True if every requested byte was read
+	 *	\param[in]	payload	The copy of the payload passed in with the read, only valid during the callback
+	 */
+	typedef void (*ReadFinishedCallback)(void * buffer, u32 bytes, bool success, void * payload);
+
+	static void					CreateInstance();
+	//! Finishes every read that was submitted then stops the I/O threads
+	static void					DestroyInstance();
+	static FutureIOScheduler *	GetInstance();
+
+	/*!	\brief		Opens a file for reading through the scheduler
+	 *	\param[in]	file	The relative path to the file
+	 *	\param[out]	sizeOut	If not NULL, places the size of the file in bytes in sizeOut
+	 *	\return		The opened file, FutureIOFile_NULL if it couldn't be opened
+	 */
+	static FutureIOFile			OpenFile(const char * file, u64 * sizeOut = NULL);
+	//! Closes a file opened with OpenFile, every read of it must have finished
+	static void					CloseFile(FutureIOFile file);
+
+	/*!	\brief		Queues a read from an open file
+	 *	\param[in]	file			The file to read from
+	 *	\param[in]	offset			The byte offset in the file to start reading at
+	 *	\param[in]	bytes			The number of bytes to read
+	 *	\param[in]	buffer			Where to read to, must stay valid until the callback is called. If NULL nothing is
+	 *								read, the kernel is told the range will be needed so it is brought into the file
+	 *								cache in the background instead of being faulted in a page at a time through a mapping
+	 *	\param[in]	callback		Called on the thread pool once the read has finished, can be NULL
+	 *	\param[in]	payload			Copied into the read and passed to the callback
+	 *	\param[in]	payloadBytes	The size of the payload, no more than FUTURE_IO_PAYLOAD_SIZE
+	 *	\param[in]	priority		Orders the read against the rest of the queue and is the priority of the callback's job
+	 *	\return		True if the read was queued
+	 */
+	bool						Read(FutureIOFile file, u64 offset, u32 bytes, void * buffer, ReadFinishedCallback callback,
+									 const void * payload = NULL, u32 payloadBytes = 0,
+									 FutureThreadJob::FutureThreadJobPriority priority = FutureThreadJob::JobPriority_Normal);
+
+	/*!	\brief		Queues a read of a whole file
+	 *	\details	The file is opened straight away and closed once it has been read. The buffer is only allocated
+	 *				when the read is started, so a long queue of files doesn't hold their memory.
+	 *	\param[in]	file			The relative path to the file
+	 *	\param[in]	callback		Called on the thread pool with the file's data, the callback must free the buffer
+	 *	\param[in]	payload			Copied into the read and passed to the callback
+	 *	\param[in]	payloadBytes	The size of the payload, no more than FUTURE_IO_PAYLOAD_SIZE
+	 *	\param[in]	priority		Orders the read against the rest of the queue and is the priority of the callback's job
+	 *	\return		True if the file was opened and the read was queued
+	 */
+	bool						ReadFile(const char * file, ReadFinishedCallback callback, const void * payload = NULL, u32 payloadBytes = 0,
+										 FutureThreadJob::FutureThreadJobPriority priority = FutureThreadJob::JobPriority_Normal);
+
+	//! Sorts every read queued since the last Submit into the pending reads and wakes the I/O threads
+	void						Submit();
+
+	//! Submits anything queued then blocks until every read has finished and its callback has returned.
+	//! Must not be called from a thread pool job, the callbacks may need the worker it is blocking
+	void						WaitForIdle();
+
+	//! Returns true if reads are going through io_uring instead of threads blocking on them
+	bool						UsesIOUring() const
+	{ return m_ring != NULL; }
+
+	//! The number of reads that have been submitted and haven't finished, including their callbacks
+	u32							PendingRequests();
+
+protected:
+
+	FutureIOScheduler();
+	~FutureIOScheduler();
+
+	enum RequestFlags
+	{
+		Request_Advise		= 0x1,	// nothing is read, the range is only brought into the file cache
+		Request_OwnsBuffer	= 0x2,	// the buffer is allocated when the read starts and handed to the callback
+		Request_CloseFile	= 0x4,	// the file was opened by ReadFile and is closed when the read finishes
+	};
+
+	struct Request
+	{
+		FutureIOFile								m_file;
+		u64											m_offset;
+		void *										m_buffer;
+		u32											m_bytes;
+		u32											m_flags;
+		FutureThreadJob::FutureThreadJobPriority	m_priority;
+		ReadFinishedCallback						m_callback;
+		u64											m_payload[FUTURE_IO_PAYLOAD_SIZE / sizeof(u64)];
+	};
+
+	// The order reads are started in, pending reads are sorted so the next one is at the end
+	static int		CompareRequests(const void * a, const void * b);
+
+	// Takes the next read off the pending list, must be locked
+	void			PopRequest(Request * out);
+	// Allocates the buffer of a read that needs one, false if it couldn't be allocated
+	bool			PrepareRequest(Request * request);
+	// Asks the kernel to bring an advise request's range into the file cache, false if it couldn't be asked
+	bool			AdviseRequest(Request * request);
+	// Reads on the calling thread
+	void			PerformRequest(Request * request);
+	// Frees what the read doesn't need anymore and posts the callback
+	void			FinishRequest(Request * request, u32 bytesRead);
+	// Takes a read off m_outstanding once its callback has returned
+	void			RequestDone();
+
+	static void		ThreadMain(void * data);
+	static void		FinishedJob(void * data);
+
+#if FUTURE_ENABLE_IO_URING
+	bool			CreateRing();
+	void			DestroyRing();
+	static void		RingMain(void * data);
+#endif
+
+	FutureConditionVariable	m_condition;		//! Guards the lists below, signaled when reads are submitted or finish
+	FutureArray<Request>	m_queued;			//! Reads added since the last Submit
+	FutureArray<Request>	m_pending;			//! Submitted reads that haven't started
+	u32						m_outstanding;		//! Submitted reads that haven't finished or whose callbacks haven't returned
+	bool					m_stopping;			//! Set when the scheduler is destroyed, threads exit once the lists are empty
+	FutureIORing *			m_ring;				//! The io_uring the reads go through, NULL if they go through threads
+	IFutureThread *			m_threads[FUTURE_IO_THREADS];
+	u32						m_numThreads;
+};
+
+#endif
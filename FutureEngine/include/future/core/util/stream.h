@@ -23,6 +23,7 @@
 
 // Forward Declares
 class FutureFile;
+class FutureMappedFile;
 class IFutureThread;
 
 /*!
@@ -79,6 +80,27 @@ public:
 	 */
 	void	 	Skip(u32 bytes);
 
+	/*!	\brief		Returns a pointer to the next bytes in the stream without copying them
+	 *	\details	If the next bytes are all in the current buffer the stream moves past them and returns
+	 *				where they are in the buffer. Otherwise nothing is read and NULL is returned, the caller
+	 *				should fall back to Read. Memory and mapped streams hold their whole source in one buffer
+	 *				so this only fails at the end of the stream. The pointer is valid for as long as the
+	 *				buffer's source is, for a mapped stream until the file is unmapped, but for file streams
+	 *				only until the next read. The data is not aligned beyond what the writer made sure of.
+	 *	\param[in]	bytes	The number of bytes to read
+	 *	\return		A pointer to the bytes or NULL if they aren't all in the current buffer
+	 */
+	const void *	ReadInPlace(u32 bytes);
+	/*!	\brief		Reads a size prefixed array without copying it
+	 *	\details	The same as the Read*Array functions except that the elements are left where they are in
+	 *				the buffer, see ReadInPlace. If the array is not in the current buffer NULL is returned after
+	 *				the size prefix has been read, so the caller can still Read the elements itself.
+	 *	\param[in]	elementSize	The size in bytes of one element
+	 *	\param[out]	elementsOut	Places the total number of elements in the array in elementsOut
+	 *	\return		A pointer to the first element or NULL if the array isn't in the current buffer
+	 */
+	const void *	ReadArrayInPlace(u32 elementSize, u32 * elementsOut);
+
 	//!	Reads the next byte from the stream and returns it as a bool
     bool		ReadBool();
 	//!	Reads the next byte from the stream and returns it as an unsigned 8 bit value
@@ -299,7 +321,7 @@ protected:
 	void *			m_nextChunk;		//! A pointer to the chunk currently being read in
 
 	volatile bool	m_isEOF;			//! True if the end of the file was reached.
-	volatile bool	m_waitingForRead;	//! True if a chunk is currently being read
+	volatile s32	m_waitingForRead;	//! 1 while a chunk is being read, a counter so jobs can wait on it with FutureJobWait
 	volatile bool	m_waitingForBuffer;	//! True if the chunk has been read but the FutureBufferedInputStream has not requested it yet
 
 	bool			m_readAsync			//! True id the stream should read asynchronously
@@ -307,6 +329,65 @@ protected:
 };
 
 
+/*!
+ *	\brief		An Input Stream for reading data from a memory mapped file
+ *
+ *	\details 	Reads a file, or a range of one, through a FutureMappedFile. The whole range is handed to
+ *				FutureBufferedInputStream as one buffer so there are no read calls or copies into chunks, pages
+ *				are faulted in as the stream reaches them. Because the buffer is the mapping itself, ReadInPlace
+ *				and ReadArrayInPlace always succeed and the pointers they return stay valid after the stream is
+ *				closed, for as long as the file stays mapped. This lets resources point straight into the file
+ *				instead of copying their data.
+ *
+ *				Several streams can read different ranges of the same mapping on different threads, but each
+ *				stream should only ever be touched by one thread throughout it's entire life.
+ *	
+ *	\author		Lucas Stufflebeam
+ *	\version 	1.0
+ *	\date		August 2013
+ */
+class FutureMappedInputStream : public FutureBufferedInputStream
+{
+public:
+	FUTURE_DECLARE_MEMORY_OPERATORS(FutureMappedInputStream);
+
+	//! FutureMappedInputStream Constructor
+	FutureMappedInputStream();
+	//! FutureMappedInputStream Destructor
+	virtual ~FutureMappedInputStream();
+
+	/*!	\brief		Maps the provided file and opens a stream over all of it
+	 *	\details	The stream owns the mapping and unmaps the file when it is closed, so pointers read in place
+	 *				are only valid until then.
+	 *	\param[in]	file	The file name and location to read from
+	 *	\return		True if the file was mapped, false otherwise
+	 */
+	bool			Open(const char * file);
+	/*!	\brief		Opens a stream over a range of a file that is already mapped
+	 *	\details	The stream does not own the mapping, which must stay mapped until the stream is closed and
+	 *				for as long as any pointers read in place are used.
+	 *	\param[in]	file	The mapped file to read from
+	 *	\param[in]	offset	The byte offset into the file of the first byte of the stream
+	 *	\param[in]	size	The size of the stream in bytes, the range must be inside the file
+	 *	\return		True if the stream was opened successfully, false otherwise
+	 */
+	bool			Open(const FutureMappedFile * file, u64 offset, u32 size);
+	//! Closes the stream and unmaps the file if the stream mapped it
+	virtual void	Close();
+
+protected:
+
+	/*!	\brief		Sends the whole mapped range to the FutureBufferedInputStream
+	 *	\details	The first call hands over the range, any additional calls will do nothing.
+	 */
+	virtual void UpdateBuffer();
+
+	FutureMappedFile *	m_ownedFile;	//! The file mapped by Open(const char *), NULL if the mapping belongs to someone else
+	const u8 *			m_data;			//! The first byte of the range being read
+	u32					m_size;			//! The size in bytes of the range not yet handed to the buffer
+};
+
+
 
 
 /*!
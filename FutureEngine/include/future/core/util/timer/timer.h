@@ -44,6 +44,9 @@ public:
 	//! Returns the number of seconds that have passed since the start time
 	static f32	TimeSince(f32 start); 
 
+	//! Returns a monotonic time in nanoseconds, only useful for measuring short intervals
+	static u64	CurrentNanoseconds();
+
 	//! Converts milliseconds into seconds, everything should be handled in seconds
 	static f32	MilliToSeconds(s64 milliSeconds);
 	//! Converts seconds into milliseconds, everything should be handled in seconds
@@ -18,19 +18,28 @@
 #include <future/core/type/type.h>
 #include <future/core/config/coreconfig.h>
 #include <future/core/util/stream.h>
+#include <future/core/memory/memory.h>
+
+// Starts every config written with a version, configs from before versions start with FUTURE_CHECKSUM
+#define FUTURE_CORE_CONFIG_MARKER	(FUTURE_CHECKSUM ^ 0x00010000)
+// Settings are only ever added to the end of the config, each one bumps the version
+#define FUTURE_CORE_CONFIG_VERSION	3
 
 bool FutureCoreConfig::m_profileEnabled = FUTURE_DEBUG || FUTURE_PROFILE;
 bool FutureCoreConfig::m_trackMemory = FutureCoreConfig::m_profileEnabled;
 bool FutureCoreConfig::m_profileMemory = FutureCoreConfig::m_profileEnabled;
+u32 FutureCoreConfig::m_memorySampleInterval = 0;
 bool FutureCoreConfig::m_forceMemoryLimit = false;
 u32 FutureCoreConfig::m_memoryLimit = 0;
 u32 FutureCoreConfig::m_heapSize = 1024 * 1024 * 10;
+u32 FutureCoreConfig::m_frameArenaSize = 1024 * 1024;
 u32 FutureCoreConfig::m_numPools = 5;
 u32 * FutureCoreConfig::m_poolBlockSizes = {16, 32, 64, 128, 256};
 u32 * FutureCoreConfig::m_poolNumBlocks = {4096, 4096, 4096, 4096, 4096};
 bool FutureCoreConfig::m_multithreaded = FUTURE_ENABLE_MULTITHREADED == 1;
 bool FutureCoreConfig::m_profileThreadPool = FutureCoreConfig::m_profileEnabled;
 u8 FutureCoreConfig::m_defaultThreads = 6;
+FutureThreadAffinity FutureCoreConfig::m_threadAffinity = FutureThreadAffinity_None;
 bool FutureCoreConfig::m_asyncSystems = false;
 bool FutureCoreConfig::m_autoPopulate = true;
 bool FutureCoreConfig::m_eventDispatching = true;
@@ -43,37 +52,99 @@ bool FutureCoreConfig::m_searchResourceNames = false;
 
 bool FutureCoreConfig::LoadConfig(IFutureIStream * stream)
 {
+	u32 version = 0;
+	u32 marker = stream->ReadU32();
+	if(marker == FUTURE_CORE_CONFIG_MARKER)
+	{
+		version = stream->ReadU32();
+	}
+	else if(marker != FUTURE_CHECKSUM)
+	{
+		return false;
+	}
+	if(version > FUTURE_CORE_CONFIG_VERSION)
+	{
+		// the settings this doesn't know about can't be skipped
+		return false;
+	}
+
+	// everything is read into locals first, so a bad config doesn't leave the settings half overwritten
+	bool profileEnabled = stream->ReadBool();
+	bool trackMemory = stream->ReadBool();
+	bool profileMemory = stream->ReadBool();
+	bool forceMemoryLimit = stream->ReadBool();
+	u32 memoryLimit = stream->ReadU32();
+	u32 heapSize = stream->ReadU32();
+	u32 numPools = 0;
+	u32 * poolBlockSizes = stream->ReadU32Array(&numPools);
+	u32 * poolNumBlocks = stream->ReadU32Array(&numPools);
+	bool profileThreadPool = stream->ReadBool();
+	u8 defaultThreads = stream->ReadU8();
+	bool asyncSystems = stream->ReadBool();
+	bool autoPopulate = stream->ReadBool();
+	bool eventDispatching = stream->ReadBool();
+	bool eventPolling = stream->ReadBool();
+	bool eventAsync = stream->ReadBool();
+	Language language = (Language)stream->ReadU32();
+	bool storeResourceNames = stream->ReadBool();
+	bool searchResourceNames = stream->ReadBool();
+
+	// settings added after the first version keep their defaults when they aren't in the config
+	FutureThreadAffinity threadAffinity = m_threadAffinity;
+	u32 frameArenaSize = m_frameArenaSize;
+	u32 memorySampleInterval = m_memorySampleInterval;
+	if(version >= 1)
+	{
+		threadAffinity = (FutureThreadAffinity)stream->ReadU8();
+	}
+	if(version >= 2)
+	{
+		frameArenaSize = stream->ReadU32();
+	}
+	if(version >= 3)
+	{
+		memorySampleInterval = stream->ReadU32();
+	}
+
 	if(!stream->ReadCheckSum())
 	{
+		FUTURE_FREE(poolBlockSizes);
+		FUTURE_FREE(poolNumBlocks);
 		return false;
 	}
-	m_profileEnabled = stream->ReadBool();
-	m_trackMemory = stream->ReadBool();
-	m_profileMemory = stream->ReadBool();
-	m_forceMemoryLimit = stream->ReadBool();
-	m_memoryLimit = stream->ReadU32();
-	m_heapSize = stream->ReadU32();
-	m_poolBlockSizes = stream->ReadU32Array(&m_numPools);
-	m_poolNumBlocks = stream->ReadU32Array(&m_numPools);
-	m_profileThreadPool = stream->ReadBool();
-	m_defaultThreads = stream->ReadU8();
-	m_asyncSystems = stream->ReadBool();
-	m_autoPopulate = stream->ReadBool();
-	m_eventDispatching = stream->ReadBool();
-	m_eventPolling = stream->ReadBool();
-	m_eventAsync = stream->ReadBool();
-	m_language = (Language)stream->ReadU32();
-	m_storeResourceNames = stream->ReadBool();
-	m_searchResourceNames = stream->ReadBool();
-	return stream->ReadCheckSum();
+
+	m_profileEnabled = profileEnabled;
+	m_trackMemory = trackMemory;
+	m_profileMemory = profileMemory;
+	m_memorySampleInterval = memorySampleInterval;
+	m_forceMemoryLimit = forceMemoryLimit;
+	m_memoryLimit = memoryLimit;
+	m_heapSize = heapSize;
+	m_frameArenaSize = frameArenaSize;
+	m_numPools = numPools;
+	m_poolBlockSizes = poolBlockSizes;
+	m_poolNumBlocks = poolNumBlocks;
+	m_profileThreadPool = profileThreadPool;
+	m_defaultThreads = defaultThreads;
+	m_threadAffinity = threadAffinity;
+	m_asyncSystems = asyncSystems;
+	m_autoPopulate = autoPopulate;
+	m_eventDispatching = eventDispatching;
+	m_eventPolling = eventPolling;
+	m_eventAsync = eventAsync;
+	m_language = language;
+	m_storeResourceNames = storeResourceNames;
+	m_searchResourceNames = searchResourceNames;
+	return true;
 }
 
 bool FutureCoreConfig::DumpConfig(IFutureOStream * stream)
 {
-	if(!stream->WriteCheckSum())
+	if(!stream->Write((u32)FUTURE_CORE_CONFIG_MARKER))
 	{
 		return false;
 	}
+	stream->Write((u32)FUTURE_CORE_CONFIG_VERSION);
 	stream->Write(m_profileEnabled);
 	stream->Write(m_trackMemory);
 	stream->Write(m_profileMemory);
@@ -92,6 +163,12 @@ bool FutureCoreConfig::DumpConfig(IFutureOStream * stream)
 	stream->Write((u32)m_language);
 	stream->Write(m_storeResourceNames);
 	stream->Write(m_searchResourceNames);
+	// version 1
+	stream->Write((u8)m_threadAffinity);
+	// version 2
+	stream->Write(m_frameArenaSize);
+	// version 3
+	stream->Write(m_memorySampleInterval);
 	return stream->WriteCheckSum();
 }
 
@@ -0,0 +1,275 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureTrace
+*/
+
+#include <future/core/debug/trace.h>
+#include <future/core/debug/debug.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/util/stream.h>
+#include <future/core/utils/timer/timer.h>
+#include <stdio.h>
+#include <string.h>
+
+struct FutureTraceEvent
+{
+	const char *	m_name;
+	u64				m_startTime;
+	u64				m_duration;
+	u64				m_arg;
+	bool			m_hasArg;
+};
+
+// One per thread that has recorded an event, only the owning thread writes to it
+struct FutureTraceBuffer
+{
+	FutureTraceBuffer *		m_next;
+	const char * volatile	m_threadName;
+	u32						m_threadId;
+	volatile s64			m_count;	// events ever recorded, the next goes in m_count % FUTURE_TRACE_EVENTS_PER_THREAD
+	volatile s64			m_cleared;	// events before this were thrown away by Clear
+	FutureTraceEvent		m_events[FUTURE_TRACE_EVENTS_PER_THREAD];
+};
+
+volatile bool FutureTrace::ms_enabled = false;
+
+// Every buffer ever created, freed on Shutdown
+static void * volatile		s_buffers = NULL;
+static volatile s32			s_numBuffers = 0;
+// Bumped on Shutdown so threads drop buffers that no longer exist
+static volatile s32			s_generation = 0;
+// Timestamps in the trace are relative to this
+static volatile s64			s_epoch = 0;
+
+static FUTURE_THREAD_LOCAL FutureTraceBuffer *	s_threadBuffer = NULL;
+static FUTURE_THREAD_LOCAL s32					s_threadGeneration = 0;
+static FUTURE_THREAD_LOCAL const char *			s_threadName = NULL;
+static FUTURE_THREAD_LOCAL bool					s_creatingBuffer = false;
+
+static FutureTraceBuffer * FutureGetTraceBuffer()
+{
+	s32 generation = FutureAtomicLoad(&s_generation);
+	if(s_threadBuffer && s_threadGeneration == generation)
+	{
+		return s_threadBuffer;
+	}
+	// allocating the buffer can hit a traced allocator slow path
+	if(s_creatingBuffer)
+	{
+		return NULL;
+	}
+
+	s_creatingBuffer = true;
+	FutureTraceBuffer * buffer = (FutureTraceBuffer*)FUTURE_ALLOC(sizeof(FutureTraceBuffer), "FutureTrace buffer");
+	s_creatingBuffer = false;
+	if(!buffer)
+	{
+		return NULL;
+	}
+	buffer->m_threadName = s_threadName;
+	buffer->m_threadId = (u32)FutureAtomicIncrement(&s_numBuffers);
+	buffer->m_count = 0;
+	buffer->m_cleared = 0;
+	while(true)
+	{
+		void * head = FutureAtomicLoadPtr(&s_buffers);
+		buffer->m_next = (FutureTraceBuffer*)head;
+		if(FutureAtomicCompareExchangePtr(&s_buffers, head, buffer))
+		{
+			break;
+		}
+	}
+
+	s_threadBuffer = buffer;
+	s_threadGeneration = generation;
+	return buffer;
+}
+
+// Copies text into out as the inside of a JSON string, returns the length written
+static u32 FutureTraceEscape(const char * text, char * out, u32 size)
+{
+	u32 length = 0;
+	for(; *text && length + 7 < size; ++text)
+	{
+		char c = *text;
+		if(c == '"' || c == '\\')
+		{
+			out[length++] = '\\';
+			out[length++] = c;
+		}
+		else if((u8)c < 0x20)
+		{
+			length += (u32)snprintf(out + length, size - length, "\\u%04x", (u32)(u8)c);
+		}
+		else
+		{
+			out[length++] = c;
+		}
+	}
+	out[length] = 0;
+	return length;
+}
+
+void FutureTrace::SetEnabled(bool enabled)
+{
+	if(enabled)
+	{
+		FutureAtomicCompareExchange(&s_epoch, 0, (s64)FutureTimer::CurrentNanoseconds());
+	}
+	ms_enabled = enabled;
+}
+
+void FutureTrace::Record(const char * name, u64 startTime, u64 endTime, u64 arg, bool hasArg)
+{
+	FutureTraceBuffer * buffer = FutureGetTraceBuffer();
+	if(!buffer)
+	{
+		return;
+	}
+
+	s64 count = buffer->m_count;
+	FutureTraceEvent & event = buffer->m_events[count & (FUTURE_TRACE_EVENTS_PER_THREAD - 1)];
+	event.m_name = name;
+	event.m_startTime = startTime;
+	event.m_duration = endTime - startTime;
+	event.m_arg = arg;
+	event.m_hasArg = hasArg;
+	// publish the event
+	FutureAtomicStore(&buffer->m_count, count + 1);
+}
+
+void FutureTrace::SetThreadName(const char * name)
+{
+	s_threadName = name;
+	if(s_threadBuffer && s_threadGeneration == FutureAtomicLoad(&s_generation))
+	{
+		s_threadBuffer->m_threadName = name;
+	}
+}
+
+bool FutureTrace::Dump(FutureBufferedOutputStream * stream)
+{
+	FUTURE_ASSERT_MSG((FUTURE_TRACE_EVENTS_PER_THREAD & (FUTURE_TRACE_EVENTS_PER_THREAD - 1)) == 0, L"FUTURE_TRACE_EVENTS_PER_THREAD must be a power of two");
+
+	s64 epoch = FutureAtomicLoad(&s_epoch);
+	char line[512];
+	char name[256];
+	bool result = true;
+	bool first = true;
+
+	const char * header = "{\"traceEvents\":[\n";
+	result &= stream->Write(header, (u32)strlen(header));
+
+	for(FutureTraceBuffer * buffer = (FutureTraceBuffer*)FutureAtomicLoadPtr(&s_buffers); buffer; buffer = buffer->m_next)
+	{
+		const char * threadName = buffer->m_threadName;
+		if(threadName)
+		{
+			FutureTraceEscape(threadName, name, sizeof(name));
+			u32 length = (u32)snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", buffer->m_threadId, name);
+			result &= stream->Write(line, length);
+			first = false;
+		}
+
+		s64 count = FutureAtomicLoad(&buffer->m_count);
+		s64 begin = FutureAtomicLoad(&buffer->m_cleared);
+		if(count - begin > FUTURE_TRACE_EVENTS_PER_THREAD)
+		{
+			begin = count - FUTURE_TRACE_EVENTS_PER_THREAD;
+		}
+		for(s64 i = begin; i < count; ++i)
+		{
+			FutureTraceEvent event = buffer->m_events[i & (FUTURE_TRACE_EVENTS_PER_THREAD - 1)];
+			if(!event.m_name)
+			{
+				continue;
+			}
+			FutureTraceEscape(event.m_name, name, sizeof(name));
+			// chrome wants microseconds
+			f64 start = (f64)((s64)event.m_startTime - epoch) / 1000.0;
+			f64 duration = (f64)event.m_duration / 1000.0;
+			u32 length = (u32)snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"future\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+				first ? "" : ",\n", name, start, duration, buffer->m_threadId);
+			if(event.m_hasArg)
+			{
+				length += (u32)snprintf(line + length, sizeof(line) - length, ",\"args\":{\"id\":%llu}", (unsigned long long)event.m_arg);
+			}
+			line[length++] = '}';
+			result &= stream->Write(line, length);
+			first = false;
+		}
+	}
+
+	const char * footer = "\n]}\n";
+	result &= stream->Write(footer, (u32)strlen(footer));
+	return result;
+}
+
+void FutureTrace::Clear()
+{
+	for(FutureTraceBuffer * buffer = (FutureTraceBuffer*)FutureAtomicLoadPtr(&s_buffers); buffer; buffer = buffer->m_next)
+	{
+		FutureAtomicStore(&buffer->m_cleared, FutureAtomicLoad(&buffer->m_count));
+	}
+}
+
+void FutureTrace::Shutdown()
+{
+	FutureAtomicIncrement(&s_generation);
+
+	FutureTraceBuffer * buffer = (FutureTraceBuffer*)FutureAtomicExchangePtr(&s_buffers, NULL);
+	while(buffer)
+	{
+		FutureTraceBuffer * next = buffer->m_next;
+		FUTURE_FREE(buffer);
+		buffer = next;
+	}
+	FutureAtomicStore(&s_numBuffers, 0);
+	s_threadBuffer = NULL;
+}
+
+u32 FutureTrace::EventCount()
+{
+	s64 events = 0;
+	for(FutureTraceBuffer * buffer = (FutureTraceBuffer*)FutureAtomicLoadPtr(&s_buffers); buffer; buffer = buffer->m_next)
+	{
+		s64 count = FutureAtomicLoad(&buffer->m_count);
+		s64 begin = FutureAtomicLoad(&buffer->m_cleared);
+		events += count - begin < FUTURE_TRACE_EVENTS_PER_THREAD ? count - begin : FUTURE_TRACE_EVENTS_PER_THREAD;
+	}
+	return (u32)events;
+}
+
+void FutureTraceScope::Begin(const char * name, u64 arg, bool hasArg)
+{
+	m_name = name;
+	m_arg = arg;
+	m_hasArg = hasArg;
+	m_startTime = FutureTimer::CurrentNanoseconds();
+}
+
+void FutureTraceScope::End()
+{
+	FutureTrace::Record(m_name, m_startTime, FutureTimer::CurrentNanoseconds(), m_arg, m_hasArg);
+}
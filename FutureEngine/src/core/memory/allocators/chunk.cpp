@@ -0,0 +1,158 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+
+/*
+*	Implementation of FutureMemoryChunk
+*
+*	The chunk map is indexed by address >> FUTURE_MEMORY_CHUNK_SHIFT. The root level is a static
+*	array, leaves are allocated the first time a chunk lands in their part of the address space
+*	and are never freed. Leaves are published with a compare exchange and slots are written with
+*	atomic stores, so chunks can be created and destroyed on any thread while others look them up.
+*/
+
+#include <future/core/debug/debug.h>
+#include <future/core/memory/allocators/allocator.h>
+#include <future/core/memory/allocators/chunk.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <string.h>
+
+// Bits of a user space address
+#ifdef FUTURE_X64
+#	define FUTURE_CHUNK_ADDRESS_BITS	48
+#else
+#	define FUTURE_CHUNK_ADDRESS_BITS	32
+#endif
+
+#define FUTURE_CHUNK_KEY_BITS	(FUTURE_CHUNK_ADDRESS_BITS - FUTURE_MEMORY_CHUNK_SHIFT)
+#define FUTURE_CHUNK_LEAF_BITS	16
+#define FUTURE_CHUNK_ROOT_BITS	(FUTURE_CHUNK_KEY_BITS - FUTURE_CHUNK_LEAF_BITS)
+#define FUTURE_CHUNK_LEAF_SIZE	(1 << FUTURE_CHUNK_LEAF_BITS)
+#define FUTURE_CHUNK_ROOT_SIZE	(1 << FUTURE_CHUNK_ROOT_BITS)
+
+static void * volatile	s_chunkMap[FUTURE_CHUNK_ROOT_SIZE];
+
+// Returns the slot for an address, creating its leaf if create is true
+static void * volatile * FutureChunkSlot(size_t address, bool create)
+{
+	size_t key = address >> FUTURE_MEMORY_CHUNK_SHIFT;
+	size_t root = key >> FUTURE_CHUNK_LEAF_BITS;
+	if(root >= FUTURE_CHUNK_ROOT_SIZE)
+	{
+		return NULL;
+	}
+
+	void * volatile * leaf = (void * volatile *)FutureAtomicLoadPtr(&s_chunkMap[root]);
+	if(!leaf && create)
+	{
+		void * newLeaf = malloc(sizeof(void*) * FUTURE_CHUNK_LEAF_SIZE);
+		if(!newLeaf)
+		{
+			return NULL;
+		}
+		memset(newLeaf, 0, sizeof(void*) * FUTURE_CHUNK_LEAF_SIZE);
+		if(!FutureAtomicCompareExchangePtr(&s_chunkMap[root], NULL, newLeaf))
+		{
+			// another thread created it first
+			free(newLeaf);
+		}
+		leaf = (void * volatile *)FutureAtomicLoadPtr(&s_chunkMap[root]);
+	}
+	if(!leaf)
+	{
+		return NULL;
+	}
+	return &leaf[key & (FUTURE_CHUNK_LEAF_SIZE - 1)];
+}
+
+// Points every slot covered by the chunk at value
+static bool FutureChunkRegister(FutureMemoryChunk * chunk, FutureMemoryChunk * value)
+{
+	for(size_t address = (size_t)chunk; address < (size_t)chunk->End(); address += FUTURE_MEMORY_CHUNK_SIZE)
+	{
+		void * volatile * slot = FutureChunkSlot(address, value != NULL);
+		if(slot)
+		{
+			FutureAtomicStorePtr(slot, value);
+		}
+		else if(value)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+FutureMemoryChunk * FutureMemoryChunk::Create(IFutureAllocator * owner, u32 bytes, IFutureAllocator * backing)
+{
+	FUTURE_ASSERT(owner != NULL);
+
+	size_t size = (size_t)bytes + FUTURE_MEMORY_CHUNK_HEADER_SIZE;
+	size = (size + FUTURE_MEMORY_CHUNK_SIZE - 1) & ~(size_t)(FUTURE_MEMORY_CHUNK_SIZE - 1);
+	if(size > 0xFFFFFFFF - FUTURE_MEMORY_CHUNK_SIZE)
+	{
+		FUTURE_LOG_ERROR(L"Memory chunk of %u bytes is too large", bytes);
+		return NULL;
+	}
+
+	FutureMemoryChunk * chunk = (FutureMemoryChunk*)(backing ? backing->AllocAligned((u32)size, FUTURE_MEMORY_CHUNK_SIZE) : _aligned_malloc(size, FUTURE_MEMORY_CHUNK_SIZE));
+	if(chunk == NULL)
+	{
+		FUTURE_LOG_ERROR(L"Failed to allocate a memory chunk of %u bytes", (u32)size);
+		return NULL;
+	}
+	chunk->m_owner = owner;
+	chunk->m_next = NULL;
+	chunk->m_backing = backing;
+	chunk->m_size = (u32)size;
+	chunk->m_sizeClass = FUTURE_NO_SIZE_CLASS;
+
+	if(!FutureChunkRegister(chunk, chunk))
+	{
+		FUTURE_LOG_ERROR(L"Failed to register a memory chunk");
+		Destroy(chunk);
+		return NULL;
+	}
+	return chunk;
+}
+
+void FutureMemoryChunk::Destroy(FutureMemoryChunk * chunk)
+{
+	if(chunk == NULL)
+	{
+		return;
+	}
+	FutureChunkRegister(chunk, NULL);
+	if(chunk->m_backing)
+	{
+		chunk->m_backing->Free(chunk);
+	}
+	else
+	{
+		_aligned_free(chunk);
+	}
+}
+
+FutureMemoryChunk * FutureMemoryChunk::Find(const void * p)
+{
+	void * volatile * slot = FutureChunkSlot((size_t)p, false);
+	if(!slot)
+	{
+		return NULL;
+	}
+	return (FutureMemoryChunk*)FutureAtomicLoadPtr(slot);
+}
@@ -0,0 +1,243 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+/*
+*	Implementation of FutureFrameAllocator
+*/
+
+#include <future/core/memory/allocators/frameallocator.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/debug/debug.h>
+#include <new>
+
+static FutureFrameAllocator *	s_instance = NULL;
+// Bumped when the frame allocator is destroyed so threads drop arenas that no longer exist
+static volatile s32				s_generation = 0;
+
+static FUTURE_THREAD_LOCAL FutureFrameArena *	s_threadArena = NULL;
+static FUTURE_THREAD_LOCAL s32					s_threadGeneration = 0;
+
+// A single thread's stack
+struct FutureFrameArena
+{
+	FutureFrameArena(FutureFrameAllocator * allocator, s32 frame)
+		: m_stack(allocator->m_stackSize, allocator),
+		  m_frame(frame),
+		  m_orphaned(0),
+		  m_next(NULL)
+	{}
+
+	// Gives the calling thread an arena another thread has finished with or creates a new one
+	static FutureFrameArena * Acquire(FutureFrameAllocator * allocator)
+	{
+		s32 frame = FutureAtomicLoad(&allocator->m_frame);
+
+		FutureFrameArena * arena = NULL;
+		for(FutureFrameArena * a = (FutureFrameArena*)FutureAtomicLoadPtr(&allocator->m_arenas); a; a = a->m_next)
+		{
+			if(FutureAtomicLoad(&a->m_orphaned) && FutureAtomicCompareExchange(&a->m_orphaned, 1, 0))
+			{
+				arena = a;
+				break;
+			}
+		}
+
+		if(!arena)
+		{
+			void * memory = _aligned_malloc(sizeof(FutureFrameArena), 16);
+			FUTURE_ASSERT_CRIT(memory != NULL, 9869);
+			arena = new(memory) FutureFrameArena(allocator, frame);
+			while(true)
+			{
+				void * head = FutureAtomicLoadPtr(&allocator->m_arenas);
+				arena->m_next = (FutureFrameArena*)head;
+				if(FutureAtomicCompareExchangePtr(&allocator->m_arenas, head, arena))
+				{
+					break;
+				}
+			}
+		}
+
+		s_threadArena = arena;
+		s_threadGeneration = FutureAtomicLoad(&s_generation);
+		return arena;
+	}
+
+	FutureStackAllocator	m_stack;
+	// the frame m_stack was last reset for, only touched by the owning thread
+	s32						m_frame;
+	// 1 while no thread owns this arena
+	volatile s32			m_orphaned;
+	FutureFrameArena *		m_next;
+};
+
+/*******************************************************************/
+// Frame Allocator
+
+FutureFrameAllocator * FutureFrameAllocator::GetInstance()
+{
+	return s_instance;
+}
+
+void FutureFrameAllocator::ReleaseThread()
+{
+	FutureFrameArena * arena = s_threadArena;
+	if(!arena || s_threadGeneration != FutureAtomicLoad(&s_generation))
+	{
+		return;
+	}
+	s_threadArena = NULL;
+	FutureAtomicExchange(&arena->m_orphaned, 1);
+}
+
+FutureFrameAllocator::FutureFrameAllocator(u32 stackSize)
+	: m_stackSize(stackSize),
+	  m_frame(0),
+	  m_arenas(NULL)
+{
+	FUTURE_ASSERT_MSG(s_instance == NULL, L"Only one frame allocator can exist at a time");
+	s_instance = this;
+}
+
+FutureFrameAllocator::~FutureFrameAllocator()
+{
+	FutureAtomicIncrement(&s_generation);
+
+	FutureFrameArena * arena = (FutureFrameArena*)FutureAtomicExchangePtr(&m_arenas, NULL);
+	while(arena)
+	{
+		FutureFrameArena * next = arena->m_next;
+		arena->~FutureFrameArena();
+		_aligned_free(arena);
+		arena = next;
+	}
+	s_threadArena = NULL;
+	if(s_instance == this)
+	{
+		s_instance = NULL;
+	}
+}
+
+void * FutureFrameAllocator::Alloc(u32 bytes)
+{
+	return GetArena()->m_stack.Alloc(bytes);
+}
+
+void * FutureFrameAllocator::AllocAligned(u32 bytes, u32 alignment)
+{
+	return GetArena()->m_stack.AllocAligned(bytes, alignment);
+}
+
+void FutureFrameAllocator::Free(void * p)
+{
+}
+
+u8 FutureFrameAllocator::Priority()
+{
+	return 255;
+}
+
+bool FutureFrameAllocator::ShouldAllocate(FutureMemoryParam memParam)
+{
+	return false;
+}
+
+bool FutureFrameAllocator::TrackAllocations()
+{
+	return false;
+}
+
+bool FutureFrameAllocator::UsesChunks()
+{
+	return true;
+}
+
+void FutureFrameAllocator::EndFrame()
+{
+	FutureAtomicIncrement(&m_frame);
+}
+
+s32 FutureFrameAllocator::Frame()
+{
+	return FutureAtomicLoad(&m_frame);
+}
+
+FutureFrameMarker FutureFrameAllocator::GetMarker()
+{
+	FutureFrameArena * arena = GetArena();
+	FutureFrameMarker marker;
+	marker.m_marker = arena->m_stack.GetMarker();
+	marker.m_frame = arena->m_frame;
+	marker.m_arena = arena;
+	return marker;
+}
+
+void FutureFrameAllocator::FreeToMarker(const FutureFrameMarker & marker)
+{
+	FutureFrameArena * arena = GetArena();
+	// rewinding another thread's offset in this arena would free allocations that are still in use
+	if(arena != marker.m_arena)
+	{
+		FUTURE_ASSERT_MSG(false, L"Frame marker freed on a different thread than it was taken on");
+		return;
+	}
+	// the arena was reset since the marker was taken, everything after it is already gone
+	if(arena->m_frame != marker.m_frame)
+	{
+		return;
+	}
+	arena->m_stack.FreeToMarker(marker.m_marker);
+}
+
+u32 FutureFrameAllocator::BytesUsed()
+{
+	return GetArena()->m_stack.BytesUsed();
+}
+
+FutureFrameArena * FutureFrameAllocator::GetArena()
+{
+	FutureFrameArena * arena = s_threadArena;
+	if(!arena || s_threadGeneration != FutureAtomicLoad(&s_generation))
+	{
+		arena = FutureFrameArena::Acquire(this);
+	}
+
+	// the first use of the arena since the frame ended releases the last frame's memory
+	s32 frame = FutureAtomicLoad(&m_frame);
+	if(arena->m_frame != frame)
+	{
+		arena->m_stack.Reset();
+		arena->m_frame = frame;
+	}
+	return arena;
+}
+
+/*******************************************************************/
+// Scoped Arena Marker
+
+FutureScopedArenaMarker::FutureScopedArenaMarker(FutureFrameAllocator * allocator)
+	: m_allocator(allocator)
+{
+	FUTURE_ASSERT(m_allocator != NULL);
+	m_marker = m_allocator->GetMarker();
+}
+
+FutureScopedArenaMarker::~FutureScopedArenaMarker()
+{
+	m_allocator->FreeToMarker(m_marker);
+}
@@ -17,36 +17,112 @@
 
 
 /*
-*	Implementation of FutureHeapAllocator
+*	Implementation of FutureHeapAllocator, a two level segregated fit allocator
+*	following "TLSF: a New Dynamic Memory Allocator for Real-Time Systems"
+*	(Masmano, Ripoll, Crespo, Real)
 */
 
 #include <future/core/debug/debug.h>
+#include <future/core/debug/trace.h>
 #include <future/core/memory/allocators/heapallocator.h>
-#include <future/core/memory/allocators/poolallocator.h>
+#include <future/core/memory/allocators/virtualallocator.h>
 #include <future/core/memory/memory.h>
+#include <future/core/memory/memoryStatistics.h>
 #include <future/core/memory/tracker/memorytracker.h>
 
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+#define FUTURE_HEAP_ALIGN			(1 << FUTURE_HEAP_ALIGN_LOG2)
+// Sizes below this are mapped linearly into the first level
+#define FUTURE_HEAP_SMALL_BLOCK		(1 << FUTURE_HEAP_FL_SHIFT)
+// Bytes in front of the data when the allocator adds its own tag
+#define FUTURE_HEAP_TAG_SIZE		16
+// A free block must hold its tag, both free list links and the size at its end
+#define FUTURE_HEAP_MIN_BLOCK		32
+// The heap descriptor is padded so the first block stays aligned
+#define FUTURE_HEAP_REGION_HEADER	16
+
+#define FUTURE_HEAP_BLOCK_FREE		0x1
+#define FUTURE_HEAP_PREV_FREE		0x2
+#define FUTURE_HEAP_FLAGS			(FUTURE_HEAP_BLOCK_FREE | FUTURE_HEAP_PREV_FREE)
+
+// index of the lowest set bit, value must not be 0
+inline static u32 FutureHeapLowestBit(u32 value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return (u32)index;
+#else
+	return (u32)__builtin_ctz(value);
+#endif
+}
+
+// index of the highest set bit, value must not be 0
+inline static u32 FutureHeapHighestBit(u32 value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return (u32)index;
+#else
+	return 31 - (u32)__builtin_clz(value);
+#endif
+}
+
+// The free list a block of size bytes belongs in
+inline static void FutureHeapMapping(u32 size, u32 & fl, u32 & sl)
+{
+	if(size < FUTURE_HEAP_SMALL_BLOCK)
+	{
+		fl = 0;
+		sl = size >> FUTURE_HEAP_ALIGN_LOG2;
+	}
+	else
+	{
+		u32 high = FutureHeapHighestBit(size);
+		sl = (size >> (high - FUTURE_HEAP_SL_LOG2)) ^ FUTURE_HEAP_SL_COUNT;
+		fl = high - FUTURE_HEAP_FL_SHIFT + 1;
+	}
+}
+
 /*******************************************************************/
 // Heap Allocator
 
-FutureHeapAllocator::FutureHeapAllocator(u32 heapSize, bool usingHeaders)
+FutureHeapAllocator::FutureHeapAllocator(u32 heapSize, bool usingHeaders, FutureVirtualAllocator * backing)
 	: m_heapSize(heapSize),
 	  m_heaps(NULL),
-	  m_usingHeaders(usingHeaders)
+	  m_usingHeaders(usingHeaders),
+	  m_backing(backing),
+	  m_flBitmap(0)
 {
 	FUTURE_ASSERT(m_heapSize > 0);
 	
 	if(!m_usingHeaders)
 	{
-		m_heapSize += 16;
+		m_heapSize += FUTURE_HEAP_TAG_SIZE;
 	}
-	u32 r = m_heapSize % 16;
+	u32 r = m_heapSize % FUTURE_HEAP_ALIGN;
 	if(r != 0)
 	{
-		m_heapSize = m_heapSize + 16 - r;
+		m_heapSize = m_heapSize + FUTURE_HEAP_ALIGN - r;
+	}
+	if(m_heapSize < FUTURE_HEAP_MIN_BLOCK)
+	{
+		m_heapSize = FUTURE_HEAP_MIN_BLOCK;
+	}
+
+	for(u32 fl = 0; fl < FUTURE_HEAP_FL_COUNT; ++fl)
+	{
+		m_slBitmap[fl] = 0;
+		for(u32 sl = 0; sl < FUTURE_HEAP_SL_COUNT; ++sl)
+		{
+			m_freeLists[fl][sl] = NULL;
+		}
 	}
 
-	m_poolAllocator = new FuturePoolAllocator(sizeof(Heap), 1024, false);
 	AddHeap();
 }
 
@@ -54,187 +130,216 @@ FutureHeapAllocator::~FutureHeapAllocator()
 {
 	for(Heap * heap = m_heaps; heap; )
 	{
-		for(Block * block = heap->m_freeBlocks; block;)
+		Heap * next = heap->m_next;
+		if(m_backing)
 		{
-			Block * nextBlock = block->m_next;
-			m_poolAllocator->Free(block);
-			block = nextBlock;
+			m_backing->Free(heap);
 		}
-		if(heap->m_data)
+		else
 		{
-			_aligned_free(heap->m_data);
+			_aligned_free(heap);
 		}
-		Heap * next = heap->m_next;
-		m_poolAllocator->Free(heap);
 		heap = next;
 	}
 	m_heaps = NULL;
-	m_poolAllocator->Release();
-	delete m_poolAllocator;
-	m_poolAllocator = NULL;
 }
 
 void * FutureHeapAllocator::Alloc(u32 bytes)
 {
-	if(!m_usingHeaders)
-	{
-		bytes += sizeof(u32);
-	}
-	FUTURE_ASSERT_CRIT(bytes <= m_heapSize, 9875);
+	return AllocAligned(bytes, FUTURE_HEAP_ALIGN);
+}
+
+void * FutureHeapAllocator::AllocAligned(u32 bytes, u32 alignment)
+{
+	FUTURE_ASSERT_MSG((alignment & (alignment - 1)) == 0, L"Alignment must be a power of two");
+	// the returned pointer is this far into its block
+	u32 offset = m_usingHeaders ? 0 : FUTURE_HEAP_TAG_SIZE;
+	bytes += offset;
 	// keep the heap aligned	
-	u32 r = bytes % 16;
+	u32 r = bytes % FUTURE_HEAP_ALIGN;
 	if(r != 0)
 	{
-		bytes = bytes + 16 - r;
+		bytes = bytes + FUTURE_HEAP_ALIGN - r;
 	}
-
-	Block * block = NULL;
-	Block * blockPrev = NULL;
-	Heap * heap = NULL;
-	u32 dif = m_heapSize;
+	if(bytes < FUTURE_HEAP_MIN_BLOCK)
+	{
+		bytes = FUTURE_HEAP_MIN_BLOCK;
+	}
+	// blocks are always aligned to FUTURE_HEAP_ALIGN, a larger alignment needs a block big enough
+	// to split a free block off its front that moves the rest to an aligned address
+	u32 padding = alignment > FUTURE_HEAP_ALIGN ? alignment + FUTURE_HEAP_MIN_BLOCK : 0;
+	FUTURE_ASSERT_CRIT(bytes + padding <= m_heapSize, 9875);
 
 	Lock();
 
-	// Loop through all current blocks and find the smallest block with enough room
-	// for our object
-	for(heap = m_heaps; heap; heap = heap->m_next)
+	Block * block = FindFreeBlock(bytes + padding);
+	if(!block)
 	{
-		blockPrev = NULL;
-		Block * last = NULL;
-		for(Block * checkBlock = heap->m_freeBlocks; checkBlock; checkBlock = checkBlock->m_next)
-		{
-			if(checkBlock->m_size >= bytes)
-			{
-				u32 d = checkBlock->m_size - bytes;
-				if(d < dif)
-				{
-					block = checkBlock;
-					blockPrev = last;
-					dif = d;
-					if(dif == 0)
-					{
-						break;
-					}
-				}
-			}
-			last = block;
-		}
-		if(block)
+		FUTURE_LOG_WARNING(L"Heap is full, expanding");
+		// a new heap is a single free block that fits any request up to the heap size
+		block = AddHeap();
+		if(!block)
 		{
-			break;
+			Unlock();
+			return NULL;
 		}
+		RemoveFreeBlock(block);
 	}
 
-	if(!heap || !block)
-	{
-		FUTURE_LOG_WARNING("Heap is full, expanding");
-		AddHeap();
-		heap = m_heaps;
-		block = heap->m_freeBlocks;
-		blockPrev = NULL;
-	}
+	size_t size = block->m_size & ~(size_t)FUTURE_HEAP_FLAGS;
+	FUTURE_ASSERT(size >= bytes + padding);
 
-	FUTURE_ASSERT(heap && block && block->m_size >= bytes);
-
-	void * data = block->m_data;
-	
-	if(block->m_size == bytes)
+	size_t flags = 0;
+	size_t gap = padding ? (alignment - (((size_t)block + offset) & (alignment - 1))) & (alignment - 1) : 0;
+	if(gap > 0)
 	{
-		if(blockPrev)
-		{
-			blockPrev->m_next = block->m_next;
-		}
-		if(block == heap->m_freeBlocks)
+		// the front must be big enough to be a free block of its own
+		if(gap < FUTURE_HEAP_MIN_BLOCK)
 		{
-			heap->m_freeBlocks = heap->m_freeBlocks->m_next;
+			gap += alignment;
 		}
-		m_poolAllocator->Free(block);
+		Block * front = block;
+		block = (Block*)((u8*)block + gap);
+		size -= gap;
+		block->m_size = size;
+		SetFree(front, gap);
+		InsertFreeBlock(front);
+		flags = FUTURE_HEAP_PREV_FREE;
+	}
+
+	// return the end of the block to the heap if it's big enough to be a block of its own
+	if(size - bytes >= FUTURE_HEAP_MIN_BLOCK)
+	{
+		Block * remainder = (Block*)((u8*)block + bytes);
+		SetFree(remainder, size - bytes);
+		InsertFreeBlock(remainder);
+		size = bytes;
 	}
 	else
 	{
-		block->m_size -= bytes;
-		block->m_data = (void*)((size_t)block->m_data + bytes);
+		Block * next = (Block*)((u8*)block + size);
+		next->m_size &= ~(size_t)FUTURE_HEAP_PREV_FREE;
 	}
 
+	// only the front split off for alignment can be free before the block
+	block->m_size = size | flags;
+
 	Unlock();
 
-	
 	if(m_usingHeaders)
 	{
-		FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(data);
-		header->m_allocatorData = bytes;
-		return data;
-	}
-	else
-	{
-		u32 * header = (u32*)data;
-		*header = (u32)bytes;
-		return (void*)(header + 1);
+		return block;
 	}
+	return (u8*)block + FUTURE_HEAP_TAG_SIZE;
 }
 
 void FutureHeapAllocator::Free(void * p)
 {
+	Block * block = (Block*)(m_usingHeaders ? p : (u8*)p - FUTURE_HEAP_TAG_SIZE);
+
 	Lock();
-	Heap * heap = m_heaps;
-	for( ;heap; heap = heap->m_next)
+
+	size_t size = block->m_size & ~(size_t)FUTURE_HEAP_FLAGS;
+	FUTURE_ASSERT_MSG(!(block->m_size & FUTURE_HEAP_BLOCK_FREE), L"Attempting to free a heap block that is already free");
+	FUTURE_ASSERT(size >= FUTURE_HEAP_MIN_BLOCK && size <= m_heapSize);
+
+	// merge with the block before, its size is stored in its last bytes
+	if(block->m_size & FUTURE_HEAP_PREV_FREE)
 	{
-		if((size_t)p >= (size_t)heap->m_data && (size_t)p < (size_t)heap->m_data + m_heapSize)
-		{
-			break;
-		}
+		size_t prevSize = *((size_t*)block - 1);
+		Block * prev = (Block*)((u8*)block - prevSize);
+		FUTURE_ASSERT(prev->m_size & FUTURE_HEAP_BLOCK_FREE);
+		RemoveFreeBlock(prev);
+		block = prev;
+		size += prevSize;
+	}
+
+	// merge with the block after
+	Block * next = (Block*)((u8*)block + size);
+	if(next->m_size & FUTURE_HEAP_BLOCK_FREE)
+	{
+		RemoveFreeBlock(next);
+		size += next->m_size & ~(size_t)FUTURE_HEAP_FLAGS;
 	}
+
+	SetFree(block, size);
+	InsertFreeBlock(block);
+
+	// heaps added when the first one filled up give their pages back once they are empty again
+	if(m_backing && size == m_heapSize && ((Heap*)((u8*)block - FUTURE_HEAP_REGION_HEADER))->m_next)
+	{
+		DecommitHeap(block);
+	}
+
 	Unlock();
-	FUTURE_ASSERT_MSG(heap, "Attempting to free a block that does not belong to this heap");
-	
-	u32 size = 0;
-	if(m_usingHeaders)
+}
+
+bool FutureHeapAllocator::Resize(void * p, u32 bytes)
+{
+	Block * block = (Block*)(m_usingHeaders ? p : (u8*)p - FUTURE_HEAP_TAG_SIZE);
+	bytes += m_usingHeaders ? 0 : FUTURE_HEAP_TAG_SIZE;
+	u32 r = bytes % FUTURE_HEAP_ALIGN;
+	if(r != 0)
 	{
-		FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(p);
-		size = header->m_allocatorData;
+		bytes = bytes + FUTURE_HEAP_ALIGN - r;
 	}
-	else
+	if(bytes < FUTURE_HEAP_MIN_BLOCK)
+	{
+		bytes = FUTURE_HEAP_MIN_BLOCK;
+	}
+	if(bytes > m_heapSize)
 	{
-		u32 * header = ((u32*)p) - 1;
-		size = *header;
-		p = (void*)header;
+		return false;
 	}
-	FUTURE_ASSERT(size > 0 && size <= m_heapSize);
 
 	Lock();
-	bool found = false;
-	if(heap->m_freeBlocks != NULL)
+
+	FUTURE_ASSERT_MSG(!(block->m_size & FUTURE_HEAP_BLOCK_FREE), L"Attempting to resize a heap block that is free");
+	size_t flags = block->m_size & FUTURE_HEAP_PREV_FREE;
+	size_t size = block->m_size & ~(size_t)FUTURE_HEAP_FLAGS;
+
+	// growing takes the block after this one, which must be free and big enough for the difference
+	if(bytes > size)
 	{
-		// check to see if this block is next to another block
-		for(Block * checkBlock = heap->m_freeBlocks; checkBlock && !found; checkBlock = checkBlock->m_next)
+		Block * next = (Block*)((u8*)block + size);
+		size_t nextSize = next->m_size & ~(size_t)FUTURE_HEAP_FLAGS;
+		if(!(next->m_size & FUTURE_HEAP_BLOCK_FREE) || size + nextSize < bytes)
 		{
-			// checkBlock is before this one
-			if((size_t)checkBlock->m_data + checkBlock->m_size == (size_t)p)
-			{
-				checkBlock->m_size += size;
-				found = true;
-			}
-			// checkBlock is directly after this block
-			else if((size_t)p + size == (size_t)checkBlock->m_data)
-			{
-				checkBlock->m_size += size;
-				checkBlock->m_data = p;
-				found = true;
-			}
+			Unlock();
+			return false;
 		}
+		RemoveFreeBlock(next);
+		size += nextSize;
+		Block * after = (Block*)((u8*)block + size);
+		after->m_size &= ~(size_t)FUTURE_HEAP_PREV_FREE;
 	}
 
-	if(!found)
+	// return the end of the block to the heap, merged with the block after it if that one is free
+	if(size - bytes >= FUTURE_HEAP_MIN_BLOCK)
 	{
-		// we couldn't add this to another block so make a new one
-		Block * block = (Block*)m_poolAllocator->Alloc(sizeof(Block));
-		block->m_data = p;
-		block->m_size = size;
-		block->m_next = heap->m_freeBlocks;
-		heap->m_freeBlocks = block;
+		Block * remainder = (Block*)((u8*)block + bytes);
+		size_t remainderSize = size - bytes;
+		Block * after = (Block*)((u8*)block + size);
+		if(after->m_size & FUTURE_HEAP_BLOCK_FREE)
+		{
+			RemoveFreeBlock(after);
+			remainderSize += after->m_size & ~(size_t)FUTURE_HEAP_FLAGS;
+		}
+		SetFree(remainder, remainderSize);
+		InsertFreeBlock(remainder);
+		size = bytes;
 	}
-	
+
+	block->m_size = size | flags;
+
 	Unlock();
+	return true;
+}
+
+u32 FutureHeapAllocator::UsableSize(void * p)
+{
+	Block * block = (Block*)(m_usingHeaders ? p : (u8*)p - FUTURE_HEAP_TAG_SIZE);
+	return (u32)(block->m_size & ~(size_t)FUTURE_HEAP_FLAGS) - (m_usingHeaders ? 0 : FUTURE_HEAP_TAG_SIZE);
 }
 
 u8 FutureHeapAllocator::Priority()
@@ -244,25 +349,194 @@ u8 FutureHeapAllocator::Priority()
 
 bool FutureHeapAllocator::ShouldAllocate(FutureMemoryParam memParam)
 {
-	return (memParam.m_bytes + FutureMemory::HeaderSize() < m_heapSize / 4);
+	return (memParam.m_bytes + FutureMemory::HeaderSize() + memParam.m_alignment < m_heapSize / 4);
+}
+
+bool FutureHeapAllocator::GetFragmentation(FutureMemoryFragmentation & fragmentation)
+{
+	fragmentation.m_heaps = 0;
+	fragmentation.m_totalBytes = 0;
+	fragmentation.m_usedBytes = 0;
+	fragmentation.m_usedBlocks = 0;
+	fragmentation.m_freeBytes = 0;
+	fragmentation.m_freeBlocks = 0;
+	fragmentation.m_largestFreeBlock = 0;
+	fragmentation.m_fragmentation = 0.0f;
+
+	Lock();
+	for(Heap * heap = m_heaps; heap; heap = heap->m_next)
+	{
+		++fragmentation.m_heaps;
+		fragmentation.m_totalBytes += m_heapSize;
+
+		// the sentinel at the end of each heap is the only block with a size of 0
+		Block * block = (Block*)((u8*)heap + FUTURE_HEAP_REGION_HEADER);
+		for(size_t size = block->m_size & ~(size_t)FUTURE_HEAP_FLAGS; size; size = block->m_size & ~(size_t)FUTURE_HEAP_FLAGS)
+		{
+			if(block->m_size & FUTURE_HEAP_BLOCK_FREE)
+			{
+				++fragmentation.m_freeBlocks;
+				fragmentation.m_freeBytes += size;
+				if(size > fragmentation.m_largestFreeBlock)
+				{
+					fragmentation.m_largestFreeBlock = (u32)size;
+				}
+			}
+			else
+			{
+				++fragmentation.m_usedBlocks;
+				fragmentation.m_usedBytes += size;
+			}
+			block = (Block*)((u8*)block + size);
+		}
+	}
+	Unlock();
+
+	// free memory in different heaps can never be merged, so a free block the size of a heap counts as whole
+	if(fragmentation.m_freeBytes > 0)
+	{
+		u32 mergeable = fragmentation.m_freeBytes < m_heapSize ? fragmentation.m_freeBytes : m_heapSize;
+		fragmentation.m_fragmentation = 1.0f - (f32)fragmentation.m_largestFreeBlock / (f32)mergeable;
+	}
+	return true;
+}
+
+void FutureHeapAllocator::Trim()
+{
+	if(!m_backing)
+	{
+		return;
+	}
+
+	Lock();
+	for(Heap * heap = m_heaps; heap; heap = heap->m_next)
+	{
+		Block * block = (Block*)((u8*)heap + FUTURE_HEAP_REGION_HEADER);
+		if((block->m_size & FUTURE_HEAP_BLOCK_FREE) && (block->m_size & ~(size_t)FUTURE_HEAP_FLAGS) == m_heapSize)
+		{
+			DecommitHeap(block);
+		}
+	}
+	Unlock();
 }
 
-void FutureHeapAllocator::AddHeap()
+FutureHeapAllocator::Block * FutureHeapAllocator::AddHeap()
 {
-	Heap * heap = (Heap*)m_poolAllocator->Alloc(sizeof(Heap));
-	heap->m_data = _aligned_malloc(m_heapSize, 16);
+	FUTURE_TRACE_SCOPE("FutureHeapAllocator::AddHeap");
+	// descriptor, one block covering the whole heap and a used sentinel tag that stops merges and walks
+	u32 bytes = FUTURE_HEAP_REGION_HEADER + m_heapSize + FUTURE_HEAP_TAG_SIZE;
+	Heap * heap = (Heap*)(m_backing ? m_backing->Alloc(bytes) : _aligned_malloc(bytes, FUTURE_HEAP_ALIGN));
+	if(heap == NULL)
+	{
+		FUTURE_LOG_ERROR(L"Heap Allocator failed to allocate a new heap");
+		return NULL;
+	}
 	heap->m_next = m_heaps;
 	m_heaps = heap;
 
-	Block * block = (Block*)m_poolAllocator->Alloc(sizeof(Block));
-	block->m_data = heap->m_data;
-	block->m_next = NULL;
-	block->m_size = m_heapSize;
-	heap->m_freeBlocks = block;
-	if(!m_usingHeaders)
+	Block * block = (Block*)((u8*)heap + FUTURE_HEAP_REGION_HEADER);
+	Block * sentinel = (Block*)((u8*)block + m_heapSize);
+	sentinel->m_nextFree = NULL;
+	sentinel->m_size = 0;
+
+	SetFree(block, m_heapSize);
+	InsertFreeBlock(block);
+	return block;
+}
+
+FutureHeapAllocator::Block * FutureHeapAllocator::FindFreeBlock(u32 size)
+{
+	// round up to the start of the next list so every block in the list found is big enough
+	if(size >= FUTURE_HEAP_SMALL_BLOCK)
+	{
+		size += (1 << (FutureHeapHighestBit(size) - FUTURE_HEAP_SL_LOG2)) - 1;
+	}
+	u32 fl, sl;
+	FutureHeapMapping(size, fl, sl);
+	if(fl >= FUTURE_HEAP_FL_COUNT)
+	{
+		return NULL;
+	}
+
+	u32 slMap = m_slBitmap[fl] & (~0U << sl);
+	if(!slMap)
+	{
+		u32 flMap = fl + 1 < 32 ? m_flBitmap & (~0U << (fl + 1)) : 0;
+		if(!flMap)
+		{
+			return NULL;
+		}
+		fl = FutureHeapLowestBit(flMap);
+		slMap = m_slBitmap[fl];
+	}
+	sl = FutureHeapLowestBit(slMap);
+
+	Block * block = m_freeLists[fl][sl];
+	RemoveFreeBlock(block);
+	return block;
+}
+
+void FutureHeapAllocator::InsertFreeBlock(Block * block)
+{
+	u32 fl, sl;
+	FutureHeapMapping((u32)(block->m_size & ~(size_t)FUTURE_HEAP_FLAGS), fl, sl);
+
+	Block * head = m_freeLists[fl][sl];
+	block->m_nextFree = head;
+	block->m_prevFree = NULL;
+	if(head)
+	{
+		head->m_prevFree = block;
+	}
+	m_freeLists[fl][sl] = block;
+	m_slBitmap[fl] |= 1U << sl;
+	m_flBitmap |= 1U << fl;
+}
+
+void FutureHeapAllocator::RemoveFreeBlock(Block * block)
+{
+	u32 fl, sl;
+	FutureHeapMapping((u32)(block->m_size & ~(size_t)FUTURE_HEAP_FLAGS), fl, sl);
+
+	if(block->m_nextFree)
+	{
+		block->m_nextFree->m_prevFree = block->m_prevFree;
+	}
+	if(block->m_prevFree)
 	{
-		// Adjust block location to keep alignment after added u32 header
-		block->m_data = (void*)((u8*)block->m_data + (16 - sizeof(u32)));
-		block->m_size -= (16 - sizeof(u32));
+		block->m_prevFree->m_nextFree = block->m_nextFree;
 	}
-}
\ No newline at end of file
+	else
+	{
+		FUTURE_ASSERT(m_freeLists[fl][sl] == block);
+		m_freeLists[fl][sl] = block->m_nextFree;
+		if(!m_freeLists[fl][sl])
+		{
+			m_slBitmap[fl] &= ~(1U << sl);
+			if(!m_slBitmap[fl])
+			{
+				m_flBitmap &= ~(1U << fl);
+			}
+		}
+	}
+	block->m_nextFree = NULL;
+	block->m_prevFree = NULL;
+}
+
+void FutureHeapAllocator::SetFree(Block * block, size_t size)
+{
+	// the block before a free block is always in use, anything else would have been merged
+	block->m_size = size | FUTURE_HEAP_BLOCK_FREE;
+	*(size_t*)((u8*)block + size - sizeof(size_t)) = size;
+
+	Block * next = (Block*)((u8*)block + size);
+	next->m_size |= FUTURE_HEAP_PREV_FREE;
+}
+
+void FutureHeapAllocator::DecommitHeap(Block * block)
+{
+	// keep the tag with the free list links and the size at the end, everything between can read as zero
+	u8 * start = (u8*)block + sizeof(Block);
+	u8 * end = (u8*)block + m_heapSize - sizeof(size_t);
+	m_backing->Decommit(start, (u32)(end - start));
+}
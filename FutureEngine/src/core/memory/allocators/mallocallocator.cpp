@@ -24,6 +24,10 @@
 #include <future/core/memory/memory.h>
 #include <new>
 
+#if FUTURE_PLATFORM_OSX || FUTURE_PLATFORM_IOS
+#	include <malloc/malloc.h>
+#endif
+
 /*******************************************************************/
 // Default Malloc allocator, aligned allocations
 
@@ -38,11 +42,40 @@ void * FutureMallocAllocator::Alloc(u32 bytes)
 	return _aligned_malloc(bytes, 16);
 }
 
+void * FutureMallocAllocator::AllocAligned(u32 bytes, u32 alignment)
+{
+	return _aligned_malloc(bytes, alignment > 16 ? alignment : 16);
+}
+
 void FutureMallocAllocator::Free(void * p)
 {
 	_aligned_free(p);
 }
 
+void * FutureMallocAllocator::Realloc(void * p, u32 bytes)
+{
+#if FUTURE_PLATFORM_WINDOWS
+	return _aligned_realloc(p, bytes, 16);
+#elif defined(FUTURE_X64) || FUTURE_PLATFORM_OSX || FUTURE_PLATFORM_IOS
+	// malloc is already 16 byte aligned here, glibc moves blocks above its mmap threshold with mremap
+	return realloc(p, bytes);
+#else
+	// realloc would only keep 8 byte alignment
+	return NULL;
+#endif
+}
+
+u32 FutureMallocAllocator::UsableSize(void * p)
+{
+#if FUTURE_PLATFORM_WINDOWS
+	return (u32)_aligned_msize(p, 16, 0);
+#elif FUTURE_PLATFORM_OSX || FUTURE_PLATFORM_IOS
+	return (u32)malloc_size(p);
+#else
+	return (u32)malloc_usable_size(p);
+#endif
+}
+
 // return the highest priority possible, this should be our last resort allocator
 u8 FutureMallocAllocator::Priority()
 {
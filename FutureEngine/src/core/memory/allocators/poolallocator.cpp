@@ -21,34 +21,76 @@
 */
 
 #include <future/core/debug/debug.h>
+#include <future/core/debug/trace.h>
+#include <future/core/memory/allocators/chunk.h>
 #include <future/core/memory/allocators/poolallocator.h>
+#include <future/core/memory/allocators/virtualallocator.h>
 #include <future/core/memory/memory.h>
-#include <future/core/memory/tracker/memorytracker.h>
 #include <new>
 
 #ifndef FUTURE_MAX_POOL_GROUP_SIZE
 #	define FUTURE_MAX_POOL_GROUP_SIZE	1024
 #endif
 
+// The free list head holds the address of the top block in its low bits and a counter in the rest.
+// On 64 bit platforms user space addresses fit in 48 bits and blocks are at least 16 byte aligned,
+// so the address takes 44 bits and the counter 20.
+#ifdef FUTURE_X64
+#	define FUTURE_POOL_HEAD_ADDRESS_SHIFT	4
+#	define FUTURE_POOL_HEAD_TAG_SHIFT		44
+#else
+#	define FUTURE_POOL_HEAD_ADDRESS_SHIFT	0
+#	define FUTURE_POOL_HEAD_TAG_SHIFT		32
+#endif
+
+static inline s64 FuturePoolHead(void * block, u64 tag)
+{
+	return (s64)(((u64)(size_t)block >> FUTURE_POOL_HEAD_ADDRESS_SHIFT) | (tag << FUTURE_POOL_HEAD_TAG_SHIFT));
+}
+
+static inline void * FuturePoolHeadBlock(s64 head)
+{
+	return (void*)(size_t)(((u64)head & (((u64)1 << FUTURE_POOL_HEAD_TAG_SHIFT) - 1)) << FUTURE_POOL_HEAD_ADDRESS_SHIFT);
+}
+
+// the next counter, wrapping is fine as long as it doesn't come back around while one thread is between its load and exchange
+static inline u64 FuturePoolHeadNextTag(s64 head)
+{
+	return ((u64)head >> FUTURE_POOL_HEAD_TAG_SHIFT) + 1;
+}
+
 /*******************************************************************/
 // Pool Allocator
 
-FuturePoolAllocator::FuturePoolAllocator(u8 blockSize, u32 numBlocks, bool accountForHeaders)
+FuturePoolAllocator::FuturePoolAllocator(u16 blockSize, u32 numBlocks, u16 alignment, FutureVirtualAllocator * backing)
 	: m_blockSize(16),
-	  m_freeList(NULL),
+	  m_alignment(FUTURE_DEFAULT_ALIGNMENT),
+	  m_freeList(0),
 	  m_blocks(0),
-	  m_poolList(NULL),
-	  m_usingHeaders(accountForHeaders),
+	  m_sizeClass(FUTURE_NO_SIZE_CLASS),
+	  m_chunks(NULL),
+	  m_backing(backing),
 	  m_poolSize(numBlocks)
 {
-	FUTURE_ASSERT(blockSize > 0 && numPools > 0);
+	FUTURE_ASSERT(blockSize > 0 && numBlocks > 0);
+	FUTURE_ASSERT_MSG((alignment & (alignment - 1)) == 0, L"Pool alignment must be a power of two");
 	
-	blockSize += (accountForHeaders ? FutureMemory::HeaderSize() : sizeof(size_t));
+	// free blocks hold the free list link
+	u32 size = blockSize < sizeof(Block) ? sizeof(Block) : blockSize;
 
-	u32 r = blockSize % 16;
+	u32 align = alignment > FUTURE_DEFAULT_ALIGNMENT ? alignment : FUTURE_DEFAULT_ALIGNMENT;
+	u32 r = size % align;
 	if(r != 0)
 	{
-		blockSize = blockSize + 16 - r;
+		size = size + align - r;
+	}
+	m_blockSize = size;
+
+	// every block is aligned if the first one is and the size is a multiple of the alignment
+	m_alignment = size & (0 - size);
+	if(m_alignment > FUTURE_POOL_NATURAL_ALIGNMENT)
+	{
+		m_alignment = align > FUTURE_POOL_NATURAL_ALIGNMENT ? align : FUTURE_POOL_NATURAL_ALIGNMENT;
 	}
 
 	if(m_poolSize > FUTURE_MAX_POOL_GROUP_SIZE)
@@ -56,93 +98,130 @@ FuturePoolAllocator::FuturePoolAllocator(u8 blockSize, u32 numBlocks, bool accou
 		m_poolSize = FUTURE_MAX_POOL_GROUP_SIZE;
 	}
 
-	while(m_blocks < numBlocks)
+	while(m_blocks < numBlocks && AddPool())
 	{
-		AddPool();
 	}
 }
 
 FuturePoolAllocator::~FuturePoolAllocator()
 {
-	for(Block * pool = m_poolList; pool;)
+	for(FutureMemoryChunk * chunk = m_chunks; chunk;)
 	{
-		if(pool->m_data)
-		{
-			if(((Block*)(pool->m_data))->m_data)
-			{
-				if(m_usingHeaders)
-				{
-					_aligned_free(((Block*)(pool->m_data))->m_data);
-				}
-				else
-				{
-					void * data = ((Block*)(pool->m_data))->m_data;
-					data = (void*)(((size_t*)data) - 1);
-					_aligned_free(data);
-				}
-			}
-			_aligned_free(pool->m_data);
-		}
-		Block * next = pool->m_next;
-		delete pool;
-		pool = next;
+		FutureMemoryChunk * next = chunk->m_next;
+		FutureMemoryChunk::Destroy(chunk);
+		chunk = next;
 	}
-	m_groupList = NULL;
-	m_freeList = NULL;
-	m_pools = 0;
-	Unlock();
+	m_chunks = NULL;
+	m_freeList = 0;
+	m_blocks = 0;
 }
 
 void * FuturePoolAllocator::Alloc(u32 bytes)
 {
 	FUTURE_ASSERT_CRIT(bytes <= m_blockSize, 9865);
 
-
-	if(m_freeList == NULL)
+	Block * block = Pop();
+	// other threads can take the new blocks before this one gets to them
+	while(block == NULL && Expand())
 	{
-		FUTURE_LOG_WARNING("Pool Allocator is full, expanding");
-		AddPool();
+		block = Pop();
 	}
-	FUTURE_ASSERT_CRIT(m_freeList != NULL, 9864);
+	FUTURE_ASSERT_CRIT(block != NULL, 9864);
 
-	Lock();
+	return block;
+}
 
-	Block * block = m_freeList;
-	m_freeList = m_freeList->m_next;
-	
-	Unlock();
+void FuturePoolAllocator::Free(void * p)
+{
+	Block * block = (Block*)p;
+	FUTURE_ASSERT_MSG(FutureMemoryChunk::Find(p) && FutureMemoryChunk::Find(p)->m_owner == this, L"Freeing a block that does not belong to this pool");
 
-	return block->m_data;
+	Push(block, block);
 }
 
-void FuturePoolAllocator::Free(void * p)
+bool FuturePoolAllocator::Resize(void * p, u32 bytes)
 {
-	Block * block;
-	if(m_usingHeaders)
-	{
-		FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(p);
-		block = (Block*)header->m_allocatorData;
-	}
-	else
+	return bytes <= m_blockSize;
+}
+
+u32 FuturePoolAllocator::UsableSize(void * p)
+{
+	return m_blockSize;
+}
+
+void * FuturePoolAllocator::AllocAligned(u32 bytes, u32 alignment)
+{
+	if(alignment > m_alignment)
 	{
-		size_t * header = ((size_t*)p) - 1;
-		block = (Block*)(*header);
+		FUTURE_LOG_ERROR(L"Pool Allocator blocks are only aligned to %u bytes, %u were requested", m_alignment, alignment);
+		return NULL;
 	}
+	return Alloc(bytes);
+}
 
-	FUTURE_ASSERT(pool->m_data == p);
+u32 FuturePoolAllocator::AllocBatch(void ** blocks, u32 count)
+{
+	// popping the blocks one at a time is safe, walking the list to take several at once is not
+	// because another thread can pop and reuse a block in the middle of the walk
+	u32 taken = 0;
+	for(u32 attempt = 0; attempt < 2 && taken == 0; ++attempt)
+	{
+		if(attempt > 0 && !Expand())
+		{
+			break;
+		}
 
-	Lock();
+		while(taken < count)
+		{
+			Block * block = Pop();
+			if(block == NULL)
+			{
+				break;
+			}
+			blocks[taken++] = block;
+		}
+	}
+	return taken;
+}
 
-	if(m_freeList == NULL)
+void FuturePoolAllocator::FreeBatch(void ** blocks, u32 count)
+{
+	if(count == 0)
 	{
-		m_freeList = block;
+		return;
 	}
-	else
+
+	// chain the blocks together so they go on the free list in one exchange
+	Block * first = (Block*)blocks[0];
+	Block * last = first;
+	for(u32 i = 1; i < count; ++i)
 	{
-		block->m_next = m_freeList;
-		m_freeList = block;
+		Block * block = (Block*)blocks[i];
+		last->m_next = block;
+		last = block;
 	}
 
+	Push(first, last);
+}
+
+u32 FuturePoolAllocator::BlockSize()
+{
+	return m_blockSize;
+}
+
+u32 FuturePoolAllocator::Alignment()
+{
+	return m_alignment;
+}
+
+void FuturePoolAllocator::SetSizeClass(u8 sizeClass)
+{
+	Lock();
+	m_sizeClass = sizeClass;
+	for(FutureMemoryChunk * chunk = m_chunks; chunk; chunk = chunk->m_next)
+	{
+		chunk->m_sizeClass = sizeClass;
+	}
 	Unlock();
 }
 
@@ -155,50 +234,99 @@ u8 FuturePoolAllocator::Priority()
 // Make sure we have room to spare, if we do and the requested bytes is the right size, return true
 bool FuturePoolAllocator::ShouldAllocate(FutureMemoryParam memParam)
 {
-	if(memParam.m_bytes + (m_usingHeaders ? FutureMemory::HeaderSize() : sizeof(size_t)) <= m_blockSize)
+	if(memParam.m_bytes <= m_blockSize && memParam.m_alignment <= m_alignment)
 	{
 		return true;
 	}
 	return false;
 }
 
-
-void FuturePoolAllocator::AddPool()
+bool FuturePoolAllocator::UsesChunks()
 {
-	Block * pools = (Block*)_aligned_malloc((sizeof(Block) * m_poolSize), 16);
-	void * data = _aligned_malloc(m_blockSize * m_poolSize, 16);
+	return true;
+}
 
-	Block * group = new Block();
-	group->m_data = pools;
-	group->m_next = m_poolList;
-	if(m_poolList == NULL)
-	{
-		m_poolList = group;
-	}
 
-	for(u32 i = 0; i < m_poolSize && pools != NULL; ++i)
+FuturePoolAllocator::Block * FuturePoolAllocator::Pop()
+{
+	s64 head = FutureAtomicLoad(&m_freeList);
+	for(;;)
 	{
-		pools->m_next = (i < m_poolSize - 1 ? pools + 1 : m_freeList);
-		if(m_usingHeaders)
+		Block * block = (Block*)FuturePoolHeadBlock(head);
+		if(block == NULL)
+		{
+			return NULL;
+		}
+
+		// another thread may already have popped the block and be writing to it, the read is still
+		// safe because chunks are only released by the destructor and the exchange fails if so
+		Block * next = (Block*)FutureAtomicLoadPtr((void * const volatile *)&block->m_next);
+		if(FutureAtomicCompareExchange(&m_freeList, head, FuturePoolHead(next, FuturePoolHeadNextTag(head))))
 		{
-			FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(data);
-			header->m_allocatorData = (size_t)pools;
-			pools->m_data = data;
+			return block;
 		}
-		else
+		head = FutureAtomicLoad(&m_freeList);
+	}
+}
+
+void FuturePoolAllocator::Push(Block * first, Block * last)
+{
+	s64 head = FutureAtomicLoad(&m_freeList);
+	for(;;)
+	{
+		last->m_next = (Block*)FuturePoolHeadBlock(head);
+		if(FutureAtomicCompareExchange(&m_freeList, head, FuturePoolHead(first, FuturePoolHeadNextTag(head))))
 		{
-			size_t * header = (size_t*)data;
-			*header = (size_t)pools;
-			pools->m_data = (void*)(header + 1);
+			return;
 		}
-		++pools;
-		data = (void*)((u8*)data + m_blockSize);
+		head = FutureAtomicLoad(&m_freeList);
 	}
+}
 
+bool FuturePoolAllocator::Expand()
+{
 	Lock();
 
-	m_freeList = (Pool*)(Block->m_data);
-	m_pools += m_poolSize;
+	bool expanded = true;
+	if(FuturePoolHeadBlock(FutureAtomicLoad(&m_freeList)) == NULL)
+	{
+		FUTURE_LOG_WARNING(L"Pool Allocator is full, expanding");
+		expanded = AddPool();
+	}
 
 	Unlock();
-}
\ No newline at end of file
+	return expanded;
+}
+
+bool FuturePoolAllocator::AddPool()
+{
+	FUTURE_TRACE_SCOPE("FuturePoolAllocator::AddPool");
+	// the chunk data is only aligned to the chunk header size, leave room to align the first block
+	FutureMemoryChunk * chunk = FutureMemoryChunk::Create(this, m_blockSize * m_poolSize + m_alignment, m_backing);
+	if(chunk == NULL)
+	{
+		FUTURE_LOG_ERROR(L"Pool Allocator failed to allocate a new pool");
+		return false;
+	}
+	chunk->m_sizeClass = m_sizeClass;
+
+	// the chunk is rounded up, fill all of it
+	u8 * data = (u8*)(((size_t)chunk->Data() + m_alignment - 1) & ~(size_t)(m_alignment - 1));
+	u32 count = (u32)(chunk->End() - data) / m_blockSize;
+	Block * first = (Block*)data;
+	Block * block = first;
+	for(u32 i = 1; i < count; ++i)
+	{
+		Block * next = (Block*)((u8*)block + m_blockSize);
+		block->m_next = next;
+		block = next;
+	}
+
+	chunk->m_next = m_chunks;
+	m_chunks = chunk;
+	m_blocks += count;
+
+	// the new blocks go in front of whatever other threads freed in the meantime
+	Push(first, block);
+	return true;
+}
@@ -15,167 +15,114 @@
  *
  */
 
-
 /*
 *	Implementation of FutureStackAllocator
 */
 
 #include <future/core/debug/debug.h>
+#include <future/core/memory/allocators/chunk.h>
 #include <future/core/memory/allocators/stackallocator.h>
-#include <future/core/memory/allocators/poolallocator.h>
 #include <future/core/memory/memory.h>
-#include <future/core/memory/tracker/memorytracker.h>
-#include <new>
 
 /*******************************************************************/
 // Stack Allocator
 
-FutureStackAllocator::FutureStackAllocator(u32 stackSize, bool usingHeaders)
+FutureStackAllocator::FutureStackAllocator(u32 stackSize, IFutureAllocator * owner)
 	: m_stackSize(stackSize),
+	  m_owner(owner ? owner : this),
 	  m_stacks(NULL),
-	  m_usingHeaders(usingHeaders)
+	  m_current(NULL),
+	  m_position(NULL)
 {
 	FUTURE_ASSERT(m_stackSize > 0);
 	
 	// round to nearest multiple of align
-
-	if(!m_usingHeaders)
-	{
-		m_stackSize += 16;
-	}
 	u32 r = m_stackSize % 16;
 	if(r != 0)
 	{
 		m_stackSize = m_stackSize + 16 - r;
 	}
 
-	m_poolAllocator = new FuturePoolAllocator(4, sizeof(Block), 1024 * 256, false);
-	AddStack();
+	m_stacks = AddStack(m_stackSize);
+	FUTURE_ASSERT_CRIT(m_stacks != NULL, 9876);
+	m_current = m_stacks;
+	m_position = m_stacks->Data();
 }
 
-void FutureStackAllocator::~FutureStackAllocator()
+FutureStackAllocator::~FutureStackAllocator()
 {
-	for(Stack * stack = m_stacks; stack; )
+	for(FutureMemoryChunk * stack = m_stacks; stack; )
 	{
-		for(Block * block = stack->m_blocks; block;)
-		{
-			Block * nextBlock = block->m_next;
-			m_poolAllocator->Free(block);
-			block = nextBlock;
-		}
-		if(stack->m_data)
-		{
-			if(!m_usingHeaders)
-			{
-				stack->m_data = (void*)((size_t)stack->m_data - (16 - sizeof(size_t)));
-			}
-			_aligned_free(stack->m_data);
-		}
-		Stack * next = stack->m_next;
-		delete stack;
+		FutureMemoryChunk * next = stack->m_next;
+		FutureMemoryChunk::Destroy(stack);
 		stack = next;
 	}
 	m_stacks = NULL;
-	m_poolAllocator->Release();
-	delete m_poolAllocator;
-	m_poolAllocator = NULL;
+	m_current = NULL;
+	m_position = NULL;
 }
 
 void * FutureStackAllocator::Alloc(u32 bytes)
 {
-	if(!m_usingHeaders)
+	return AllocAligned(bytes, 16);
+}
+
+void * FutureStackAllocator::AllocAligned(u32 bytes, u32 alignment)
+{
+	FUTURE_ASSERT_MSG((alignment & (alignment - 1)) == 0, L"Alignment must be a power of two");
+	if(alignment < 16)
 	{
-		bytes += 4;
+		alignment = 16;
 	}
-	FUTURE_ASSERT_CRIT(bytes <= m_stackSize, 9875);
-	// keep the heap aligned	
+
+	// keep the stack aligned	
 	u32 r = bytes % 16;
 	if(r != 0)
 	{
 		bytes = bytes + 16 - r;
 	}
 
-	Lock();
-
-	Stack * stack = m_stacks;
-
-	if((m_stackSize - ((size_t)stack->m_position - (size_t)stack->m_data)) < bytes)
+	u8 * data = (u8*)(((size_t)m_position + alignment - 1) & ~(size_t)(alignment - 1));
+	if(data > m_current->End() || (size_t)(m_current->End() - data) < bytes)
 	{
-		FUTURE_LOG_WARNING("Stack is full, expanding");
-		AddStack();
-		stack = m_stacks;
+		// reuse the next stack if it's big enough, otherwise put a new one in front of it.
+		// Stack data is only aligned to the chunk header size, so a stack may need room to align
+		u32 needed = alignment > FUTURE_MEMORY_CHUNK_HEADER_SIZE ? bytes + alignment : bytes;
+		FutureMemoryChunk * next = m_current->m_next;
+		if(!next || (size_t)(next->End() - next->Data()) < needed)
+		{
+			next = AddStack(needed > m_stackSize ? needed : m_stackSize);
+			if(!next)
+			{
+				return NULL;
+			}
+		}
+		m_current = next;
+		data = (u8*)(((size_t)next->Data() + alignment - 1) & ~(size_t)(alignment - 1));
 	}
 
-	FUTURE_ASSERT(stack && (m_stackSize - ((size_t)stack->m_position - (size_t)stack->m_data)) >= bytes);
-
-	void * data = stack->m_position;
-	stack->m_position = (void*)((size_t)stack->m_position + bytes);
-	Block * block = (Block*)m_poolAllocator->Alloc(sizeof(Block));
-	block->m_size = bytes;
-	block->m_next = stack->m_blocks;
-	stack->m_blocks = block;
-
-	Unlock();
-
-	if(m_usingHeaders)
-	{
-		FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(data);
-		header->m_allocatorData = (size_t)block;
-		return data;
-	}
-	else
-	{
-		size_t * header = (size_t*)data;
-		*header = (size_t)block;
-		return (void*)(header + 1);
-	}
+	m_position = data + bytes;
+	return data;
 }
 
 void FutureStackAllocator::Free(void * p)
 {
-	Block * block;
-	if(m_usingHeaders)
+	u8 * position = (u8*)p;
+	if(position < m_current->Data() || position >= m_position)
 	{
-		FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(p);
-		block = (Block*)header->m_allocatorData;
-	}
-	else
-	{
-		size_t * header = ((size_t*)p) - 1;
-		block = (Block*)(*header);
-		p = (void*)header;
-	}
-
-	FUTURE_ASSERT(block);
-
-	if(m_stacks->m_blocks == NULL)
-	{
-		FUTURE_ASSERT(m_stacks->m_data == m_stacks->m_position);
-		Lock();
-		Stack * stack = m_stacks;
-		if(stack->m_data)
+		// the first allocation in this stack has been freed, go back to the stack holding p
+		for(m_current = m_stacks; m_current; m_current = m_current->m_next)
 		{
-			if(!m_usingHeaders && m_align >= 4)
+			if(position >= m_current->Data() && position < m_current->End())
 			{
-				stack->m_data = (void*)((size_t)stack->m_data - (m_align - 4));
+				break;
 			}
-			_aligned_free(stack->m_data);
 		}
-		m_stacks = stack->m_next;
-		delete stack;
-		Unlock();
+		FUTURE_ASSERT_MSG(m_current, L"Freeing a block that does not belong to this stack");
 	}
+	FUTURE_ASSERT_MSG(m_current != NULL && position < m_current->End(), L"Freeing stack in the wrong order.");
 
-	FUTURE_ASSERT_MSG(m_stacks->m_blocks == block, "Freeing stack in the wrong order.");
-
-	Lock();
-	Stack * stack = m_stacks;
-
-	stack->m_position = (void *)((size_t)stack->m_position - block->m_size);
-	stack->m_blocks = block->m_next;
-	m_poolAllocator->Free(block);
-	
-	Unlock();
+	m_position = position;
 }
 
 u8 FutureStackAllocator::Priority()
@@ -188,18 +135,54 @@ bool FutureStackAllocator::ShouldAllocate(FutureMemoryParam memParam)
 	return false;
 }
 
+bool FutureStackAllocator::UsesChunks()
+{
+	return true;
+}
 
-void FutureStackAllocator::AddStack()
+FutureStackMarker FutureStackAllocator::GetMarker()
 {
-	Stack * stack = new Stack();
-	stack->m_data = _aligned_malloc(m_stackSize + sizeof(Stack), 16);
-	stack->m_next = m_stacks;
-	m_stacks = stack;
-	stack->m_blocks = NULL;
+	FutureStackMarker marker;
+	marker.m_stack = m_current;
+	marker.m_position = m_position;
+	return marker;
+}
 
-	if(!m_usingHeaders)
+void FutureStackAllocator::FreeToMarker(const FutureStackMarker & marker)
+{
+	FUTURE_ASSERT(marker.m_stack != NULL);
+	m_current = (FutureMemoryChunk*)marker.m_stack;
+	m_position = marker.m_position;
+}
+
+void FutureStackAllocator::Reset()
+{
+	m_current = m_stacks;
+	m_position = m_stacks->Data();
+}
+
+u32 FutureStackAllocator::BytesUsed()
+{
+	u32 bytes = 0;
+	for(FutureMemoryChunk * stack = m_stacks; stack != m_current; stack = stack->m_next)
 	{
-		stack->m_data = (void*)((size_t)stack->m_data + (16 - sizeof(size_t)));
+		bytes += (u32)(stack->End() - stack->Data());
 	}
-	stack->m_position = stack->m_data;
-}
\ No newline at end of file
+	return bytes + (u32)(m_position - m_current->Data());
+}
+
+FutureMemoryChunk * FutureStackAllocator::AddStack(u32 bytes)
+{
+	FutureMemoryChunk * stack = FutureMemoryChunk::Create(m_owner, bytes);
+	if(stack == NULL)
+	{
+		FUTURE_LOG_ERROR(L"Stack Allocator failed to allocate a new stack");
+		return NULL;
+	}
+	if(m_current)
+	{
+		stack->m_next = m_current->m_next;
+		m_current->m_next = stack;
+	}
+	return stack;
+}
@@ -0,0 +1,285 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureThreadCache
+*/
+
+#include <future/core/memory/allocators/threadcache.h>
+#include <future/core/memory/allocators/poolallocator.h>
+#include <future/core/memory/memory.h>
+#include <future/core/debug/debug.h>
+#include <new>
+
+static FuturePoolAllocator *	s_pools[FUTURE_THREAD_CACHE_MAX_CLASSES];
+static u32						s_numClasses = 0;
+
+// Every set ever created, freed on Shutdown
+static void * volatile			s_sets = NULL;
+// Bumped on Shutdown so threads drop sets that no longer exist
+static volatile s32				s_generation = 0;
+
+static FUTURE_THREAD_LOCAL FutureThreadCacheSet *	s_threadSet = NULL;
+static FUTURE_THREAD_LOCAL s32						s_threadGeneration = 0;
+
+// pushes a node onto a list that is only ever popped all at once
+static void FuturePushShared(void * volatile * list, void * node, void * volatile * next)
+{
+	while(true)
+	{
+		void * head = FutureAtomicLoadPtr(list);
+		*next = head;
+		if(FutureAtomicCompareExchangePtr(list, head, node))
+		{
+			return;
+		}
+	}
+}
+
+// The caches for every size class owned by a single thread
+struct FutureThreadCacheSet
+{
+	FutureThreadCacheSet()
+		: m_orphaned(0),
+		  m_next(NULL)
+	{
+		for(u32 i = 0; i < FUTURE_THREAD_CACHE_MAX_CLASSES; ++i)
+		{
+			m_caches[i].m_pool = i < s_numClasses ? s_pools[i] : NULL;
+			m_caches[i].m_set = this;
+		}
+	}
+
+	// Gives the calling thread a set another thread has finished with or creates a new one
+	static FutureThreadCacheSet * Acquire()
+	{
+		s32 generation = FutureAtomicLoad(&s_generation);
+
+		FutureThreadCacheSet * set = NULL;
+		for(FutureThreadCacheSet * s = (FutureThreadCacheSet*)FutureAtomicLoadPtr(&s_sets); s; s = s->m_next)
+		{
+			if(FutureAtomicLoad(&s->m_orphaned) && FutureAtomicCompareExchange(&s->m_orphaned, 1, 0))
+			{
+				set = s;
+				break;
+			}
+		}
+
+		if(!set)
+		{
+			// can't use the memory system here, the allocation would come straight back to this thread's cache
+			void * memory = _aligned_malloc(sizeof(FutureThreadCacheSet), 16);
+			FUTURE_ASSERT_CRIT(memory != NULL, 9870);
+			set = new(memory) FutureThreadCacheSet();
+			FuturePushShared(&s_sets, set, (void * volatile *)&set->m_next);
+		}
+
+		s_threadSet = set;
+		s_threadGeneration = generation;
+		return set;
+	}
+
+	FutureThreadCache		m_caches[FUTURE_THREAD_CACHE_MAX_CLASSES];
+	// 1 while no thread owns this set
+	volatile s32			m_orphaned;
+	FutureThreadCacheSet *	m_next;
+};
+
+/*******************************************************************/
+// Size classes
+
+bool FutureThreadCache::AddSizeClass(FuturePoolAllocator * pool)
+{
+	FUTURE_ASSERT(pool != NULL);
+	FUTURE_ASSERT_MSG(FutureAtomicLoadPtr(&s_sets) == NULL, L"Size classes must be added before any thread caches are created");
+	if(s_numClasses >= FUTURE_THREAD_CACHE_MAX_CLASSES)
+	{
+		return false;
+	}
+	pool->SetSizeClass((u8)s_numClasses);
+	s_pools[s_numClasses++] = pool;
+	return true;
+}
+
+FuturePoolAllocator * FutureThreadCache::SizeClassPool(u32 sizeClass)
+{
+	FUTURE_ASSERT(sizeClass < s_numClasses);
+	return s_pools[sizeClass];
+}
+
+FutureThreadCache * FutureThreadCache::GetCache(u32 sizeClass)
+{
+	FUTURE_ASSERT(sizeClass < s_numClasses);
+
+	FutureThreadCacheSet * set = s_threadSet;
+	if(!set || s_threadGeneration != FutureAtomicLoad(&s_generation))
+	{
+		set = FutureThreadCacheSet::Acquire();
+	}
+	return &set->m_caches[sizeClass];
+}
+
+void FutureThreadCache::ReleaseThread()
+{
+	FutureThreadCacheSet * set = s_threadSet;
+	if(!set || s_threadGeneration != FutureAtomicLoad(&s_generation))
+	{
+		return;
+	}
+	s_threadSet = NULL;
+
+	for(u32 i = 0; i < s_numClasses; ++i)
+	{
+		set->m_caches[i].Flush(set->m_caches[i].m_count);
+	}
+	FutureAtomicExchange(&set->m_orphaned, 1);
+}
+
+void FutureThreadCache::Shutdown()
+{
+	FutureAtomicIncrement(&s_generation);
+
+	// cached blocks aren't returned, the pools are destroyed along with the memory system
+	FutureThreadCacheSet * set = (FutureThreadCacheSet*)FutureAtomicExchangePtr(&s_sets, NULL);
+	while(set)
+	{
+		FutureThreadCacheSet * next = set->m_next;
+		set->~FutureThreadCacheSet();
+		_aligned_free(set);
+		set = next;
+	}
+	s_numClasses = 0;
+	s_threadSet = NULL;
+}
+
+u32 FutureThreadCache::NumSizeClasses()
+{
+	return s_numClasses;
+}
+
+/*******************************************************************/
+// Thread Cache
+
+FutureThreadCache::FutureThreadCache()
+	: m_free(NULL),
+	  m_count(0),
+	  m_pool(NULL),
+	  m_set(NULL)
+{}
+
+void * FutureThreadCache::Alloc(u32 bytes)
+{
+	FUTURE_ASSERT(IsOwner());
+	FUTURE_ASSERT(bytes <= m_pool->BlockSize());
+
+	if(!m_free && !Refill())
+	{
+		return NULL;
+	}
+
+	void * block = m_free;
+	m_free = *(void**)block;
+	--m_count;
+	return block;
+}
+
+void * FutureThreadCache::AllocAligned(u32 bytes, u32 alignment)
+{
+	// every block in the pool has the same alignment
+	if(alignment > m_pool->Alignment())
+	{
+		return NULL;
+	}
+	return Alloc(bytes);
+}
+
+void FutureThreadCache::Free(void * p)
+{
+	FUTURE_ASSERT(IsOwner());
+
+	*(void**)p = m_free;
+	m_free = p;
+	if(++m_count > FUTURE_THREAD_CACHE_MAGAZINE_SIZE)
+	{
+		Flush(FUTURE_THREAD_CACHE_BATCH_SIZE);
+	}
+}
+
+u8 FutureThreadCache::Priority()
+{
+	return 0;
+}
+
+bool FutureThreadCache::ShouldAllocate(FutureMemoryParam memParam)
+{
+	return memParam.m_bytes <= m_pool->BlockSize() && memParam.m_alignment <= m_pool->Alignment();
+}
+
+bool FutureThreadCache::UsesChunks()
+{
+	return true;
+}
+
+u32 FutureThreadCache::UsableSize(void * p)
+{
+	return m_pool->BlockSize();
+}
+
+u32 FutureThreadCache::Size()
+{
+	return m_count;
+}
+
+bool FutureThreadCache::IsOwner()
+{
+	return m_set == s_threadSet && s_threadGeneration == FutureAtomicLoad(&s_generation);
+}
+
+bool FutureThreadCache::Refill()
+{
+	void * blocks[FUTURE_THREAD_CACHE_BATCH_SIZE];
+	u32 count = m_pool->AllocBatch(blocks, FUTURE_THREAD_CACHE_BATCH_SIZE);
+
+	// link them backwards so they are handed out in the order the pool gave them
+	for(u32 i = count; i > 0; --i)
+	{
+		*(void**)blocks[i - 1] = m_free;
+		m_free = blocks[i - 1];
+	}
+	m_count += count;
+	return count > 0;
+}
+
+void FutureThreadCache::Flush(u32 count)
+{
+	void * blocks[FUTURE_THREAD_CACHE_BATCH_SIZE];
+	while(count > 0 && m_free)
+	{
+		u32 batch = 0;
+		while(batch < FUTURE_THREAD_CACHE_BATCH_SIZE && batch < count && m_free)
+		{
+			blocks[batch++] = m_free;
+			m_free = *(void**)m_free;
+		}
+		m_count -= batch;
+		count -= batch;
+		m_pool->FreeBatch(blocks, batch);
+	}
+}
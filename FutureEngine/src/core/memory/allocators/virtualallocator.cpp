@@ -0,0 +1,566 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+
+/*
+*	Implementation of FutureVirtualAllocator
+*
+*	The reserved range is split into 64KB granules with a bit each in m_usedMap. Regions are
+*	found by a first fit search for a run of free granules, which is slow next to the heaps but
+*	regions are large and only allocated when a heap or pool grows.
+*/
+
+#include <future/core/debug/debug.h>
+#include <future/core/debug/trace.h>
+#include <future/core/memory/allocators/virtualallocator.h>
+#include <future/core/memory/memory.h>
+#include <future/core/memory/memoryStatistics.h>
+#include <string.h>
+
+#if FUTURE_PLATFORM_WINDOWS
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <unistd.h>
+#	include <stdio.h>
+#endif
+
+// Set in m_regions for regions mapped with MAP_HUGETLB, they have to be unmapped to give the huge pages back
+#define FUTURE_VIRTUAL_REGION_HUGETLB	0x80000000
+#define FUTURE_VIRTUAL_REGION_COUNT		0x7FFFFFFF
+
+#define FUTURE_VIRTUAL_HUGE_GRANULES	(FUTURE_VIRTUAL_HUGE_PAGE_SIZE >> FUTURE_VIRTUAL_GRANULE_SHIFT)
+
+/*******************************************************************/
+// Platform
+
+// Reserves address space without committing it, aligned to alignment bytes
+static u8 * FutureVirtualReserve(size_t bytes, size_t alignment)
+{
+#if FUTURE_PLATFORM_WINDOWS
+	// VirtualAlloc reservations are already aligned to 64KB
+	for(u32 attempt = 0; attempt < 8; ++attempt)
+	{
+		// reserve extra, then reserve again at the aligned address inside it once it is released
+		u8 * p = (u8*)VirtualAlloc(NULL, bytes + alignment, MEM_RESERVE, PAGE_NOACCESS);
+		if(!p)
+		{
+			return NULL;
+		}
+		VirtualFree(p, 0, MEM_RELEASE);
+		u8 * aligned = (u8*)(((size_t)p + alignment - 1) & ~(alignment - 1));
+		p = (u8*)VirtualAlloc(aligned, bytes, MEM_RESERVE, PAGE_NOACCESS);
+		if(p)
+		{
+			return p;
+		}
+	}
+	return NULL;
+#else
+	u8 * p = (u8*)mmap(NULL, bytes + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(p == (u8*)MAP_FAILED)
+	{
+		return NULL;
+	}
+	// trim the range down to the aligned part
+	u8 * aligned = (u8*)(((size_t)p + alignment - 1) & ~(alignment - 1));
+	if(aligned > p)
+	{
+		munmap(p, aligned - p);
+	}
+	size_t after = (p + bytes + alignment) - (aligned + bytes);
+	if(after > 0)
+	{
+		munmap(aligned + bytes, after);
+	}
+	return aligned;
+#endif
+}
+
+static void FutureVirtualRelease(u8 * p, size_t bytes)
+{
+#if FUTURE_PLATFORM_WINDOWS
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	munmap(p, bytes);
+#endif
+}
+
+static u32 FutureVirtualPageSize()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (u32)info.dwPageSize;
+#else
+	long size = sysconf(_SC_PAGESIZE);
+	return size > 0 ? (u32)size : 4096;
+#endif
+}
+
+// True if the system has huge pages set aside that MAP_HUGETLB can map
+static bool FutureVirtualHasHugeTLB()
+{
+#if FUTURE_PLATFORM_LINUX && defined(MAP_HUGETLB)
+	FILE * file = fopen("/proc/sys/vm/nr_hugepages", "r");
+	if(!file)
+	{
+		return false;
+	}
+	unsigned long pages = 0;
+	if(fscanf(file, "%lu", &pages) != 1)
+	{
+		pages = 0;
+	}
+	fclose(file);
+	return pages > 0;
+#else
+	return false;
+#endif
+}
+
+/*******************************************************************/
+// Virtual Allocator
+
+FutureVirtualAllocator::FutureVirtualAllocator(u64 reserveBytes, bool hugePages)
+	: m_base(NULL),
+	  m_granules(0),
+	  m_usedGranules(0),
+	  m_searchStart(0),
+	  m_pageSize(FutureVirtualPageSize()),
+	  m_hugePages(false),
+	  m_hugeTLB(false),
+	  m_usedMap(NULL),
+	  m_regions(NULL)
+{
+	FUTURE_ASSERT(reserveBytes > 0);
+
+#if FUTURE_PLATFORM_LINUX && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+	m_hugePages = hugePages;
+	m_hugeTLB = hugePages && FutureVirtualHasHugeTLB();
+#endif
+	if(m_hugePages)
+	{
+		m_pageSize = FUTURE_VIRTUAL_HUGE_PAGE_SIZE;
+	}
+
+	u64 granules = (reserveBytes + FUTURE_VIRTUAL_GRANULE_SIZE - 1) >> FUTURE_VIRTUAL_GRANULE_SHIFT;
+	if(granules > (((size_t)-1) >> FUTURE_VIRTUAL_GRANULE_SHIFT) - FUTURE_VIRTUAL_HUGE_GRANULES || granules > FUTURE_VIRTUAL_REGION_COUNT)
+	{
+		FUTURE_LOG_ERROR(L"Virtual Allocator can't reserve %llu bytes", (unsigned long long)reserveBytes);
+		return;
+	}
+
+	// aligned to a huge page so huge regions only need to line up with the start of the range
+	m_base = FutureVirtualReserve((size_t)granules << FUTURE_VIRTUAL_GRANULE_SHIFT, FUTURE_VIRTUAL_HUGE_PAGE_SIZE);
+	if(!m_base)
+	{
+		FUTURE_LOG_ERROR(L"Virtual Allocator failed to reserve %llu bytes of address space", (unsigned long long)reserveBytes);
+		return;
+	}
+
+	u32 words = (u32)((granules + 63) / 64);
+	m_usedMap = (u64*)malloc(sizeof(u64) * words);
+	m_regions = (u32*)malloc(sizeof(u32) * (size_t)granules);
+	if(!m_usedMap || !m_regions)
+	{
+		FUTURE_LOG_ERROR(L"Virtual Allocator failed to allocate its region map");
+		free(m_usedMap);
+		free(m_regions);
+		m_usedMap = NULL;
+		m_regions = NULL;
+		FutureVirtualRelease(m_base, (size_t)granules << FUTURE_VIRTUAL_GRANULE_SHIFT);
+		m_base = NULL;
+		return;
+	}
+	memset(m_usedMap, 0, sizeof(u64) * words);
+	memset(m_regions, 0, sizeof(u32) * (size_t)granules);
+	m_granules = (u32)granules;
+
+	// the bits past the end of the range are never free
+	for(u32 g = m_granules; g < words * 64; ++g)
+	{
+		m_usedMap[g / 64] |= (u64)1 << (g % 64);
+	}
+}
+
+FutureVirtualAllocator::~FutureVirtualAllocator()
+{
+	if(m_usedGranules > 0)
+	{
+		FUTURE_LOG_WARNING(L"Destroying Virtual Allocator with %u granules of 64KB still in use", m_usedGranules);
+	}
+	if(m_base)
+	{
+		FutureVirtualRelease(m_base, (size_t)m_granules << FUTURE_VIRTUAL_GRANULE_SHIFT);
+	}
+	free(m_usedMap);
+	free(m_regions);
+	m_base = NULL;
+	m_usedMap = NULL;
+	m_regions = NULL;
+	m_granules = 0;
+}
+
+void * FutureVirtualAllocator::Alloc(u32 bytes)
+{
+	return AllocAligned(bytes, FUTURE_VIRTUAL_GRANULE_SIZE);
+}
+
+void * FutureVirtualAllocator::AllocAligned(u32 bytes, u32 alignment)
+{
+	FUTURE_TRACE_SCOPE("FutureVirtualAllocator::AllocAligned");
+	FUTURE_ASSERT_MSG((alignment & (alignment - 1)) == 0, L"Alignment must be a power of two");
+	if(!m_base || bytes == 0)
+	{
+		return NULL;
+	}
+
+	size_t size = ((size_t)bytes + FUTURE_VIRTUAL_GRANULE_SIZE - 1) & ~(size_t)(FUTURE_VIRTUAL_GRANULE_SIZE - 1);
+	u32 count = (u32)(size >> FUTURE_VIRTUAL_GRANULE_SHIFT);
+	bool huge = m_hugePages && size >= FUTURE_VIRTUAL_HUGE_PAGE_SIZE;
+	if(huge && alignment < FUTURE_VIRTUAL_HUGE_PAGE_SIZE)
+	{
+		alignment = FUTURE_VIRTUAL_HUGE_PAGE_SIZE;
+	}
+	u32 align = alignment > FUTURE_VIRTUAL_GRANULE_SIZE ? alignment >> FUTURE_VIRTUAL_GRANULE_SHIFT : 1;
+
+	Lock();
+	u32 first = ClaimGranules(count, align);
+	Unlock();
+
+	if(first == m_granules)
+	{
+		FUTURE_LOG_ERROR(L"Virtual Allocator is out of address space for a region of %u bytes", bytes);
+		return NULL;
+	}
+	u8 * p = m_base + ((size_t)first << FUTURE_VIRTUAL_GRANULE_SHIFT);
+	u32 flags = 0;
+
+#if FUTURE_PLATFORM_WINDOWS
+	if(!VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE))
+	{
+		FUTURE_LOG_ERROR(L"Virtual Allocator failed to commit %u bytes", (u32)size);
+		Lock();
+		ReleaseGranules(first, count);
+		Unlock();
+		return NULL;
+	}
+#else
+	bool committed = false;
+#	if defined(MAP_HUGETLB)
+	// huge pages set aside by the system are never split or swapped, but come in whole pages only
+	if(huge && m_hugeTLB && (size & (FUTURE_VIRTUAL_HUGE_PAGE_SIZE - 1)) == 0)
+	{
+		if(mmap(p, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED)
+		{
+			committed = true;
+			flags = FUTURE_VIRTUAL_REGION_HUGETLB;
+		}
+		else
+		{
+			// the pool is used up, map the range again with small pages and stop asking for huge ones
+			FUTURE_LOG_WARNING(L"Virtual Allocator ran out of huge pages, falling back to transparent huge pages");
+			m_hugeTLB = false;
+			committed = mmap(p, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED;
+		}
+	}
+#	endif
+	if(!committed)
+	{
+		committed = mprotect(p, size, PROT_READ | PROT_WRITE) == 0;
+	}
+	if(!committed)
+	{
+		FUTURE_LOG_ERROR(L"Virtual Allocator failed to commit %u bytes", (u32)size);
+		Lock();
+		ReleaseGranules(first, count);
+		Unlock();
+		return NULL;
+	}
+#	if defined(MADV_HUGEPAGE)
+	if(huge && !flags)
+	{
+		madvise(p, size, MADV_HUGEPAGE);
+	}
+#	endif
+#endif
+
+	Lock();
+	m_regions[first] = count | flags;
+	Unlock();
+	return p;
+}
+
+void FutureVirtualAllocator::Free(void * p)
+{
+	FUTURE_ASSERT_MSG(Owns(p) && ((size_t)p & (FUTURE_VIRTUAL_GRANULE_SIZE - 1)) == 0, L"Freeing a region that does not belong to this allocator");
+	u32 first = (u32)(((u8*)p - m_base) >> FUTURE_VIRTUAL_GRANULE_SHIFT);
+
+	Lock();
+	u32 region = m_regions[first];
+	m_regions[first] = 0;
+	Unlock();
+
+	u32 count = region & FUTURE_VIRTUAL_REGION_COUNT;
+	FUTURE_ASSERT_MSG(count > 0, L"Freeing a region that is not allocated");
+	size_t size = (size_t)count << FUTURE_VIRTUAL_GRANULE_SHIFT;
+
+#if FUTURE_PLATFORM_WINDOWS
+	VirtualFree(p, size, MEM_DECOMMIT);
+#else
+	if(region & FUTURE_VIRTUAL_REGION_HUGETLB)
+	{
+		// mapping over the range hands the huge pages back and leaves it reserved again
+		mmap(p, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+	}
+	else
+	{
+		madvise(p, size, MADV_DONTNEED);
+		mprotect(p, size, PROT_NONE);
+	}
+#endif
+
+	Lock();
+	ReleaseGranules(first, count);
+	Unlock();
+}
+
+bool FutureVirtualAllocator::Resize(void * p, u32 bytes)
+{
+	FUTURE_ASSERT_MSG(Owns(p) && ((size_t)p & (FUTURE_VIRTUAL_GRANULE_SIZE - 1)) == 0, L"Resizing a region that does not belong to this allocator");
+	u32 first = (u32)(((u8*)p - m_base) >> FUTURE_VIRTUAL_GRANULE_SHIFT);
+	u32 count = (u32)(((size_t)bytes + FUTURE_VIRTUAL_GRANULE_SIZE - 1) >> FUTURE_VIRTUAL_GRANULE_SHIFT);
+
+	Lock();
+	u32 region = m_regions[first];
+	u32 current = region & FUTURE_VIRTUAL_REGION_COUNT;
+	FUTURE_ASSERT_MSG(current > 0, L"Resizing a region that is not allocated");
+	if(count <= current)
+	{
+		Unlock();
+		return true;
+	}
+	// huge pages set aside by the system can't be added to with mprotect
+	if((region & FUTURE_VIRTUAL_REGION_HUGETLB) || count > m_granules - first)
+	{
+		Unlock();
+		return false;
+	}
+	for(u32 g = first + current; g < first + count; ++g)
+	{
+		if(m_usedMap[g / 64] & ((u64)1 << (g % 64)))
+		{
+			Unlock();
+			return false;
+		}
+	}
+	for(u32 g = first + current; g < first + count; ++g)
+	{
+		m_usedMap[g / 64] |= (u64)1 << (g % 64);
+	}
+	m_usedGranules += count - current;
+	m_regions[first] = count;
+	Unlock();
+
+	u8 * grown = (u8*)p + ((size_t)current << FUTURE_VIRTUAL_GRANULE_SHIFT);
+	size_t size = (size_t)(count - current) << FUTURE_VIRTUAL_GRANULE_SHIFT;
+#if FUTURE_PLATFORM_WINDOWS
+	bool committed = VirtualAlloc(grown, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+	bool committed = mprotect(grown, size, PROT_READ | PROT_WRITE) == 0;
+#	if defined(MADV_HUGEPAGE)
+	if(committed && m_hugePages && ((size_t)count << FUTURE_VIRTUAL_GRANULE_SHIFT) >= FUTURE_VIRTUAL_HUGE_PAGE_SIZE)
+	{
+		madvise(p, (size_t)count << FUTURE_VIRTUAL_GRANULE_SHIFT, MADV_HUGEPAGE);
+	}
+#	endif
+#endif
+	if(!committed)
+	{
+		Lock();
+		m_regions[first] = region;
+		ReleaseGranules(first + current, count - current);
+		Unlock();
+		return false;
+	}
+	return true;
+}
+
+u32 FutureVirtualAllocator::UsableSize(void * p)
+{
+	FUTURE_ASSERT(Owns(p));
+	u32 first = (u32)(((u8*)p - m_base) >> FUTURE_VIRTUAL_GRANULE_SHIFT);
+	size_t size = (size_t)(m_regions[first] & FUTURE_VIRTUAL_REGION_COUNT) << FUTURE_VIRTUAL_GRANULE_SHIFT;
+	return size < 0xFFFFFFFF ? (u32)size : 0xFFFFFFFF;
+}
+
+void FutureVirtualAllocator::Decommit(void * p, u32 bytes)
+{
+	FUTURE_ASSERT(Owns(p));
+	// only whole pages inside the range
+	size_t start = ((size_t)p + m_pageSize - 1) & ~(size_t)(m_pageSize - 1);
+	size_t end = ((size_t)p + bytes) & ~(size_t)(m_pageSize - 1);
+	if(end <= start)
+	{
+		return;
+	}
+
+#if FUTURE_PLATFORM_WINDOWS
+	// decommitting and committing again gives the pages back and leaves zeroed pages behind
+	VirtualFree((void*)start, end - start, MEM_DECOMMIT);
+	VirtualAlloc((void*)start, end - start, MEM_COMMIT, PAGE_READWRITE);
+#else
+	madvise((void*)start, end - start, MADV_DONTNEED);
+#endif
+}
+
+// allocations smaller than this are better off in a heap
+u8 FutureVirtualAllocator::Priority()
+{
+	return 250;
+}
+
+bool FutureVirtualAllocator::ShouldAllocate(FutureMemoryParam memParam)
+{
+	return m_base && memParam.m_bytes >= FUTURE_VIRTUAL_MIN_ALLOCATION;
+}
+
+bool FutureVirtualAllocator::GetFragmentation(FutureMemoryFragmentation & fragmentation)
+{
+	fragmentation.m_heaps = 1;
+	fragmentation.m_totalBytes = 0;
+	fragmentation.m_usedBytes = 0;
+	fragmentation.m_usedBlocks = 0;
+	fragmentation.m_freeBytes = 0;
+	fragmentation.m_freeBlocks = 0;
+	fragmentation.m_largestFreeBlock = 0;
+	fragmentation.m_fragmentation = 0.0f;
+
+	// the counts are in granules until the end, the reserved range may not fit in 32 bits of bytes
+	u64 used = 0;
+	u64 unused = 0;
+	u64 largest = 0;
+	u64 run = 0;
+
+	Lock();
+	for(u32 g = 0; g <= m_granules; ++g)
+	{
+		if(g < m_granules && !(m_usedMap[g / 64] & ((u64)1 << (g % 64))))
+		{
+			++run;
+			continue;
+		}
+		if(run > 0)
+		{
+			++fragmentation.m_freeBlocks;
+			unused += run;
+			largest = run > largest ? run : largest;
+			run = 0;
+		}
+		if(g < m_granules && m_regions[g])
+		{
+			++fragmentation.m_usedBlocks;
+			used += m_regions[g] & FUTURE_VIRTUAL_REGION_COUNT;
+		}
+	}
+	Unlock();
+
+	const u64 limit = 0xFFFFFFFF;
+	used <<= FUTURE_VIRTUAL_GRANULE_SHIFT;
+	unused <<= FUTURE_VIRTUAL_GRANULE_SHIFT;
+	largest <<= FUTURE_VIRTUAL_GRANULE_SHIFT;
+	fragmentation.m_usedBytes = (u32)(used < limit ? used : limit);
+	fragmentation.m_freeBytes = (u32)(unused < limit ? unused : limit);
+	fragmentation.m_largestFreeBlock = (u32)(largest < limit ? largest : limit);
+	fragmentation.m_totalBytes = (u32)(used + unused < limit ? used + unused : limit);
+	if(unused > 0)
+	{
+		fragmentation.m_fragmentation = 1.0f - (f32)((f64)largest / (f64)unused);
+	}
+	return true;
+}
+
+bool FutureVirtualAllocator::Owns(const void * p)
+{
+	return m_base && (const u8*)p >= m_base && (const u8*)p < m_base + ((size_t)m_granules << FUTURE_VIRTUAL_GRANULE_SHIFT);
+}
+
+u64 FutureVirtualAllocator::BytesCommitted()
+{
+	return (u64)m_usedGranules << FUTURE_VIRTUAL_GRANULE_SHIFT;
+}
+
+u64 FutureVirtualAllocator::BytesReserved()
+{
+	return (u64)m_granules << FUTURE_VIRTUAL_GRANULE_SHIFT;
+}
+
+bool FutureVirtualAllocator::UsesHugePages()
+{
+	return m_hugePages;
+}
+
+u32 FutureVirtualAllocator::ClaimGranules(u32 count, u32 align)
+{
+	if(count > m_granules)
+	{
+		return m_granules;
+	}
+
+	u32 first = (m_searchStart + align - 1) & ~(align - 1);
+	while(first <= m_granules - count)
+	{
+		// look for a used granule in the run, start again after it if there is one
+		u32 g = first;
+		for(; g < first + count; ++g)
+		{
+			if(m_usedMap[g / 64] & ((u64)1 << (g % 64)))
+			{
+				break;
+			}
+		}
+		if(g == first + count)
+		{
+			for(g = first; g < first + count; ++g)
+			{
+				m_usedMap[g / 64] |= (u64)1 << (g % 64);
+			}
+			if(first == m_searchStart)
+			{
+				m_searchStart = first + count;
+			}
+			m_usedGranules += count;
+			return first;
+		}
+		first = (g + align) & ~(align - 1);
+	}
+	return m_granules;
+}
+
+void FutureVirtualAllocator::ReleaseGranules(u32 first, u32 count)
+{
+	for(u32 g = first; g < first + count; ++g)
+	{
+		m_usedMap[g / 64] &= ~((u64)1 << (g % 64));
+	}
+	if(first < m_searchStart)
+	{
+		m_searchStart = first;
+	}
+	m_usedGranules -= count;
+}
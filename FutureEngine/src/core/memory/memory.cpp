@@ -27,13 +27,35 @@
 
 #include <future/core/object/threadsafeobject.h>
 #include <future/core/memory/allocators/allocator.h>
+#include <future/core/memory/allocators/chunk.h>
+#include <future/core/memory/allocators/frameallocator.h>
 #include <future/core/memory/allocators/mallocallocator.h>
 #include <future/core/memory/allocators/heapallocator.h>
 #include <future/core/memory/allocators/poolallocator.h>
+#include <future/core/memory/allocators/threadcache.h>
 #include <future/core/memory/memorystatistics.h>
+#include <future/core/memory/tracker/memoryprofiler.h>
 #include <future/core/memory/tracker/memorytracker.h>
+#include <future/core/thread/atomic/atomic.h>
 #include <future/core/utils/timer/timer.h>
 
+// Size class table granularity, pool block sizes are always a multiple of 16 bytes
+#define FUTURE_SIZE_CLASS_SHIFT		4
+// Largest allocation that is looked up in the size class table
+#ifndef FUTURE_SIZE_CLASS_MAX_BYTES
+#	define FUTURE_SIZE_CLASS_MAX_BYTES	4096
+#endif
+#define FUTURE_SIZE_CLASS_TABLE_SIZE	((FUTURE_SIZE_CLASS_MAX_BYTES >> FUTURE_SIZE_CLASS_SHIFT) + 1)
+
+// Set in FutureAllocHeader::m_allocator when the header sits in the alignment padding of an over aligned
+// block, m_allocatorData then holds the distance from the start of the block to the data
+#define FUTURE_HEADER_ALIGNED		((size_t)0x1)
+
+// Most pressure callbacks a single budget can have
+#ifndef FUTURE_MEMORY_MAX_PRESSURE_CALLBACKS
+#	define FUTURE_MEMORY_MAX_PRESSURE_CALLBACKS	8
+#endif
+
 /*******************************************************************/
 // Structure to keep track of memory allocators
 struct AllocatorList
@@ -42,6 +64,24 @@ struct AllocatorList
 	AllocatorList *		m_next;
 };
 
+/*******************************************************************/
+// A named memory budget, the counters are written by every thread that allocates from the budget
+struct MemoryBudget
+{
+	volatile s64		m_used;			// bytes handed out by the budget's allocators
+	volatile s32		m_softSignaled;	// set once the soft limit callbacks ran, cleared when the budget drops back under it
+	volatile s32		m_inCallback;	// set while a thread is calling the callbacks
+	u8					m_pad[FUTURE_CACHE_LINE_SIZE - sizeof(s64) - sizeof(s32) * 2];
+
+	u64					m_softLimit;
+	u64					m_hardLimit;
+	AllocatorList *		m_allocators;	// sorted by priority like the shared list
+
+	FutureMemoryPressureCallback	m_callbacks[FUTURE_MEMORY_MAX_PRESSURE_CALLBACKS];
+	void *							m_callbackData[FUTURE_MEMORY_MAX_PRESSURE_CALLBACKS];
+	u32								m_numCallbacks;
+};
+
 	
 /*******************************************************************/
 // Memory System
@@ -54,23 +94,54 @@ public:
 	void *					Alloc(const FutureMemoryParam & memParam);
 	void *					Track(const FutureMemoryParamDebug & memParam);
 	void					Free(void * p );
+	void *					Realloc(void * p, const FutureMemoryParam & memParam, const FutureMemoryParamDebug * debugParam);
 
 	u32						BytesForAllocation(const FutureMemoryParam & memParam);
-	void					AddAllocator(IFutureAllocator * allocator);
+	void					AddAllocator(IFutureAllocator * allocator, FutureMemoryBudgetID budget = FutureMemoryBudget_Default);
 	IFutureAllocator *		GetAllocator(int i);
+	u32						NumAllocators();
+	void					AddSizeClass(FuturePoolAllocator * pool);
 
 	IFutureAllocator *		GetBestAllocator(const FutureMemoryParam & memParam);
 	IFutureAllocator *		GetPreviousAllocator(void * p);
+	void *					AllocFrom(IFutureAllocator * allocator, u32 bytes, u32 alignment);
 	
 	FutureMemoryStatistics	GetStatistics();
 	
-	void					LogStatistics();
+	void					LogStatistics(FutureBufferedOutputStream * heapProfile);
 	void					LogAllocations();
 	void					LogAllocation(void *);
 
+	FutureMemoryFragmentation	GetFragmentation();
+	void						LogFragmentation();
+
 	AllocatorList *			m_allocators;
 	u32						m_currentMemoryUse;
 
+	// m_sizeClassTable[(bytes + 15) >> 4] is the size class for an allocation of bytes
+	u8						m_sizeClassTable[FUTURE_SIZE_CLASS_TABLE_SIZE];
+	u32						m_sizeClassMaxBytes;
+	// the first allocator that isn't a size class, allocations the table can't answer start looking here
+	AllocatorList *			m_fallback;
+
+	s32						SizeClassOf(IFutureAllocator * allocator);
+	void					BuildSizeClassTable();
+
+	MemoryBudget			m_budgets[FutureMemoryBudget_Max];
+	// allocators added to budgets other than the default, while there are none the budgets are never looked at
+	u32						m_numBudgetAllocators;
+
+	FutureMemoryBudgetID	BudgetOf(IFutureAllocator * allocator);
+	u64						BudgetUsage(FutureMemoryBudgetID budget);
+	bool					ReserveBudget(FutureMemoryBudgetID budget, u64 bytes);
+	void					ChargeBudget(FutureMemoryBudgetID budget, s64 bytes);
+	void					CheckSoftLimit(FutureMemoryBudgetID budget, s64 used, s64 bytes);
+	bool					ReserveAllocation(FutureMemoryBudgetID budget, u64 bytes);
+	void					ChargeAllocation(FutureMemoryBudgetID budget, s64 bytes);
+	void					CallPressureCallbacks(FutureMemoryBudgetID budget, FutureMemoryPressure pressure, u64 bytes);
+	void					SetBudgetLimits(FutureMemoryBudgetID budget, u64 softBytes, u64 hardBytes);
+	void					AddPressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data);
+	void					RemovePressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data);
 };
 
 MemorySystem * 	memory;
@@ -92,22 +163,28 @@ void FutureMemory::CreateMemory()
 
 void FutureMemory::PostConfigInit()
 {
-	if(FutureCoreConfig::TrackMemory())
-	{
-		futureHeaderSize = 48;
-	}
-
+	// the default pools are the size classes for each thread's cache
 	for(u32 i = 0; i < FutureCoreConfig::DefaultMemoryPoolAllcoators(); ++i)
 	{
-		memory->AddAllocator(new FuturePoolAllocator(FutureCoreConfig::DefaultMemoryPoolAllocatorBlockSizes()[i], FutureCoreConfig::DefaultMemoryPoolAllocatorPoolSizes()[i]));
+		memory->AddSizeClass(new FuturePoolAllocator(FutureCoreConfig::DefaultMemoryPoolAllocatorBlockSizes()[i], FutureCoreConfig::DefaultMemoryPoolAllocatorPoolSizes()[i]));
 	}
 	memory->AddAllocator(new FutureHeapAllocator(FutureCoreConfig::DefaultMemoryHeapSize()));
+	if(FutureCoreConfig::DefaultFrameArenaSize() > 0)
+	{
+		memory->AddAllocator(new FutureFrameAllocator(FutureCoreConfig::DefaultFrameArenaSize()));
+	}
+	if(FutureCoreConfig::ForceInternalMemoryLimit())
+	{
+		memory->SetBudgetLimits(FutureMemoryBudget_Default, 0, FutureCoreConfig::InternalMemoryLimit());
+	}
 }
 
 void FutureMemory::DestroyMemory()
 {
 	FUTURE_ASSERT(memory != NULL);
+	FutureThreadCache::Shutdown();
 	FutureMemoryTracker::DestroyInstance();
+	FutureMemoryProfiler::Shutdown();
 	delete memory;
 	memory = NULL;
 }
@@ -124,6 +201,14 @@ void FutureMemory::Free(void * p)
 {
 	memory->Free(p);
 }
+void * FutureMemory::Realloc(void * p, const FutureMemoryParam & memParam)
+{
+	return memory->Realloc(p, memParam, NULL);
+}
+void * FutureMemory::TrackRealloc(void * p, const FutureMemoryParamDebug & memParam)
+{
+	return memory->Realloc(p, memParam, &memParam);
+}
 u32	FutureMemory::BytesForAllocation(const FutureMemoryParam & memParam)
 {
 	return memory->BytesForAllocation(memParam);
@@ -132,17 +217,57 @@ void FutureMemory::AddAllocator(IFutureAllocator * allocator)
 {
 	memory->AddAllocator(allocator);
 }
+void FutureMemory::AddAllocator(IFutureAllocator * allocator, FutureMemoryBudgetID budget)
+{
+	memory->AddAllocator(allocator, budget);
+}
+void FutureMemory::AddSizeClass(FuturePoolAllocator * pool)
+{
+	memory->AddSizeClass(pool);
+}
+void FutureMemory::SetBudgetLimits(FutureMemoryBudgetID budget, u64 softBytes, u64 hardBytes)
+{
+	memory->SetBudgetLimits(budget, softBytes, hardBytes);
+}
+void FutureMemory::AddPressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data)
+{
+	memory->AddPressureCallback(budget, callback, data);
+}
+void FutureMemory::RemovePressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data)
+{
+	memory->RemovePressureCallback(budget, callback, data);
+}
+u64 FutureMemory::BudgetUsage(FutureMemoryBudgetID budget)
+{
+	return memory->BudgetUsage(budget);
+}
+void FutureMemory::LowMemory()
+{
+	FUTURE_LOG_WARNING(L"The system is low on memory");
+	for(u32 budget = 0; budget < FutureMemoryBudget_Max; ++budget)
+	{
+		memory->CallPressureCallbacks((FutureMemoryBudgetID)budget, FutureMemoryPressure_Critical, 0);
+	}
+}
+IFutureAllocator * FutureMemory::AllocatorOf(void * p)
+{
+	return memory->GetPreviousAllocator(p);
+}
 IFutureAllocator * FutureMemory::GetAllocator(u32 i)
 {
 	return memory->GetAllocator(i);
 }
+u32 FutureMemory::NumAllocators()
+{
+	return memory->NumAllocators();
+}
 FutureMemoryStatistics FutureMemory::GetStatistics()
 {
 	return memory->GetStatistics();
 }
-void FutureMemory::LogStatistics()
+void FutureMemory::LogStatistics(FutureBufferedOutputStream * heapProfile)
 {
-	return memory->LogStatistics();
+	return memory->LogStatistics(heapProfile);
 }
 void FutureMemory::LogAllocations()
 {
@@ -152,6 +277,14 @@ void FutureMemory::LogAllocation(void * p)
 {
 	return memory->LogAllocation(p);
 }
+FutureMemoryFragmentation FutureMemory::GetFragmentation()
+{
+	return memory->GetFragmentation();
+}
+void FutureMemory::LogFragmentation()
+{
+	return memory->LogFragmentation();
+}
 
 u32 FutureMemory::HeaderSize()
 {
@@ -162,62 +295,262 @@ inline static void * DataFromHeader(FutureAllocHeader * header)
 	{ return (void *)(((u8*)header) + FutureMemory::HeaderSize()); }
 inline static FutureAllocHeader * HeaderFromData(void * p)
 	{ return (FutureAllocHeader *)((u8*)p - FutureMemory::HeaderSize()); }
+inline static IFutureAllocator * AllocatorFromHeader(FutureAllocHeader * header)
+	{ return (IFutureAllocator *)((size_t)header->m_allocator & ~FUTURE_HEADER_ALIGNED); }
+// The address the allocator returned for the block holding p
+inline static void * BlockFromData(void * p)
+{
+	FutureAllocHeader * header = HeaderFromData(p);
+	if((size_t)header->m_allocator & FUTURE_HEADER_ALIGNED)
+	{
+		return (u8*)p - header->m_allocatorData;
+	}
+	return header;
+}
+inline static void * BlockOf(IFutureAllocator * allocator, void * p)
+	{ return allocator->UsesChunks() ? p : BlockFromData(p); }
 
 
 /*******************************************************************/
 // Memory System functions
 void * MemorySystem::Alloc(const FutureMemoryParam & memParam)
 {
-	if(memParam.m_bytes <= 0 || 
-		(FutureCoreConfig::ForceInternalMemoryLimit() && (m_currentMemoryUse + memParam.m_bytes > FutureCoreConfig::InternalMemoryLimit()))
+	if(memParam.m_bytes <= 0)
 	{
 		return NULL;
 	}
 	IFutureAllocator * allocator = GetBestAllocator(memParam); // get the best allocator
-	void * p = allocator->Alloc((u32)BytesForAllocation(memParam)); // allocate enough bytes for the header
+	FutureMemoryBudgetID budget = BudgetOf(allocator);
+	bool tracked = allocator->TrackAllocations();
+	if(tracked && !ReserveAllocation(budget, memParam.m_bytes))
+	{
+		return NULL;
+	}
+	void * p = AllocFrom(allocator, memParam.m_bytes, memParam.m_alignment);
 	if(!p)
 	{
+		if(tracked)
+		{
+			ChargeAllocation(budget, -(s64)memParam.m_bytes);
+		}
 		FUTURE_LOG_E("Out of Memory for allocation of size %u", memParam.m_bytes);
 		return NULL;
 	}
-	FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(p);
-	header->m_allocator = allocator;
-	m_currentMemoryUse += memParam.m_bytes;
-	return DataFromHeader(header);
+	if(tracked)
+	{
+		// the budgets count what the allocator actually handed out
+		ChargeAllocation(budget, (s64)allocator->UsableSize(BlockOf(allocator, p)) - (s64)memParam.m_bytes);
+	}
+	return p;
 }
 
 void * MemorySystem::Track(const FutureMemoryParamDebug & memParam)
 {
-	if(memParam.m_bytes <= 0 || 
-		(FutureCoreConfig::ForceInternalMemoryLimit() && (m_currentMemoryUse + memParam.m_bytes > FutureCoreConfig::InternalMemoryLimit()))
+	if(memParam.m_bytes <= 0)
 	{
 		return NULL;
 	}
-	f32 time = FutureTimer::CurrentTime();
+	f32 time = FutureCoreConfig::TrackMemory() ? FutureTimer::CurrentTime() : 0.0f;
 	IFutureAllocator * allocator = GetBestAllocator(memParam); // get the best allocator
-	void * p = allocator->Alloc((u32)BytesForAllocation(memParam)); // allocate enough bytes for the header
+	FutureMemoryBudgetID budget = BudgetOf(allocator);
+	bool tracked = allocator->TrackAllocations();
+	if(tracked && !ReserveAllocation(budget, memParam.m_bytes))
+	{
+		return NULL;
+	}
+	void * p = AllocFrom(allocator, memParam.m_bytes, memParam.m_alignment);
 	if(!p)
 	{
+		if(tracked)
+		{
+			ChargeAllocation(budget, -(s64)memParam.m_bytes);
+		}
 		FUTURE_LOG_E("Out of Memory for allocation of size %u", memParam.m_bytes);
 		return NULL;
 	}
-	m_currentMemoryUse += memParam.m_bytes;
-	FutureAllocHeaderDebug * header = reinterpret_cast<FutureAllocHeaderDebug *>(p);
-	header->m_allocator = allocator;
+	if(!tracked)
+	{
+		return p;
+	}
 
-	FutureMemoryTracker::GetInstance()->Track(memParam, header, time);
+	ChargeAllocation(budget, (s64)allocator->UsableSize(BlockOf(allocator, p)) - (s64)memParam.m_bytes);
+	FutureMemoryTracker::GetInstance()->Track(memParam, p, time);
+	FutureMemoryProfiler::RecordAllocation(memParam, p);
 
-	return DataFromHeader(header);
+	return p;
 }
 
 void MemorySystem::Free(void * p)
 {
-	FutureMemoryTracker::GetInstance()->Untrack(HeaderFromData(p));
+	// blocks without a header are found through the chunk they live in
+	FutureMemoryChunk * chunk = FutureMemoryChunk::Find(p);
+	IFutureAllocator * allocator = chunk ? chunk->m_owner : AllocatorFromHeader(HeaderFromData(p));
+	if(allocator->TrackAllocations())
+	{
+		FutureMemoryTracker::GetInstance()->Untrack(p);
+		FutureMemoryProfiler::RecordFree(p);
+		ChargeAllocation(BudgetOf(allocator), -(s64)allocator->UsableSize(chunk ? p : BlockFromData(p)));
+	}
+
+	if(!chunk)
+	{
+		allocator->Free(BlockFromData(p));
+	}
+	else if(chunk->m_sizeClass != FUTURE_NO_SIZE_CLASS)
+	{
+		// size class blocks go to the calling thread's cache, whichever thread allocated them
+		FutureThreadCache::GetCache(chunk->m_sizeClass)->Free(p);
+	}
+	else
+	{
+		allocator->Free(p);
+	}
+}
+
+void * MemorySystem::Realloc(void * p, const FutureMemoryParam & memParam, const FutureMemoryParamDebug * debugParam)
+{
+	if(!p)
+	{
+		return debugParam ? Track(*debugParam) : Alloc(memParam);
+	}
+	if(memParam.m_bytes == 0)
+	{
+		Free(p);
+		return NULL;
+	}
+
+	FutureMemoryChunk * chunk = FutureMemoryChunk::Find(p);
+	IFutureAllocator * allocator = chunk ? chunk->m_owner : AllocatorFromHeader(HeaderFromData(p));
+	void * block = chunk ? p : BlockFromData(p);
+	u32 offset = (u32)((u8*)p - (u8*)block);
+	bool paddedHeader = !chunk && ((size_t)HeaderFromData(p)->m_allocator & FUTURE_HEADER_ALIGNED);
+	u32 alignment = memParam.m_alignment > FUTURE_DEFAULT_ALIGNMENT ? memParam.m_alignment : FUTURE_DEFAULT_ALIGNMENT;
+	bool tracked = allocator->TrackAllocations();
+	FutureMemoryBudgetID budget = tracked ? BudgetOf(allocator) : FutureMemoryBudget_Default;
+
+	// the block can only stay with its allocator if no other one was asked for and it is aligned well enough
+	if((!memParam.m_allocator || memParam.m_allocator == allocator) && ((size_t)p & (alignment - 1)) == 0)
+	{
+		// growing counts against the block's budget the same as a new allocation would
+		u32 oldUsable = tracked ? allocator->UsableSize(block) : 0;
+		s64 reserved = tracked && offset + memParam.m_bytes > oldUsable ? (s64)(offset + memParam.m_bytes - oldUsable) : 0;
+		if(reserved > 0 && !ReserveAllocation(budget, (u64)reserved))
+		{
+			return NULL;
+		}
+
+		f32 time = debugParam && FutureCoreConfig::TrackMemory() ? FutureTimer::CurrentTime() : 0.0f;
+		void * moved = NULL;
+		if(allocator->Resize(block, offset + memParam.m_bytes))
+		{
+			moved = p;
+		}
+		// an over aligned block keeps its header in the padding, moving it with the allocator would lose the alignment
+		else if(!paddedHeader)
+		{
+			// the old address may be handed out again as soon as the allocator moves the block
+			if(tracked)
+			{
+				FutureMemoryTracker::GetInstance()->Untrack(p);
+				FutureMemoryProfiler::RecordFree(p);
+			}
+			void * newBlock = allocator->Realloc(block, offset + memParam.m_bytes);
+			moved = newBlock ? (u8*)newBlock + offset : NULL;
+			if(!moved && tracked && debugParam)
+			{
+				FutureMemoryTracker::GetInstance()->Track(*debugParam, p, time);
+				FutureMemoryProfiler::RecordAllocation(*debugParam, p);
+			}
+		}
+		if(tracked)
+		{
+			// swap the reservation for the actual change, or give it back if the block couldn't be kept
+			ChargeAllocation(budget, (moved ? (s64)allocator->UsableSize((u8*)moved - offset) - (s64)oldUsable : 0) - reserved);
+		}
+		if(moved)
+		{
+			if(tracked && debugParam)
+			{
+				FutureMemoryTracker::GetInstance()->Untrack(moved);
+				FutureMemoryTracker::GetInstance()->Track(*debugParam, moved, time);
+				FutureMemoryProfiler::RecordFree(moved);
+				FutureMemoryProfiler::RecordAllocation(*debugParam, moved);
+			}
+			return moved;
+		}
+	}
 
-	IFutureAllocator * allocator = GetPreviousAllocator(p);
-	allocator->Free(HeaderFromData(p));
+	// copy as much of the old block as there is, blocks in chunks whose size isn't known are copied up
+	// to the end of their chunk, which may copy bytes past the block but never outside the chunk
+	u32 usable = allocator->UsableSize(block);
+	if(usable == 0 && !chunk)
+	{
+		FUTURE_LOG_ERROR(L"Can't reallocate a block from an allocator that doesn't know the size of its blocks");
+		return NULL;
+	}
+	u32 oldBytes = usable > 0 ? usable - offset : (u32)(chunk->End() - (u8*)p);
 
-	m_currentMemoryUse -= memParam.m_bytes;
+	// a block that was over aligned stays that way unless a larger alignment was asked for
+	void * newP = NULL;
+	u32 keepAlignment = paddedHeader && HeaderFromData(p)->m_allocatorData > alignment ? (u32)HeaderFromData(p)->m_allocatorData : memParam.m_alignment;
+	// and stays in its budget unless another one was asked for
+	FutureMemoryBudgetID keepBudget = memParam.m_budget != FutureMemoryBudget_Default ? memParam.m_budget : budget;
+	if(debugParam)
+	{
+		FutureMemoryParamDebug param = *debugParam;
+		param.m_alignment = keepAlignment;
+		param.m_budget = keepBudget;
+		newP = Track(param);
+	}
+	else
+	{
+		FutureMemoryParam param = memParam;
+		param.m_alignment = keepAlignment;
+		param.m_budget = keepBudget;
+		newP = Alloc(param);
+	}
+	if(!newP)
+	{
+		return NULL;
+	}
+	memcpy(newP, p, oldBytes < memParam.m_bytes ? oldBytes : memParam.m_bytes);
+	Free(p);
+	return newP;
+}
+
+// Allocates from the allocator, adding a header unless the allocator uses chunks
+void * MemorySystem::AllocFrom(IFutureAllocator * allocator, u32 bytes, u32 alignment)
+{
+	FUTURE_ASSERT_MSG((alignment & (alignment - 1)) == 0, L"Alignment must be a power of two");
+	if(alignment > FUTURE_DEFAULT_ALIGNMENT)
+	{
+		if(allocator->UsesChunks())
+		{
+			return allocator->AllocAligned(bytes, alignment);
+		}
+		// the block is aligned and the data starts one alignment into it, the header goes in the padding
+		u8 * block = (u8*)allocator->AllocAligned(alignment + bytes, alignment);
+		if(!block)
+		{
+			return NULL;
+		}
+		FutureAllocHeader * header = HeaderFromData(block + alignment);
+		header->m_allocator = (IFutureAllocator *)((size_t)allocator | FUTURE_HEADER_ALIGNED);
+		header->m_allocatorData = alignment;
+		return block + alignment;
+	}
+	if(allocator->UsesChunks())
+	{
+		return allocator->Alloc(bytes);
+	}
+	void * p = allocator->Alloc(FutureMemory::HeaderSize() + bytes); // allocate enough bytes for the header
+	if(!p)
+	{
+		return NULL;
+	}
+	FutureAllocHeader * header = reinterpret_cast<FutureAllocHeader *>(p);
+	header->m_allocator = allocator;
+	return DataFromHeader(header);
 }
 
 	
@@ -228,15 +561,40 @@ void MemorySystem::Free(void * p)
 // that returns true for ShouldAllocate
 IFutureAllocator * MemorySystem::GetBestAllocator(const FutureMemoryParam & memParam)
 {
-	if(memParam->m_allocator != NULL)
+	if(memParam.m_allocator != NULL)
+	{
+		return memParam.m_allocator;
+	}
+	// a budget's own allocators come first, the shared ones only get what they don't take
+	if(memParam.m_budget != FutureMemoryBudget_Default)
+	{
+		for(AllocatorList * a = m_budgets[memParam.m_budget].m_allocators; a; a = a->m_next)
+		{
+			if(a->m_allocator->ShouldAllocate(memParam))
+			{
+				return a->m_allocator;
+			}
+		}
+	}
+	// small allocations come from this thread's cache without walking the list or taking a lock
+	u32 bytes = memParam.m_bytes;
+	bool aligned = memParam.m_alignment > FUTURE_DEFAULT_ALIGNMENT;
+	if(bytes <= m_sizeClassMaxBytes)
 	{
-		return memParam->m_allocator;
+		u8 sizeClass = m_sizeClassTable[(bytes + (1 << FUTURE_SIZE_CLASS_SHIFT) - 1) >> FUTURE_SIZE_CLASS_SHIFT];
+		if(sizeClass != FUTURE_NO_SIZE_CLASS &&
+			(!aligned || FutureThreadCache::SizeClassPool(sizeClass)->Alignment() >= memParam.m_alignment))
+		{
+			return FutureThreadCache::GetCache(sizeClass);
+		}
 	}
 	if(!m_allocators)
 	{
 		return NULL;
 	}
-	AllocatorList* allocator = m_allocators;
+	// every allocator before the fallback is a size class that is too small, unless
+	// the allocation is over aligned and a larger size class is aligned well enough
+	AllocatorList* allocator = aligned ? m_allocators : m_fallback;
 	while(allocator && !allocator->m_allocator->ShouldAllocate(memParam))
 	{
 		allocator = allocator->m_next;
@@ -246,29 +604,33 @@ IFutureAllocator * MemorySystem::GetBestAllocator(const FutureMemoryParam & memP
 	{
 		return m_allocators->m_allocator;
 	}
+	if(aligned)
+	{
+		s32 sizeClass = SizeClassOf(allocator->m_allocator);
+		if(sizeClass >= 0)
+		{
+			return FutureThreadCache::GetCache(sizeClass);
+		}
+	}
 	return allocator->m_allocator;
 }
 
 // Get the allocator used to allocate this memory
 IFutureAllocator * MemorySystem::GetPreviousAllocator(void * p)
 {
-	FutureAllocHeader * header = (FutureAllocHeader *)HeaderFromData(p);
-	return header->m_allocator;
+	FutureMemoryChunk * chunk = FutureMemoryChunk::Find(p);
+	if(chunk)
+	{
+		return chunk->m_owner;
+	}
+	return AllocatorFromHeader(HeaderFromData(p));
 }
 
-void MemorySystem::AddAllocator(IFutureAllocator * allocator)
+void MemorySystem::AddAllocator(IFutureAllocator * allocator, FutureMemoryBudgetID budget)
 {
-	if(!m_allocators)
-	{
-		m_allocators = new AllocatorList;
-		m_currentMemoryUse += sizeof(AllocatorList);
-		m_currentMemoryUse += sizeof(allocator);
-		m_allocators->m_allocator = allocator;
-		m_allocators->m_next = NULL;
-		return;
-	}
+	AllocatorList ** list = budget == FutureMemoryBudget_Default ? &m_allocators : &m_budgets[budget].m_allocators;
 	AllocatorList * last = NULL;
-	for(AllocatorList* a = m_allocators; a; a = a->m_next)
+	for(AllocatorList* a = *list; a; a = a->m_next)
 	{
 		// check for duplicates
 		if(a->m_allocator == allocator)
@@ -298,8 +660,67 @@ void MemorySystem::AddAllocator(IFutureAllocator * allocator)
 	}
 	else
 	{
-		link->m_next = m_allocators;
-		m_allocators = link;
+		link->m_next = *list;
+		*list = link;
+	}
+
+	if(budget == FutureMemoryBudget_Default)
+	{
+		BuildSizeClassTable();
+	}
+	else
+	{
+		++m_numBudgetAllocators;
+	}
+}
+
+void MemorySystem::AddSizeClass(FuturePoolAllocator * pool)
+{
+	if(pool->BlockSize() > FUTURE_SIZE_CLASS_MAX_BYTES || !FutureThreadCache::AddSizeClass(pool))
+	{
+		FUTURE_LOG_WARNING(L"Pool allocator with %u byte blocks can't be a size class, it will be checked like any other allocator", pool->BlockSize());
+	}
+	AddAllocator(pool);
+}
+
+s32 MemorySystem::SizeClassOf(IFutureAllocator * allocator)
+{
+	for(u32 i = 0; i < FutureThreadCache::NumSizeClasses(); ++i)
+	{
+		if(FutureThreadCache::SizeClassPool(i) == allocator)
+		{
+			return (s32)i;
+		}
+	}
+	return -1;
+}
+
+// Does the list walk once for every entry in the table. A size maps to the first size
+// class that fits it, unless some other allocator is checked before that size class as
+// only calling ShouldAllocate can tell if that allocator wants the allocation
+void MemorySystem::BuildSizeClassTable()
+{
+	m_fallback = m_allocators;
+	while(m_fallback && SizeClassOf(m_fallback->m_allocator) >= 0)
+	{
+		m_fallback = m_fallback->m_next;
+	}
+
+	m_sizeClassMaxBytes = 0;
+	for(u32 i = 0; i < FUTURE_SIZE_CLASS_TABLE_SIZE; ++i)
+	{
+		u32 bytes = i << FUTURE_SIZE_CLASS_SHIFT;
+		m_sizeClassTable[i] = FUTURE_NO_SIZE_CLASS;
+		for(AllocatorList * a = m_allocators; a != m_fallback; a = a->m_next)
+		{
+			s32 sizeClass = SizeClassOf(a->m_allocator);
+			if(FutureThreadCache::SizeClassPool(sizeClass)->BlockSize() >= bytes)
+			{
+				m_sizeClassTable[i] = (u8)sizeClass;
+				m_sizeClassMaxBytes = bytes;
+				break;
+			}
+		}
 	}
 }
 
@@ -312,18 +733,32 @@ IFutureAllocator * MemorySystem::GetAllocator(int i)
 		{
 			return a->m_allocator;
 		}
-		++i;
+		++index;
 	}
 	FUTURE_ASSERT_MSG(false, "Index out of bounds exception looking for index %i", i);
 	return NULL;
 }
+
+u32 MemorySystem::NumAllocators()
+{
+	u32 count = 0;
+	for(AllocatorList* a = m_allocators; a; a = a->m_next)
+	{
+		++count;
+	}
+	return count;
+}
 	
 // Create the memory tracker
 MemorySystem::MemorySystem( )
 	: m_allocators(NULL),
-	  m_currentMemoryUse(sizeof(MemorySystem) + sizeof(FutureMallocAllocator) + sizeof(FutureMemoryTracker))
+	  m_currentMemoryUse(sizeof(MemorySystem) + sizeof(FutureMallocAllocator) + sizeof(FutureMemoryTracker)),
+	  m_sizeClassMaxBytes(0),
+	  m_fallback(NULL),
+	  m_numBudgetAllocators(0)
 {
 	FUTURE_LOG_V("Creating Memory System");
+	memset(m_budgets, 0, sizeof(m_budgets));
 	// create a default allocator 
 	AddAllocator(new FutureMallocAllocator());
 }
@@ -332,25 +767,205 @@ MemorySystem::MemorySystem( )
 MemorySystem::~MemorySystem()
 {
 	FUTURE_LOG_V("Destroying Memory System");
-	// loop through all allocators and release them
-	for(AllocatorList* allocator = m_allocators; allocator; )
+	// loop through all allocators and release them, the budgets' allocators are released with the shared ones
+	for(u32 budget = 0; budget < FutureMemoryBudget_Max; ++budget)
 	{
-		AllocatorList* next = allocator->m_next;
-		if(allocator->m_allocator)
+		AllocatorList * list = budget == FutureMemoryBudget_Default ? m_allocators : m_budgets[budget].m_allocators;
+		for(AllocatorList* allocator = list; allocator; )
 		{
-			m_currentMemoryUse -= sizeof(allocator->m_allocator);
-			delete allocator->m_allocator;
-			allocator->m_allocator = NULL;
+			AllocatorList* next = allocator->m_next;
+			if(allocator->m_allocator)
+			{
+				m_currentMemoryUse -= sizeof(allocator->m_allocator);
+				delete allocator->m_allocator;
+				allocator->m_allocator = NULL;
+			}
+			m_currentMemoryUse -= sizeof(AllocatorList);
+			delete allocator;
+			allocator = next;
 		}
-		m_currentMemoryUse -= sizeof(AllocatorList);
-		delete allocator;
-		allocator = next;
 	}
 	m_currentMemoryUse -= sizeof(MemorySystem) + sizeof(FutureMallocAllocator) + sizeof(FutureMemoryTracker);
-	if(m_currentMemoryUse > 0)
+	// every tracked allocation is counted in the default budget
+	s64 allocated = FutureAtomicLoad(&m_budgets[FutureMemoryBudget_Default].m_used);
+	if(allocated > 0)
+	{
+		FUTURE_LOG_W("Destroying Memory System with %lld bytes still allocated.", (long long)allocated);
+	}
+}
+
+
+/*******************************************************************/
+// Memory budgets
+
+// Only allocators added to a budget belong to it, everything else is the default budget
+FutureMemoryBudgetID MemorySystem::BudgetOf(IFutureAllocator * allocator)
+{
+	if(m_numBudgetAllocators == 0)
+	{
+		return FutureMemoryBudget_Default;
+	}
+	for(u32 budget = FutureMemoryBudget_Default + 1; budget < FutureMemoryBudget_Max; ++budget)
+	{
+		for(AllocatorList * a = m_budgets[budget].m_allocators; a; a = a->m_next)
+		{
+			if(a->m_allocator == allocator)
+			{
+				return (FutureMemoryBudgetID)budget;
+			}
+		}
+	}
+	return FutureMemoryBudget_Default;
+}
+
+// The default budget counts every tracked allocation, whichever budget its allocator belongs to
+u64 MemorySystem::BudgetUsage(FutureMemoryBudgetID budget)
+{
+	s64 used = FutureAtomicLoad(&m_budgets[budget].m_used);
+	FUTURE_ASSERT_MSG(used >= 0, L"A memory budget was given back more than was charged to it");
+	return (u64)used;
+}
+
+// Charges bytes to the budget before they are allocated, so threads allocating at once can't all see room
+// for themselves under the hard limit. If they don't fit the pressure callbacks are given a chance to free
+// enough memory, if they still don't the charge is taken back and the allocation is failed
+bool MemorySystem::ReserveBudget(FutureMemoryBudgetID budget, u64 bytes)
+{
+	MemoryBudget & b = m_budgets[budget];
+	s64 used = FutureAtomicAdd(&b.m_used, (s64)bytes);
+	u64 limit = b.m_hardLimit;
+	if(limit != 0 && used > (s64)limit)
+	{
+		// the callbacks see the budget without this charge, then it is made again against what they left
+		FutureAtomicAdd(&b.m_used, -(s64)bytes);
+		CallPressureCallbacks(budget, FutureMemoryPressure_Hard, (u64)used - limit);
+		used = FutureAtomicAdd(&b.m_used, (s64)bytes);
+		if(used > (s64)limit)
+		{
+			FutureAtomicAdd(&b.m_used, -(s64)bytes);
+			FUTURE_LOG_ERROR(L"Memory budget %u is full, %llu bytes are in use out of %llu and %llu more were requested",
+				budget, (unsigned long long)(used - (s64)bytes), (unsigned long long)limit, (unsigned long long)bytes);
+			return false;
+		}
+	}
+	CheckSoftLimit(budget, used, (s64)bytes);
+	return true;
+}
+
+// Adds bytes, which may be negative, to the budget
+void MemorySystem::ChargeBudget(FutureMemoryBudgetID budget, s64 bytes)
+{
+	CheckSoftLimit(budget, FutureAtomicAdd(&m_budgets[budget].m_used, bytes), bytes);
+}
+
+// Calls the callbacks once when a charge of bytes takes the budget to used, past its soft limit
+void MemorySystem::CheckSoftLimit(FutureMemoryBudgetID budget, s64 used, s64 bytes)
+{
+	MemoryBudget & b = m_budgets[budget];
+	if(b.m_softLimit == 0)
+	{
+		return;
+	}
+	if(used < (s64)b.m_softLimit)
+	{
+		if(FutureAtomicLoad(&b.m_softSignaled))
+		{
+			FutureAtomicStore(&b.m_softSignaled, 0);
+		}
+	}
+	else if(bytes > 0 && FutureAtomicCompareExchange(&b.m_softSignaled, 0, 1))
+	{
+		CallPressureCallbacks(budget, FutureMemoryPressure_Soft, (u64)used - b.m_softLimit);
+	}
+}
+
+// Every tracked allocation counts against the default budget as well as its allocator's own budget
+bool MemorySystem::ReserveAllocation(FutureMemoryBudgetID budget, u64 bytes)
+{
+	if(!ReserveBudget(FutureMemoryBudget_Default, bytes))
+	{
+		return false;
+	}
+	if(budget != FutureMemoryBudget_Default && !ReserveBudget(budget, bytes))
+	{
+		ChargeBudget(FutureMemoryBudget_Default, -(s64)bytes);
+		return false;
+	}
+	return true;
+}
+
+void MemorySystem::ChargeAllocation(FutureMemoryBudgetID budget, s64 bytes)
+{
+	if(bytes == 0)
+	{
+		return;
+	}
+	ChargeBudget(FutureMemoryBudget_Default, bytes);
+	if(budget != FutureMemoryBudget_Default)
+	{
+		ChargeBudget(budget, bytes);
+	}
+}
+
+void MemorySystem::CallPressureCallbacks(FutureMemoryBudgetID budget, FutureMemoryPressure pressure, u64 bytes)
+{
+	MemoryBudget & b = m_budgets[budget];
+	// only one thread calls a budget's callbacks at a time, allocations made by the callbacks
+	// or by other threads meanwhile go ahead without calling them again
+	if(b.m_numCallbacks == 0 || !FutureAtomicCompareExchange(&b.m_inCallback, 0, 1))
+	{
+		return;
+	}
+	for(u32 i = 0; i < b.m_numCallbacks; ++i)
+	{
+		b.m_callbacks[i](budget, pressure, bytes, b.m_callbackData[i]);
+	}
+	FutureAtomicStore(&b.m_inCallback, 0);
+}
+
+void MemorySystem::SetBudgetLimits(FutureMemoryBudgetID budget, u64 softBytes, u64 hardBytes)
+{
+	FUTURE_ASSERT(budget < FutureMemoryBudget_Max);
+	FUTURE_ASSERT_MSG(hardBytes == 0 || softBytes <= hardBytes, L"The soft limit of a memory budget must be below its hard limit");
+	m_budgets[budget].m_softLimit = softBytes;
+	m_budgets[budget].m_hardLimit = hardBytes;
+	m_budgets[budget].m_softSignaled = 0;
+}
+
+void MemorySystem::AddPressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data)
+{
+	FUTURE_ASSERT(budget < FutureMemoryBudget_Max);
+	MemoryBudget & b = m_budgets[budget];
+	Lock();
+	if(b.m_numCallbacks < FUTURE_MEMORY_MAX_PRESSURE_CALLBACKS)
 	{
-		FUTURE_LOG_W("Destroying Memory System will %u bytes still allocated.", %m_currentMemoryUse);
+		b.m_callbacks[b.m_numCallbacks] = callback;
+		b.m_callbackData[b.m_numCallbacks] = data;
+		++b.m_numCallbacks;
 	}
+	else
+	{
+		FUTURE_LOG_ERROR(L"Memory budget %u already has %u pressure callbacks", budget, FUTURE_MEMORY_MAX_PRESSURE_CALLBACKS);
+	}
+	Unlock();
+}
+
+void MemorySystem::RemovePressureCallback(FutureMemoryBudgetID budget, FutureMemoryPressureCallback callback, void * data)
+{
+	FUTURE_ASSERT(budget < FutureMemoryBudget_Max);
+	MemoryBudget & b = m_budgets[budget];
+	Lock();
+	for(u32 i = 0; i < b.m_numCallbacks; ++i)
+	{
+		if(b.m_callbacks[i] == callback && b.m_callbackData[i] == data)
+		{
+			--b.m_numCallbacks;
+			b.m_callbacks[i] = b.m_callbacks[b.m_numCallbacks];
+			b.m_callbackData[i] = b.m_callbackData[b.m_numCallbacks];
+			break;
+		}
+	}
+	Unlock();
 }
 
 	
@@ -363,6 +978,14 @@ inline size_t MemorySystem::BytesForAllocation(const FutureMemoryParam & memPara
 	{
 		return 0;
 	}
+	if(GetBestAllocator(memParam)->UsesChunks())
+	{
+		return memParam.m_bytes;
+	}
+	if(memParam.m_alignment > FUTURE_DEFAULT_ALIGNMENT)
+	{
+		return memParam.m_alignment + memParam.m_bytes;
+	}
 	return FutureMemory::HeaderSize() + memParam.m_bytes;
 }
 
@@ -371,9 +994,17 @@ FutureMemoryStatistics MemorySystem::GetStatistics()
 	return FutureMemoryTracker::GetInstance()->GetStatistics();
 }
 
-void MemorySystem::LogStatistics()
+void MemorySystem::LogStatistics(FutureBufferedOutputStream * heapProfile)
 {
 	FutureMemoryTracker::GetInstance()->LogStatistics();
+	if(FutureCoreConfig::MemorySampleInterval() != 0)
+	{
+		FutureMemoryProfiler::LogSites(10);
+	}
+	if(heapProfile && !FutureMemoryProfiler::WriteHeapProfile(heapProfile))
+	{
+		FUTURE_LOG_ERROR(L"Failed to write the heap profile");
+	}
 }
 
 void MemorySystem::LogAllocations()
@@ -383,5 +1014,15 @@ void MemorySystem::LogAllocations()
 
 void MemorySystem::LogAllocation(void * p)
 {
-	FutureMemoryTracker::GetInstance()->LogAllocation((FutureAllocHeaderDebug*)HeaderFromData(p));
+	FutureMemoryTracker::GetInstance()->LogAllocation(p);
+}
+
+FutureMemoryFragmentation MemorySystem::GetFragmentation()
+{
+	return FutureMemoryTracker::GetInstance()->GetFragmentation();
+}
+
+void MemorySystem::LogFragmentation()
+{
+	FutureMemoryTracker::GetInstance()->LogFragmentation();
 }
\ No newline at end of file
@@ -0,0 +1,475 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+
+/*
+*	Implementation of FutureMemoryProfiler
+*
+*	The tables are allocated with malloc the first time anything is sampled so the profiler
+*	never allocates through the memory system it is watching. Both tables use open addressing,
+*	a slot is claimed with a compare exchange on its key and never moves afterwards.
+*/
+
+#include <future/core/memory/tracker/memoryprofiler.h>
+#include <future/core/config/coreconfig.h>
+#include <future/core/debug/debug.h>
+#include <future/core/memory/memory.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/util/stream.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if FUTURE_PLATFORM_WINDOWS
+#	include <windows.h>
+#elif FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_OSX
+#	include <execinfo.h>
+#endif
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#	define FUTURE_RETURN_ADDRESS()	_ReturnAddress()
+#else
+#	define FUTURE_RETURN_ADDRESS()	__builtin_return_address(0)
+#endif
+
+// Extra frames captured to make room for the profiler's own, which are cut off the top
+#define FUTURE_MEMORY_PROFILER_EXTRA_FRAMES	8
+// Slots checked for a call site before its sample is dropped
+#define FUTURE_MEMORY_PROFILER_SITE_PROBES	64
+// Slots checked for a live sample, a free has to check all of them for an address that was sampled
+#define FUTURE_MEMORY_PROFILER_LIVE_PROBES	16
+
+// A sampled allocation that has not been freed
+struct FutureMemoryProfileLive
+{
+	void * volatile				m_address;	// NULL while the slot is free
+	FutureMemoryProfileSite *	m_site;
+	u32							m_bytes;
+};
+
+struct FutureMemoryProfileTables
+{
+	FutureMemoryProfileSite		m_sites[FUTURE_MEMORY_PROFILER_MAX_SITES];
+	FutureMemoryProfileLive		m_live[FUTURE_MEMORY_PROFILER_MAX_LIVE];
+};
+
+static void * volatile	s_tables = NULL;
+static volatile s64		s_numSamples = 0;
+static volatile s64		s_numDropped = 0;
+static volatile s32		s_numLive = 0;
+
+// Bytes the calling thread can allocate before its next sample
+static FUTURE_THREAD_LOCAL s64	s_bytesUntilSample = 0;
+// The interval s_bytesUntilSample was picked with, a new one is picked when the interval changes
+static FUTURE_THREAD_LOCAL u32	s_sampleInterval = 0;
+static FUTURE_THREAD_LOCAL u64	s_random = 0;
+
+// Picks the bytes until the next sample from an exponential distribution with a mean of interval.
+// Each allocation of n bytes is then sampled with a chance of 1 - e^(-n / interval), which is
+// what pprof assumes when it scales the samples back up
+static s64 FutureSampleDistance(u32 interval)
+{
+	if(s_random == 0)
+	{
+		s_random = ((u64)(size_t)&s_random * 0x9E3779B97F4A7C15ull) | 1;
+	}
+	// xorshift64*
+	s_random ^= s_random >> 12;
+	s_random ^= s_random << 25;
+	s_random ^= s_random >> 27;
+	u64 bits = (s_random * 0x2545F4914F6CDD1Dull) >> 11;
+
+	// uniform in (0, 1]
+	f64 uniform = (f64)(bits + 1) * (1.0 / 9007199254740992.0);
+	return (s64)(-log(uniform) * (f64)interval) + 1;
+}
+
+static FutureMemoryProfileTables * FutureGetProfileTables()
+{
+	FutureMemoryProfileTables * tables = (FutureMemoryProfileTables*)FutureAtomicLoadPtr(&s_tables);
+	if(tables)
+	{
+		return tables;
+	}
+
+	void * newTables = calloc(1, sizeof(FutureMemoryProfileTables));
+	if(!newTables)
+	{
+		return NULL;
+	}
+	if(!FutureAtomicCompareExchangePtr(&s_tables, NULL, newTables))
+	{
+		// another thread created them first
+		free(newTables);
+	}
+	return (FutureMemoryProfileTables*)FutureAtomicLoadPtr(&s_tables);
+}
+
+// Captures the backtrace above caller, the return address of RecordAllocation. How many frames
+// the profiler itself adds depends on what the compiler inlined, so they are found by address
+static u32 FutureCaptureBacktrace(void ** frames, void * caller)
+{
+	void * buffer[FUTURE_MEMORY_PROFILER_MAX_FRAMES + FUTURE_MEMORY_PROFILER_EXTRA_FRAMES];
+	s32 count = 0;
+#if FUTURE_PLATFORM_WINDOWS
+	count = (s32)CaptureStackBackTrace(0, FUTURE_MEMORY_PROFILER_MAX_FRAMES + FUTURE_MEMORY_PROFILER_EXTRA_FRAMES, buffer, NULL);
+#elif FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_OSX
+	count = (s32)backtrace(buffer, FUTURE_MEMORY_PROFILER_MAX_FRAMES + FUTURE_MEMORY_PROFILER_EXTRA_FRAMES);
+#endif
+
+	// the memory system frame that called RecordAllocation is dropped as well
+	s32 first = 0;
+	for(s32 i = 0; i < count && i < FUTURE_MEMORY_PROFILER_EXTRA_FRAMES; ++i)
+	{
+		if(buffer[i] == caller)
+		{
+			first = i + 1;
+			break;
+		}
+	}
+	count -= first;
+	if(count <= 0)
+	{
+		return 0;
+	}
+	if(count > FUTURE_MEMORY_PROFILER_MAX_FRAMES)
+	{
+		count = FUTURE_MEMORY_PROFILER_MAX_FRAMES;
+	}
+	memcpy(frames, buffer + first, sizeof(void*) * count);
+	return (u32)count;
+}
+
+// FNV-1a over everything that makes up a call site, never returns 0
+static s64 FutureHashSite(const FutureMemoryParamDebug & memParam, void ** frames, u32 numFrames)
+{
+	u64 hash = 14695981039346656037ull;
+	for(u32 i = 0; i < numFrames; ++i)
+	{
+		hash = (hash ^ (u64)(size_t)frames[i]) * 1099511628211ull;
+	}
+	hash = (hash ^ (u64)(size_t)memParam.m_type) * 1099511628211ull;
+	hash = (hash ^ (u64)(size_t)memParam.m_file) * 1099511628211ull;
+	hash = (hash ^ (u64)memParam.m_line) * 1099511628211ull;
+	return hash == 0 ? 1 : (s64)hash;
+}
+
+static u32 FutureHashAddress(void * p)
+{
+	return (u32)(((u64)(size_t)p * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Finds the site with hash, claiming a free slot for it if there isn't one. NULL if the table is full
+static FutureMemoryProfileSite * FutureFindSite(FutureMemoryProfileTables * tables, s64 hash,
+	const FutureMemoryParamDebug & memParam, void ** frames, u32 numFrames)
+{
+	for(u32 i = 0; i < FUTURE_MEMORY_PROFILER_SITE_PROBES; ++i)
+	{
+		FutureMemoryProfileSite * site = &tables->m_sites[((u32)hash + i) & (FUTURE_MEMORY_PROFILER_MAX_SITES - 1)];
+		s64 current = FutureAtomicLoad(&site->m_hash);
+		if(current == 0)
+		{
+			if(FutureAtomicCompareExchange(&site->m_hash, (s64)0, hash))
+			{
+				site->m_type = memParam.m_type;
+				site->m_file = memParam.m_file;
+				site->m_line = memParam.m_line;
+				site->m_numFrames = numFrames;
+				memcpy(site->m_frames, frames, sizeof(void*) * numFrames);
+				FutureAtomicStore(&site->m_ready, 1);
+				return site;
+			}
+			current = FutureAtomicLoad(&site->m_hash);
+		}
+		if(current == hash)
+		{
+			// the thread that claimed it may still be filling it in
+			while(!FutureAtomicLoad(&site->m_ready))
+			{
+				FutureAtomicPause();
+			}
+			return site;
+		}
+	}
+	return NULL;
+}
+
+static void FutureSample(const FutureMemoryParamDebug & memParam, void * p, void * caller)
+{
+	FutureMemoryProfileTables * tables = FutureGetProfileTables();
+	if(!tables)
+	{
+		FutureAtomicIncrement(&s_numDropped);
+		return;
+	}
+
+	void * frames[FUTURE_MEMORY_PROFILER_MAX_FRAMES];
+	u32 numFrames = FutureCaptureBacktrace(frames, caller);
+	FutureMemoryProfileSite * site = FutureFindSite(tables, FutureHashSite(memParam, frames, numFrames), memParam, frames, numFrames);
+	if(!site)
+	{
+		FutureAtomicIncrement(&s_numDropped);
+		return;
+	}
+
+	// a sample that can't be found when it is freed would stay in use forever
+	u32 home = FutureHashAddress(p);
+	FutureMemoryProfileLive * live = NULL;
+	for(u32 i = 0; i < FUTURE_MEMORY_PROFILER_LIVE_PROBES && !live; ++i)
+	{
+		FutureMemoryProfileLive * slot = &tables->m_live[(home + i) & (FUTURE_MEMORY_PROFILER_MAX_LIVE - 1)];
+		if(FutureAtomicLoadPtr(&slot->m_address) == NULL && FutureAtomicCompareExchangePtr(&slot->m_address, NULL, p))
+		{
+			live = slot;
+		}
+	}
+	if(!live)
+	{
+		FutureAtomicIncrement(&s_numDropped);
+		return;
+	}
+	live->m_site = site;
+	live->m_bytes = memParam.m_bytes;
+	FutureAtomicIncrement(&s_numLive);
+
+	FutureAtomicIncrement(&s_numSamples);
+	FutureAtomicIncrement(&site->m_allocObjects);
+	FutureAtomicAdd(&site->m_allocBytes, (s64)memParam.m_bytes);
+	FutureAtomicIncrement(&site->m_inUseObjects);
+	FutureAtomicAdd(&site->m_inUseBytes, (s64)memParam.m_bytes);
+}
+
+void FutureMemoryProfiler::RecordAllocation(const FutureMemoryParamDebug & memParam, void * p)
+{
+	u32 interval = FutureCoreConfig::MemorySampleInterval();
+	if(interval == 0 || p == NULL)
+	{
+		return;
+	}
+	if(s_sampleInterval != interval)
+	{
+		s_sampleInterval = interval;
+		s_bytesUntilSample = FutureSampleDistance(interval);
+	}
+
+	s_bytesUntilSample -= memParam.m_bytes;
+	if(s_bytesUntilSample > 0)
+	{
+		return;
+	}
+	s_bytesUntilSample = FutureSampleDistance(interval);
+	FutureSample(memParam, p, FUTURE_RETURN_ADDRESS());
+}
+
+void FutureMemoryProfiler::RecordFree(void * p)
+{
+	if(FutureAtomicLoad(&s_numLive) == 0)
+	{
+		return;
+	}
+	FutureMemoryProfileTables * tables = (FutureMemoryProfileTables*)FutureAtomicLoadPtr(&s_tables);
+	if(!tables || p == NULL)
+	{
+		return;
+	}
+
+	u32 home = FutureHashAddress(p);
+	for(u32 i = 0; i < FUTURE_MEMORY_PROFILER_LIVE_PROBES; ++i)
+	{
+		FutureMemoryProfileLive * slot = &tables->m_live[(home + i) & (FUTURE_MEMORY_PROFILER_MAX_LIVE - 1)];
+		if(FutureAtomicLoadPtr(&slot->m_address) == p)
+		{
+			FutureMemoryProfileSite * site = slot->m_site;
+			s64 bytes = (s64)slot->m_bytes;
+			FutureAtomicStorePtr(&slot->m_address, NULL);
+			FutureAtomicDecrement(&s_numLive);
+
+			FutureAtomicAdd(&site->m_inUseObjects, (s64)-1);
+			FutureAtomicAdd(&site->m_inUseBytes, -bytes);
+			return;
+		}
+	}
+}
+
+bool FutureMemoryProfiler::WriteHeapProfile(FutureBufferedOutputStream * stream)
+{
+	FutureMemoryProfileTables * tables = (FutureMemoryProfileTables*)FutureAtomicLoadPtr(&s_tables);
+	char line[64 + FUTURE_MEMORY_PROFILER_MAX_FRAMES * 20];
+	bool result = true;
+
+	s64 totals[4] = {0, 0, 0, 0};
+	for(u32 i = 0; tables && i < FUTURE_MEMORY_PROFILER_MAX_SITES; ++i)
+	{
+		FutureMemoryProfileSite * site = &tables->m_sites[i];
+		if(FutureAtomicLoad(&site->m_ready))
+		{
+			totals[0] += FutureAtomicLoad(&site->m_inUseObjects);
+			totals[1] += FutureAtomicLoad(&site->m_inUseBytes);
+			totals[2] += FutureAtomicLoad(&site->m_allocObjects);
+			totals[3] += FutureAtomicLoad(&site->m_allocBytes);
+		}
+	}
+
+	u32 length = (u32)snprintf(line, sizeof(line), "heap profile: %lld: %lld [%lld: %lld] @ heap_v2/%u\n",
+		(long long)totals[0], (long long)totals[1], (long long)totals[2], (long long)totals[3], FutureCoreConfig::MemorySampleInterval());
+	result &= stream->Write(line, length);
+
+	for(u32 i = 0; tables && i < FUTURE_MEMORY_PROFILER_MAX_SITES; ++i)
+	{
+		FutureMemoryProfileSite * site = &tables->m_sites[i];
+		if(!FutureAtomicLoad(&site->m_ready))
+		{
+			continue;
+		}
+		length = (u32)snprintf(line, sizeof(line), "%lld: %lld [%lld: %lld] @",
+			(long long)FutureAtomicLoad(&site->m_inUseObjects), (long long)FutureAtomicLoad(&site->m_inUseBytes),
+			(long long)FutureAtomicLoad(&site->m_allocObjects), (long long)FutureAtomicLoad(&site->m_allocBytes));
+		for(u32 frame = 0; frame < site->m_numFrames; ++frame)
+		{
+			length += (u32)snprintf(line + length, sizeof(line) - length, " 0x%llx", (unsigned long long)(size_t)site->m_frames[frame]);
+		}
+		line[length++] = '\n';
+		result &= stream->Write(line, length);
+	}
+
+	// pprof needs to know where each library was loaded to turn the addresses into symbols
+	const char * libraries = "\nMAPPED_LIBRARIES:\n";
+	result &= stream->Write(libraries, (u32)strlen(libraries));
+#if FUTURE_PLATFORM_LINUX
+	FILE * maps = fopen("/proc/self/maps", "r");
+	if(maps)
+	{
+		char buffer[4096];
+		size_t read;
+		while((read = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+		{
+			result &= stream->Write(buffer, (u32)read);
+		}
+		fclose(maps);
+	}
+#endif
+	return result;
+}
+
+// Copies an ascii string so it can be logged with %ls
+static void FutureProfilerWiden(const char * text, wchar_t * out, u32 size)
+{
+	if(text == NULL)
+	{
+		text = "unknown";
+	}
+	// only the file name, not the whole path
+	const char * name = strrchr(text, '/');
+	const char * backslash = strrchr(text, '\\');
+	if(backslash > name)
+	{
+		name = backslash;
+	}
+	text = name ? name + 1 : text;
+
+	u32 length = 0;
+	for(; *text && length + 1 < size; ++text)
+	{
+		out[length++] = (wchar_t)(u8)*text;
+	}
+	out[length] = 0;
+}
+
+void FutureMemoryProfiler::LogSites(u32 count)
+{
+	FutureMemoryProfileTables * tables = (FutureMemoryProfileTables*)FutureAtomicLoadPtr(&s_tables);
+	u32 interval = FutureCoreConfig::MemorySampleInterval();
+	FUTURE_LOG_DEBUG(L"Memory samples: %llu taken, %u in use, %llu dropped",
+		(unsigned long long)NumSamples(), NumLiveSamples(), (unsigned long long)NumDroppedSamples());
+	if(!tables)
+	{
+		return;
+	}
+
+	// sites in order of bytes in use, ties go to the lower index
+	s64 lastBytes = 0x7FFFFFFFFFFFFFFFll;
+	s32 lastIndex = -1;
+	for(u32 logged = 0; logged < count; ++logged)
+	{
+		s32 best = -1;
+		s64 bestBytes = 0;
+		for(u32 i = 0; i < FUTURE_MEMORY_PROFILER_MAX_SITES; ++i)
+		{
+			FutureMemoryProfileSite * site = &tables->m_sites[i];
+			if(!FutureAtomicLoad(&site->m_ready))
+			{
+				continue;
+			}
+			s64 bytes = FutureAtomicLoad(&site->m_inUseBytes);
+			bool after = bytes < lastBytes || (bytes == lastBytes && (s32)i > lastIndex);
+			if(after && bytes > 0 && (best < 0 || bytes > bestBytes))
+			{
+				best = (s32)i;
+				bestBytes = bytes;
+			}
+		}
+		if(best < 0)
+		{
+			break;
+		}
+		lastBytes = bestBytes;
+		lastIndex = best;
+
+		FutureMemoryProfileSite * site = &tables->m_sites[best];
+		s64 objects = FutureAtomicLoad(&site->m_inUseObjects);
+		// undo the sampling the same way pprof does
+		f64 scale = 1.0;
+		if(interval > 0 && objects > 0)
+		{
+			f64 average = (f64)bestBytes / (f64)objects;
+			scale = 1.0 / (1.0 - exp(-average / (f64)interval));
+		}
+
+		wchar_t type[64];
+		wchar_t file[128];
+		FutureProfilerWiden(site->m_type, type, 64);
+		FutureProfilerWiden(site->m_file, file, 128);
+		FUTURE_LOG_DEBUG(L"%llu bytes in %llu allocations of %ls from %ls:%u, %lld samples",
+			(unsigned long long)((f64)bestBytes * scale), (unsigned long long)((f64)objects * scale),
+			type, file, site->m_line, (long long)objects);
+	}
+}
+
+u64 FutureMemoryProfiler::NumSamples()
+{
+	return (u64)FutureAtomicLoad(&s_numSamples);
+}
+
+u32 FutureMemoryProfiler::NumLiveSamples()
+{
+	return (u32)FutureAtomicLoad(&s_numLive);
+}
+
+u64 FutureMemoryProfiler::NumDroppedSamples()
+{
+	return (u64)FutureAtomicLoad(&s_numDropped);
+}
+
+void FutureMemoryProfiler::Shutdown()
+{
+	free(FutureAtomicExchangePtr(&s_tables, NULL));
+	FutureAtomicStore(&s_numSamples, (s64)0);
+	FutureAtomicStore(&s_numDropped, (s64)0);
+	FutureAtomicStore(&s_numLive, 0);
+}
@@ -19,11 +19,15 @@
 *	Implementation of MemoryTracker
 */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <future/core/debug/debug.h>
 
 #include <future/core/memory/memory.h>
 
 #include <future/core/memory/allocators/allocator.h>
+#include <future/core/memory/allocators/poolallocator.h>
 #include <future/core/memory/memorystatistics.h>
 #include <future/core/memory/tracker/memorytracker.h>
 #include <future/core/utils/timer/timer.h>
@@ -48,148 +52,159 @@ FutureMemoryTracker * FutureMemoryTracker::GetInstance()
 	return FutureMemoryTracker::instance;
 }
 
+// Starting number of hash buckets is 1 << this
+#define FUTURE_TRACKER_BUCKET_SHIFT	10
+
 // Create the memory tracker
 FutureMemoryTracker::FutureMemoryTracker()
 	: FutureThreadSafeObject(),
+	  m_buckets(NULL),
+	  m_bucketShift(FUTURE_TRACKER_BUCKET_SHIFT),
+	  m_records(NULL),
+	  m_currentAllocations(0),
+	  m_currentBytes(0),
 	  m_totalAllocations(0),
 	  m_totalAllocationTime(0),
 	  m_totalBytesAllocated(0)
 {
-
-	// set up the header list
-	m_headerRoot.m_bytes = 0;
-	m_headerRoot.m_line = 0;
-	m_headerRoot.m_file = "Start";
-	m_headerRoot.m_next = NULL;
-	m_headerRoot.m_previous = NULL;
-	SetChecksum(&m_headerRoot);
-	m_headerTail = &m_headerRoot;
+	// the table can't come from the memory system, every allocation would be tracked again
+	m_buckets = (FutureAllocRecord**)calloc((size_t)1 << m_bucketShift, sizeof(FutureAllocRecord*));
+	FUTURE_ASSERT_CRIT(m_buckets != NULL, 9872);
+	m_records = new FuturePoolAllocator(sizeof(FutureAllocRecord), 1024);
 }
 
 // destroy the tracker
 FutureMemoryTracker::~FutureMemoryTracker()
 {
-#if FUTURE_TRACK_MEMORY
 	// make sure there are no memory leaks
-	if(m_headerRoot.m_next != NULL)
+	if(m_currentAllocations > 0)
 	{
 		LogAllocations();
-		FUTURE_ASSERT_MSG(false, "Memory Leak! Memory Tracker destroyed with active allocations");
+		FUTURE_ASSERT_MSG(false, L"Memory Leak! Memory Tracker destroyed with active allocations");
 	}
-#else
+	free(m_buckets);
+	m_buckets = NULL;
+	delete m_records;
+	m_records = NULL;
 }
 
 	
 /*******************************************************************/
 // Memory Tracker tracking functions
 
-void FutureMemoryTracker::Track(const FutureMemoryParamDebug & memParam, FutureAllocHeaderDebug * header, f32 startTime)
+void FutureMemoryTracker::Track(const FutureMemoryParamDebug & memParam, void * p, f32 startTime)
 {
 	// if the allocation failed then we are out of memory!
-	FUTURE_ASSERT_CRIT_MSG(header != NULL && memParam.bytes > 0, 9871, "Out of memory!");
+	FUTURE_ASSERT_CRIT_MSG(p != NULL && memParam.m_bytes > 0, 9871, L"Out of memory!");
 
-	if(header == NULL || !FutureCoreConfig::TrackMemory())
+	if(p == NULL || !FutureCoreConfig::TrackMemory())
 	{
 		return;
 	}
 
 	FUTURE_LOG_V("Tracking %u bytes of data of type %s", memParam.m_bytes, memParam.m_type);
-	// create the header
-	header->m_bytes = memParam.m_bytes;
-	header->m_type = memParam.m_type;
-	header->m_file = strrchr(memParam.m_file, '\\' ); + 1
-	header->m_line = memParam.m_line;
-	header->m_headerCheck = FUTURE_CHECKSUM;
-	SetChecksum(header);
-		
-	// Only one thread can change the header list and statistics at a time
+	// Only one thread can change the table and statistics at a time
 	Lock();
-	// Add the new header to the header list
-	header->m_next = NULL;
-	m_headerTail->m_next = header;
-	header->m_previous = m_headerTail;
-	m_headerTail = header;
+
+	FutureAllocRecord * record = (FutureAllocRecord*)m_records->Alloc(sizeof(FutureAllocRecord));
+	if(record == NULL)
+	{
+		Unlock();
+		FUTURE_LOG_ERROR(L"Memory Tracker is out of memory, allocation will not be tracked");
+		return;
+	}
+
+	// create the record
+	const char * file = memParam.m_file ? strrchr(memParam.m_file, '\\') : NULL;
+	record->m_address = p;
+	record->m_bytes = memParam.m_bytes;
+	record->m_type = memParam.m_type;
+	record->m_file = file ? file + 1 : memParam.m_file;
+	record->m_line = memParam.m_line;
+
+	// Add the new record to its bucket
+	FutureAllocRecord ** bucket = Bucket(p);
+	record->m_next = *bucket;
+	*bucket = record;
 		
 	// Update statistics
-	m_totalBytesAllocated += header->m_bytes;
+	m_currentAllocations += 1;
+	m_currentBytes += record->m_bytes;
+	m_totalBytesAllocated += record->m_bytes;
 	m_totalAllocations += 1;
 	m_totalAllocationTime += FutureTimer::TimeSince(startTime);
 
+	if(m_currentAllocations > ((u32)1 << m_bucketShift))
+	{
+		Grow();
+	}
+
 	// Make sure other threads can access this now
 	Unlock();
-
-	// make sure everything copied right
-	FUTURE_ASSERT(header->m_line == memParam.m_line);
-	FUTURE_ASSERT(header->m_bytes == memParam.m_bytes);
-	FUTURE_ASSERT(header->m_bytes != 24296);
-	VerifyChecksum(header);
 }
 
-void FutureMemoryTracker::Untrack(FutureAllocHeader * header)
+void FutureMemoryTracker::Untrack(void * p)
 {
-	if(header == NULL || !FutureCoreConfig::TrackMemory())
+	if(p == NULL || !FutureCoreConfig::TrackMemory())
 	{
 		return;
 	}
 
-	FutureAllocHeaderDebug * debug = dynamic_cast<FutureAllocHeaderDebug*>(header);
-	if(!debug || debug->m_headerCheck != FUTURE_CHECKSUM)
-	{
-		return;
-	}
-	// make sure it is not corrupt
-	VerifyChecksum(debug);
-
-	// Only one thread can change the header list at a time
+	// Only one thread can change the table at a time
 	Lock();
 
-	// Remove the header from the header list
-	FutureAllocHeaderDebug * next = debug->m_next;
-	FutureAllocHeaderDebug * prev = debug->m_previous;
-
-	FUTURE_ASSERT(prev != NULL);
-	prev->m_next = next;
-	if(next != NULL)
-	{
-		next->m_previous = prev;
-	}
-	else
+	// allocations made while tracking was off have no record
+	for(FutureAllocRecord ** link = Bucket(p); *link; link = &(*link)->m_next)
 	{
-		// this header is the tail
-		m_headerTail = prev;
+		FutureAllocRecord * record = *link;
+		if(record->m_address == p)
+		{
+			*link = record->m_next;
+			m_currentAllocations -= 1;
+			m_currentBytes -= record->m_bytes;
+			m_records->Free(record);
+			break;
+		}
 	}
 
 	// Make sure we allow other threads in when we are done
 	Unlock();
-#endif
 }
 
-#if FUTURE_TRACK_MEMORY
-
-// check all headers to make sure memory is not corrupt
-void FutureMemoryTracker::VerifyAllocations()
+FutureAllocRecord ** FutureMemoryTracker::Bucket(void * p)
 {
-	for(FutureAllocHeaderDebug * header = m_headerRoot.m_next; header != NULL; header = header->m_next)
-	{
-		VerifyChecksum(header);
-	}
+	// allocations are at least 16 byte aligned, the low bits carry no information
+	size_t hash = ((size_t)p >> 4) * (size_t)0x9E3779B97F4A7C15ULL;
+	return &m_buckets[(hash >> (sizeof(size_t) * 8 - m_bucketShift)) & (((size_t)1 << m_bucketShift) - 1)];
 }
 
-// Set the header's check sum, each header has a unique check sum
-void FutureMemoryTracker::SetChecksum(FutureAllocHeaderDebug * header)
+void FutureMemoryTracker::Grow()
 {
-	header->m_checkSum = FUTURE_CHECKSUM ^ (u32)reinterpret_cast<size_t>(header) ^ header->m_bytes;
-}
+	u32 oldShift = m_bucketShift;
+	FutureAllocRecord ** oldBuckets = m_buckets;
 
-// make sure the check sum for this header is correct, assert if is it not.
-void FutureMemoryTracker::VerifyChecksum(FutureAllocHeaderDebug * header)
-{
-	// NOTE: If this assert fires, then memory is corrupt or some else weird is happening.
-	FUTURE_ASSERT_CRIT(header->m_checkSum == (FUTURE_CHECKSUM ^ reinterpret_cast<size_t>(header) ^ header->m_bytes), 9899);
+	FutureAllocRecord ** buckets = (FutureAllocRecord**)calloc((size_t)1 << (oldShift + 1), sizeof(FutureAllocRecord*));
+	if(buckets == NULL)
+	{
+		// keep using the smaller table, lookups only get slower
+		return;
+	}
 
+	m_buckets = buckets;
+	m_bucketShift = oldShift + 1;
+	for(u32 i = 0; i < ((u32)1 << oldShift); ++i)
+	{
+		for(FutureAllocRecord * record = oldBuckets[i]; record;)
+		{
+			FutureAllocRecord * next = record->m_next;
+			FutureAllocRecord ** bucket = Bucket(record->m_address);
+			record->m_next = *bucket;
+			*bucket = record;
+			record = next;
+		}
+	}
+	free(oldBuckets);
 }
-
-#endif
 	
 /*******************************************************************/
 // Print debug information about the Memory Tracker
@@ -197,20 +212,15 @@ void FutureMemoryTracker::VerifyChecksum(FutureAllocHeaderDebug * header)
 FutureMemoryStatistics FutureMemoryTracker::GetStatistics()
 {
 	FutureMemoryStatistics stats;
-	stats.m_currentBytes = 0;
-	stats.m_currentAllocations = 0;
-	
-	for(FutureAllocHeaderDebug * header = m_headerRoot.m_next; header != NULL; header = header->m_next)
-	{
-		++stats.m_currentAllocations;
-		stats.m_currentBytes += header->m_bytes;
-	}
+	stats.m_currentBytes = m_currentBytes;
+	stats.m_currentAllocations = m_currentAllocations;
 
 	stats.m_totalBytes = m_totalBytesAllocated;
 	stats.m_totalAllocations = m_totalAllocations;
 	stats.m_totalTimeForAllocations = m_totalAllocationTime;
-	stats.m_averageAllocationSize = m_totalBytesAllocated / m_totalAllocations;
-	stats.m_averageTimeForAllocation = m_totalAllocationTime / (f32)m_totalAllocations;
+	// nothing has been tracked if only the sampling profiler is on
+	stats.m_averageAllocationSize = m_totalAllocations > 0 ? m_totalBytesAllocated / m_totalAllocations : 0;
+	stats.m_averageTimeForAllocation = m_totalAllocations > 0 ? m_totalAllocationTime / (f32)m_totalAllocations : 0.0f;
 
 	return stats;
 }
@@ -230,7 +240,7 @@ void FutureMemoryTracker::LogStatistics()
 
 void FutureMemoryTracker::LogAllocations()
 {	
-	if (!m_headerRoot.m_next )
+	if (m_currentAllocations == 0)
 	{
 		FUTURE_LOG_DEBUG("No Current Allocations");
 		return;
@@ -239,18 +249,23 @@ void FutureMemoryTracker::LogAllocations()
 	FutureMemoryStatistics stats = GetStatistics();
 	u32 allocations = 0;
 	//f32 time = FutureTimer::CurrentTime();
-	for(FutureAllocHeaderDebug * header = m_headerRoot.m_next; header != NULL; header = header->m_next)
+	Lock();
+	for(u32 i = 0; i < ((u32)1 << m_bucketShift); ++i)
 	{
-		++allocations;
-		FUTURE_LOG_DEBUG(
-			"%u: Type: %ls File: %ls Line: %u Size: %u Percent: %f",
-			allocations,
-			header->m_type,
-			header->m_file,
-			header->m_line,
-			header->m_bytes,
-			((f32)header->m_bytes / (f32)stats.m_currentBytes) * 100.0f);
+		for(FutureAllocRecord * record = m_buckets[i]; record != NULL; record = record->m_next)
+		{
+			++allocations;
+			FUTURE_LOG_DEBUG(
+				"%u: Type: %ls File: %ls Line: %u Size: %u Percent: %f",
+				allocations,
+				record->m_type,
+				record->m_file,
+				record->m_line,
+				record->m_bytes,
+				((f32)record->m_bytes / (f32)stats.m_currentBytes) * 100.0f);
+		}
 	}
+	Unlock();
 
 	FUTURE_LOG_DEBUG("Current allocations: %u", stats.m_currentAllocations);
 	FUTURE_LOG_DEBUG("Current bytes allocated: %u", stats.m_currentBytes);
@@ -262,12 +277,80 @@ void FutureMemoryTracker::LogAllocations()
 
 }
 
-void FutureMemoryTracker::LogAllocation(FutureAllocHeaderDebug * header)
+void FutureMemoryTracker::LogAllocation(void * p)
 {
-	FUTURE_LOG_DEBUG(
-		"Type: %ls File: %ls Line: %u Size: %u",
-		header->m_type,
-		header->m_file,
-		header->m_line,
-		header->m_bytes);
+	Lock();
+	FutureAllocRecord * record = *Bucket(p);
+	while(record && record->m_address != p)
+	{
+		record = record->m_next;
+	}
+	if(record)
+	{
+		FUTURE_LOG_DEBUG(
+			"Type: %ls File: %ls Line: %u Size: %u",
+			record->m_type,
+			record->m_file,
+			record->m_line,
+			record->m_bytes);
+	}
+	else
+	{
+		FUTURE_LOG_DEBUG(L"Allocation %p is not tracked", p);
+	}
+	Unlock();
+}
+
+FutureMemoryFragmentation FutureMemoryTracker::GetFragmentation()
+{
+	FutureMemoryFragmentation total = FutureMemoryFragmentation();
+
+	for(u32 i = 0; i < FutureMemory::NumAllocators(); ++i)
+	{
+		FutureMemoryFragmentation fragmentation;
+		if(!FutureMemory::GetAllocator(i)->GetFragmentation(fragmentation))
+		{
+			continue;
+		}
+		total.m_heaps += fragmentation.m_heaps;
+		total.m_totalBytes += fragmentation.m_totalBytes;
+		total.m_usedBytes += fragmentation.m_usedBytes;
+		total.m_usedBlocks += fragmentation.m_usedBlocks;
+		total.m_freeBytes += fragmentation.m_freeBytes;
+		total.m_freeBlocks += fragmentation.m_freeBlocks;
+		if(fragmentation.m_largestFreeBlock > total.m_largestFreeBlock)
+		{
+			total.m_largestFreeBlock = fragmentation.m_largestFreeBlock;
+		}
+		// weighted by free bytes, allocators can't hand their free memory to each other
+		total.m_fragmentation += fragmentation.m_fragmentation * fragmentation.m_freeBytes;
+	}
+
+	if(total.m_freeBytes > 0)
+	{
+		total.m_fragmentation /= (f32)total.m_freeBytes;
+	}
+	return total;
+}
+
+void FutureMemoryTracker::LogFragmentation()
+{
+	for(u32 i = 0; i < FutureMemory::NumAllocators(); ++i)
+	{
+		FutureMemoryFragmentation fragmentation;
+		if(!FutureMemory::GetAllocator(i)->GetFragmentation(fragmentation))
+		{
+			continue;
+		}
+		FUTURE_LOG_DEBUG(L"Allocator %u: Heaps: %u Total: %u Used: %u in %u blocks Free: %u in %u blocks Largest free block: %u Fragmentation: %f",
+			i,
+			fragmentation.m_heaps,
+			fragmentation.m_totalBytes,
+			fragmentation.m_usedBytes,
+			fragmentation.m_usedBlocks,
+			fragmentation.m_freeBytes,
+			fragmentation.m_freeBlocks,
+			fragmentation.m_largestFreeBlock,
+			fragmentation.m_fragmentation);
+	}
 }
@@ -23,8 +23,16 @@
 */
 
 #include <future/core/resource/resourcemanager.h>
+#include <future/core/resource/resourcepack.h>
+#include <future/core/util/stream.h>
+#include <future/core/util/ioscheduler.h>
 #include <future/core/thread/pool/threadpool.h>
 #include <future/core/thread/pool/job.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/utils/timer/timer.h>
+#include <future/core/debug/trace.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 
 struct ResourceFileInfo
@@ -36,12 +44,15 @@ struct ResourceFileInfo
 };
 
 FutureResourceManager * ms_manager = NULL;
+// True if the resource manager created the I/O scheduler and has to destroy it
+bool ms_ownsIOScheduler = false;
 
 void LoadSystemResources(void * data)
 {
 	FutureResourceManager::GetInstance()->LoadSystemResourcesSync((LoadFinishedCallback)data);
 }
 
+// Copied into the load job's payload, so starting a load doesn't allocate
 struct ResourceLoadOperation
 {
 	FutureResourceManager::LoadFinishedCallback		m_callback;
@@ -51,13 +62,25 @@ struct ResourceLoadOperation
 
 void LoadResource(void * data)
 {
-	ResourceLoadOperation * op = dynamic_cast<ResourceLoadOperation*>(data);
+	ResourceLoadOperation * op = (ResourceLoadOperation*)data;
 	if(!op)
 	{
 		FUTURE_ASSET_MSG(false, "Invalid data sent to resource loader");
 	}
 	FutureResourceManager::GetInstance()->LoadResourceSync(op->m_resource, op->m_callback, op->m_language);
-	delete op;
+}
+
+// Names read from the system resource file only live in the indexes, which keep just their hashes unless names are stored
+void IndexName(FutureNameIndex * index, u32 id, char * name)
+{
+	if(name)
+	{
+		if(id < index->Count() && !index->SetName(id, name))
+		{
+			FUTURE_LOG_W("'%s' has the same hash as another name and can't be found by name", name);
+		}
+		FUTURE_FREE(name);
+	}
 }
 
 
@@ -65,12 +88,31 @@ void FutureResourceManager::CreateInstance()
 {
 	FUTURE_ASSET(!ms_manager);
 	FUTURE_LOG_V("Creating Resource Manager");
+	if(!FutureIOScheduler::GetInstance())
+	{
+		FutureIOScheduler::CreateInstance();
+		ms_ownsIOScheduler = true;
+	}
 	ms_manager = new FutureResourceManager();
+	FutureMemory::AddPressureCallback(FutureMemoryBudget_Resources, OnMemoryPressure);
+	FutureMemory::AddPressureCallback(FutureMemoryBudget_Default, OnMemoryPressure);
 }
 void FutureResourceManager::DestroyInstance()
 {
 	FUTURE_ASSET(ms_manager);
 	FUTURE_LOG_V("Destroying Resource Manager");
+	FutureMemory::RemovePressureCallback(FutureMemoryBudget_Resources, OnMemoryPressure);
+	FutureMemory::RemovePressureCallback(FutureMemoryBudget_Default, OnMemoryPressure);
+	// reads in flight and their callbacks use the pack, they all finish before it is closed
+	if(ms_ownsIOScheduler)
+	{
+		FutureIOScheduler::DestroyInstance();
+		ms_ownsIOScheduler = false;
+	}
+	else if(FutureIOScheduler::GetInstance())
+	{
+		FutureIOScheduler::GetInstance()->WaitForIdle();
+	}
 	delete ms_manager;
 	ms_manager = NULL;
 }
@@ -81,10 +123,29 @@ FutureResourceManager * FutureResourceManager::GetInstance()
 
 FutureResourceManager::FutureResourceManager()
 	: m_languages(1),
+	  m_pack(NULL),
+	  m_packFile(FutureIOFile_NULL),
 	  m_resources(),
 	  m_groups(),
 	  m_strings(),
-	  m_values()
+	  m_values(),
+	  m_resourceNames(),
+	  m_groupNames(),
+	  m_stringTags(),
+	  m_valueNames(),
+	  m_residencyBudget(0),
+	  m_residencyPolicy(ResidencyPolicy_LRU),
+	  m_frame(0),
+	  m_residentBytes(0),
+	  m_evictionCandidates(),
+	  m_statRequests(0),
+	  m_statHits(0),
+	  m_statReloads(0),
+	  m_statEvictions(0),
+	  m_statBytesEvicted(0),
+	  m_statReloadsFinished(0),
+	  m_statReloadMicros(0),
+	  m_statMaxReloadMicros(0)
 {}
 
 FutureResourceManager::~FutureResourceManager()
@@ -92,29 +153,18 @@ FutureResourceManager::~FutureResourceManager()
 	UnloadAll();
 	CleanUpResources();
 
-	for(u32 i = 0; i < m_resources.Size(); ++i)
+	// resources loaded from the pack can point into it, so it stays mapped until they are all gone
+	if(m_pack)
 	{
-		if(m_resources[i].m_name)
-		{
-			FUTURE_FREE(m_resources[i].m_name);
-			m_resources[i].m_name = NULL;
-		}
-	}
-	for(u32 i = 0; i < m_groups.Size(); ++i)
-	{
-		if(m_groups[i].m_name)
-		{
-			FUTURE_FREE(m_groups[i].m_name);
-			m_groups[i].m_name = NULL;
-		}
+		FutureIOScheduler::CloseFile(m_packFile);
+		m_packFile = FutureIOFile_NULL;
+		m_pack->Close();
+		delete m_pack;
+		m_pack = NULL;
 	}
+
 	for(u32 i = 0; i < m_strings.Size(); ++i)
 	{
-		if(m_strings[i].m_tag)
-		{
-			FUTURE_FREE(m_strings[i].m_tag);
-			m_strings[i].m_tag = NULL;
-		}
 		if(m_strings[i].m_strings)
 		{
 			for(u32 j = 0; j < m_languages; ++j)
@@ -131,11 +181,6 @@ FutureResourceManager::~FutureResourceManager()
 	}
 	for(u32 i = 0; i < m_values.Size(); ++i)
 	{
-		if(m_values[i].m_name)
-		{
-			FUTURE_FREE(m_values[i].m_name);
-			m_values[i].m_name = NULL;
-		}
 		if(m_values[i].m_type == ValueType_Array && m_values[i].m_array)
 		{
 			FUTURE_FREE(m_values[i].m_array);
@@ -146,6 +191,10 @@ FutureResourceManager::~FutureResourceManager()
 	m_groups.Clear();
 	m_strings.Clear();
 	m_values.Clear();
+	m_resourceNames.Clear();
+	m_groupNames.Clear();
+	m_stringTags.Clear();
+	m_valueNames.Clear();
 }
 
 bool FutureResourceManager::LoadSystemResources(LoadFinishedCallback callback)
@@ -196,17 +245,23 @@ bool FutureResourceManager::LoadSystemResourcesSync(LoadFinishedCallback callbac
 
 	m_languages = stream->ReadU32();
 
+	// without names to store or search for the indexes are left empty and the names are thrown away as they're read
+	bool storeNames = FutureCoreConfig::StoreResourceNames();
+	bool indexNames = storeNames || FutureCoreConfig::SearchResourceNames();
+
 	u32 numResources = stream->ReadU32();
 	m_resources.SetSize(numResources);
+	m_resourceNames.Reset(indexNames ? numResources : 0, storeNames);
 	for(u32 i = 0; i < numResources; ++i)
 	{
-		m_resources[i].m_name = stream->ReadString();
-		if(!FutureCoreConfig::StoreResourceNames())
-		{
-			FUTURE_FREE(m_resources[i].m_name);
-			m_resources[i].m_name = NULL;
-		}
+		IndexName(&m_resourceNames, i, stream->ReadString());
 		m_resources[i].m_resource = NULL;
+		m_resources[i].m_residentBytes = 0;
+		m_resources[i].m_lastUsedFrame = 0;
+		m_resources[i].m_residencyPriority = 0;
+		m_resources[i].m_residencyDistance = 0.0f;
+		m_resources[i].m_reloadStart = -1.0f;
+		m_resources[i].m_evicted = false;
 	}
 	m_resources.Shrink();
 
@@ -219,14 +274,10 @@ bool FutureResourceManager::LoadSystemResourcesSync(LoadFinishedCallback callbac
 
 	u32 numGroups = stream->ReadU32();
 	m_groups.SetSize(numGroups);
+	m_groupNames.Reset(indexNames ? numGroups : 0, storeNames);
 	for(u32 i = 0; i < numGroups; ++i)
 	{
-		m_groups[i].m_name = stream->ReadString();
-		if(!FutureCoreConfig::StoreResourceNames())
-		{
-			FUTURE_FREE(m_groups[i].m_name);
-			m_groups[i].m_name = NULL;
-		}
+		IndexName(&m_groupNames, i, stream->ReadString());
 		m_groups[i].m_loadAttempted = false;
 		m_groups[i].m_loadCounter = 0;
 		u32 numRes;
@@ -244,14 +295,10 @@ bool FutureResourceManager::LoadSystemResourcesSync(LoadFinishedCallback callbac
 
 	u32 numStrings = stream->ReadU32();
 	m_strings.SetSize(numStrings);
+	m_stringTags.Reset(indexNames ? numStrings : 0, storeNames);
 	for(u32 i = 0; i < numGroups; ++i)
 	{
-		m_strings[i].m_tag = stream->ReadString();
-		if(!FutureCoreConfig::StoreResourceNames())
-		{
-			FUTURE_FREE(m_strings[i].m_tag);
-			m_strings[i].m_tag = NULL;
-		}
+		IndexName(&m_stringTags, i, stream->ReadString());
 		m_strings[i].m_strings = (char**)FUTURE_ALLOC(sizeof(char*) * m_languages, "Localized String Array");
 		for(u32 j = 0; j < m_languages; ++j)
 		{
@@ -269,14 +316,10 @@ bool FutureResourceManager::LoadSystemResourcesSync(LoadFinishedCallback callbac
 
 	u32 numValues = stream->ReadU32();
 	m_values.SetSize(numValues);
+	m_valueNames.Reset(indexNames ? numValues : 0, storeNames);
 	for(u32 i = 0; i < numValues; ++i)
 	{
-		m_values[i].m_name = stream->ReadString();
-		if(!FutureCoreConfig::StoreResourceNames())
-		{
-			FUTURE_FREE(m_values[i].m_name);
-			m_values[i].m_name = NULL;
-		}
+		IndexName(&m_valueNames, i, stream->ReadString());
 		m_values[i].m_type = (ValueType)stream->ReadU32();
 		switch(m_values[i].m_type)
 		{
@@ -322,6 +365,24 @@ bool FutureResourceManager::LoadSystemResourcesSync(LoadFinishedCallback callbac
 		goto Finished;
 	}
 
+	// everything but the system resources is loaded out of the pack if there is one that matches them
+	m_pack = new FutureResourcePack();
+	if(!m_pack->Open(FUTURE_RESOURCE_PACK_FILE) || m_pack->NumResources() != m_resources.Size() || m_pack->NumLanguages() != m_languages)
+	{
+		if(m_pack->IsOpen())
+		{
+			FUTURE_LOG_W("Resource pack does not match the system resources, resources will be loaded from their own files");
+			m_pack->Close();
+		}
+		delete m_pack;
+		m_pack = NULL;
+	}
+	else
+	{
+		// group loads read the pack through the I/O scheduler to get it into memory before it is decoded
+		m_packFile = FutureIOScheduler::OpenFile(FUTURE_RESOURCE_PACK_FILE);
+	}
+
 Finished:
 	Unlock();
 
@@ -411,19 +472,51 @@ bool FutureResourceManager::LoadGroup(ResourceGroupID group, LoadFinishedCallbac
 
 	FUTURE_LOG_V("Sending async group load request for group %u.", group);
 
+	// the I/O scheduler reads the whole group in archive order and posts a decode job as each read finishes,
+	// so the workers never block on the disk. Without it every resource is read by the job that decodes it
+	FutureIOScheduler * io = FutureIOScheduler::GetInstance();
+	if(m_pack && !io)
+	{
+		m_pack->Prefetch(m_groups[group].m_resources.a(), m_groups[group].m_resources.Size(), FutureCoreConfig::DefaultResourceLanguage());
+	}
+
 	for(u32 i = 0; i < m_groups[group].m_resources.Size(); ++i)
 	{
  		if(IsResourceLoaded(m_groups[group].m_resources[i]))
  		{
  			continue;
  		}
- 		ResourceLoadOperation * op = new ResourceLoadOperation();
- 		op->m_callback = NULL;
- 		op->m_resource = m_groups[group].m_resources[i];
- 		op->m_language = FutureCoreConfig::DefaultResourceLanguage();
+ 		ResourceLoadOperation op;
+ 		op.m_callback = NULL;
+ 		op.m_resource = m_groups[group].m_resources[i];
+ 		op.m_language = FutureCoreConfig::DefaultResourceLanguage();
 
-		FutureThreadJob * job = new FutureThreadJob(LoadResource, op);
-		FutureThreadPool::GetInstance()->AddJob(job);
+		bool queued = false;
+		if(io)
+		{
+			u64 offset;
+			u32 size;
+			if(m_pack && m_packFile != FutureIOFile_NULL && m_pack->GetRange(op.m_resource, op.m_language, &offset, &size))
+			{
+				queued = io->Read(m_packFile, offset, size, NULL, OnResourceRead, &op, sizeof(op));
+			}
+			else
+			{
+				char file[32];
+				snprintf(file, sizeof(file), "assets/_%u.dat", op.m_resource);
+				queued = io->ReadFile(file, OnResourceRead, &op, sizeof(op));
+			}
+		}
+		if(!queued)
+		{
+			FutureThreadJob * job = new FutureThreadJob(LoadResource);
+			job->SetPayload(&op, sizeof(op));
+			FutureThreadPool::GetInstance()->AddJob(job);
+		}
+	}
+	if(io)
+	{
+		io->Submit();
 	}
 	return true;
 }
@@ -457,8 +550,15 @@ bool FutureResourceManager::LoadGroupSync(ResourceGroupID group, LoadFinishedCal
 	m_groups[group].m_loadAttempted = true;
 	Unlock();
 
+	FUTURE_TRACE_SCOPE_ARG("FutureResourceManager::LoadGroupSync", group);
 	FUTURE_LOG_V("Syncronously loading resources for group %u.", group);
 
+	if(m_pack)
+	{
+		// the group is next to each other in the pack, have it read in a few large requests instead of a fault per page
+		m_pack->Prefetch(m_groups[group].m_resources.a(), m_groups[group].m_resources.Size(), FutureCoreConfig::DefaultResourceLanguage());
+	}
+
 	for(u32 i = 0; i < m_groups[group].m_resources.Size(); ++i)
 	{
  		if(IsResourceLoaded(m_groups[group].m_resources[i]))
@@ -501,7 +601,8 @@ bool FutureResourceManager::UnloadGroup(ResourceGroupID group, bool force)
 		if(res)
 		{
 			res->GroupRelease();
-			if(force || res->ShouldUnload())
+			// with a residency budget unreferenced resources stay loaded until UpdateResidency needs the room
+			if(force || (res->ShouldUnload() && m_residencyBudget == 0))
 			{
 				UnloadResource(res->Id());
 			}
@@ -538,17 +639,10 @@ ResourceGroupID FutureResourceManager::GetGroupID(const char * name)
 	if(!FutureCoreConfig::SearchResourceNames())
 	{
 		FUTURE_LOG_E("Attempting to search for a group by name when this funcionality has been disabled by the configuration");
-		return ResourceGroupID_NULL;
+		return ResourceGroupID_Null;
 	}
-	FUTURE_LOG_D("Attempting to locate resource group by name. This is expensive");
-	for(u32 i = 0; i < m_groups.Size(); ++i)
-	{
-		if(strcmp(m_groups[i].m_name, name) == 0)
-		{
-			return (ResourceGroupID)i;
-		}
-	}
-	return ResourceGroupID_NULL;
+	u32 group = m_groupNames.Find(name);
+	return group == FUTURE_NAME_INDEX_NULL ? ResourceGroupID_Null : (ResourceGroupID)group;
 }
 const char * FutureResourceManager::GetGroupName(ResourceGroupID group)
 {
@@ -561,7 +655,7 @@ const char * FutureResourceManager::GetGroupName(ResourceGroupID group)
 		FUTURE_LOG_E("Attempting to get a resource group name when this funcionality has been disabled by the configuration");
 		return NULL;
 	}
-	return m_groups[group].m_name;
+	return m_groupNames.Name(group);
 }
 u32 FutureResourceManager::GetNumGroupResources(ResourceGroupID group)
 {
@@ -606,14 +700,33 @@ bool FutureResourceManager::LoadResource(ResourceID resource, LoadFinishedCallba
 
 	FUTURE_LOG_V("Sending load request for resource %u.", resource);
 
-	ResourceLoadOperation * op = new ResourceLoadOperation();
-	op->m_callback = callback;
-	op->m_resource = resource;
+	ResourceLoadOperation op;
+	op.m_callback = callback;
+	op.m_resource = resource;
+	op.m_language = language;
 
-	FutureThreadJob * job = new FutureThreadJob(LoadResource, op);
+	FutureThreadJob * job = new FutureThreadJob(LoadResource);
+	job->SetPayload(&op, sizeof(op));
 	FutureThreadPool::GetInstance()->AddJob(job);
 }
 bool FutureResourceManager::LoadResourceSync(ResourceID resource, LoadFinishedCallback callback, Language language)
+{
+	return LoadResourceData(resource, callback, language, NULL, 0);
+}
+
+void FutureResourceManager::OnResourceRead(void * buffer, u32 bytes, bool success, void * payload)
+{
+	ResourceLoadOperation * op = (ResourceLoadOperation*)payload;
+	// a pack range isn't read, the kernel has been told to bring it in and it is loaded through the mapping.
+	// If a read failed the load reads the resource itself and reports why it couldn't
+	GetInstance()->LoadResourceData(op->m_resource, op->m_callback, op->m_language, success ? buffer : NULL, success ? bytes : 0);
+	if(buffer)
+	{
+		FUTURE_FREE(buffer);
+	}
+}
+
+bool FutureResourceManager::LoadResourceData(ResourceID resource, LoadFinishedCallback callback, Language language, void * fileData, u32 fileSize)
 {
 	if(!HasSystemResources())
 	{
@@ -646,41 +759,79 @@ bool FutureResourceManager::LoadResourceSync(ResourceID resource, LoadFinishedCa
 	res->m_loading = true;
 	res->Unlock();
 
+	FUTURE_TRACE_SCOPE_ARG("FutureResourceManager::LoadResourceSync", resource);
 	FUTURE_LOG_V("Loading resource %u.", resource);
 
-	bool result = true;
-	char file[32];
-	sprintf(file, 32, "assets/_%u.dat", resource);
-	FutureFileInputStream * stream = new FutureFileInputStream();
-	if(!stream->Open(file));
+	if(language == Language_Null)
 	{
-		FUTURE_LOG_E("Failed to open resource file '%s' for resource %u", file, resource);
-		result = false;
-		goto Finished;
+		language = FutureCoreConfig::DefaultResourceLanguage();
 	}
 
-	ResourceFileInfo fileInfo;
-	filesInfo.m_size = stream->ReadU32();
-	filesInfo.m_buildVersion = stream->ReadU32();
+	bool result = true;
+	u64 loadedBytes = 0;
+	FutureBufferedInputStream * stream = NULL;
+	if(m_pack && m_pack->Contains(resource, language))
+	{
+		// the stream reads straight out of the mapped pack, Load can keep pointers into it with ReadInPlace
+		FutureMappedInputStream * mappedStream = new FutureMappedInputStream();
+		stream = mappedStream;
+		if(!m_pack->OpenStream(resource, language, mappedStream))
+		{
+			FUTURE_LOG_E("Failed to open resource %u in the resource pack", resource);
+			result = false;
+			goto Finished;
+		}
+		u64 offset;
+		u32 size;
+		m_pack->GetRange(resource, language, &offset, &size);
+		loadedBytes = size;
+	}
+	else
+	{
+		if(fileData)
+		{
+			// the file was already read by the I/O scheduler, the caller frees the data
+			FutureMemoryInputStream * memoryStream = new FutureMemoryInputStream();
+			stream = memoryStream;
+			memoryStream->Open(fileData, fileSize, false);
+			loadedBytes = fileSize;
+		}
+		else
+		{
+			char file[32];
+			snprintf(file, sizeof(file), "assets/_%u.dat", resource);
+			FutureFileInputStream * fileStream = new FutureFileInputStream();
+			stream = fileStream;
+			if(!fileStream->Open(file))
+			{
+				FUTURE_LOG_E("Failed to open resource file '%s' for resource %u", file, resource);
+				result = false;
+				goto Finished;
+			}
+		}
 
-	FUTURE_ASSET_MSG(filesInfo.m_buildVersion != FUTURE_VERSION_CODE, "Resource file and core library have different version codes.");
+		ResourceFileInfo fileInfo;
+		filesInfo.m_size = stream->ReadU32();
+		filesInfo.m_buildVersion = stream->ReadU32();
+		if(!fileData)
+		{
+			loadedBytes = filesInfo.m_size;
+		}
 
-	filesInfo.m_languageOffsets = stream->ReadU32Array(&filesInfo.m_numLanguages);
+		FUTURE_ASSET_MSG(filesInfo.m_buildVersion != FUTURE_VERSION_CODE, "Resource file and core library have different version codes.");
 
-	if(language == Language_Null)
-	{
-		language = FutureCoreConfig::DefaultResourceLanguage();
-	}
+		filesInfo.m_languageOffsets = stream->ReadU32Array(&filesInfo.m_numLanguages);
 
-	stream->Skip(filesInfo.m_languageOffsets[language]);
+		stream->Skip(filesInfo.m_languageOffsets[language]);
 
-	FUTURE_FREE(filesInfo.m_languageOffsets);
+		FUTURE_FREE(filesInfo.m_languageOffsets);
 
-	if(!stream->ReadCheckSum())
-	{
-		FUTURE_LOG_E("Resource file is not valid for resource %u", resource);
-		result = false;
-		goto Finished;
+		if(!stream->ReadCheckSum())
+		{
+			FUTURE_LOG_E("Resource file is not valid for resource %u", resource);
+			result = false;
+			goto Finished;
+		}
 	}
 
 	if(!res->Load(resource, stream));
@@ -690,6 +841,7 @@ bool FutureResourceManager::LoadResourceSync(ResourceID resource, LoadFinishedCa
 		goto Finished;
 	}
 
+	AddResidency(resource, res, loadedBytes);
 
 	Lock();
 	for(u32 g = 0; g < res->m_numGroups; ++g)
@@ -768,8 +920,14 @@ ResourceID FutureResourceManager::LoadCustomResource(const char * file, FutureRe
 	}
 	ResourceID res = m_resources.Size();
 	ResourceInfo info;
-	info.m_name = NULL;
     info.m_resource = res;
+    // custom resources can't be loaded again by id, so they are never counted or evicted by the residency manager
+    info.m_residentBytes = 0;
+    info.m_lastUsedFrame = 0;
+    info.m_residencyPriority = 0;
+    info.m_residencyDistance = 0.0f;
+    info.m_reloadStart = -1.0f;
+    info.m_evicted = false;
     m_resources.Add(info);
     Unlock();
 
@@ -870,6 +1028,7 @@ bool FutureResourceManager::UnloadResource(ResourceID resource)
 
 	FUTURE_LOG_V("Unloading resource %u.", resource);
  	res->Unload();
+	RemoveResidency(resource, false);
 
  	Lock():
 	for(u32 g = 0; g < res->m_numGroups; ++g)
@@ -893,17 +1052,10 @@ ResourceID FutureResourceManager::GetResourceID(const char * name)
 	if(!FutureCoreConfig::SearchResourceNames())
 	{
 		FUTURE_LOG_E("Attempting to search for a resource by name when this functionality has been disabled by the configuration");
-		return ResourceID_NULL;
+		return ResourceID_Null;
 	}
-	FUTURE_LOG_D("Attempting to locate resource by name. This is expensive");
-	for(u32 i = 0; i < m_resources.Size(); ++i)
-	{
-		if(strcmp(m_resources[i].m_name, name) == 0)
-		{
-			return (ResourceID)i;
-		}
-	}
-	return ResourceID_NULL;
+	u32 resource = m_resourceNames.Find(name);
+	return resource == FUTURE_NAME_INDEX_NULL ? ResourceID_Null : (ResourceID)resource;
 }
 const char * FutureResourceManager::GetResourceName(ResourceID resource)
 {
@@ -916,15 +1068,28 @@ const char * FutureResourceManager::GetResourceName(ResourceID resource)
 		FUTURE_LOG_E("Attempting to get a resource name when this functionality has been disabled by the configuration");
 		return NULL;
 	}
-	return m_resources[resource].m_name;
+	return m_resourceNames.Name(resource);
 }
 
 FutureResource * FutureResourceManager::GetResource(ResourceID resource, bool loadIfNeeded, bool loadAsync)
 {
 	Lock();
 	FutureResource * res = m_resources[resource].m_resource;
+	bool resident = res && (res->IsLoaded() || res->IsLoading());
+	m_resources[resource].m_lastUsedFrame = m_frame;
+	if(!resident && loadIfNeeded && m_resources[resource].m_evicted && m_resources[resource].m_reloadStart < 0.0f)
+	{
+		// AddResidency measures the reload when the load finishes
+		m_resources[resource].m_reloadStart = FutureTimer::CurrentTime();
+		FutureAtomicAdd(&m_statReloads, 1);
+	}
 	Unlock();
-	if((!res || (!res->IsLoaded() && !res->IsLoading())) && loadIfNeeded)
+	FutureAtomicAdd(&m_statRequests, 1);
+	if(resident)
+	{
+		FutureAtomicAdd(&m_statHits, 1);
+	}
+	if(!resident && loadIfNeeded)
 	{
 		if(loadAsync)
 		{
@@ -954,17 +1119,10 @@ StringID FutureResourceManager::GetStringIDByTag(const char * tag)
 	if(!FutureCoreConfig::SearchResourceNames())
 	{
 		FUTURE_LOG_E("Attempting to search for a string by tag when this functionality has been disabled by the configuration");
-		return StringID_NULL;
-	}
-	FUTURE_LOG_D("Attempting to locate string by tag. This is very expensive");
-	for(u32 i = 0; i < m_string.Size(); ++i)
-	{
-		if(strcmp(m_string[i].m_tag, tag) == 0)
-		{
-			return (StringID)i;
-		}
+		return StringID_Null;
 	}
-	return StringID_NULL;
+	u32 id = m_stringTags.Find(tag);
+	return id == FUTURE_NAME_INDEX_NULL ? StringID_Null : (StringID)id;
 }
 const char * FutureResourceManager::GetStringTag(StringID id)
 {
@@ -977,7 +1135,7 @@ const char * FutureResourceManager::GetStringTag(StringID id)
 		FUTURE_LOG_E("Attempting to get a string tag when this functionality has been disabled by the configuration");
 		return NULL;
 	}
-	return m_strings[id].m_tag;
+	return m_stringTags.Name(id);
 }
 const char * FutureResourceManager::GetString(StringID id, Language language)
 {
@@ -997,9 +1155,46 @@ const char * FutureResourceManager::GetString(StringID id, Language language)
 	return m_strings[id].m_strings[language];
 }
 
-ValueID FutureResourceManager::GetValueIDByName(const char * name);
-const char * FutureResourceManager::GetValueName(ValueID id);
-ValueType FutureResourceManager::GetValueType(ValueID id);
+ValueID FutureResourceManager::GetValueIDByName(const char * name)
+{
+	if(!HasSystemResources())
+	{
+		FUTURE_ASSERT_MSG(false, "This function cannot be called until system resources are loaded");
+	}
+	if(!FutureCoreConfig::SearchResourceNames())
+	{
+		FUTURE_LOG_E("Attempting to search for a value by name when this functionality has been disabled by the configuration");
+		return ValueID_Null;
+	}
+	u32 id = m_valueNames.Find(name);
+	return id == FUTURE_NAME_INDEX_NULL ? ValueID_Null : (ValueID)id;
+}
+const char * FutureResourceManager::GetValueName(ValueID id)
+{
+	if(!HasSystemResources())
+	{
+		FUTURE_ASSERT_MSG(false, "This function cannot be called until system resources are loaded");
+	}
+	if(!FutureCoreConfig::StoreResourceNames())
+	{
+		FUTURE_LOG_E("Attempting to get a value name when this functionality has been disabled by the configuration");
+		return NULL;
+	}
+	return m_valueNames.Name(id);
+}
+ValueType FutureResourceManager::GetValueType(ValueID id)
+{
+	if(!HasSystemResources())
+	{
+		FUTURE_ASSERT_MSG(false, "This function cannot be called until system resources have finished loading");
+	}
+	if(id >= m_values.Size())
+	{
+		FUTURE_LOG_E("Recieved invalid ValueID: %u", id)
+		return ValueType_Null;
+	}
+	return m_values[id].m_type;
+}
 
 bool FutureResourceManager::GetBool(ValueID id)
 {
@@ -1269,10 +1464,12 @@ void FutureResourceManager::CleanUpResources()
 			continue;
 		}
 		m_resources[i]->m_resource->Lock();
-		if(m_resources[i]->m_resource->ShouldUnload())
+		// with a residency budget unreferenced resources are cached until UpdateResidency needs the room
+		if(m_resources[i]->m_resource->ShouldUnload() && m_residencyBudget == 0)
 		{
 			FUTURE_LOG_V("Unloading resource %u.", i);
 		 	m_resources[i]->m_resource->Unload();
+			RemoveResidency((ResourceID)i, false);
 
 			for(u32 g = 0; g < m_resources[i]->m_resource->m_numGroups; ++g)
 			{
@@ -1309,6 +1506,333 @@ void FutureResourceManager::EnsureResource(ResourceID resource)
 	Unlock();
 }
 
+void FutureResourceManager::UnloadUnreferenced()
+{
+	// this runs on whichever thread ran out of memory, which may be in the middle of loading while holding
+	// the manager or a resource, so nothing here waits for a lock
+	if(!TryLock())
+	{
+		return;
+	}
+	for(u32 i = 0; i < m_resources.Size(); ++i)
+	{
+		FutureResource * res = m_resources[i].m_resource;
+		if(!res || !res->TryLock())
+		{
+			continue;
+		}
+		if(res->IsLoaded() && !res->IsLoading() && res->ShouldUnload())
+		{
+			FUTURE_LOG_V("Unloading unreferenced resource %u to free memory.", i);
+			res->Unload();
+			RemoveResidency((ResourceID)i, true);
+
+			for(u32 g = 0; g < res->m_numGroups; ++g)
+			{
+				--m_groups[res->m_groups[g]].m_loadCounter;
+			}
+
+			res->m_valid = false;
+			res->m_loaded = false;
+			res->m_loading = false;
+		}
+		res->Unlock();
+	}
+	Unlock();
+}
+
+void FutureResourceManager::SetResidencyBudget(u64 bytes)
+{
+	FUTURE_LOG_V("Setting the resource residency budget to %llu bytes", (unsigned long long)bytes);
+	Lock();
+	m_residencyBudget = bytes;
+	Unlock();
+}
+u64 FutureResourceManager::GetResidencyBudget()
+{
+	return m_residencyBudget;
+}
+void FutureResourceManager::SetResidencyPolicy(FutureResidencyPolicy policy)
+{
+	Lock();
+	m_residencyPolicy = policy;
+	Unlock();
+}
+u64 FutureResourceManager::GetResidentBytes()
+{
+	return (u64)FutureAtomicLoad(&m_residentBytes);
+}
+void FutureResourceManager::SetResidencyHint(ResourceID resource, s32 priority, f32 distance)
+{
+	FUTURE_ASSERT(resource < m_resources.Size());
+	Lock();
+	m_resources[resource].m_residencyPriority = priority;
+	m_resources[resource].m_residencyDistance = distance > 0.0f ? distance : 0.0f;
+	Unlock();
+}
+
+void FutureResourceManager::AddResidency(ResourceID resource, FutureResource * res, u64 loadedBytes)
+{
+	u64 bytes = res->MemoryUsage();
+	if(bytes == 0)
+	{
+		bytes = loadedBytes;
+	}
+
+	Lock();
+	ResourceInfo & info = m_resources[resource];
+	ChargeResidency(info, &m_residentBytes, bytes);
+	info.m_lastUsedFrame = m_frame;
+	if(info.m_reloadStart >= 0.0f)
+	{
+		s64 micros = (s64)(FutureTimer::TimeSince(info.m_reloadStart) * 1000000.0f);
+		FutureAtomicAdd(&m_statReloadsFinished, 1);
+		FutureAtomicAdd(&m_statReloadMicros, micros);
+		s64 max = FutureAtomicLoad(&m_statMaxReloadMicros);
+		while(micros > max && !FutureAtomicCompareExchange(&m_statMaxReloadMicros, max, micros))
+		{
+			max = FutureAtomicLoad(&m_statMaxReloadMicros);
+		}
+		info.m_reloadStart = -1.0f;
+	}
+	info.m_evicted = false;
+	Unlock();
+}
+
+void FutureResourceManager::RemoveResidency(ResourceID resource, bool evicted)
+{
+	// called with the resource locked, which may be while another thread holds the manager, so this doesn't lock it.
+	// The bytes are only ever taken off once, evictions come from UnloadUnreferenced and UpdateResidency which hold the manager
+	u64 bytes = ReleaseResidency(m_resources[resource], &m_residentBytes);
+	if(bytes > 0 && evicted)
+	{
+		FutureAtomicAdd(&m_statEvictions, 1);
+		FutureAtomicAdd(&m_statBytesEvicted, (s64)bytes);
+		m_resources[resource].m_evicted = true;
+	}
+}
+
+void FutureResourceManager::ChargeResidency(ResourceInfo & info, volatile s64 * total, u64 bytes)
+{
+	s64 old = FutureAtomicLoad(&info.m_residentBytes);
+	while(!FutureAtomicCompareExchange(&info.m_residentBytes, old, (s64)bytes))
+	{
+		old = FutureAtomicLoad(&info.m_residentBytes);
+	}
+	FutureAtomicAdd(total, (s64)bytes - old);
+}
+
+u64 FutureResourceManager::ReleaseResidency(ResourceInfo & info, volatile s64 * total)
+{
+	s64 bytes = FutureAtomicLoad(&info.m_residentBytes);
+	while(bytes != 0 && !FutureAtomicCompareExchange(&info.m_residentBytes, bytes, 0))
+	{
+		bytes = FutureAtomicLoad(&info.m_residentBytes);
+	}
+	if(bytes != 0)
+	{
+		FutureAtomicAdd(total, -bytes);
+	}
+	return (u64)bytes;
+}
+
+f32 FutureResourceManager::EvictionScore(FutureResidencyPolicy policy, u32 framesUnused, s32 priority, f32 distance)
+{
+	f32 score = (f32)framesUnused;
+	if(policy == ResidencyPolicy_PriorityDistance)
+	{
+		// something far away that hasn't been used in a while goes before something close by,
+		// each step of priority counts as much as halving the time since it was used
+		score = (score + 1.0f) * (1.0f + distance);
+		for(s32 p = 0; p < priority && p < 31; ++p)
+		{
+			score *= 0.5f;
+		}
+		for(s32 p = 0; p > priority && p > -31; --p)
+		{
+			score *= 2.0f;
+		}
+	}
+	return score;
+}
+
+int FutureResourceManager::CompareEvictionCandidates(const void * a, const void * b)
+{
+	f32 scoreA = ((const FutureResourceManager::EvictionCandidate*)a)->m_score;
+	f32 scoreB = ((const FutureResourceManager::EvictionCandidate*)b)->m_score;
+	return scoreA > scoreB ? -1 : (scoreA < scoreB ? 1 : 0);
+}
+
+void FutureResourceManager::UpdateResidency()
+{
+	Lock();
+	++m_frame;
+	if(m_residencyBudget == 0)
+	{
+		Unlock();
+		return;
+	}
+
+	// referenced resources are in use this frame, everything else unloaded is a candidate
+	m_evictionCandidates.SetSize(0);
+	for(u32 i = 0; i < m_resources.Size(); ++i)
+	{
+		FutureResource * res = m_resources[i].m_resource;
+		if(!res || FutureAtomicLoad(&m_resources[i].m_residentBytes) == 0 || !res->TryLock())
+		{
+			continue;
+		}
+		if(res->IsLoaded() && !res->IsLoading())
+		{
+			if(!res->ShouldUnload())
+			{
+				m_resources[i].m_lastUsedFrame = m_frame;
+			}
+			else
+			{
+				EvictionCandidate candidate;
+				candidate.m_resource = (ResourceID)i;
+				candidate.m_score = EvictionScore(m_residencyPolicy, m_frame - m_resources[i].m_lastUsedFrame,
+					m_resources[i].m_residencyPriority, m_resources[i].m_residencyDistance);
+				m_evictionCandidates.Add(candidate);
+			}
+		}
+		res->Unlock();
+	}
+
+	u64 resident = GetResidentBytes();
+	if(resident > m_residencyBudget && m_evictionCandidates.Size() > 0)
+	{
+		qsort(m_evictionCandidates.a(), m_evictionCandidates.Size(), sizeof(EvictionCandidate), CompareEvictionCandidates);
+		for(u32 c = 0; c < m_evictionCandidates.Size() && GetResidentBytes() > m_residencyBudget; ++c)
+		{
+			ResourceID i = m_evictionCandidates[c].m_resource;
+			FutureResource * res = m_resources[i].m_resource;
+			if(!res->TryLock())
+			{
+				continue;
+			}
+			// a reference may have been taken since the candidates were gathered
+			if(res->IsLoaded() && !res->IsLoading() && res->ShouldUnload())
+			{
+				FUTURE_LOG_V("Evicting resource %u to stay in the residency budget.", i);
+				res->Unload();
+				RemoveResidency(i, true);
+
+				for(u32 g = 0; g < res->m_numGroups; ++g)
+				{
+					--m_groups[res->m_groups[g]].m_loadCounter;
+				}
+
+				res->m_valid = false;
+				res->m_loaded = false;
+				res->m_loading = false;
+			}
+			res->Unlock();
+		}
+		FUTURE_LOG_V("Residency went from %llu to %llu bytes with a budget of %llu bytes", (unsigned long long)resident,
+			(unsigned long long)GetResidentBytes(), (unsigned long long)m_residencyBudget);
+	}
+	Unlock();
+}
+
+void FutureResourceManager::GetResidencyStats(FutureResidencyStats * stats)
+{
+	FUTURE_ASSERT(stats);
+	stats->m_requests = (u64)FutureAtomicLoad(&m_statRequests);
+	stats->m_hits = (u64)FutureAtomicLoad(&m_statHits);
+	stats->m_reloads = (u64)FutureAtomicLoad(&m_statReloads);
+	stats->m_evictions = (u64)FutureAtomicLoad(&m_statEvictions);
+	stats->m_bytesEvicted = (u64)FutureAtomicLoad(&m_statBytesEvicted);
+	stats->m_residentBytes = GetResidentBytes();
+	stats->m_budget = m_residencyBudget;
+	s64 finished = FutureAtomicLoad(&m_statReloadsFinished);
+	stats->m_averageReloadTime = finished > 0 ? (f32)FutureAtomicLoad(&m_statReloadMicros) / (f32)finished / 1000000.0f : 0.0f;
+	stats->m_maxReloadTime = (f32)FutureAtomicLoad(&m_statMaxReloadMicros) / 1000000.0f;
+}
+void FutureResourceManager::ResetResidencyStats()
+{
+	FutureAtomicStore(&m_statRequests, 0);
+	FutureAtomicStore(&m_statHits, 0);
+	FutureAtomicStore(&m_statReloads, 0);
+	FutureAtomicStore(&m_statEvictions, 0);
+	FutureAtomicStore(&m_statBytesEvicted, 0);
+	FutureAtomicStore(&m_statReloadsFinished, 0);
+	FutureAtomicStore(&m_statReloadMicros, 0);
+	FutureAtomicStore(&m_statMaxReloadMicros, 0);
+}
+
+bool FutureResourceManager::UsesResourcePack()
+{
+	return m_pack != NULL;
+}
+
+#if defined(FUTURE_TOOL)
+bool FutureResourceManager::PackResources(const char * file)
+{
+	FUTURE_ASSERT(HasSystemResources());
+
+	FUTURE_LOG_V("Packing resources");
+
+	Lock();
+
+	bool result = true;
+	char resourceFile[32];
+	FutureResourcePackWriter * writer = new FutureResourcePackWriter(m_resources.Size(), m_languages);
+
+	// resource 0 is the system resource file, it holds the config and is always loaded on its own.
+	// Each group is written together so loading it prefetches one range, then whatever is in no group
+	for(u32 g = 0; result && g < m_groups.Size(); ++g)
+	{
+		for(u32 i = 0; result && i < m_groups[g].m_resources.Size(); ++i)
+		{
+			ResourceID resource = m_groups[g].m_resources[i];
+			if(resource == ResourceID_SystemResource || writer->HasResource(resource))
+			{
+				continue;
+			}
+			snprintf(resourceFile, sizeof(resourceFile), "assets/_%u.dat", resource);
+			result = writer->AddResourceFile(resource, resourceFile);
+		}
+	}
+	for(u32 r = 1; result && r < m_resources.Size(); ++r)
+	{
+		if(writer->HasResource((ResourceID)r))
+		{
+			continue;
+		}
+		snprintf(resourceFile, sizeof(resourceFile), "assets/_%u.dat", r);
+		result = writer->AddResourceFile((ResourceID)r, resourceFile);
+	}
+
+	Unlock();
+
+	result = result && writer->Write(file);
+	delete writer;
+
+	if(result)
+	{
+		FUTURE_LOG_V("Successfully packed %u resources", m_resources.Size() - 1);
+	}
+	else
+	{
+		FUTURE_LOG_E("Failed to pack resources");
+	}
+	return result;
+}
+#endif
+
+void FutureResourceManager::OnMemoryPressure(FutureMemoryBudgetID budget, FutureMemoryPressure pressure, u64 bytes, void * data)
+{
+	// the soft limit is only a warning, resources are kept until memory is actually needed
+	if(pressure == FutureMemoryPressure_Soft || !ms_manager)
+	{
+		return;
+	}
+	FUTURE_LOG_W("Memory budget %u needs %llu bytes, unloading unreferenced resources", budget, (unsigned long long)bytes);
+	ms_manager->UnloadUnreferenced();
+}
+
 bool FutureResourceManager::UnloadAll()
 {
 {
@@ -1324,6 +1848,7 @@ bool FutureResourceManager::UnloadAll()
 		{
 			FUTURE_LOG_V("Unloading resource %u.", i);
 		 	m_resources[i]->m_resource->Unload();
+			RemoveResidency((ResourceID)i, false);
 
 			for(u32 g = 0; g < m_resources[i]->m_resource->m_numGroups; ++g)
 			{
@@ -1376,7 +1901,7 @@ bool FutureResourceManager::DumpSystemResources()
 
 	for(u32 i = 0; i < m_resources.Size(); ++i)
 	{
-		stream->Write(m_resources[i].m_name);
+		stream->Write(m_resourceNames.Name(i));
 	}
 
 	stream->WriteCheckSum();
@@ -1384,7 +1909,7 @@ bool FutureResourceManager::DumpSystemResources()
 	stream->Write(m_groups.Size());
 	for(u32 i = 0; i < m_groups.Size(); ++i)
 	{
-		stream->Write(m_groups[i].m_name);
+		stream->Write(m_groupNames.Name(i));
 		stream->Write((u32*)m_groups[i].m_resources.a(), m_groups[i].m_resources.Size())
 	}
 
@@ -1393,7 +1918,7 @@ bool FutureResourceManager::DumpSystemResources()
 	stream->Write(m_strings.Size());
 	for(u32 i = 0; i < m_strings.Size(); ++i)
 	{
-		stream->Write(m_strings[i].m_tag);
+		stream->Write(m_stringTags.Name(i));
 		for(u32 j = 0; j < m_languages; ++j)
 		{
 			stream->Write(m_strings[i].m_strings[j]);
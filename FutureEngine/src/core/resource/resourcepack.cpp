@@ -0,0 +1,421 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureResourcePack and FutureResourcePackWriter
+*/
+
+#include <future/core/resource/resourcepack.h>
+#include <future/core/util/stream.h>
+#include <future/core/debug/debug.h>
+#include <future/core/debug/trace.h>
+#include <string.h>
+
+static inline u64 FutureResourcePackAlign(u64 offset)
+{
+	return (offset + FUTURE_RESOURCE_PACK_ALIGNMENT - 1) & ~(u64)(FUTURE_RESOURCE_PACK_ALIGNMENT - 1);
+}
+
+/*******************************************************************/
+// Resource Pack
+
+FutureResourcePack::FutureResourcePack()
+	: m_file(),
+	  m_header(NULL),
+	  m_table(NULL)
+{}
+
+FutureResourcePack::~FutureResourcePack()
+{
+	if(m_header)
+	{
+		Close();
+	}
+}
+
+bool FutureResourcePack::Open(const char * file)
+{
+	FUTURE_ASSERT(!m_header && file);
+	FUTURE_TRACE_SCOPE("FutureResourcePack::Open");
+
+	if(!m_file.Map(file))
+	{
+		FUTURE_LOG_DEBUG(L"Resource pack could not be mapped, resources will be loaded from their own files");
+		return false;
+	}
+
+	const FutureResourcePackHeader * header = (const FutureResourcePackHeader*)m_file.Data();
+	bool valid = m_file.Size() >= sizeof(FutureResourcePackHeader) &&
+		header->m_magic == FUTURE_RESOURCE_PACK_MAGIC &&
+		header->m_version == FUTURE_RESOURCE_PACK_VERSION &&
+		header->m_checkSum == FUTURE_CHECKSUM &&
+		header->m_size == m_file.Size() &&
+		header->m_numLanguages > 0 &&
+		(header->m_tableOffset % FUTURE_RESOURCE_PACK_ALIGNMENT) == 0 &&
+		header->m_tableOffset <= m_file.Size() &&
+		(u64)header->m_numResources * header->m_numLanguages * sizeof(FutureResourcePackEntry) <= m_file.Size() - header->m_tableOffset;
+
+	// every entry is checked once here so lookups can hand out pointers into the file without checking again
+	const FutureResourcePackEntry * table = (const FutureResourcePackEntry*)(m_file.Data() + header->m_tableOffset);
+	u64 numEntries = valid ? (u64)header->m_numResources * header->m_numLanguages : 0;
+	for(u64 i = 0; i < numEntries && valid; ++i)
+	{
+		valid = table[i].m_size == 0 ||
+			(table[i].m_offset >= sizeof(FutureResourcePackHeader) && table[i].m_offset <= header->m_size &&
+			table[i].m_size <= header->m_size - table[i].m_offset);
+	}
+	if(!valid)
+	{
+		FUTURE_LOG_ERROR(L"Resource pack is corrupt or was written by a different version");
+		m_file.Unmap();
+		return false;
+	}
+	if(header->m_buildVersion != (u32)(FUTURE_VERSION_CODE))
+	{
+		FUTURE_LOG_WARNING(L"Resource pack and core library have different version codes");
+	}
+
+	m_header = header;
+	m_table = table;
+
+	// the table is looked at for every load, get it in now rather than a page at a time
+	m_file.Prefetch(header->m_tableOffset, (u64)header->m_numResources * header->m_numLanguages * sizeof(FutureResourcePackEntry));
+	return true;
+}
+
+void FutureResourcePack::Close()
+{
+	FUTURE_ASSERT(m_header);
+	m_header = NULL;
+	m_table = NULL;
+	m_file.Unmap();
+}
+
+bool FutureResourcePack::Contains(ResourceID resource, Language language) const
+{
+	return FindEntry(resource, language) != NULL;
+}
+
+const void * FutureResourcePack::GetData(ResourceID resource, Language language, u32 * sizeOut) const
+{
+	const FutureResourcePackEntry * entry = FindEntry(resource, language);
+	if(!entry)
+	{
+		*sizeOut = 0;
+		return NULL;
+	}
+	*sizeOut = entry->m_size;
+	return m_file.Data() + entry->m_offset;
+}
+
+bool FutureResourcePack::OpenStream(ResourceID resource, Language language, FutureMappedInputStream * stream) const
+{
+	FUTURE_ASSERT(stream && !stream->IsOpen());
+	const FutureResourcePackEntry * entry = FindEntry(resource, language);
+	if(!entry)
+	{
+		return false;
+	}
+	return stream->Open(&m_file, entry->m_offset, entry->m_size);
+}
+
+bool FutureResourcePack::GetRange(ResourceID resource, Language language, u64 * offsetOut, u32 * sizeOut) const
+{
+	const FutureResourcePackEntry * entry = FindEntry(resource, language);
+	if(!entry)
+	{
+		return false;
+	}
+	*offsetOut = entry->m_offset;
+	*sizeOut = entry->m_size;
+	return true;
+}
+
+void FutureResourcePack::Prefetch(const ResourceID * resources, u32 count, Language language) const
+{
+	FUTURE_ASSERT(m_header);
+
+	// payloads are padded to the alignment, so neighbours are joined if the gap between them is only padding
+	u64 start = 0;
+	u64 end = 0;
+	for(u32 i = 0; i < count; ++i)
+	{
+		const FutureResourcePackEntry * entry = FindEntry(resources[i], language);
+		if(!entry)
+		{
+			continue;
+		}
+		if(end > start && entry->m_offset >= start && entry->m_offset <= FutureResourcePackAlign(end))
+		{
+			u64 entryEnd = entry->m_offset + entry->m_size;
+			end = entryEnd > end ? entryEnd : end;
+			continue;
+		}
+		if(end > start)
+		{
+			m_file.Prefetch(start, end - start);
+		}
+		start = entry->m_offset;
+		end = entry->m_offset + entry->m_size;
+	}
+	if(end > start)
+	{
+		m_file.Prefetch(start, end - start);
+	}
+}
+
+const FutureResourcePackEntry * FutureResourcePack::FindEntry(ResourceID resource, Language language) const
+{
+	if(!m_header || (u32)resource >= m_header->m_numResources)
+	{
+		return NULL;
+	}
+	if(language == Language_Null || (u32)language >= m_header->m_numLanguages)
+	{
+		language = Language_Default;
+	}
+	// the packer points missing languages at the default language, so there is nothing to fall back on here
+	const FutureResourcePackEntry * entry = &m_table[(u32)resource * m_header->m_numLanguages + (u32)language];
+	return entry->m_size > 0 ? entry : NULL;
+}
+
+
+/*******************************************************************/
+// Resource Pack Writer
+
+FutureResourcePackWriter::FutureResourcePackWriter(u32 numResources, u32 numLanguages)
+	: m_numResources(numResources),
+	  m_numLanguages(numLanguages > 0 ? numLanguages : 1),
+	  m_payloads(),
+	  m_slots(NULL)
+{
+	u32 numEntries = m_numResources * m_numLanguages;
+	m_slots = (u32*)FUTURE_ALLOC(sizeof(u32) * (numEntries > 0 ? numEntries : 1), "Resource pack writer slots");
+	memset(m_slots, 0, sizeof(u32) * numEntries);
+}
+
+FutureResourcePackWriter::~FutureResourcePackWriter()
+{
+	for(u32 i = 0; i < m_payloads.Size(); ++i)
+	{
+		FUTURE_FREE(m_payloads[i].m_data);
+	}
+	m_payloads.Clear();
+	FUTURE_FREE(m_slots);
+	m_slots = NULL;
+}
+
+bool FutureResourcePackWriter::AddResource(ResourceID resource, Language language, const void * data, u32 size)
+{
+	if((u32)resource >= m_numResources || (u32)language >= m_numLanguages || !data || size == 0)
+	{
+		FUTURE_LOG_ERROR(L"Can't pack resource %u in language %u", (u32)resource, (u32)language);
+		return false;
+	}
+
+	u8 * copy = (u8*)FUTURE_ALLOC(size, "Resource pack payload");
+	memcpy(copy, data, size);
+
+	u32 & slot = m_slots[(u32)resource * m_numLanguages + (u32)language];
+	if(slot > 0)
+	{
+		FUTURE_FREE(m_payloads[slot - 1].m_data);
+		m_payloads[slot - 1].m_data = copy;
+		m_payloads[slot - 1].m_size = size;
+		return true;
+	}
+
+	Payload payload;
+	payload.m_resource = resource;
+	payload.m_language = language;
+	payload.m_size = size;
+	payload.m_data = copy;
+	m_payloads.Add(payload);
+	slot = m_payloads.Size();
+	return true;
+}
+
+bool FutureResourcePackWriter::AddResourceFile(ResourceID resource, const char * file)
+{
+	FutureFile input;
+	if(!input.OpenForRead(file))
+	{
+		FUTURE_LOG_ERROR(L"Failed to open the resource file for resource %u", (u32)resource);
+		return false;
+	}
+	u32 size = input.Size();
+	u8 * data = (u8*)FUTURE_ALLOC(size, "Resource pack input file");
+	bool result = input.Read(size, data) == size;
+	input.Close();
+
+	// u32 size, u32 build version, then the size prefixed language offsets which are relative to the end of the list.
+	// Nothing in the file is aligned so every value is copied out
+	u32 headerSize = 4 + 4 + 2;
+	u16 numLanguages = 0;
+	if(result && size >= headerSize)
+	{
+		memcpy(&numLanguages, data + 8, 2);
+	}
+	u8 * offsets = data + headerSize;
+	headerSize += numLanguages * 4;
+	result = result && numLanguages > 0 && size >= headerSize;
+
+	for(u32 i = 0; result && i < numLanguages; ++i)
+	{
+		u32 start;
+		memcpy(&start, offsets + i * 4, 4);
+		start += headerSize;
+		// a language runs until the next one starts or the end of the file
+		u32 end = size;
+		for(u32 j = 0; j < numLanguages; ++j)
+		{
+			u32 other;
+			memcpy(&other, offsets + j * 4, 4);
+			other += headerSize;
+			if(other > start && other < end)
+			{
+				end = other;
+			}
+		}
+		u32 checkSum = 0;
+		if(start < end && end - start >= 4)
+		{
+			memcpy(&checkSum, data + start, 4);
+		}
+		if(checkSum != FUTURE_CHECKSUM)
+		{
+			result = false;
+			break;
+		}
+		result = AddResource(resource, (Language)i, data + start + 4, end - start - 4);
+	}
+
+	if(!result)
+	{
+		FUTURE_LOG_ERROR(L"Resource file is not valid for resource %u", (u32)resource);
+	}
+	FUTURE_FREE(data);
+	return result;
+}
+
+bool FutureResourcePackWriter::HasResource(ResourceID resource)
+{
+	if((u32)resource >= m_numResources)
+	{
+		return false;
+	}
+	for(u32 l = 0; l < m_numLanguages; ++l)
+	{
+		if(m_slots[(u32)resource * m_numLanguages + l] > 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FutureResourcePackWriter::Write(const char * file)
+{
+	FUTURE_TRACE_SCOPE("FutureResourcePackWriter::Write");
+
+	u32 numEntries = m_numResources * m_numLanguages;
+	FutureResourcePackEntry * table = (FutureResourcePackEntry*)FUTURE_ALLOC(sizeof(FutureResourcePackEntry) * (numEntries > 0 ? numEntries : 1), "Resource pack table");
+	memset(table, 0, sizeof(FutureResourcePackEntry) * numEntries);
+
+	// lay the payloads out in the order they were added
+	u64 tableOffset = FutureResourcePackAlign(sizeof(FutureResourcePackHeader));
+	u64 offset = FutureResourcePackAlign(tableOffset + sizeof(FutureResourcePackEntry) * numEntries);
+	for(u32 i = 0; i < m_payloads.Size(); ++i)
+	{
+		FutureResourcePackEntry & entry = table[(u32)m_payloads[i].m_resource * m_numLanguages + (u32)m_payloads[i].m_language];
+		entry.m_offset = offset;
+		entry.m_size = m_payloads[i].m_size;
+		offset = FutureResourcePackAlign(offset + m_payloads[i].m_size);
+	}
+
+	// languages a resource wasn't translated to share its default language payload
+	for(u32 r = 0; r < m_numResources; ++r)
+	{
+		const FutureResourcePackEntry & fallback = table[r * m_numLanguages + Language_Default];
+		for(u32 l = 1; l < m_numLanguages; ++l)
+		{
+			if(table[r * m_numLanguages + l].m_size == 0)
+			{
+				table[r * m_numLanguages + l] = fallback;
+			}
+		}
+	}
+
+	FutureResourcePackHeader header;
+	memset(&header, 0, sizeof(header));
+	header.m_magic = FUTURE_RESOURCE_PACK_MAGIC;
+	header.m_version = FUTURE_RESOURCE_PACK_VERSION;
+	header.m_buildVersion = FUTURE_VERSION_CODE;
+	header.m_numResources = m_numResources;
+	header.m_numLanguages = m_numLanguages;
+	header.m_checkSum = FUTURE_CHECKSUM;
+	header.m_tableOffset = tableOffset;
+	header.m_size = offset;
+
+	FutureFile output;
+	bool result = output.OpenForWrite(file, true, false);
+	if(result)
+	{
+		static u8 padding[FUTURE_RESOURCE_PACK_ALIGNMENT] = {0};
+		u64 written = 0;
+
+		result = output.Write(&header, sizeof(header));
+		written += sizeof(header);
+		if(tableOffset > written)
+		{
+			result = result && output.Write(padding, (u32)(tableOffset - written));
+		}
+		written = tableOffset;
+
+		if(numEntries > 0)
+		{
+			result = result && output.Write(table, sizeof(FutureResourcePackEntry) * numEntries);
+			written += sizeof(FutureResourcePackEntry) * numEntries;
+		}
+
+		for(u32 i = 0; result && i < m_payloads.Size(); ++i)
+		{
+			u64 start = FutureResourcePackAlign(written);
+			if(start > written)
+			{
+				result = output.Write(padding, (u32)(start - written));
+			}
+			result = result && output.Write(m_payloads[i].m_data, m_payloads[i].m_size);
+			written = start + m_payloads[i].m_size;
+		}
+		if(result && offset > written)
+		{
+			result = output.Write(padding, (u32)(offset - written));
+		}
+		output.Close();
+	}
+
+	if(!result)
+	{
+		FUTURE_LOG_ERROR(L"Failed to write resource pack");
+	}
+	FUTURE_FREE(table);
+	return result;
+}
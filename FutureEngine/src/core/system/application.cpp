@@ -23,6 +23,7 @@
 */
 
 #include <future/core/debug/debug.h>
+#include <future/core/memory/memory.h>
 #include <future/core/system/window.h>
 #include <future/core/system/application.h>
 
@@ -70,6 +71,11 @@ FutureSystemController * FutureApplication::GetSystemController()
 	return m_systemController;
 }
 
+void FutureApplication::OnLowMemory()
+{
+	FutureMemory::LowMemory();
+}
+
 
 FutureApplication::FutureApplication()
 {
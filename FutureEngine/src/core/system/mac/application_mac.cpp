@@ -96,9 +96,7 @@ void	FutureApplicationImpl::RunMainLoop()
 
 void	FutureApplicationImpl::UpdateMainLoop()
 {
-	m_systemController->PreSynchronizeAll();
-	m_systemController->UpdateAll();
-	m_systemController->PostSynchronizeAll();
+	m_systemController->RunFrame();
 }
 
 void _EnableVisibilityUpdates()
@@ -24,6 +24,7 @@
 
 #include <future/core/system/systemcontroller.h>
 #include <future/core/system/system.h>
+#include <future/core/debug/trace.h>
 #include <future/core/utils/timer/timer.h>
 
 FutureSystemBase::FutureSystemBase()
@@ -89,6 +90,7 @@ bool				FutureSystemBase::IsSystemRunning()
 void				FutureSystemBase::PreSyncSystem()
 {
 	FUTURE_ASSERT(!IsSystemRunning() && IsSystemActive() && GetNeedsPreSync());
+	FUTURE_TRACE_SCOPE_ARG("FutureSystemBase::PreSyncSystem", m_systemType);
 	f32 delta = FutureTimer::TimeSince(m_systemTime);
 	m_isSystemRunning = true;
 	OnPreSyncSystem(delta);
@@ -97,6 +99,7 @@ void				FutureSystemBase::PreSyncSystem()
 void				FutureSystemBase::UpdateSystem()
 {
 	FUTURE_ASSERT(!IsSystemRunning() && IsSystemActive() && GetNeedsUpdate());
+	FUTURE_TRACE_SCOPE_ARG("FutureSystemBase::UpdateSystem", m_systemType);
 	f32 delta = FutureTimer::TimeSince(m_systemTime);
 	m_isSystemRunning = true;
 	OnUpdateSystem(delta);
@@ -105,6 +108,7 @@ void				FutureSystemBase::UpdateSystem()
 void				FutureSystemBase::PostSyncSystem()
 {
 	FUTURE_ASSERT(!IsSystemRunning() && IsSystemActive() && GetNeedsPostSync());
+	FUTURE_TRACE_SCOPE_ARG("FutureSystemBase::PostSyncSystem", m_systemType);
 	f32 delta = FutureTimer::TimeSince(m_systemTime);
 	m_isSystemRunning = true;
 	OnPostSyncSystem(delta);
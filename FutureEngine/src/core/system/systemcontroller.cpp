@@ -23,6 +23,7 @@
 */
 
 #include <future/core/system/systemcontroller.h>
+#include <future/core/memory/allocators/frameallocator.h>
 #include <future/core/thread/pool/job.h>
 #include <future/core/thread/pool/threadpool.h>
 
@@ -201,6 +202,7 @@ void	FutureSystemController::PostSynchronizeAll()
 {
 	PostSynchronizeCore();
 	PostSynchronizeCustom();
+	EndFrame();
 }
 void	FutureSystemController::PostSynchronizeOne(FutureSystemType type)
 {
@@ -256,6 +258,65 @@ void	FutureSystemController::PostSynchronizeCustom()
 	}
 }
 
+void	FutureSystemController::RunFrame()
+{
+	FutureThreadPool * pool = FutureThreadPool::GetInstance();
+	u32 numSystems = FutureSystemType_Max + m_customSystems.Size();
+
+	// systems are free to touch the window, the GL context and each other during PreSync and PostSync,
+	// so those phases stay on the calling thread and run one system at a time like PreSynchronizeAll does.
+	// AsynchronousSystemUpdate isn't supported yet, so only the updates are spread over the workers
+	for(u32 i = 0; i < numSystems; ++i)
+	{
+		FutureSystemBase * system = i < FutureSystemType_Max ? m_systems[i] : m_customSystems[i - FutureSystemType_Max];
+		if(system != NULL && system->GetNeedsPreSync())
+		{
+			system->PreSyncSystem();
+		}
+	}
+
+	// an empty job joins the updates so the calling thread only waits on one job
+	FutureThreadJob * updateDone = new FutureThreadJob();
+	updateDone->SetAutoDelete(false);
+	for(u32 i = 0; i < numSystems; ++i)
+	{
+		FutureSystemBase * system = i < FutureSystemType_Max ? m_systems[i] : m_customSystems[i - FutureSystemType_Max];
+		if(system == NULL || !system->GetNeedsUpdate())
+		{
+			continue;
+		}
+
+		// the dependency is added before the job is queued, so it can't finish early
+		FutureThreadJob * job = new FutureThreadJob(FutureSystemControllerUpdateHandler, system);
+		updateDone->AddDependency(job);
+		pool->AddJob(job);
+	}
+	pool->AddJob(updateDone);
+	pool->WaitForJob(updateDone);
+	delete updateDone;
+
+	for(u32 i = 0; i < numSystems; ++i)
+	{
+		FutureSystemBase * system = i < FutureSystemType_Max ? m_systems[i] : m_customSystems[i - FutureSystemType_Max];
+		if(system != NULL && system->GetNeedsPostSync())
+		{
+			system->PostSyncSystem();
+		}
+	}
+
+	EndFrame();
+}
+
+void	FutureSystemController::EndFrame()
+{
+	// nothing allocated from the frame allocator this frame is used after PostSync
+	FutureFrameAllocator * frameAllocator = FutureFrameAllocator::GetInstance();
+	if(frameAllocator)
+	{
+		frameAllocator->EndFrame();
+	}
+}
+
 void	FutureSystemController::SetCoreSystem(FutureSystemType type, FutureSystemBase * system)
 {
 	if(type == FutureSystemType_Custom)
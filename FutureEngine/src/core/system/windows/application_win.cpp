@@ -121,9 +121,7 @@ void	FutureApplicationImpl::RunMainLoop()
 			}
 		}
 		
-		m_systemController->PreSynchronizeAll();
-		m_systemController->UpdateAll();
-		m_systemController->PostSynchronizeAll();
+		m_systemController->RunFrame();
 
 	}
 }
@@ -0,0 +1,124 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of Condition Variable
+*/
+
+#include <future/core/debug/debug.h>
+#include <future/core/thread/criticalsection/conditionvariable.h>
+
+// we only want to define these functions is we are using multiple threads
+#if FUTURE_ENABLE_MULTITHREADED
+
+#if defined(FUTURE_USES_PTHREAD)
+#	include <sys/time.h>
+#	include <errno.h>
+#endif
+
+FutureConditionVariable::FutureConditionVariable()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	InitializeCriticalSection(&m_mutex);
+	InitializeConditionVariable(&m_condition);
+#elif defined(FUTURE_USES_PTHREAD)
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_condition, NULL);
+#endif
+}
+
+FutureConditionVariable::~FutureConditionVariable()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	DeleteCriticalSection(&m_mutex);
+#elif defined(FUTURE_USES_PTHREAD)
+	pthread_cond_destroy(&m_condition);
+	pthread_mutex_destroy(&m_mutex);
+#endif
+}
+
+void FutureConditionVariable::Lock()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	EnterCriticalSection(&m_mutex);
+#elif defined(FUTURE_USES_PTHREAD)
+	pthread_mutex_lock(&m_mutex);
+#endif
+}
+
+void FutureConditionVariable::Unlock()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	LeaveCriticalSection(&m_mutex);
+#elif defined(FUTURE_USES_PTHREAD)
+	pthread_mutex_unlock(&m_mutex);
+#endif
+}
+
+FutureResult FutureConditionVariable::Wait(u32 milliTimeOut)
+{
+#if FUTURE_PLATFORM_WINDOWS
+	if(!SleepConditionVariableCS(&m_condition, &m_mutex, milliTimeOut == (u32)-1 ? INFINITE : milliTimeOut))
+	{
+		return GetLastError() == ERROR_TIMEOUT ? FR_TIMEOUT : FR_ERROR;
+	}
+	return FR_OK;
+#elif defined(FUTURE_USES_PTHREAD)
+	if(milliTimeOut == (u32)-1)
+	{
+		return pthread_cond_wait(&m_condition, &m_mutex) == 0 ? FR_OK : FR_ERROR;
+	}
+
+	// pthreads wants an absolute time
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	u64 nanoSeconds = (u64)now.tv_usec * 1000 + (u64)milliTimeOut * 1000000;
+	struct timespec time;
+	time.tv_sec = now.tv_sec + (time_t)(nanoSeconds / 1000000000);
+	time.tv_nsec = (long)(nanoSeconds % 1000000000);
+
+	int result = pthread_cond_timedwait(&m_condition, &m_mutex, &time);
+	if(result == ETIMEDOUT)
+	{
+		return FR_TIMEOUT;
+	}
+	return result == 0 ? FR_OK : FR_ERROR;
+#endif
+}
+
+void FutureConditionVariable::Signal()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	WakeConditionVariable(&m_condition);
+#elif defined(FUTURE_USES_PTHREAD)
+	pthread_cond_signal(&m_condition);
+#endif
+}
+
+void FutureConditionVariable::Broadcast()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	WakeAllConditionVariable(&m_condition);
+#elif defined(FUTURE_USES_PTHREAD)
+	pthread_cond_broadcast(&m_condition);
+#endif
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureFiber
+*/
+
+// ucontext is only declared on OS X when asking for the XSI extensions
+#if defined(__APPLE__) && !defined(_XOPEN_SOURCE)
+#	define _XOPEN_SOURCE 600
+#endif
+
+#include <future/core/thread/fiber/fiber.h>
+#include <future/core/debug/debug.h>
+
+#if FUTURE_ENABLE_FIBERS
+
+#if FUTURE_PLATFORM_WINDOWS
+#	include <windows.h>
+#else
+#	include <ucontext.h>
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
+
+// Committed up front on Windows, the rest of the stack is committed as it's touched
+#define FUTURE_FIBER_STACK_COMMIT	(16 * 1024)
+
+FutureFiber::FutureFiber()
+	: m_context(NULL),
+	  m_stack(NULL),
+	  m_stackBytes(0),
+	  m_function(NULL),
+	  m_data(NULL)
+{
+#if !FUTURE_PLATFORM_WINDOWS
+	// allocated up front so converting a thread doesn't allocate on that thread
+	m_context = FUTURE_ALLOC(sizeof(ucontext_t), "FutureFiber context");
+#endif
+}
+
+FutureFiber::~FutureFiber()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	if(m_context && m_stack)
+	{
+		DeleteFiber(m_context);
+	}
+#else
+	if(m_context)
+	{
+		FUTURE_FREE(m_context);
+	}
+	if(m_stack)
+	{
+		munmap(m_stack, m_stackBytes);
+	}
+#endif
+}
+
+bool FutureFiber::Create(FiberFunction function, void * data, u32 stackSize)
+{
+	FUTURE_ASSERT(m_stack == NULL && function);
+
+	m_function = function;
+	m_data = data;
+#if FUTURE_PLATFORM_WINDOWS
+	// Windows reserves the stack, commits as it grows and puts a guard page below it
+	m_context = CreateFiberEx(FUTURE_FIBER_STACK_COMMIT < stackSize ? FUTURE_FIBER_STACK_COMMIT : stackSize, stackSize, 0, StartFiber, this);
+	// marks this as a created fiber, Windows owns the stack
+	m_stack = m_context;
+	return m_context != NULL;
+#else
+	long pageSize = sysconf(_SC_PAGESIZE);
+	size_t page = pageSize > 0 ? (size_t)pageSize : 4096;
+	size_t usable = ((size_t)stackSize + page - 1) & ~(page - 1);
+
+	// anonymous pages are only backed once they're touched, so the whole stack can be mapped up front
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#	if defined(MAP_STACK)
+	flags |= MAP_STACK;
+#	endif
+	void * memory = mmap(NULL, usable + page, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if(memory == MAP_FAILED)
+	{
+		return false;
+	}
+	m_stack = memory;
+	m_stackBytes = usable + page;
+
+	// the stack grows down, so the guard page is the lowest one
+	ucontext_t * context = (ucontext_t*)m_context;
+	if(mprotect(memory, page, PROT_NONE) != 0 || !context || getcontext(context) != 0)
+	{
+		return false;
+	}
+	context->uc_stack.ss_sp = (u8*)memory + page;
+	context->uc_stack.ss_size = usable;
+	context->uc_link = NULL;
+
+	// makecontext only passes ints, so the pointer is split in two
+	u64 pointer = (u64)(size_t)this;
+	makecontext(context, (void (*)())StartFiber, 2, (int)(u32)(pointer >> 32), (int)(u32)pointer);
+	return true;
+#endif
+}
+
+bool FutureFiber::ConvertFromThread()
+{
+	FUTURE_ASSERT(m_stack == NULL);
+#if FUTURE_PLATFORM_WINDOWS
+	FUTURE_ASSERT(m_context == NULL);
+	m_context = ConvertThreadToFiber(NULL);
+#endif
+	// with ucontext the thread's context is saved the first time it switches away
+	return m_context != NULL;
+}
+
+void FutureFiber::ConvertToThread()
+{
+	FUTURE_ASSERT(m_context && !m_stack);
+#if FUTURE_PLATFORM_WINDOWS
+	ConvertFiberToThread();
+	m_context = NULL;
+#endif
+}
+
+void FutureFiber::SwitchTo(FutureFiber * fiber)
+{
+	FUTURE_ASSERT(m_context && fiber && fiber->m_context && fiber != this);
+#if FUTURE_PLATFORM_WINDOWS
+	SwitchToFiber(fiber->m_context);
+#else
+	swapcontext((ucontext_t*)m_context, (ucontext_t*)fiber->m_context);
+#endif
+}
+
+#if FUTURE_PLATFORM_WINDOWS
+void __stdcall FutureFiber::StartFiber(void * data)
+{
+	FutureFiber * fiber = (FutureFiber*)data;
+#else
+void FutureFiber::StartFiber(int high, int low)
+{
+	FutureFiber * fiber = (FutureFiber*)(size_t)(((u64)(u32)high << 32) | (u64)(u32)low);
+#endif
+	fiber->m_function(fiber->m_data);
+	FUTURE_ASSERT_MSG(false, L"A fiber's function must not return");
+}
+
+#endif
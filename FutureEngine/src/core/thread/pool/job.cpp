@@ -23,52 +23,65 @@
 *
 */
 #include <future/core/thread/pool/job.h>
+#include <future/core/debug/trace.h>
+#include <string.h>
+
+// Marks a job's continuation list once the job has finished
+#define FUTURE_JOB_CONTINUATIONS_CLOSED ((void*)1)
 
 // Constructors
 FutureThreadJob::FutureThreadJob()
-	: m_state(FutureThreadJob::JobState_Created),
+	: m_unfinishedDependencies(1),
+	  m_continuations(NULL),
+	  m_state(FutureThreadJob::JobState_Created),
 	  m_thread(NULL),
 	  m_id(-1),
 	  m_priority(FutureThreadJob::JobPriority_Normal),
 	  m_autoDelete(true),
 	  m_next(NULL),
+	  m_timeQueued(0),
+	  m_timeStarted(0),
+	  m_timeCompleted(0),
 	  m_function(NULL),
 	  m_onFinished(NULL),
-	  m_data(NULL),
-	  m_timeAdded(0),
-	  m_timeStarted(0),
-	  m_timeCompleted(0)
+	  m_data(NULL)
 {}
 
 FutureThreadJob::FutureThreadJob(JobFunction function, void * data, FutureThreadJobPriority priority)
-	: m_state(FutureThreadJob::JobState_Created),
+	: m_unfinishedDependencies(1),
+	  m_continuations(NULL),
+	  m_state(FutureThreadJob::JobState_Created),
 	  m_thread(NULL),
 	  m_id(-1),
 	  m_priority(priority),
 	  m_autoDelete(true),
 	  m_next(NULL),
+	  m_timeQueued(0),
+	  m_timeStarted(0),
+	  m_timeCompleted(0),
 	  m_function(function),
 	  m_onFinished(NULL),
-	  m_data(data),
-	  m_timeAdded(0),
-	  m_timeStarted(0),
-	  m_timeCompleted(0)
+	  m_data(data)
 {}
 
 FutureThreadJob::FutureThreadJob(const FutureThreadJob& job)
-	: m_state(FutureThreadJob::JobState_Created),
+	: m_unfinishedDependencies(1),
+	  m_continuations(NULL),
+	  m_state(FutureThreadJob::JobState_Created),
 	  m_thread(NULL),
 	  m_id(-1),
 	  m_priority(job.m_priority),
 	  m_autoDelete(job.m_autoDelete),
 	  m_next(NULL),
+	  m_timeQueued(0),
+	  m_timeStarted(0),
+	  m_timeCompleted(0),
 	  m_function(job.m_function),
 	  m_onFinished(job.m_onFinished),
-	  m_data(job.m_data),
-	  m_timeAdded(0),
-	  m_timeStarted(0),
-	  m_timeCompleted(0)
-{}
+	  m_data(job.m_data == job.m_payload ? (void*)m_payload : job.m_data)
+{
+	memcpy(m_payload, job.m_payload, sizeof(m_payload));
+}
 	
 FutureThreadJob::~FutureThreadJob()
 {}
@@ -76,7 +89,17 @@ FutureThreadJob::~FutureThreadJob()
 // Returns the job's state
 FutureThreadJob::FutureThreadJobState FutureThreadJob::GetState()
 {
-	return m_state;
+	return (FutureThreadJobState)FutureAtomicLoad(&m_state);
+}
+
+void FutureThreadJob::SetState(FutureThreadJobState state)
+{
+	FutureAtomicStore(&m_state, state);
+}
+
+bool FutureThreadJob::ChangeState(FutureThreadJobState expected, FutureThreadJobState state)
+{
+	return FutureAtomicCompareExchange(&m_state, expected, state);
 }
 
 // Gets or sets the job's priority. Higher priority jobs are performed first
@@ -104,6 +127,16 @@ void FutureThreadJob::SetData(void * data)
 
 	m_data = data;
 }
+void * FutureThreadJob::SetPayload(const void * payload, u32 bytes)
+{
+	FUTURE_ASSERT(	m_state == FutureThreadJob::JobState_Created ||
+					m_state != FutureThreadJob::JobState_Finished);
+	FUTURE_ASSERT_MSG(bytes <= FUTURE_JOB_PAYLOAD_SIZE, L"Job payload is too large");
+
+	memcpy(m_payload, payload, bytes);
+	m_data = m_payload;
+	return m_data;
+}
 
 // Set the functions this job should call
 void FutureThreadJob::SetJobFunction(JobFunction function)
@@ -138,9 +171,81 @@ IFutureThread * FutureThreadJob::GetThread()
 	return m_thread;
 }
 
+void FutureThreadJob::AddDependency(FutureThreadJob * job)
+{
+	FUTURE_ASSERT(	m_state == FutureThreadJob::JobState_Created ||
+					m_state == FutureThreadJob::JobState_Finished);
+	FUTURE_ASSERT(job != NULL && job != this);
+
+	Continuation * continuation = new Continuation();
+	continuation->m_job = this;
+
+	// count the dependency first so job can't release us before we are counted
+	FutureAtomicIncrement(&m_unfinishedDependencies);
+	while(true)
+	{
+		void * head = FutureAtomicLoadPtr(&job->m_continuations);
+		if(head == FUTURE_JOB_CONTINUATIONS_CLOSED)
+		{
+			// job has already finished
+			FutureAtomicDecrement(&m_unfinishedDependencies);
+			delete continuation;
+			return;
+		}
+		continuation->m_next = (Continuation*)head;
+		if(FutureAtomicCompareExchangePtr(&job->m_continuations, head, continuation))
+		{
+			return;
+		}
+	}
+}
+
+u32 FutureThreadJob::UnfinishedDependencies()
+{
+	s32 count = FutureAtomicLoad(&m_unfinishedDependencies);
+	if(m_state == FutureThreadJob::JobState_Created || m_state == FutureThreadJob::JobState_Finished)
+	{
+		// don't count the hold that is released when the job is added
+		--count;
+	}
+	return count > 0 ? (u32)count : 0;
+}
+
+bool FutureThreadJob::ReleaseAddHold()
+{
+	return FutureAtomicDecrement(&m_unfinishedDependencies) == 0;
+}
+
+FutureThreadJob * FutureThreadJob::FinishContinuations()
+{
+	Continuation * continuation = (Continuation*)FutureAtomicExchangePtr(&m_continuations, FUTURE_JOB_CONTINUATIONS_CLOSED);
+	FUTURE_ASSERT(continuation != FUTURE_JOB_CONTINUATIONS_CLOSED);
+
+	FutureThreadJob * ready = NULL;
+	while(continuation)
+	{
+		Continuation * next = continuation->m_next;
+		FutureThreadJob * job = continuation->m_job;
+		if(FutureAtomicDecrement(&job->m_unfinishedDependencies) == 0)
+		{
+			job->m_next = ready;
+			ready = job;
+		}
+		delete continuation;
+		continuation = next;
+	}
+	return ready;
+}
+
+void FutureThreadJob::ResetDependencies()
+{
+	FutureAtomicStorePtr(&m_continuations, NULL);
+}
+
 // executes this job
 void FutureThreadJob::Execute(IFutureThread * thread)
 {
+	FUTURE_TRACE_SCOPE_ARG("FutureThreadJob::Execute", m_id);
 	m_thread = thread;
 	if(m_function)
 	{
@@ -0,0 +1,218 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureJobAllocator
+*/
+
+#include <future/core/thread/pool/joballocator.h>
+#include <future/core/debug/debug.h>
+#include <future/core/debug/trace.h>
+
+// Distance between slots, keeps every slot 16 byte aligned
+#define FUTURE_JOB_SLOT_STRIDE ((sizeof(FutureJobAllocator::Slot) + FUTURE_JOB_SLOT_SIZE + 15) & ~(size_t)15)
+
+// Every cache and block ever created, freed on Shutdown
+static void * volatile		s_caches = NULL;
+static void * volatile		s_blocks = NULL;
+static volatile s32			s_numBlocks = 0;
+// Bumped on Shutdown so threads drop caches that no longer exist
+static volatile s32			s_generation = 0;
+
+static FUTURE_THREAD_LOCAL void *	s_threadCache = NULL;
+static FUTURE_THREAD_LOCAL s32		s_threadGeneration = 0;
+
+// pushes a node onto a list that is only ever popped all at once
+static void FuturePushShared(void * volatile * list, void * node, void * volatile * next)
+{
+	while(true)
+	{
+		void * head = FutureAtomicLoadPtr(list);
+		*next = head;
+		if(FutureAtomicCompareExchangePtr(list, head, node))
+		{
+			return;
+		}
+	}
+}
+
+void * FutureJobAllocator::Allocate(u32 bytes)
+{
+	FUTURE_ASSERT(bytes > 0);
+	if(bytes > FUTURE_JOB_SLOT_SIZE)
+	{
+		return FUTURE_ALLOC(bytes, "FutureThreadJob");
+	}
+
+	Cache * cache = GetCache();
+	Slot * slot = cache->m_free;
+	if(!slot)
+	{
+		// take back everything other threads have freed
+		slot = (Slot*)FutureAtomicExchangePtr(&cache->m_remoteFree, NULL);
+		if(!slot)
+		{
+			slot = AllocateBlock(cache);
+		}
+	}
+	cache->m_free = slot->m_next;
+	slot->m_next = NULL;
+	return slot + 1;
+}
+
+void FutureJobAllocator::Free(void * p, u32 bytes)
+{
+	if(!p)
+	{
+		return;
+	}
+	if(bytes > FUTURE_JOB_SLOT_SIZE)
+	{
+		FUTURE_FREE(p);
+		return;
+	}
+
+	Slot * slot = (Slot*)p - 1;
+	Cache * cache = slot->m_owner;
+	if(cache == s_threadCache && s_threadGeneration == FutureAtomicLoad(&s_generation))
+	{
+		slot->m_next = cache->m_free;
+		cache->m_free = slot;
+	}
+	else
+	{
+		FuturePushShared(&cache->m_remoteFree, slot, (void * volatile *)&slot->m_next);
+	}
+}
+
+void FutureJobAllocator::ReleaseThread()
+{
+	Cache * cache = (Cache*)s_threadCache;
+	if(!cache || s_threadGeneration != FutureAtomicLoad(&s_generation))
+	{
+		return;
+	}
+	// the free list goes with the cache, slots it owns keep pointing at it
+	s_threadCache = NULL;
+	FutureAtomicExchange(&cache->m_orphaned, 1);
+}
+
+void FutureJobAllocator::Shutdown()
+{
+	// every slot that isn't on a free list belongs to a job that still exists
+	u32 freeSlots = 0;
+	for(Cache * cache = (Cache*)FutureAtomicLoadPtr(&s_caches); cache; cache = cache->m_nextCache)
+	{
+		for(Slot * slot = cache->m_free; slot; slot = slot->m_next)
+		{
+			++freeSlots;
+		}
+		for(Slot * slot = (Slot*)FutureAtomicLoadPtr(&cache->m_remoteFree); slot; slot = slot->m_next)
+		{
+			++freeSlots;
+		}
+	}
+	u32 totalSlots = (u32)FutureAtomicLoad(&s_numBlocks) * FUTURE_JOB_SLOTS_PER_BLOCK;
+	if(freeSlots != totalSlots)
+	{
+		FUTURE_ASSERT_MSG(false, L"FutureJobAllocator shut down with jobs still allocated");
+		FUTURE_LOG_ERROR(L"%u jobs still allocated when the FutureJobAllocator was shut down, its blocks are leaked", totalSlots - freeSlots);
+		return;
+	}
+
+	FutureAtomicIncrement(&s_generation);
+
+	Block * block = (Block*)FutureAtomicExchangePtr(&s_blocks, NULL);
+	while(block)
+	{
+		Block * next = block->m_next;
+		FUTURE_FREE(block);
+		block = next;
+	}
+	Cache * cache = (Cache*)FutureAtomicExchangePtr(&s_caches, NULL);
+	while(cache)
+	{
+		Cache * next = cache->m_nextCache;
+		FUTURE_FREE(cache);
+		cache = next;
+	}
+	FutureAtomicStore(&s_numBlocks, 0);
+	s_threadCache = NULL;
+}
+
+u32 FutureJobAllocator::BlocksAllocated()
+{
+	return (u32)FutureAtomicLoad(&s_numBlocks);
+}
+
+FutureJobAllocator::Cache * FutureJobAllocator::GetCache()
+{
+	s32 generation = FutureAtomicLoad(&s_generation);
+	if(s_threadCache && s_threadGeneration == generation)
+	{
+		return (Cache*)s_threadCache;
+	}
+
+	// adopt a cache from a thread that has exited before making a new one
+	Cache * cache = NULL;
+	for(Cache * c = (Cache*)FutureAtomicLoadPtr(&s_caches); c; c = c->m_nextCache)
+	{
+		if(FutureAtomicLoad(&c->m_orphaned) && FutureAtomicCompareExchange(&c->m_orphaned, 1, 0))
+		{
+			cache = c;
+			break;
+		}
+	}
+
+	if(!cache)
+	{
+		cache = (Cache*)FUTURE_ALLOC(sizeof(Cache), "FutureJobAllocator cache");
+		cache->m_free = NULL;
+		cache->m_remoteFree = NULL;
+		cache->m_orphaned = 0;
+		FuturePushShared(&s_caches, cache, (void * volatile *)&cache->m_nextCache);
+	}
+
+	s_threadCache = cache;
+	s_threadGeneration = generation;
+	return cache;
+}
+
+FutureJobAllocator::Slot * FutureJobAllocator::AllocateBlock(Cache * cache)
+{
+	FUTURE_TRACE_SCOPE("FutureJobAllocator::AllocateBlock");
+	u8 * memory = (u8*)FUTURE_ALLOC(sizeof(Block) + FUTURE_JOB_SLOT_STRIDE * FUTURE_JOB_SLOTS_PER_BLOCK + 15, "FutureJobAllocator block");
+	Block * block = (Block*)memory;
+	block->m_slots = (Slot*)(((size_t)(memory + sizeof(Block)) + 15) & ~(size_t)15);
+	FuturePushShared(&s_blocks, block, (void * volatile *)&block->m_next);
+	FutureAtomicIncrement(&s_numBlocks);
+
+	// link the slots together, first slot first
+	Slot * first = block->m_slots;
+	Slot * slot = first;
+	for(u32 i = 0; i < FUTURE_JOB_SLOTS_PER_BLOCK; ++i)
+	{
+		Slot * next = (Slot*)((u8*)slot + FUTURE_JOB_SLOT_STRIDE);
+		slot->m_owner = cache;
+		slot->m_next = i + 1 < FUTURE_JOB_SLOTS_PER_BLOCK ? next : NULL;
+		slot = next;
+	}
+	return first;
+}
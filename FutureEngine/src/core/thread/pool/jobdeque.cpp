@@ -0,0 +1,130 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureJobDeque, based on "Correct and Efficient Work-Stealing
+*	for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli). The buffer does not grow,
+*	a full deque simply rejects the push.
+*/
+
+#include <future/core/thread/pool/jobdeque.h>
+#include <future/core/thread/pool/job.h>
+#include <future/core/debug/debug.h>
+
+FutureJobDeque::FutureJobDeque()
+	: m_top(0),
+	  m_bottom(0),
+	  m_buffer(NULL),
+	  m_mask(0)
+{}
+
+FutureJobDeque::~FutureJobDeque()
+{
+	if(m_buffer)
+	{
+		FUTURE_FREE((void*)m_buffer);
+		m_buffer = NULL;
+	}
+}
+
+void FutureJobDeque::Initialize(u32 capacity)
+{
+	FUTURE_ASSERT(m_buffer == NULL);
+	FUTURE_ASSERT_MSG(capacity && (capacity & (capacity - 1)) == 0, L"Job deque capacity must be a power of two");
+
+	m_buffer = (void * volatile *)FUTURE_ALLOC(sizeof(void*) * capacity, "FutureJobDeque buffer");
+	m_mask = capacity - 1;
+	m_top = 0;
+	m_bottom = 0;
+}
+
+bool FutureJobDeque::IsInitialized()
+{
+	return m_buffer != NULL;
+}
+
+bool FutureJobDeque::Push(FutureThreadJob * job)
+{
+	s64 bottom = m_bottom;
+	s64 top = FutureAtomicLoad(&m_top);
+	if(bottom - top > m_mask)
+	{
+		return false;
+	}
+	m_buffer[bottom & m_mask] = job;
+	// publish the job before the new bottom
+	FutureAtomicStore(&m_bottom, bottom + 1);
+	return true;
+}
+
+FutureThreadJob * FutureJobDeque::Pop()
+{
+	s64 bottom = m_bottom - 1;
+	FutureAtomicStore(&m_bottom, bottom);
+	// the new bottom must be visible before top is read or a thief could take the same job
+	FutureAtomicFence();
+	s64 top = FutureAtomicLoad(&m_top);
+
+	if(top > bottom)
+	{
+		// empty
+		FutureAtomicStore(&m_bottom, bottom + 1);
+		return NULL;
+	}
+
+	FutureThreadJob * job = (FutureThreadJob*)m_buffer[bottom & m_mask];
+	if(top == bottom)
+	{
+		// last job, race any thieves for it
+		if(!FutureAtomicCompareExchange(&m_top, top, top + 1))
+		{
+			job = NULL;
+		}
+		FutureAtomicStore(&m_bottom, bottom + 1);
+	}
+	return job;
+}
+
+FutureThreadJob * FutureJobDeque::Steal()
+{
+	s64 top = FutureAtomicLoad(&m_top);
+	FutureAtomicFence();
+	s64 bottom = FutureAtomicLoad(&m_bottom);
+
+	if(top >= bottom)
+	{
+		return NULL;
+	}
+
+	FutureThreadJob * job = (FutureThreadJob*)FutureAtomicLoadPtr(&m_buffer[top & m_mask]);
+	if(!FutureAtomicCompareExchange(&m_top, top, top + 1))
+	{
+		// lost to the owner or another thief
+		return NULL;
+	}
+	return job;
+}
+
+u32 FutureJobDeque::Size()
+{
+	s64 bottom = FutureAtomicLoad(&m_bottom);
+	s64 top = FutureAtomicLoad(&m_top);
+	return bottom > top ? (u32)(bottom - top) : 0;
+}
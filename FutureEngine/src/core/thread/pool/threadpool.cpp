@@ -23,6 +23,16 @@
 *	keeps a list of jobs in a Priority Queue and pulls jobs off the queue whenever
 *	a thread becomes available. Jobs with higher priority are executed first.
 *
+*	Jobs added from a worker thread go onto that worker's deque, idle workers
+*	steal from each other's deques before touching Idle priority jobs.
+*
+*	Threads with nothing to do spin for a short while, then sleep on m_wakeCondition.
+*	A sleeping thread first bumps m_sleepingThreads and checks for work one last
+*	time, anyone publishing work checks m_sleepingThreads after publishing and wakes
+*	a thread by bumping m_wakeCount. One side or the other always sees the change so
+*	no wake up is lost. Threads waiting on jobs to finish sleep the same way and are
+*	woken when the pool runs dry or a job that isn't auto deleted finishes.
+*
 *	When running in a single threaded application, ThreadPool executes each job
 *	on the main thread, when WaitForCompletion is called. If a timeout is specified
 *	then ThreadPool will execute as many jobs as possible within the allotted time
@@ -31,126 +41,120 @@
 
 #include <future/core/thread/pool/threadpool.h>
 #include <future/core/thread/thread/workerthread.h>
+#include <future/core/thread/thread/cputopology.h>
 #include <future/core/utils/timer/timer.h>
 
 FutureThreadPool * FutureThreadPool::ms_instance = NULL;
 
 FutureThreadPool::FutureThreadPool()
-	: m_jobs(NULL),
+	: m_usedBuckets(0),
 #if FUTURE_ENABLE_MULTITHREADED
-	  m_threads(NULL),
+	  m_numThreads(0),
+	  m_numQueues(0),
+#endif
+	  m_criticalJobs(0),
+	  m_queuedJobs(0),
+	  m_pendingJobs(0),
+	  m_sleepingThreads(0),
+	  m_wakeCount(0),
+	  m_totalJobs(0)
+#if FUTURE_ENABLE_FIBERS
+	  ,m_numFibers(0),
+	  m_freeFibers(NULL),
+	  m_waitingFibers(NULL),
+	  m_numWaitingFibers(0)
 #endif
-	  m_totalJobs(0),
-	  m_threadTime(0.f),
-	  m_jobTime(0.f)
 {		
 	FUTURE_ASSERT(ms_instance == NULL);
+	FUTURE_ASSERT(JobBucket_Count == FUTURE_THREAD_POOL_PRIORITY_LEVELS);
 	ms_instance = this;
+	for(u32 i = 0; i < FUTURE_THREAD_POOL_MAX_THREADS; ++i)
+	{
+		m_counters[i] = NULL;
+	}
+	m_counters[FUTURE_THREAD_POOL_MAX_THREADS] = new FutureThreadPoolCounters(true);
+	for(u32 i = 0; i < JobBucket_Count; ++i)
+	{
+		m_jobs[i].m_head = NULL;
+		m_jobs[i].m_tail = NULL;
+	}
+#if FUTURE_ENABLE_MULTITHREADED
+	for(u32 i = 0; i < FUTURE_THREAD_POOL_MAX_THREADS; ++i)
+	{
+		m_threads[i] = NULL;
+		m_queueNodes[i] = 0;
+	}
+#endif
 }
 
 FutureThreadPool::~FutureThreadPool()
 {
-	ClearJobQueue();
 #if FUTURE_ENABLE_MULTITHREADED
-	for(FutureWorkerThread * thread = m_threads; thread;)
+	SetNumThreads(0);
+#endif
+	ClearJobQueue();
+#if FUTURE_ENABLE_FIBERS
+	FUTURE_ASSERT_MSG(m_numWaitingFibers == 0, L"Thread pool destroyed while jobs are suspended");
+	for(u32 i = 0; i < m_numFibers; ++i)
 	{
-		FutureWorkerThread * next = thread->m_next;
-		thread->Release();
-		delete thread;
-		thread = next;
+		delete m_fibers[i];
 	}
 #endif
+	for(u32 i = 0; i <= FUTURE_THREAD_POOL_MAX_THREADS; ++i)
+	{
+		delete m_counters[i];
+	}
+	FutureJobAllocator::Shutdown();
 	ms_instance = NULL;
 }
 
 // Returns the id of the newly added job
 u32	FutureThreadPool::AddJob(FutureThreadJob * job)
 {
-	if(job->m_state != FutureThreadJob::JobState_Created &&
-		job->m_state != FutureThreadJob::JobState_Finished)
+	// claim the job so two threads can't add it at once
+	FutureThreadJob::FutureThreadJobState state = job->GetState();
+	if((state != FutureThreadJob::JobState_Created && state != FutureThreadJob::JobState_Finished) ||
+		!job->ChangeState(state, FutureThreadJob::JobState_ToBeAdded))
 	{
 		return -1;
 	}
 	
 #if FUTURE_ENABLE_MULTITHREADED
-	if(!m_threads)
+	if(FutureAtomicLoad(&m_numThreads) == 0)
 	{
 		SetNumThreads(FutureCoreConfig::ThreadPoolThreads());
 	}
 #endif
 
-	Lock();
-	job->Lock();
-	f32 startTime;
+	u64 startTime = 0;
+	FutureThreadPoolCounters * counters = NULL;
 	if(FutureCoreConfig::ProfileThreadPool())
 	{
-		startTime = FutureTimer::CurrentTime();
-		job->m_timeAdded = startTime;
-	}
-	job->m_state = FutureThreadJob::JobState_ToBeAdded;
-	job->m_id = m_totalJobs;
-	job->Unlock();
-	++m_totalJobs;
-
-	if(m_jobs == NULL)
-	{
-		m_jobs = job;
-		job->Lock();
-		job->m_next = NULL;
-		job->m_state = FutureThreadJob::JobState_InQueue;
-		job->Unlock();
-		if(FutureCoreConfig::ProfileThreadPool())
-		{
-			m_threadTime += FutureTimer::TimeSince(startTime);
-		}
-		Unlock();
-		return job->m_id;
+		startTime = FutureTimer::CurrentNanoseconds();
+		counters = GetCounters(FutureWorkerThread::GetCurrent());
 	}
-	FutureThreadJob * last = NULL;
-	bool added = false;
-	for(FutureThreadJob * j = m_jobs; j; j = j->m_next)
+	if(state == FutureThreadJob::JobState_Finished)
 	{
-		if(j->GetPriority() < job->GetPriority())
-		{
-			added = true;
-			job->Lock();
-			job->m_next = j;
-			if(last)
-			{
-				last->m_next = job;
-			}
-			else
-			{
-				m_jobs = job;
-			}
-			job->m_state = FutureThreadJob::JobState_InQueue;
-			job->Unlock();
-			break;
-		}
-		last = j;
+		job->ResetDependencies();
 	}
-	if(!added)
+	job->m_id = (u32)(FutureAtomicIncrement(&m_totalJobs) - 1);
+	job->m_next = NULL;
+	// must be set before the hold is released, a finishing dependency could queue the job right away
+	job->SetState(FutureThreadJob::JobState_WaitingOnDependencies);
+	u32 id = job->m_id;
+	FutureAtomicIncrement(&m_pendingJobs);
+
+	if(job->ReleaseAddHold())
 	{
-		job->Lock();
-		if(last)
-		{
-			last->m_next = job;
-			job->m_next = NULL;
-		}
-		else
-		{
-			job->m_next = m_jobs;
-			m_jobs = job;
-		}
-		job->m_state = FutureThreadJob::JobState_InQueue;
-		job->Unlock();
+		QueueJob(job);
 	}
-	if(FutureCoreConfig::ProfileThreadPool())
+
+	if(counters)
 	{
-		m_threadTime += FutureTimer::TimeSince(startTime);
+		counters->Add(&counters->m_jobsAdded, 1);
+		counters->Add(&counters->m_overheadTime, (s64)(FutureTimer::CurrentNanoseconds() - startTime));
 	}
-	Unlock();
-	return job->m_id;
+	return id;
 }
 
 u32	FutureThreadPool::AddJobAtPriority(FutureThreadJob * job, FutureThreadJob::FutureThreadJobPriority priority)
@@ -160,29 +164,83 @@ u32	FutureThreadPool::AddJobAtPriority(FutureThreadJob * job, FutureThreadJob::F
 }
 
 // Removes all jobs from the queue, jobs currently executing will not be stopped
+// Jobs waiting only on removed jobs are removed as well
 void FutureThreadPool::ClearJobQueue()
 {
+	// collect everything into one list, linked through m_next
+	FutureThreadJob * removed = NULL;
 	Lock();
-	for(FutureThreadJob * j = m_jobs; j;)
+	for(u32 i = 0; i < JobBucket_Count; ++i)
 	{
-		FutureThreadJob * next = j->m_next;
-		delete j;
-		j = next;
+		if(m_jobs[i].m_tail)
+		{
+			m_jobs[i].m_tail->m_next = removed;
+			removed = m_jobs[i].m_head;
+		}
+		m_jobs[i].m_head = NULL;
+		m_jobs[i].m_tail = NULL;
 	}
-	m_jobs = NULL;
+	m_usedBuckets = 0;
+	FutureAtomicStore(&m_criticalJobs, 0);
 	Unlock();
+
+#if FUTURE_ENABLE_MULTITHREADED
+	s32 queues = FutureAtomicLoad(&m_numQueues);
+	for(s32 i = 0; i < queues; ++i)
+	{
+		while(m_queues[i].Size() > 0)
+		{
+			FutureThreadJob * job = m_queues[i].Steal();
+			if(job)
+			{
+				job->m_next = removed;
+				removed = job;
+			}
+		}
+	}
+#endif
+
+	s32 queued = 0;
+	for(FutureThreadJob * job = removed; job; job = job->m_next)
+	{
+		++queued;
+	}
+	FutureAtomicAdd(&m_queuedJobs, -queued);
+
+	s32 count = 0;
+	while(removed)
+	{
+		FutureThreadJob * job = removed;
+		removed = job->m_next;
+
+		FutureThreadJob * ready = job->FinishContinuations();
+		while(ready)
+		{
+			FutureThreadJob * next = ready->m_next;
+			ready->m_next = removed;
+			removed = ready;
+			ready = next;
+		}
+		delete job;
+		++count;
+	}
+	FutureAtomicAdd(&m_pendingJobs, -count);
+	WakeThreads(true);
 }
 
 // Gets the job with the provided id
 FutureThreadJob * FutureThreadPool::GetJob(u32 id)
 {
 	Lock();
-	for(FutureThreadJob * j = m_jobs; j; j = j->m_next)
+	for(u32 i = 0; i < JobBucket_Count; ++i)
 	{
-		if(j->m_id == id)
+		for(FutureThreadJob * j = m_jobs[i].m_head; j; j = j->m_next)
 		{
-			Unlock();
-			return j;
+			if(j->m_id == id)
+			{
+				Unlock();
+				return j;
+			}
 		}
 	}
 	Unlock();
@@ -193,35 +251,28 @@ u32	FutureThreadPool::ActiveJobs()
 {
 	Lock();
 	u32 count = 0;
-	for(FutureThreadJob * j = m_jobs; j; j = j->m_next)
+	for(u32 i = 0; i < JobBucket_Count; ++i)
 	{
-		++count;
+		for(FutureThreadJob * j = m_jobs[i].m_head; j; j = j->m_next)
+		{
+			++count;
+		}
 	}
 	Unlock();
+#if FUTURE_ENABLE_MULTITHREADED
+	s32 queues = FutureAtomicLoad(&m_numQueues);
+	for(s32 i = 0; i < queues; ++i)
+	{
+		count += m_queues[i].Size();
+	}
+#endif
 	return count;
 }
 
 // Checks if there are any active jobs
 bool FutureThreadPool::IsProcessing()
 {
-	Lock();
-	if(m_jobs)
-	{
-		Unlock();
-		return true;
-	}
-#if FUTURE_ENABLE_MULTITHREADED
-	for(FutureWorkerThread * thread = m_threads; thread; thread = thread->m_next)
-	{
-		if(!thread->m_idle)
-		{
-			Unlock();
-			return true;
-		}
-	}
-#endif
-	Unlock();
-	return false;
+	return FutureAtomicLoad(&m_pendingJobs) > 0;
 }
 
 // Waits until the job queue is empty and all jobs are finished before returning
@@ -229,45 +280,94 @@ bool FutureThreadPool::IsProcessing()
 void FutureThreadPool::WaitForCompletion(f32 secondsTimeOut)
 {
 	f32 startTime = FutureTimer::CurrentTime();
-	while(IsProcessing() && (secondsTimeOut <= 0 || FutureTimer::TimeSince(startTime) < secondsTimeOut))
+	while(IsProcessing())
 	{
-		FutureThreadJob * job = GetNextJob();
+		u32 milliTimeOut = -1;
+		if(secondsTimeOut > 0)
+		{
+			f32 remaining = secondsTimeOut - FutureTimer::TimeSince(startTime);
+			if(remaining <= 0)
+			{
+				break;
+			}
+			milliTimeOut = (u32)FutureTimer::SecondsToMillis(remaining) + 1;
+		}
+
+		// looked up every time, this may be a job that continues on another worker after running others
+		FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+		FutureThreadJob * job = GetNextJob(worker);
 		if(job)
 		{
-			job->Execute(NULL);
+			job->Execute(worker);
 			JobFinished(job);
+			continue;
 		}
-		else
+
+		// everything left is running on other threads, sleep until one of them
+		// finishes the last job or adds more work
+		s32 wakeCount = FutureAtomicLoad(&m_wakeCount);
+		FutureAtomicIncrement(&m_sleepingThreads);
+		if(IsProcessing() && FutureAtomicLoad(&m_queuedJobs) == 0)
 		{
-			Sleep(5);
+			SleepUntilWoken(wakeCount, milliTimeOut);
 		}
+		FutureAtomicDecrement(&m_sleepingThreads);
 	}
+}
 
-	if(FutureCoreConfig::ProfileThreadPool())
+void FutureThreadPool::WaitForJob(FutureThreadJob * job)
+{
+	FUTURE_ASSERT_MSG(!job->m_autoDelete, L"Can't wait on a job that deletes itself");
+
+	while(job->GetState() != FutureThreadJob::JobState_Finished)
 	{
-		Lock();
-		m_threadTime += FutureTimer::TimeSince(startTime);
-		Unlock();
+		FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+		FutureThreadJob * next = GetNextJob(worker);
+		if(next)
+		{
+			next->Execute(worker);
+			JobFinished(next);
+			continue;
+		}
+
+		s32 wakeCount = FutureAtomicLoad(&m_wakeCount);
+		FutureAtomicIncrement(&m_sleepingThreads);
+		if(job->GetState() != FutureThreadJob::JobState_Finished && FutureAtomicLoad(&m_queuedJobs) == 0)
+		{
+			SleepUntilWoken(wakeCount);
+		}
+		FutureAtomicDecrement(&m_sleepingThreads);
+	}
+}
+
+void FutureThreadPool::WaitForCounter(volatile s32 * counter)
+{
+	while(FutureAtomicLoad(counter) > 0)
+	{
+		FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+		FutureThreadJob * next = GetNextJob(worker);
+		if(next)
+		{
+			next->Execute(worker);
+			JobFinished(next);
+		}
+		else
+		{
+			FutureAtomicPause();
+		}
 	}
 }
 
 void FutureThreadPool::WaitForCompletion(u32 millisTimeOut)
 {
-	WaitForCompletion((f32)millisTimeOut * 1000.f);
+	WaitForCompletion(FutureTimer::MilliToSeconds(millisTimeOut));
 }
 
 // functions for getting and setting the number of active threads
 u32	FutureThreadPool::GetNumThreads()
 {
 #if FUTURE_ENABLE_MULTITHREADED
-	Lock();
-	u32 count = 0;
-	for(FutureWorkerThread * thread = m_threads; thread; thread = thread->m_next)
-	{
-		++count;
-	}
-	Unlock();
-	return count;
+	return (u32)FutureAtomicLoad(&m_numThreads);
 #else
 	return 0;
 #endif
@@ -275,122 +375,806 @@ u32	FutureThreadPool::GetNumThreads()
 void FutureThreadPool::SetNumThreads(u32 threads)
 {
 #if FUTURE_ENABLE_MULTITHREADED
-	f32 startTime;
+	u64 startTime = 0;
 	if(FutureCoreConfig::ProfileThreadPool())
 	{
-		startTime = FutureTimer::CurrentTime();
+		startTime = FutureTimer::CurrentNanoseconds();
+	}
+	if(threads > FUTURE_THREAD_POOL_MAX_THREADS)
+	{
+		FUTURE_LOG_WARNING(L"Requested %u threads but the thread pool supports at most %u", threads, FUTURE_THREAD_POOL_MAX_THREADS);
+		threads = FUTURE_THREAD_POOL_MAX_THREADS;
+	}
+
+#if FUTURE_ENABLE_FIBERS
+	// every new worker needs a fiber to start on, create them here rather than on the new threads
+	if(threads > (u32)m_numThreads)
+	{
+		m_fiberLock.Lock();
+		u32 freeFibers = 0;
+		for(FutureJobFiber * fiber = m_freeFibers; fiber; fiber = fiber->m_next)
+		{
+			++freeFibers;
+		}
+		for(; freeFibers < threads - (u32)m_numThreads; ++freeFibers)
+		{
+			FutureJobFiber * fiber = CreateFiber();
+			if(!fiber)
+			{
+				break;
+			}
+			fiber->m_next = m_freeFibers;
+			m_freeFibers = fiber;
+		}
+		m_fiberLock.Unlock();
 	}
-	u32 count = GetNumThreads();
-	while(count < threads)
+#endif
+
+	FutureThreadAffinity affinity = FutureCoreConfig::ThreadPoolAffinity();
+
+	Lock();
+	while((u32)m_numThreads < threads)
 	{
+		u32 index = (u32)m_numThreads;
+
+		// deal the workers out to the nodes in turn, then to the cores within each node
+		u32 node = 0;
+		u32 cpu = 0;
+		if(affinity != FutureThreadAffinity_None)
+		{
+			u32 nodes = FutureCpuTopology::NumNodes();
+			node = index % nodes;
+			cpu = FutureCpuTopology::CpuInNode(node, (index / nodes) % FutureCpuTopology::NumCpusInNode(node));
+		}
+		m_queueNodes[index] = node;
+
+		if(!m_queues[index].IsInitialized())
+		{
+			m_queues[index].Initialize(FUTURE_THREAD_POOL_QUEUE_SIZE);
+			m_counters[index] = new FutureThreadPoolCounters(false);
+			FutureAtomicStore(&m_numQueues, (s32)index + 1);
+		}
 		FutureWorkerThread * thread = new FutureWorkerThread();
+		thread->m_index = index;
+		thread->m_affinity = affinity;
+		thread->m_node = node;
+		thread->m_cpu = cpu;
 		FutureResult result = thread->Start(NULL);
-		if(result == FR_OK)
+		if(result != FR_OK)
 		{
-			Lock();
-			thread->m_next = m_threads;
-			m_threads = thread;
-			++count;
-			Unlock();
+			delete thread;
+			break;
 		}
-		else
+		m_threads[index] = thread;
+		FutureAtomicStore(&m_numThreads, (s32)index + 1);
+
+		if(FutureCoreConfig::ProfileThreadPool() && affinity != FutureThreadAffinity_None)
 		{
-			return;
+			FUTURE_LOG_DEBUG(L"Thread pool worker %u placed on node %u, cpu %u", index, node, cpu);
 		}
 	}
-	while(count > threads)
+	Unlock();
+
+	while(true)
 	{
+		// workers may be waiting on the lock, so it can't be held while joining them
 		Lock();
-		FutureWorkerThread * thread = m_threads;
-		m_threads = m_threads->m_next;
-		--count;
+		if((u32)m_numThreads <= threads)
+		{
+			Unlock();
+			break;
+		}
+		u32 index = (u32)m_numThreads - 1;
+		FutureWorkerThread * thread = m_threads[index];
+		m_threads[index] = NULL;
+		FutureAtomicStore(&m_numThreads, (s32)index);
 		Unlock();
+
 		thread->Release();
 		delete thread;
+
+		// anything the thread left behind goes back to the shared queue
+		while(m_queues[index].Size() > 0)
+		{
+			FutureThreadJob * job = m_queues[index].Steal();
+			if(job)
+			{
+				AddSharedJob(job);
+			}
+		}
 	}
+
 	if(FutureCoreConfig::ProfileThreadPool())
 	{
-		Lock();
-		m_threadTime += FutureTimer::TimeSince(startTime);
-		Unlock();
+		FutureThreadPoolCounters * counters = GetCounters(FutureWorkerThread::GetCurrent());
+		counters->Add(&counters->m_overheadTime, (s64)(FutureTimer::CurrentNanoseconds() - startTime));
 	}
 
 #endif
 }
 
 // Profiling information
+void FutureThreadPool::GetProfile(FutureThreadPoolProfile * profile)
+{
+	u32 workers = 0;
+#if FUTURE_ENABLE_MULTITHREADED
+	workers = (u32)FutureAtomicLoad(&m_numQueues);
+#endif
+	profile->m_numWorkers = workers;
+	profile->m_jobsAdded = 0;
+	profile->m_jobsExecuted = 0;
+	profile->m_executeTime = 0;
+	profile->m_waitTime = 0;
+	profile->m_overheadTime = 0;
+	profile->m_idleTime = 0;
+	profile->m_localSteals = 0;
+	profile->m_remoteSteals = 0;
+	for(u32 level = 0; level < FUTURE_THREAD_POOL_PRIORITY_LEVELS; ++level)
+	{
+		profile->m_waitTimes[level].Clear();
+		profile->m_executeTimes[level].Clear();
+	}
+
+	for(u32 i = 0; i <= workers; ++i)
+	{
+		FutureThreadPoolCounters * counters = m_counters[i == workers ? FUTURE_THREAD_POOL_MAX_THREADS : i];
+		FutureThreadPoolProfile::Thread & thread = profile->m_threads[i];
+		thread.m_jobsExecuted = (u64)FutureAtomicLoad(&counters->m_jobsExecuted);
+		thread.m_overheadTime = (u64)FutureAtomicLoad(&counters->m_overheadTime);
+		thread.m_idleTime = (u64)FutureAtomicLoad(&counters->m_idleTime);
+		thread.m_localSteals = (u64)FutureAtomicLoad(&counters->m_localSteals);
+		thread.m_remoteSteals = (u64)FutureAtomicLoad(&counters->m_remoteSteals);
+		thread.m_executeTime = 0;
+		for(u32 level = 0; level < FUTURE_THREAD_POOL_PRIORITY_LEVELS; ++level)
+		{
+			thread.m_executeTime += counters->m_executeTime[level].Total();
+			profile->m_waitTime += counters->m_waitTime[level].Total();
+			profile->m_waitTimes[level].Merge(counters->m_waitTime[level]);
+			profile->m_executeTimes[level].Merge(counters->m_executeTime[level]);
+		}
+
+		profile->m_jobsAdded += (u64)FutureAtomicLoad(&counters->m_jobsAdded);
+		profile->m_jobsExecuted += thread.m_jobsExecuted;
+		profile->m_executeTime += thread.m_executeTime;
+		profile->m_overheadTime += thread.m_overheadTime;
+		profile->m_idleTime += thread.m_idleTime;
+		profile->m_localSteals += thread.m_localSteals;
+		profile->m_remoteSteals += thread.m_remoteSteals;
+	}
+}
+
+u64 FutureThreadPool::SumCounters(volatile s64 FutureThreadPoolCounters::* counter)
+{
+	u32 workers = 0;
+#if FUTURE_ENABLE_MULTITHREADED
+	workers = (u32)FutureAtomicLoad(&m_numQueues);
+#endif
+	u64 sum = (u64)FutureAtomicLoad(&(m_counters[FUTURE_THREAD_POOL_MAX_THREADS]->*counter));
+	for(u32 i = 0; i < workers; ++i)
+	{
+		sum += (u64)FutureAtomicLoad(&(m_counters[i]->*counter));
+	}
+	return sum;
+}
+
 u32	FutureThreadPool::TotalJobsExecuted()
 {
-	return m_totalJobs;
+	return (u32)m_totalJobs;
 }
 f32	FutureThreadPool::AverageWaitTime()
 {
-	return m_waitTime / (f32)m_totalJobs;
+	u32 workers = 0;
+#if FUTURE_ENABLE_MULTITHREADED
+	workers = (u32)FutureAtomicLoad(&m_numQueues);
+#endif
+	u64 total = 0;
+	u64 count = 0;
+	for(u32 i = 0; i <= workers; ++i)
+	{
+		FutureThreadPoolCounters * counters = m_counters[i == workers ? FUTURE_THREAD_POOL_MAX_THREADS : i];
+		for(u32 level = 0; level < FUTURE_THREAD_POOL_PRIORITY_LEVELS; ++level)
+		{
+			total += counters->m_waitTime[level].Total();
+			count += counters->m_waitTime[level].Count();
+		}
+	}
+	return count ? (f32)((f64)total / (f64)count / 1000000000.0) : 0.f;
 }
 f32	FutureThreadPool::TimeOnMainThread()
 {
-	return m_threadTime;
+	return (f32)((f64)SumCounters(&FutureThreadPoolCounters::m_overheadTime) / 1000000000.0);
 }
 f32	FutureThreadPool::TimeSpentExecutingJobs()
 {
-	return m_jobTime;
+	u32 workers = 0;
+#if FUTURE_ENABLE_MULTITHREADED
+	workers = (u32)FutureAtomicLoad(&m_numQueues);
+#endif
+	u64 total = 0;
+	for(u32 i = 0; i <= workers; ++i)
+	{
+		FutureThreadPoolCounters * counters = m_counters[i == workers ? FUTURE_THREAD_POOL_MAX_THREADS : i];
+		for(u32 level = 0; level < FUTURE_THREAD_POOL_PRIORITY_LEVELS; ++level)
+		{
+			total += counters->m_executeTime[level].Total();
+		}
+	}
+	return (f32)((f64)total / 1000000000.0);
+}
+u32	FutureThreadPool::StealsWithinNode()
+{
+	return (u32)SumCounters(&FutureThreadPoolCounters::m_localSteals);
+}
+u32	FutureThreadPool::StealsAcrossNodes()
+{
+	return (u32)SumCounters(&FutureThreadPoolCounters::m_remoteSteals);
 }
 
-FutureThreadJob *	FutureThreadPool::GetNextJob()
+FutureThreadJob *	FutureThreadPool::GetNextJob(FutureWorkerThread * thread)
 {
+	u64 startTime = 0;
+	FutureThreadPoolCounters * counters = NULL;
 	if(FutureCoreConfig::ProfileThreadPool())
 	{
-		startTime = FutureTimer::CurrentTime();
+		startTime = FutureTimer::CurrentNanoseconds();
+		counters = GetCounters(thread);
 	}
-	Lock();
-	FutureThreadJob * job = m_jobs;
-	if(job)
+
+	FutureThreadJob * job = NULL;
+	if(FutureAtomicLoad(&m_criticalJobs) > 0)
 	{
-		job->Lock();
-		if(FutureCoreConfig::ProfileThreadPool())
-		{
-			job->m_timeStarted = startTime;
-			m_waitTime += job->m_timeAdded - job->m_timeStarted;
-		}
-		job->m_state = FutureThreadJob::JobState_Executing;
-		m_jobs = m_jobs->m_next;
+		job = PopSharedJob(false);
 	}
-	if(FutureCoreConfig::ProfileThreadPool())
+#if FUTURE_ENABLE_MULTITHREADED
+	if(!job && thread)
 	{
-		m_threadTime += FutureTimer::TimeSince(startTime);
+		job = m_queues[thread->m_index].Pop();
+	}
+#endif
+	if(!job)
+	{
+		job = PopSharedJob(false);
+	}
+#if FUTURE_ENABLE_MULTITHREADED
+	if(!job)
+	{
+		// threads outside the pool prefer the first node
+		job = StealJob(thread ? thread->m_index + 1 : 0, thread ? thread->m_node : 0, counters);
+	}
+#endif
+	if(!job)
+	{
+		job = PopSharedJob(true);
+	}
+
+	if(job)
+	{
+		StartJob(job, counters, startTime);
 	}
-	Unlock();
 	return job;
 }
 
 void FutureThreadPool::JobFinished(FutureThreadJob * job)
 {
-	if(FutureCoreConfig::ProfileThreadPool())
-	{
-		startTime = FutureTimer::CurrentTime();
-	}
-	Lock();
 	if(job)
 	{
-		job->Lock();
+		u64 startTime = 0;
+		FutureThreadPoolCounters * counters = NULL;
 		if(FutureCoreConfig::ProfileThreadPool())
 		{
+			startTime = FutureTimer::CurrentNanoseconds();
+			counters = GetCounters(FutureWorkerThread::GetCurrent());
 			job->m_timeCompleted = startTime;
-			m_jobTime += job->m_timeStarted - job->m_timeCompleted;
+			if(job->m_timeStarted)
+			{
+				counters->m_executeTime[BucketForPriority(job->GetPriority())].Record(startTime - job->m_timeStarted, counters->m_shared);
+			}
+			counters->Add(&counters->m_jobsExecuted, 1);
 		}
-		job->m_state = FutureThreadJob::JobState_Finished;
-		if(job->m_autoDelete)
+
+		FutureThreadJob * ready = job->FinishContinuations();
+		bool autoDelete = job->m_autoDelete;
+		if(autoDelete)
 		{
 			delete job;
 		}
 		else
 		{
-			job->Unlock();
+			// put the add hold back so the job can be reused
+			FutureAtomicStore(&job->m_unfinishedDependencies, 1);
+			job->SetState(FutureThreadJob::JobState_Finished);
+		}
+
+		// queue any jobs that were waiting on this one
+		while(ready)
+		{
+			FutureThreadJob * next = ready->m_next;
+			QueueJob(ready);
+			ready = next;
+		}
+		if(FutureAtomicDecrement(&m_pendingJobs) == 0 || !autoDelete)
+		{
+			// someone may be waiting on this
+			WakeThreads(true);
+		}
+
+		if(counters)
+		{
+			counters->Add(&counters->m_overheadTime, (s64)(FutureTimer::CurrentNanoseconds() - startTime));
+		}
+	}
+}
+
+void FutureThreadPool::QueueJob(FutureThreadJob * job)
+{
+	job->m_next = NULL;
+	job->m_timeQueued = FutureCoreConfig::ProfileThreadPool() ? FutureTimer::CurrentNanoseconds() : 0;
+	job->m_timeStarted = 0;
+	job->SetState(FutureThreadJob::JobState_InQueue);
+
+#if FUTURE_ENABLE_MULTITHREADED
+	// jobs spawned by a worker stay with that worker unless they need the shared queue's ordering
+	FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+	if(worker)
+	{
+		JobBucket bucket = BucketForPriority(job->GetPriority());
+		if(bucket != JobBucket_Idle && bucket != JobBucket_Critical)
+		{
+			if(m_queues[worker->m_index].Push(job))
+			{
+				FutureAtomicIncrement(&m_queuedJobs);
+				WakeThreads(false);
+				return;
+			}
 		}
 	}
+#endif
+	AddSharedJob(job);
+	FutureAtomicIncrement(&m_queuedJobs);
+	WakeThreads(false);
+}
+
+void FutureThreadPool::WakeThreads(bool all)
+{
+	// pairs with the increment of m_sleepingThreads in the waiting thread
+	FutureAtomicFence();
+	if(FutureAtomicLoad(&m_sleepingThreads) == 0)
+	{
+		return;
+	}
+	m_wakeCondition.Lock();
+	FutureAtomicIncrement(&m_wakeCount);
+	if(all)
+	{
+		m_wakeCondition.Broadcast();
+	}
+	else
+	{
+		m_wakeCondition.Signal();
+	}
+	m_wakeCondition.Unlock();
+}
+
+void FutureThreadPool::SleepUntilWoken(s32 wakeCount, u32 milliTimeOut)
+{
+	m_wakeCondition.Lock();
+	if(FutureAtomicLoad(&m_wakeCount) == wakeCount)
+	{
+		m_wakeCondition.Wait(milliTimeOut);
+	}
+	m_wakeCondition.Unlock();
+}
+
+FutureThreadJob * FutureThreadPool::WaitForNextJob(FutureWorkerThread * thread)
+{
+#if FUTURE_ENABLE_MULTITHREADED
+	u64 startTime = 0;
+	FutureThreadPoolCounters * counters = NULL;
 	if(FutureCoreConfig::ProfileThreadPool())
 	{
-		m_threadTime += FutureTimer::TimeSince(startTime);
+		startTime = FutureTimer::CurrentNanoseconds();
+		counters = GetCounters(thread);
+	}
+
+	// spin first, new work often shows up right away. The spin grows while it
+	// keeps paying off and shrinks while it doesn't
+	u32 spinCount = thread->m_spinCount;
+	for(u32 i = 0; i < spinCount; ++i)
+	{
+		if(FutureAtomicLoad(&m_queuedJobs) > 0)
+		{
+			FutureThreadJob * job = GetNextJob(thread);
+			if(job)
+			{
+				thread->m_spinCount = spinCount * 2 < FUTURE_THREAD_POOL_MAX_SPIN ? spinCount * 2 : FUTURE_THREAD_POOL_MAX_SPIN;
+				if(counters)
+				{
+					counters->Add(&counters->m_idleTime, (s64)(FutureTimer::CurrentNanoseconds() - startTime));
+				}
+				return job;
+			}
+		}
+		FutureAtomicPause();
+	}
+	thread->m_spinCount = spinCount / 2 > FUTURE_THREAD_POOL_MIN_SPIN ? spinCount / 2 : FUTURE_THREAD_POOL_MIN_SPIN;
+
+	thread->SetIdle(true);
+	s32 wakeCount = FutureAtomicLoad(&m_wakeCount);
+	FutureAtomicIncrement(&m_sleepingThreads);
+	FutureThreadJob * job = GetNextJob(thread);
+	if(!job && thread->m_running)
+	{
+#if FUTURE_ENABLE_FIBERS
+		// a suspended job's counter can be released from anywhere without waking anyone,
+		// so check back regularly while jobs are suspended
+		SleepUntilWoken(wakeCount, FutureAtomicLoad(&m_numWaitingFibers) > 0 ? 1 : -1);
+#else
+		SleepUntilWoken(wakeCount);
+#endif
+	}
+	FutureAtomicDecrement(&m_sleepingThreads);
+	if(counters)
+	{
+		counters->Add(&counters->m_idleTime, (s64)(FutureTimer::CurrentNanoseconds() - startTime));
+	}
+	return job;
+#else
+	return NULL;
+#endif
+}
+
+FutureThreadPool::JobBucket FutureThreadPool::BucketForPriority(FutureThreadJob::FutureThreadJobPriority priority)
+{
+	if(priority >= FutureThreadJob::JobPriority_Critical)
+	{
+		return JobBucket_Critical;
+	}
+	if(priority >= FutureThreadJob::JobPriority_VeryHigh)
+	{
+		return JobBucket_VeryHigh;
+	}
+	if(priority >= FutureThreadJob::JobPriority_High)
+	{
+		return JobBucket_High;
+	}
+	if(priority >= FutureThreadJob::JobPriority_Normal)
+	{
+		return JobBucket_Normal;
+	}
+	if(priority >= FutureThreadJob::JobPriority_Low)
+	{
+		return JobBucket_Low;
+	}
+	if(priority >= FutureThreadJob::JobPriority_VeryLow)
+	{
+		return JobBucket_VeryLow;
+	}
+	return JobBucket_Idle;
+}
+
+void FutureThreadPool::AddSharedJob(FutureThreadJob * job)
+{
+	JobBucket bucket = BucketForPriority(job->GetPriority());
+
+	Lock();
+	job->SetState(FutureThreadJob::JobState_InQueue);
+	job->m_next = NULL;
+	if(bucket == JobBucket_Critical)
+	{
+		FutureAtomicIncrement(&m_criticalJobs);
+	}
+
+	JobList & list = m_jobs[bucket];
+	if(list.m_tail)
+	{
+		list.m_tail->m_next = job;
+	}
+	else
+	{
+		list.m_head = job;
+	}
+	list.m_tail = job;
+	m_usedBuckets |= 1 << bucket;
+	Unlock();
+}
+
+FutureThreadJob * FutureThreadPool::PopSharedJob(bool includeIdle)
+{
+	Lock();
+	u32 used = m_usedBuckets;
+	if(!includeIdle)
+	{
+		used &= ~(1 << JobBucket_Idle);
+	}
+	if(!used)
+	{
+		Unlock();
+		return NULL;
+	}
+
+	// highest non empty bucket
+	u32 bucket = JobBucket_Count - 1;
+	while(!(used & (1 << bucket)))
+	{
+		--bucket;
+	}
+
+	JobList & list = m_jobs[bucket];
+	FutureThreadJob * job = list.m_head;
+	list.m_head = job->m_next;
+	if(!list.m_head)
+	{
+		list.m_tail = NULL;
+		m_usedBuckets &= ~(1 << bucket);
+	}
+	job->m_next = NULL;
+	if(bucket == JobBucket_Critical)
+	{
+		FutureAtomicDecrement(&m_criticalJobs);
 	}
 	Unlock();
+	return job;
+}
+
+#if FUTURE_ENABLE_MULTITHREADED
+FutureThreadJob * FutureThreadPool::StealJob(u32 start, u32 node, FutureThreadPoolCounters * counters)
+{
+	u32 queues = (u32)FutureAtomicLoad(&m_numQueues);
+	// first pass only looks at workers on the same node, second pass at the others
+	for(u32 pass = 0; pass < 2; ++pass)
+	{
+		for(u32 i = 0; i < queues; ++i)
+		{
+			u32 index = (start + i) % queues;
+			if((m_queueNodes[index] == node) != (pass == 0))
+			{
+				continue;
+			}
+			FutureThreadJob * job = m_queues[index].Steal();
+			if(job)
+			{
+				if(counters)
+				{
+					counters->Add(pass == 0 ? &counters->m_localSteals : &counters->m_remoteSteals, 1);
+				}
+				return job;
+			}
+		}
+	}
+	return NULL;
+}
+#endif
+
+void FutureThreadPool::StartJob(FutureThreadJob * job, FutureThreadPoolCounters * counters, u64 startTime)
+{
+	FutureAtomicDecrement(&m_queuedJobs);
+	job->SetState(FutureThreadJob::JobState_Executing);
+	if(counters)
+	{
+		u64 now = FutureTimer::CurrentNanoseconds();
+		job->m_timeStarted = now;
+		// jobs queued while profiling was off have no queue time
+		if(job->m_timeQueued)
+		{
+			counters->m_waitTime[BucketForPriority(job->GetPriority())].Record(now - job->m_timeQueued, counters->m_shared);
+		}
+		counters->Add(&counters->m_overheadTime, (s64)(now - startTime));
+	}
+}
+
+FutureThreadPoolCounters * FutureThreadPool::GetCounters(FutureWorkerThread * thread)
+{
+#if FUTURE_ENABLE_MULTITHREADED
+	if(thread)
+	{
+		return m_counters[thread->m_index];
+	}
+#endif
+	return m_counters[FUTURE_THREAD_POOL_MAX_THREADS];
+}
+
+#if FUTURE_ENABLE_FIBERS
+void FutureThreadPool::RunFibers(FutureWorkerThread * thread)
+{
+	FutureJobFiber * fiber = AcquireFiber();
+	if(!fiber)
+	{
+		FUTURE_LOG_WARNING(L"Out of fibers, worker thread %u runs jobs on its own stack", thread->m_index);
+		while(thread->m_running)
+		{
+			thread->RunNextJob();
+		}
+		return;
+	}
+	// returns once the worker has been released
+	SwitchFiber(NULL, &fiber->m_fiber, FiberSwitch_Free);
+}
+
+void FutureThreadPool::FiberMain(void * data)
+{
+	FutureThreadPool * pool = FutureThreadPool::GetInstance();
+	FutureJobFiber * fiber = (FutureJobFiber*)data;
+	pool->FinishSwitch(fiber);
+	while(true)
+	{
+		// this fiber may be running on a different worker every time around
+		FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+		if(!worker->m_running)
+		{
+			// hand the thread back so it can exit, any worker may pick this fiber up again
+			pool->SwitchFiber(fiber, &worker->m_threadFiber, FiberSwitch_Free);
+			continue;
+		}
+
+		// finish suspended jobs before starting new ones
+		FutureJobFiber * ready = pool->PopReadyFiber();
+		if(ready)
+		{
+			pool->SwitchFiber(fiber, &ready->m_fiber, FiberSwitch_Free);
+			continue;
+		}
+
+		worker->RunNextJob();
+	}
+}
+
+bool FutureThreadPool::SuspendJob(volatile s32 * counter)
+{
+	FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+	if(!worker || !worker->m_currentFiber)
+	{
+		return false;
+	}
+
+	FutureJobFiber * next = PopReadyFiber();
+	if(!next)
+	{
+		next = AcquireFiber();
+		if(!next)
+		{
+			return false;
+		}
+	}
+
+	FutureJobFiber * current = worker->m_currentFiber;
+	current->m_waitCounter = counter;
+	SwitchFiber(current, &next->m_fiber, FiberSwitch_Wait);
+	return true;
+}
+
+void FutureThreadPool::SwitchFiber(FutureJobFiber * current, FutureFiber * to, FiberSwitch action)
+{
+	FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+	worker->m_switchedFrom = current;
+	worker->m_switchAction = action;
+	FutureFiber * from = current ? &current->m_fiber : &worker->m_threadFiber;
+	from->SwitchTo(to);
+
+	// running again, not necessarily on the same worker
+	FinishSwitch(current);
+}
+
+void FutureThreadPool::FinishSwitch(FutureJobFiber * current)
+{
+	FutureWorkerThread * worker = FutureWorkerThread::GetCurrent();
+	worker->m_currentFiber = current;
+	FutureJobFiber * previous = worker->m_switchedFrom;
+	worker->m_switchedFrom = NULL;
+	if(!previous)
+	{
+		return;
+	}
+
+	m_fiberLock.Lock();
+	if(worker->m_switchAction == FiberSwitch_Wait)
+	{
+		previous->m_next = m_waitingFibers;
+		m_waitingFibers = previous;
+		FutureAtomicIncrement(&m_numWaitingFibers);
+	}
+	else
+	{
+		previous->m_waitCounter = NULL;
+		previous->m_next = m_freeFibers;
+		m_freeFibers = previous;
+	}
+	m_fiberLock.Unlock();
+}
+
+FutureJobFiber * FutureThreadPool::AcquireFiber()
+{
+	m_fiberLock.Lock();
+	FutureJobFiber * fiber = m_freeFibers;
+	if(fiber)
+	{
+		m_freeFibers = fiber->m_next;
+	}
+	else
+	{
+		fiber = CreateFiber();
+	}
+	m_fiberLock.Unlock();
+
+	if(fiber)
+	{
+		fiber->m_next = NULL;
+	}
+	return fiber;
+}
+
+FutureJobFiber * FutureThreadPool::CreateFiber()
+{
+	if(m_numFibers >= FUTURE_THREAD_POOL_MAX_FIBERS)
+	{
+		return NULL;
+	}
+	FutureJobFiber * fiber = new FutureJobFiber();
+	fiber->m_waitCounter = NULL;
+	fiber->m_next = NULL;
+	if(!fiber->m_fiber.Create(FutureThreadPool::FiberMain, fiber, FUTURE_THREAD_POOL_FIBER_STACK_SIZE))
+	{
+		delete fiber;
+		return NULL;
+	}
+	m_fibers[m_numFibers++] = fiber;
+	return fiber;
+}
+
+FutureJobFiber * FutureThreadPool::PopReadyFiber()
+{
+	if(FutureAtomicLoad(&m_numWaitingFibers) == 0)
+	{
+		return NULL;
+	}
+
+	m_fiberLock.Lock();
+	FutureJobFiber * previous = NULL;
+	for(FutureJobFiber * fiber = m_waitingFibers; fiber; fiber = fiber->m_next)
+	{
+		if(FutureAtomicLoad(fiber->m_waitCounter) <= 0)
+		{
+			if(previous)
+			{
+				previous->m_next = fiber->m_next;
+			}
+			else
+			{
+				m_waitingFibers = fiber->m_next;
+			}
+			FutureAtomicDecrement(&m_numWaitingFibers);
+			m_fiberLock.Unlock();
+
+			fiber->m_next = NULL;
+			fiber->m_waitCounter = NULL;
+			return fiber;
+		}
+		previous = fiber;
+	}
+	m_fiberLock.Unlock();
+	return NULL;
+}
+#endif
+
+void FutureJobWait(volatile s32 * counter)
+{
+	if(FutureAtomicLoad(counter) <= 0)
+	{
+		return;
+	}
+	FutureThreadPool * pool = FutureThreadPool::GetInstance();
+	if(!pool)
+	{
+		while(FutureAtomicLoad(counter) > 0)
+		{
+			FutureAtomicPause();
+		}
+		return;
+	}
+#if FUTURE_ENABLE_FIBERS
+	if(pool->SuspendJob(counter))
+	{
+		return;
+	}
+#endif
+	pool->WaitForCounter(counter);
 }
@@ -0,0 +1,215 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureTimeHistogram and FutureThreadPoolCounters
+*/
+
+#include <future/core/thread/pool/threadpoolprofile.h>
+
+FutureTimeHistogram::FutureTimeHistogram()
+{
+	Clear();
+}
+
+void FutureTimeHistogram::Clear()
+{
+	for(u32 i = 0; i < FUTURE_TIME_HISTOGRAM_BUCKETS; ++i)
+	{
+		m_counts[i] = 0;
+	}
+	m_count = 0;
+	m_total = 0;
+	m_min = 0x7fffffffffffffffLL;
+	m_max = 0;
+}
+
+void FutureTimeHistogram::Record(u64 nanoseconds, bool shared)
+{
+	s64 value = (s64)nanoseconds;
+	u32 bucket = BucketForValue(nanoseconds);
+	if(shared)
+	{
+		FutureAtomicIncrement(&m_counts[bucket]);
+		FutureAtomicIncrement(&m_count);
+		FutureAtomicAdd(&m_total, value);
+		s64 min = FutureAtomicLoad(&m_min);
+		while(value < min && !FutureAtomicCompareExchange(&m_min, min, value))
+		{
+			min = FutureAtomicLoad(&m_min);
+		}
+		s64 max = FutureAtomicLoad(&m_max);
+		while(value > max && !FutureAtomicCompareExchange(&m_max, max, value))
+		{
+			max = FutureAtomicLoad(&m_max);
+		}
+	}
+	else
+	{
+		// only this thread writes, the stores just have to be atomic for readers
+		FutureAtomicStore(&m_counts[bucket], m_counts[bucket] + 1);
+		FutureAtomicStore(&m_count, m_count + 1);
+		FutureAtomicStore(&m_total, m_total + value);
+		if(value < m_min)
+		{
+			FutureAtomicStore(&m_min, value);
+		}
+		if(value > m_max)
+		{
+			FutureAtomicStore(&m_max, value);
+		}
+	}
+}
+
+void FutureTimeHistogram::Merge(const FutureTimeHistogram & other)
+{
+	for(u32 i = 0; i < FUTURE_TIME_HISTOGRAM_BUCKETS; ++i)
+	{
+		m_counts[i] += FutureAtomicLoad(&other.m_counts[i]);
+	}
+	m_count += FutureAtomicLoad(&other.m_count);
+	m_total += FutureAtomicLoad(&other.m_total);
+	s64 min = FutureAtomicLoad(&other.m_min);
+	if(min < m_min)
+	{
+		m_min = min;
+	}
+	s64 max = FutureAtomicLoad(&other.m_max);
+	if(max > m_max)
+	{
+		m_max = max;
+	}
+}
+
+u64 FutureTimeHistogram::Count() const
+{
+	return (u64)FutureAtomicLoad(&m_count);
+}
+
+u64 FutureTimeHistogram::Total() const
+{
+	return (u64)FutureAtomicLoad(&m_total);
+}
+
+u64 FutureTimeHistogram::Min() const
+{
+	return Count() ? (u64)FutureAtomicLoad(&m_min) : 0;
+}
+
+u64 FutureTimeHistogram::Max() const
+{
+	return (u64)FutureAtomicLoad(&m_max);
+}
+
+u64 FutureTimeHistogram::Mean() const
+{
+	u64 count = Count();
+	return count ? Total() / count : 0;
+}
+
+u64 FutureTimeHistogram::Percentile(f32 percentile) const
+{
+	u64 count = 0;
+	for(u32 i = 0; i < FUTURE_TIME_HISTOGRAM_BUCKETS; ++i)
+	{
+		count += (u32)FutureAtomicLoad(&m_counts[i]);
+	}
+	if(count == 0)
+	{
+		return 0;
+	}
+
+	// the rank of the value we are after, rounded up so 100% is the largest value
+	u64 rank = (u64)((f64)count * (f64)percentile / 100.0 + 0.999999);
+	if(rank == 0)
+	{
+		rank = 1;
+	}
+	u64 seen = 0;
+	for(u32 i = 0; i < FUTURE_TIME_HISTOGRAM_BUCKETS; ++i)
+	{
+		seen += (u32)FutureAtomicLoad(&m_counts[i]);
+		if(seen >= rank)
+		{
+			u64 bound = BucketUpperBound(i);
+			u64 max = Max();
+			return bound < max ? bound : max;
+		}
+	}
+	return Max();
+}
+
+u32 FutureTimeHistogram::BucketForValue(u64 nanoseconds)
+{
+	if(nanoseconds < FUTURE_TIME_HISTOGRAM_SUB_BUCKETS)
+	{
+		return (u32)nanoseconds;
+	}
+
+	// position of the highest set bit
+	u32 high = 0;
+	for(u64 value = nanoseconds >> 1; value; value >>= 1)
+	{
+		++high;
+	}
+
+	// the bits just below the highest one pick the sub bucket
+	u32 shift = high - FUTURE_TIME_HISTOGRAM_SUB_BUCKET_BITS;
+	u32 bucket = (high - FUTURE_TIME_HISTOGRAM_SUB_BUCKET_BITS + 1) * FUTURE_TIME_HISTOGRAM_SUB_BUCKETS +
+		(u32)((nanoseconds >> shift) & (FUTURE_TIME_HISTOGRAM_SUB_BUCKETS - 1));
+	return bucket < FUTURE_TIME_HISTOGRAM_BUCKETS ? bucket : FUTURE_TIME_HISTOGRAM_BUCKETS - 1;
+}
+
+u64 FutureTimeHistogram::BucketUpperBound(u32 bucket)
+{
+	if(bucket < FUTURE_TIME_HISTOGRAM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	if(bucket >= FUTURE_TIME_HISTOGRAM_BUCKETS - 1)
+	{
+		return (u64)-1;
+	}
+	u32 shift = bucket / FUTURE_TIME_HISTOGRAM_SUB_BUCKETS - 1;
+	u64 sub = (u64)(bucket % FUTURE_TIME_HISTOGRAM_SUB_BUCKETS) + FUTURE_TIME_HISTOGRAM_SUB_BUCKETS;
+	return ((sub + 1) << shift) - 1;
+}
+
+FutureThreadPoolCounters::FutureThreadPoolCounters(bool shared)
+	: m_shared(shared),
+	  m_jobsAdded(0),
+	  m_jobsExecuted(0),
+	  m_overheadTime(0),
+	  m_idleTime(0),
+	  m_localSteals(0),
+	  m_remoteSteals(0)
+{}
+
+void FutureThreadPoolCounters::Add(volatile s64 * counter, s64 value)
+{
+	if(m_shared)
+	{
+		FutureAtomicAdd(counter, value);
+	}
+	else
+	{
+		FutureAtomicStore(counter, *counter + value);
+	}
+}
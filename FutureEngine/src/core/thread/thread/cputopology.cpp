@@ -0,0 +1,303 @@
+/*!
+*	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+*
+*	Thank you for taking a look at my code. If you like it, please click
+*	the donation button at the bottom of the sidebar on my blog. Thanks!
+*
+*	Licensed under the Apache License, Version 2.0 (the "License");
+*	you may not use this file except in compliance with the License.
+*	You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+*	Unless required by applicable law or agreed to in writing, software
+*	distributed under the License is distributed on an "AS IS" BASIS,
+*	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*	See the License for the specific language governing permissions and
+*	limitations under the License.
+*
+*/
+
+/*
+*	Implementation of FutureCpuTopology
+*/
+
+#include <future/core/thread/thread/cputopology.h>
+#include <future/core/debug/debug.h>
+
+#if FUTURE_PLATFORM_WINDOWS
+#	include <windows.h>
+#elif FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_ANDROID
+#	include <sched.h>
+#	include <pthread.h>
+#	include <stdio.h>
+#	include <stdlib.h>
+#	include <unistd.h>
+#elif defined(FUTURE_USES_PTHREAD)
+#	include <unistd.h>
+#endif
+
+volatile bool	FutureCpuTopology::ms_initialized = false;
+u32				FutureCpuTopology::ms_numCpus = 0;
+u32				FutureCpuTopology::ms_numNodes = 0;
+u32				FutureCpuTopology::ms_nodeCpuCount[FUTURE_MAX_NUMA_NODES];
+u32				FutureCpuTopology::ms_nodeFirstCpu[FUTURE_MAX_NUMA_NODES];
+u32				FutureCpuTopology::ms_cpus[FUTURE_MAX_CPUS];
+u8				FutureCpuTopology::ms_cpuNode[FUTURE_MAX_CPUS];
+
+u32 FutureCpuTopology::NumCpus()
+{
+	Initialize();
+	return ms_numCpus;
+}
+
+u32 FutureCpuTopology::NumNodes()
+{
+	Initialize();
+	return ms_numNodes;
+}
+
+u32 FutureCpuTopology::NumCpusInNode(u32 node)
+{
+	Initialize();
+	return node < ms_numNodes ? ms_nodeCpuCount[node] : 0;
+}
+
+u32 FutureCpuTopology::CpuInNode(u32 node, u32 index)
+{
+	Initialize();
+	FUTURE_ASSERT(node < ms_numNodes && index < ms_nodeCpuCount[node]);
+	return ms_cpus[ms_nodeFirstCpu[node] + index];
+}
+
+u32 FutureCpuTopology::NodeOfCpu(u32 cpu)
+{
+	Initialize();
+	return cpu < FUTURE_MAX_CPUS ? ms_cpuNode[cpu] : 0;
+}
+
+u32 FutureCpuTopology::CurrentCpu()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	return (u32)GetCurrentProcessorNumber();
+#elif FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_ANDROID
+	int cpu = sched_getcpu();
+	return cpu < 0 ? (u32)-1 : (u32)cpu;
+#else
+	return (u32)-1;
+#endif
+}
+
+bool FutureCpuTopology::PinCurrentThread(u32 cpu)
+{
+#if FUTURE_PLATFORM_WINDOWS
+	if(cpu >= sizeof(DWORD_PTR) * 8)
+	{
+		return false;
+	}
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_ANDROID
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+#	if FUTURE_PLATFORM_ANDROID
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#	else
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#	endif
+#else
+	return false;
+#endif
+}
+
+bool FutureCpuTopology::PinCurrentThreadToNode(u32 node)
+{
+	Initialize();
+	if(node >= ms_numNodes)
+	{
+		return false;
+	}
+#if FUTURE_PLATFORM_WINDOWS
+	DWORD_PTR mask = 0;
+	for(u32 i = 0; i < ms_nodeCpuCount[node]; ++i)
+	{
+		u32 cpu = ms_cpus[ms_nodeFirstCpu[node] + i];
+		if(cpu < sizeof(DWORD_PTR) * 8)
+		{
+			mask |= (DWORD_PTR)1 << cpu;
+		}
+	}
+	return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_ANDROID
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(u32 i = 0; i < ms_nodeCpuCount[node]; ++i)
+	{
+		CPU_SET(ms_cpus[ms_nodeFirstCpu[node] + i], &set);
+	}
+#	if FUTURE_PLATFORM_ANDROID
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#	else
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#	endif
+#else
+	return false;
+#endif
+}
+
+void FutureCpuTopology::Initialize()
+{
+	if(ms_initialized)
+	{
+		return;
+	}
+
+	// cores usable by this process, indexed by core id
+	bool allowed[FUTURE_MAX_CPUS];
+	u32 numAllowed = 0;
+	for(u32 i = 0; i < FUTURE_MAX_CPUS; ++i)
+	{
+		allowed[i] = false;
+	}
+	// node of each allowed core, nodes are numbered in the order they are found
+	s32 node[FUTURE_MAX_CPUS];
+	for(u32 i = 0; i < FUTURE_MAX_CPUS; ++i)
+	{
+		node[i] = -1;
+	}
+	u32 numNodes = 0;
+
+#if FUTURE_PLATFORM_WINDOWS
+	DWORD_PTR processMask = 0;
+	DWORD_PTR systemMask = 0;
+	GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+	for(u32 i = 0; i < sizeof(DWORD_PTR) * 8 && i < FUTURE_MAX_CPUS; ++i)
+	{
+		if(processMask & ((DWORD_PTR)1 << i))
+		{
+			allowed[i] = true;
+			++numAllowed;
+		}
+	}
+
+	ULONG highestNode = 0;
+	if(GetNumaHighestNodeNumber(&highestNode))
+	{
+		for(ULONG n = 0; n <= highestNode && numNodes < FUTURE_MAX_NUMA_NODES; ++n)
+		{
+			ULONGLONG mask = 0;
+			if(!GetNumaNodeProcessorMask((UCHAR)n, &mask))
+			{
+				continue;
+			}
+			bool found = false;
+			for(u32 i = 0; i < 64 && i < FUTURE_MAX_CPUS; ++i)
+			{
+				if((mask & ((ULONGLONG)1 << i)) && allowed[i] && node[i] < 0)
+				{
+					node[i] = (s32)numNodes;
+					found = true;
+				}
+			}
+			if(found)
+			{
+				++numNodes;
+			}
+		}
+	}
+#elif FUTURE_PLATFORM_LINUX || FUTURE_PLATFORM_ANDROID
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for(u32 i = 0; i < FUTURE_MAX_CPUS && i < CPU_SETSIZE; ++i)
+		{
+			if(CPU_ISSET(i, &set))
+			{
+				allowed[i] = true;
+				++numAllowed;
+			}
+		}
+	}
+
+	// node ids can have gaps, so look at every possible node
+	for(u32 n = 0; n < 1024 && numNodes < FUTURE_MAX_NUMA_NODES; ++n)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", n);
+		FILE * file = fopen(path, "r");
+		if(!file)
+		{
+			continue;
+		}
+		char list[1024];
+		size_t length = fread(list, 1, sizeof(list) - 1, file);
+		fclose(file);
+		list[length] = 0;
+
+		// the list looks like "0-7,16-23"
+		bool found = false;
+		char * text = list;
+		while(*text >= '0' && *text <= '9')
+		{
+			u32 first = (u32)strtoul(text, &text, 10);
+			u32 last = first;
+			if(*text == '-')
+			{
+				last = (u32)strtoul(text + 1, &text, 10);
+			}
+			for(u32 i = first; i <= last && i < FUTURE_MAX_CPUS; ++i)
+			{
+				if(allowed[i] && node[i] < 0)
+				{
+					node[i] = (s32)numNodes;
+					found = true;
+				}
+			}
+			if(*text == ',')
+			{
+				++text;
+			}
+		}
+		if(found)
+		{
+			++numNodes;
+		}
+	}
+#elif defined(FUTURE_USES_PTHREAD)
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	for(long i = 0; i < online && i < FUTURE_MAX_CPUS; ++i)
+	{
+		allowed[i] = true;
+		++numAllowed;
+	}
+#endif
+
+	if(numAllowed == 0)
+	{
+		allowed[0] = true;
+		numAllowed = 1;
+	}
+	if(numNodes == 0)
+	{
+		numNodes = 1;
+	}
+
+	// group the cores by node, anything the nodes didn't mention goes on the first node
+	ms_numCpus = 0;
+	for(u32 n = 0; n < numNodes; ++n)
+	{
+		ms_nodeFirstCpu[n] = ms_numCpus;
+		for(u32 i = 0; i < FUTURE_MAX_CPUS; ++i)
+		{
+			if(allowed[i] && (node[i] == (s32)n || (n == 0 && node[i] < 0)))
+			{
+				ms_cpus[ms_numCpus++] = i;
+				ms_cpuNode[i] = (u8)n;
+			}
+		}
+		ms_nodeCpuCount[n] = ms_numCpus - ms_nodeFirstCpu[n];
+	}
+	ms_numNodes = numNodes;
+	ms_initialized = true;
+}
@@ -25,6 +25,8 @@
 
 #include <future/core/debug/debug.h>
 #include <future/core/memory/memory.h>
+#include <future/core/memory/allocators/frameallocator.h>
+#include <future/core/memory/allocators/threadcache.h>
 #include <future/core/thread/thread/thread.h>
 
 FutureResult IFutureThread::Join(f32 secondsTimeOut)
@@ -50,6 +52,9 @@ bool IFutureThread::IsFinished()
 
 void IFutureThread::OnFinished()
 {
+	// hand this thread's cached blocks back before anyone sees it finish
+	FutureThreadCache::ReleaseThread();
+	FutureFrameAllocator::ReleaseThread();
 	m_finished = true;
 	if(m_onFinished)
 	{
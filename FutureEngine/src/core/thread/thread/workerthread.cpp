@@ -24,13 +24,30 @@
 */
 
 #include <future/core/thread/thread/workerthread.h>
+#include <future/core/thread/thread/cputopology.h>
+#include <future/core/debug/trace.h>
+#include <future/core/memory/allocators/frameallocator.h>
+#include <future/core/memory/allocators/threadcache.h>
 #include <future/core/thread/pool/job.h>
 #include <future/core/thread/pool/threadpool.h>
+#include <future/core/thread/pool/joballocator.h>
 #include <future/core/utils/timer/timer.h>
 
+static FUTURE_THREAD_LOCAL FutureWorkerThread * s_currentWorker = NULL;
+
 FutureWorkerThread::FutureWorkerThread()
-	: m_idle(false),
-	  m_next(NULL)
+	: m_running(true),
+	  m_idle(false),
+	  m_spinCount(FUTURE_THREAD_POOL_MIN_SPIN),
+	  m_index(0),
+	  m_affinity(FutureThreadAffinity_None),
+	  m_node(0),
+	  m_cpu(0)
+#if FUTURE_ENABLE_FIBERS
+	  ,m_currentFiber(NULL),
+	  m_switchedFrom(NULL),
+	  m_switchAction(0)
+#endif
 {}
 FutureWorkerThread::~FutureWorkerThread()
 {
@@ -42,14 +59,28 @@ FutureResult FutureWorkerThread::WaitForJob(u32 milliTimeOut)
 	{
 		return FR_OK;
 	}
-	f32 timeToWait = (f32)milliTimeOut * 1000.f;
 	f32 curTime = FutureTimer::CurrentTime();
+	f32 timeToWait = FutureTimer::MilliToSeconds(milliTimeOut);
 	
-	while(!m_idle && (timeToWait <= 0 || FutureTimer::TimeSince(curTime) < timeToWait))
+	m_idleCondition.Lock();
+	while(!m_idle)
 	{
-		Sleep(5);
+		u32 milliRemaining = -1;
+		if(milliTimeOut != (u32)-1)
+		{
+			f32 remaining = timeToWait - FutureTimer::TimeSince(curTime);
+			if(remaining <= 0)
+			{
+				break;
+			}
+			milliRemaining = (u32)FutureTimer::SecondsToMillis(remaining) + 1;
+		}
+		m_idleCondition.Wait(milliRemaining);
 	}
-	if(!m_idle)
+	bool idle = m_idle;
+	m_idleCondition.Unlock();
+
+	if(!idle)
 	{
 		return FR_TIMEOUT;
 	}
@@ -58,6 +89,10 @@ FutureResult FutureWorkerThread::WaitForJob(u32 milliTimeOut)
 
 void FutureWorkerThread::OnFinished()
 {
+	// give cached blocks back to the pools, the next thread that allocates adopts the empty caches
+	FutureThreadCache::ReleaseThread();
+	FutureFrameAllocator::ReleaseThread();
+	FutureJobAllocator::ReleaseThread();
 	m_finished = true;
 	if(m_onFinished)
 	{
@@ -65,35 +100,89 @@ void FutureWorkerThread::OnFinished()
 	}
 }
 
+FutureWorkerThread * FutureWorkerThread::GetCurrent()
+{
+	return s_currentWorker;
+}
+
 void FutureWorkerThread::Release()
 {
 	m_running = false;
+	FutureThreadPool::GetInstance()->WakeThreads(true);
 	Join();
 }
 
+void FutureWorkerThread::SetIdle(bool idle)
+{
+	if(m_idle == idle)
+	{
+		return;
+	}
+	m_idleCondition.Lock();
+	m_idle = idle;
+	if(idle)
+	{
+		m_idleCondition.Broadcast();
+	}
+	m_idleCondition.Unlock();
+}
+
+void FutureWorkerThread::RunNextJob()
+{
+	FutureThreadJob * job = FutureThreadPool::GetInstance()->GetNextJob(this);
+	if(!job)
+	{
+		// spins for a bit, then sleeps until new work is added
+		job = FutureThreadPool::GetInstance()->WaitForNextJob(this);
+	}
+	
+	if(job)
+	{
+		SetIdle(false);
+		job->Execute(this);
+		FutureThreadPool::GetInstance()->JobFinished(job);
+	}
+}
+
 void FutureWorkerThread::OnRunThread()
 {
 	m_started = true;
 	m_idle = false;
-	m_running = true;
+	s_currentWorker = this;
+	FutureTrace::SetThreadName("FutureWorkerThread");
+
+	// pin before the thread allocates anything so its job slot cache is first touched on its own node
+	bool pinned = true;
+	if(m_affinity == FutureThreadAffinity_Core)
+	{
+		pinned = FutureCpuTopology::PinCurrentThread(m_cpu);
+	}
+	else if(m_affinity == FutureThreadAffinity_Node)
+	{
+		pinned = FutureCpuTopology::PinCurrentThreadToNode(m_node);
+	}
+	if(!pinned)
+	{
+		FUTURE_LOG_WARNING(L"Failed to pin worker thread %u to cpu %u on node %u", m_index, m_cpu, m_node);
+	}
+#if FUTURE_ENABLE_FIBERS
+	// jobs run on the pool's fibers so they can be suspended
+	if(m_threadFiber.ConvertFromThread())
+	{
+		FutureThreadPool::GetInstance()->RunFibers(this);
+		m_threadFiber.ConvertToThread();
+		s_currentWorker = NULL;
+		return;
+	}
+	FUTURE_LOG_WARNING(L"Failed to convert worker thread %u to a fiber, its jobs can't be suspended", m_index);
+#endif
 #if FUTURE_ENABLE_MULTITHREADED
 	while(m_running)
 	{
 #endif
-		FutureThreadJob * job = FutureThreadPool::GetInstance()->GetNextJob();
-		
-		if(job)
-		{
-			m_idle = false;
-			job->Execute(this);
-			FutureThreadPool::GetInstance()->JobFinished(job);
-		}
-		else
-		{
-			m_idle = true;
-			Sleep(5);
-		}
+		RunNextJob();
 #if FUTURE_ENABLE_MULTITHREADED
 	}
 #endif
+	s_currentWorker = NULL;
 }
\ No newline at end of file
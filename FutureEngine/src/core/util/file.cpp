@@ -27,6 +27,15 @@
 #	include <CoreFoundation/CoreFoundation.h>
 #endif
 
+#if FUTURE_PLATFORM_WINDOWS
+#	include <windows.h>
+#elif !FUTURE_PLATFORM_ANDROID
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
 FutureFile::FutureFile()
 	: m_open(false),
 	  m_size(0),
@@ -265,3 +274,128 @@ void FutureFile::Move(s32 bytes)
 #endif
 	m_index += bytes;
 }
+
+
+
+FutureMappedFile::FutureMappedFile()
+	: m_data(NULL),
+	  m_size(0)
+#if FUTURE_PLATFORM_WINDOWS
+	  , m_file(NULL),
+	  m_mapping(NULL)
+#endif
+{}
+
+FutureMappedFile::~FutureMappedFile()
+{
+	if(m_data)
+	{
+		Unmap();
+	}
+}
+
+bool FutureMappedFile::Map(const char * file)
+{
+	FUTURE_ASSERT(!m_data && file);
+
+#if FUTURE_PLATFORM_ANDROID
+	return false;
+#elif FUTURE_PLATFORM_WINDOWS
+	HANDLE handle = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if(handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!mapping)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	void * data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!data)
+	{
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+	m_file = handle;
+	m_mapping = mapping;
+	m_data = (const u8*)data;
+	m_size = (u64)size.QuadPart;
+	return true;
+#else
+	int fd = open(file, O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size <= 0)
+	{
+		close(fd);
+		return false;
+	}
+	void * data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping holds its own reference to the file
+	close(fd);
+	if(data == MAP_FAILED)
+	{
+		return false;
+	}
+	m_data = (const u8*)data;
+	m_size = (u64)info.st_size;
+	return true;
+#endif
+}
+
+void FutureMappedFile::Unmap()
+{
+	FUTURE_ASSERT(m_data);
+
+#if FUTURE_PLATFORM_WINDOWS
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+	m_mapping = NULL;
+	m_file = NULL;
+#elif !FUTURE_PLATFORM_ANDROID
+	munmap((void*)m_data, (size_t)m_size);
+#endif
+	m_data = NULL;
+	m_size = 0;
+}
+
+void FutureMappedFile::Prefetch(u64 offset, u64 bytes) const
+{
+	FUTURE_ASSERT(m_data);
+	if(offset >= m_size || bytes == 0)
+	{
+		return;
+	}
+	if(bytes > m_size - offset)
+	{
+		bytes = m_size - offset;
+	}
+
+#if FUTURE_PLATFORM_WINDOWS
+#	if _WIN32_WINNT >= 0x0602
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = (void*)(m_data + offset);
+	range.NumberOfBytes = (size_t)bytes;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#	endif
+#elif !FUTURE_PLATFORM_ANDROID
+	// madvise needs a page aligned start
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = (size_t)(m_data + offset) & ~(page - 1);
+	size_t end = (size_t)(m_data + offset + bytes);
+	madvise((void*)start, end - start, MADV_WILLNEED);
+#endif
+}
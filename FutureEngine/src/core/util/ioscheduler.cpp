@@ -0,0 +1,811 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+/*
+*	Implementation of FutureIOScheduler
+*
+*	Read and ReadFile add to m_queued, Submit sorts m_queued into m_pending and wakes the
+*	I/O threads. Both lists and m_outstanding are guarded by m_condition, which is also
+*	what the I/O threads sleep on while there is nothing to read and what WaitForIdle
+*	sleeps on until m_outstanding drops to 0. A read is only taken off m_outstanding once
+*	its callback has returned, so nothing the callbacks use is torn down under them.
+*
+*	The io_uring thread only sleeps on m_condition when it has nothing in flight. While
+*	reads are in flight it sleeps in io_uring_enter until one of them finishes, and picks
+*	up newly submitted reads when it wakes.
+*/
+
+#include <future/core/util/ioscheduler.h>
+#include <future/core/thread/thread/thread.h>
+#include <future/core/thread/pool/threadpool.h>
+#include <future/core/thread/pool/joballocator.h>
+#include <future/core/thread/atomic/atomic.h>
+#include <future/core/debug/debug.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if FUTURE_PLATFORM_WINDOWS
+#	include <windows.h>
+#elif !FUTURE_PLATFORM_ANDROID
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <errno.h>
+#endif
+
+#if FUTURE_ENABLE_IO_URING
+#	include <linux/io_uring.h>
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+
+// The rings shared with the kernel, laid out the way io_uring_setup describes in its params
+struct FutureIORing
+{
+	int				m_fd;
+	u32				m_entries;
+
+	volatile u32 *	m_sqHead;
+	volatile u32 *	m_sqTail;
+	u32 *			m_sqMask;
+	u32 *			m_sqArray;
+	io_uring_sqe *	m_sqes;
+
+	volatile u32 *	m_cqHead;
+	volatile u32 *	m_cqTail;
+	u32 *			m_cqMask;
+	io_uring_cqe *	m_cqes;
+
+	void *			m_sqRing;
+	size_t			m_sqRingSize;
+	void *			m_cqRing;
+	size_t			m_cqRingSize;
+	size_t			m_sqesSize;
+};
+#endif
+
+// Copied into the payload of the job that calls a read's callback
+struct FutureIOCompletion
+{
+	FutureIOScheduler::ReadFinishedCallback		m_callback;
+	FutureIOScheduler *							m_scheduler;
+	void *										m_buffer;
+	u32											m_bytes;
+	bool										m_success;
+	u64											m_payload[FUTURE_IO_PAYLOAD_SIZE / sizeof(u64)];
+};
+
+FutureIOScheduler * ms_ioScheduler = NULL;
+
+void FutureIOScheduler::CreateInstance()
+{
+	FUTURE_ASSERT(!ms_ioScheduler);
+	ms_ioScheduler = new FutureIOScheduler();
+}
+void FutureIOScheduler::DestroyInstance()
+{
+	FUTURE_ASSERT(ms_ioScheduler);
+	delete ms_ioScheduler;
+	ms_ioScheduler = NULL;
+}
+FutureIOScheduler * FutureIOScheduler::GetInstance()
+{
+	return ms_ioScheduler;
+}
+
+FutureIOFile FutureIOScheduler::OpenFile(const char * file, u64 * sizeOut)
+{
+	FUTURE_ASSERT(file);
+
+#if FUTURE_PLATFORM_ANDROID
+	// assets are read through the asset manager, they aren't files the scheduler can open
+	return FutureIOFile_NULL;
+#elif FUTURE_PLATFORM_WINDOWS
+	HANDLE handle = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(handle == INVALID_HANDLE_VALUE)
+	{
+		return FutureIOFile_NULL;
+	}
+	if(sizeOut)
+	{
+		LARGE_INTEGER size;
+		if(!GetFileSizeEx(handle, &size))
+		{
+			CloseHandle(handle);
+			return FutureIOFile_NULL;
+		}
+		*sizeOut = (u64)size.QuadPart;
+	}
+	return (FutureIOFile)(size_t)handle;
+#else
+	int fd = open(file, O_RDONLY);
+	if(fd < 0)
+	{
+		return FutureIOFile_NULL;
+	}
+	if(sizeOut)
+	{
+		struct stat info;
+		if(fstat(fd, &info) != 0)
+		{
+			close(fd);
+			return FutureIOFile_NULL;
+		}
+		*sizeOut = (u64)info.st_size;
+	}
+	return (FutureIOFile)fd;
+#endif
+}
+
+void FutureIOScheduler::CloseFile(FutureIOFile file)
+{
+	if(file == FutureIOFile_NULL)
+	{
+		return;
+	}
+#if FUTURE_PLATFORM_WINDOWS
+	CloseHandle((HANDLE)(size_t)file);
+#elif !FUTURE_PLATFORM_ANDROID
+	close((int)file);
+#endif
+}
+
+FutureIOScheduler::FutureIOScheduler()
+	: m_condition(),
+	  m_queued(),
+	  m_pending(),
+	  m_outstanding(0),
+	  m_stopping(false),
+	  m_ring(NULL),
+	  m_numThreads(0)
+{
+	for(u32 i = 0; i < FUTURE_IO_THREADS; ++i)
+	{
+		m_threads[i] = NULL;
+	}
+
+#if FUTURE_ENABLE_IO_URING
+	if(CreateRing())
+	{
+		m_threads[0] = IFutureThread::CreateThread();
+		m_threads[0]->Start(RingMain, this);
+		m_numThreads = 1;
+		return;
+	}
+	FUTURE_LOG_DEBUG(L"io_uring isn't available, the I/O scheduler is using %u threads", FUTURE_IO_THREADS);
+#endif
+
+#if FUTURE_ENABLE_MULTITHREADED
+	for(u32 i = 0; i < FUTURE_IO_THREADS; ++i)
+	{
+		m_threads[i] = IFutureThread::CreateThread();
+		m_threads[i]->Start(ThreadMain, this);
+	}
+	m_numThreads = FUTURE_IO_THREADS;
+#endif
+}
+
+FutureIOScheduler::~FutureIOScheduler()
+{
+	Submit();
+
+	m_condition.Lock();
+	m_stopping = true;
+	m_condition.Broadcast();
+	m_condition.Unlock();
+
+	for(u32 i = 0; i < m_numThreads; ++i)
+	{
+		m_threads[i]->Join();
+		IFutureThread::DestroyThread(m_threads[i]);
+		m_threads[i] = NULL;
+	}
+	m_numThreads = 0;
+
+#if FUTURE_ENABLE_IO_URING
+	if(m_ring)
+	{
+		DestroyRing();
+	}
+#endif
+
+	// the last callbacks can still be running on the thread pool
+	m_condition.Lock();
+	while(m_outstanding > 0)
+	{
+		m_condition.Wait();
+	}
+	m_condition.Unlock();
+}
+
+bool FutureIOScheduler::Read(FutureIOFile file, u64 offset, u32 bytes, void * buffer, ReadFinishedCallback callback,
+							 const void * payload, u32 payloadBytes, FutureThreadJob::FutureThreadJobPriority priority)
+{
+	FUTURE_ASSERT_MSG(payloadBytes <= FUTURE_IO_PAYLOAD_SIZE, L"Read payload is larger than FUTURE_IO_PAYLOAD_SIZE");
+	if(file == FutureIOFile_NULL || payloadBytes > FUTURE_IO_PAYLOAD_SIZE)
+	{
+		return false;
+	}
+
+	Request request;
+	request.m_file = file;
+	request.m_offset = offset;
+	request.m_buffer = buffer;
+	request.m_bytes = bytes;
+	request.m_flags = buffer ? 0 : Request_Advise;
+	request.m_priority = priority;
+	request.m_callback = callback;
+	if(payload && payloadBytes > 0)
+	{
+		memcpy(request.m_payload, payload, payloadBytes);
+	}
+
+	m_condition.Lock();
+	m_queued.Add(request);
+	m_condition.Unlock();
+	return true;
+}
+
+bool FutureIOScheduler::ReadFile(const char * file, ReadFinishedCallback callback, const void * payload, u32 payloadBytes,
+								 FutureThreadJob::FutureThreadJobPriority priority)
+{
+	FUTURE_ASSERT_MSG(payloadBytes <= FUTURE_IO_PAYLOAD_SIZE, L"Read payload is larger than FUTURE_IO_PAYLOAD_SIZE");
+	if(payloadBytes > FUTURE_IO_PAYLOAD_SIZE)
+	{
+		return false;
+	}
+
+	u64 size = 0;
+	FutureIOFile handle = OpenFile(file, &size);
+	if(handle == FutureIOFile_NULL)
+	{
+		return false;
+	}
+	if(size == 0 || size > 0xFFFFFFFF)
+	{
+		CloseFile(handle);
+		return false;
+	}
+
+	Request request;
+	request.m_file = handle;
+	request.m_offset = 0;
+	request.m_buffer = NULL;
+	request.m_bytes = (u32)size;
+	request.m_flags = Request_OwnsBuffer | Request_CloseFile;
+	request.m_priority = priority;
+	request.m_callback = callback;
+	if(payload && payloadBytes > 0)
+	{
+		memcpy(request.m_payload, payload, payloadBytes);
+	}
+
+	m_condition.Lock();
+	m_queued.Add(request);
+	m_condition.Unlock();
+	return true;
+}
+
+void FutureIOScheduler::Submit()
+{
+	m_condition.Lock();
+	u32 count = m_queued.Size();
+	if(count == 0)
+	{
+		m_condition.Unlock();
+		return;
+	}
+	m_pending.AddMultiple(m_queued.a(), count);
+	m_queued.Clear();
+	m_outstanding += count;
+	qsort(m_pending.a(), m_pending.Size(), sizeof(Request), CompareRequests);
+
+#if FUTURE_ENABLE_MULTITHREADED
+	m_condition.Broadcast();
+	m_condition.Unlock();
+#else
+	// nothing else can read, so the whole batch is read now
+	Request request;
+	while(m_pending.Size() > 0)
+	{
+		PopRequest(&request);
+		m_condition.Unlock();
+		PerformRequest(&request);
+		m_condition.Lock();
+	}
+	m_condition.Unlock();
+#endif
+}
+
+void FutureIOScheduler::WaitForIdle()
+{
+	Submit();
+	m_condition.Lock();
+	while(m_outstanding > 0)
+	{
+		m_condition.Wait();
+	}
+	m_condition.Unlock();
+}
+
+u32 FutureIOScheduler::PendingRequests()
+{
+	m_condition.Lock();
+	u32 result = m_outstanding;
+	m_condition.Unlock();
+	return result;
+}
+
+int FutureIOScheduler::CompareRequests(const void * a, const void * b)
+{
+	const Request * ra = (const Request*)a;
+	const Request * rb = (const Request*)b;
+
+	// the list is read from the end, so the read that should go first sorts last
+	if(ra->m_priority != rb->m_priority)
+	{
+		return ra->m_priority < rb->m_priority ? -1 : 1;
+	}
+	if(ra->m_file != rb->m_file)
+	{
+		return ra->m_file > rb->m_file ? -1 : 1;
+	}
+	if(ra->m_offset != rb->m_offset)
+	{
+		return ra->m_offset > rb->m_offset ? -1 : 1;
+	}
+	return 0;
+}
+
+void FutureIOScheduler::PopRequest(Request * out)
+{
+	u32 last = m_pending.Size() - 1;
+	*out = m_pending[last];
+	m_pending.SetSize(last);
+}
+
+bool FutureIOScheduler::PrepareRequest(Request * request)
+{
+	if(request->m_flags & Request_OwnsBuffer)
+	{
+		request->m_buffer = FUTURE_ALLOC(request->m_bytes, "I/O scheduler read buffer");
+		if(!request->m_buffer)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FutureIOScheduler::AdviseRequest(Request * request)
+{
+#if FUTURE_PLATFORM_LINUX
+	return posix_fadvise((int)request->m_file, (off_t)request->m_offset, (off_t)request->m_bytes, POSIX_FADV_WILLNEED) == 0;
+#elif FUTURE_PLATFORM_OSX || FUTURE_PLATFORM_IOS
+	struct radvisory advice;
+	advice.ra_offset = (off_t)request->m_offset;
+	advice.ra_count = (int)request->m_bytes;
+	return fcntl((int)request->m_file, F_RDADVISE, &advice) != -1;
+#else
+	// a handle can't be given a hint, the pages are read when the mapping is first touched
+	return true;
+#endif
+}
+
+void FutureIOScheduler::PerformRequest(Request * request)
+{
+	if(request->m_flags & Request_Advise)
+	{
+		FinishRequest(request, AdviseRequest(request) ? request->m_bytes : 0);
+		return;
+	}
+	if(!PrepareRequest(request))
+	{
+		FinishRequest(request, 0);
+		return;
+	}
+
+	u32 bytesRead = 0;
+	while(bytesRead < request->m_bytes)
+	{
+		u8 * buffer = (u8*)request->m_buffer + bytesRead;
+		u64 offset = request->m_offset + bytesRead;
+		u32 remaining = request->m_bytes - bytesRead;
+#if FUTURE_PLATFORM_WINDOWS
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD result = 0;
+		if(!::ReadFile((HANDLE)(size_t)request->m_file, buffer, remaining, &result, &overlapped) || result == 0)
+		{
+			break;
+		}
+#elif FUTURE_PLATFORM_ANDROID
+		s32 result = -1;
+		break;
+#else
+		ssize_t result = pread((int)request->m_file, buffer, remaining, (off_t)offset);
+		if(result < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(result <= 0)
+		{
+			break;
+		}
+#endif
+		bytesRead += (u32)result;
+	}
+	FinishRequest(request, bytesRead);
+}
+
+void FutureIOScheduler::FinishRequest(Request * request, u32 bytesRead)
+{
+	bool success = (request->m_buffer || (request->m_flags & Request_Advise)) && bytesRead == request->m_bytes;
+
+	if(request->m_flags & Request_CloseFile)
+	{
+		CloseFile(request->m_file);
+	}
+	if((request->m_flags & Request_OwnsBuffer) && !success)
+	{
+		if(request->m_buffer)
+		{
+			FUTURE_FREE(request->m_buffer);
+		}
+		request->m_buffer = NULL;
+	}
+
+	if(!request->m_callback)
+	{
+		RequestDone();
+		return;
+	}
+
+	FutureIOCompletion completion;
+	completion.m_callback = request->m_callback;
+	completion.m_scheduler = this;
+	completion.m_buffer = request->m_buffer;
+	completion.m_bytes = bytesRead;
+	completion.m_success = success;
+	memcpy(completion.m_payload, request->m_payload, sizeof(completion.m_payload));
+
+#if FUTURE_ENABLE_MULTITHREADED
+	FutureThreadPool * pool = FutureThreadPool::GetInstance();
+	if(pool)
+	{
+		FutureThreadJob * job = new FutureThreadJob(FinishedJob, NULL, request->m_priority);
+		job->SetPayload(&completion, sizeof(completion));
+		pool->AddJob(job);
+		return;
+	}
+#endif
+	// without workers a posted callback would only run once WaitForIdle had given up waiting for it
+	FinishedJob(&completion);
+}
+
+void FutureIOScheduler::FinishedJob(void * data)
+{
+	FutureIOCompletion * completion = (FutureIOCompletion*)data;
+	completion->m_callback(completion->m_buffer, completion->m_bytes, completion->m_success, completion->m_payload);
+	completion->m_scheduler->RequestDone();
+}
+
+void FutureIOScheduler::RequestDone()
+{
+	m_condition.Lock();
+	--m_outstanding;
+	if(m_outstanding == 0)
+	{
+		m_condition.Broadcast();
+	}
+	m_condition.Unlock();
+}
+
+void FutureIOScheduler::ThreadMain(void * data)
+{
+	FutureIOScheduler * scheduler = (FutureIOScheduler*)data;
+	Request request;
+	while(true)
+	{
+		scheduler->m_condition.Lock();
+		while(!scheduler->m_stopping && scheduler->m_pending.Size() == 0)
+		{
+			scheduler->m_condition.Wait();
+		}
+		if(scheduler->m_pending.Size() == 0)
+		{
+			scheduler->m_condition.Unlock();
+			// completion jobs were allocated from this thread's job cache
+			FutureJobAllocator::ReleaseThread();
+			return;
+		}
+		scheduler->PopRequest(&request);
+		scheduler->m_condition.Unlock();
+
+		scheduler->PerformRequest(&request);
+	}
+}
+
+#if FUTURE_ENABLE_IO_URING
+
+bool FutureIOScheduler::CreateRing()
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, FUTURE_IO_QUEUE_DEPTH, &params);
+	if(fd < 0)
+	{
+		return false;
+	}
+
+	FutureIORing * ring = new FutureIORing;
+	memset(ring, 0, sizeof(FutureIORing));
+	ring->m_fd = fd;
+	ring->m_entries = params.sq_entries;
+	ring->m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(u32);
+	ring->m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	ring->m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+	// newer kernels put both rings in one mapping
+	bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if(single)
+	{
+		ring->m_sqRingSize = ring->m_cqRingSize = ring->m_sqRingSize > ring->m_cqRingSize ? ring->m_sqRingSize : ring->m_cqRingSize;
+	}
+
+	ring->m_sqRing = mmap(NULL, ring->m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(ring->m_sqRing == MAP_FAILED)
+	{
+		close(fd);
+		delete ring;
+		return false;
+	}
+	if(single)
+	{
+		ring->m_cqRing = ring->m_sqRing;
+	}
+	else
+	{
+		ring->m_cqRing = mmap(NULL, ring->m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(ring->m_cqRing == MAP_FAILED)
+		{
+			munmap(ring->m_sqRing, ring->m_sqRingSize);
+			close(fd);
+			delete ring;
+			return false;
+		}
+	}
+	void * sqes = mmap(NULL, ring->m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED)
+	{
+		if(!single)
+		{
+			munmap(ring->m_cqRing, ring->m_cqRingSize);
+		}
+		munmap(ring->m_sqRing, ring->m_sqRingSize);
+		close(fd);
+		delete ring;
+		return false;
+	}
+
+	u8 * sq = (u8*)ring->m_sqRing;
+	u8 * cq = (u8*)ring->m_cqRing;
+	ring->m_sqHead = (volatile u32*)(sq + params.sq_off.head);
+	ring->m_sqTail = (volatile u32*)(sq + params.sq_off.tail);
+	ring->m_sqMask = (u32*)(sq + params.sq_off.ring_mask);
+	ring->m_sqArray = (u32*)(sq + params.sq_off.array);
+	ring->m_sqes = (io_uring_sqe*)sqes;
+	ring->m_cqHead = (volatile u32*)(cq + params.cq_off.head);
+	ring->m_cqTail = (volatile u32*)(cq + params.cq_off.tail);
+	ring->m_cqMask = (u32*)(cq + params.cq_off.ring_mask);
+	ring->m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	m_ring = ring;
+	return true;
+}
+
+void FutureIOScheduler::DestroyRing()
+{
+	munmap(m_ring->m_sqes, m_ring->m_sqesSize);
+	if(m_ring->m_cqRing != m_ring->m_sqRing)
+	{
+		munmap(m_ring->m_cqRing, m_ring->m_cqRingSize);
+	}
+	munmap(m_ring->m_sqRing, m_ring->m_sqRingSize);
+	close(m_ring->m_fd);
+	delete m_ring;
+	m_ring = NULL;
+}
+
+void FutureIOScheduler::RingMain(void * data)
+{
+	FutureIOScheduler * scheduler = (FutureIOScheduler*)data;
+	FutureIORing * ring = scheduler->m_ring;
+
+	// reads in flight live in slots, a read's slot is its user_data so the completion can find it
+	u32 depth = ring->m_entries < FUTURE_IO_QUEUE_DEPTH ? ring->m_entries : FUTURE_IO_QUEUE_DEPTH;
+	Request slots[FUTURE_IO_QUEUE_DEPTH];
+	u32 bytesDone[FUTURE_IO_QUEUE_DEPTH];
+	u32 freeSlots[FUTURE_IO_QUEUE_DEPTH];
+	u32 numFree = depth;
+	for(u32 i = 0; i < depth; ++i)
+	{
+		freeSlots[i] = depth - 1 - i;
+	}
+	u32 taken[FUTURE_IO_QUEUE_DEPTH];
+	// cleared if the kernel sets up the ring but doesn't know IORING_OP_READ, reads are done directly afterwards
+	bool ringReads = true;
+
+	while(true)
+	{
+		u32 numInFlight = depth - numFree;
+
+		// take as many reads as there is room for, only sleeping here if nothing is in flight
+		u32 numTaken = 0;
+		scheduler->m_condition.Lock();
+		while(!scheduler->m_stopping && numInFlight == 0 && scheduler->m_pending.Size() == 0)
+		{
+			scheduler->m_condition.Wait();
+		}
+		if(numInFlight == 0 && scheduler->m_pending.Size() == 0)
+		{
+			scheduler->m_condition.Unlock();
+			FutureJobAllocator::ReleaseThread();
+			return;
+		}
+		while(numFree > 0 && scheduler->m_pending.Size() > 0)
+		{
+			u32 slot = freeSlots[--numFree];
+			scheduler->PopRequest(&slots[slot]);
+			taken[numTaken++] = slot;
+		}
+		scheduler->m_condition.Unlock();
+
+		u32 tail = *ring->m_sqTail;
+		for(u32 i = 0; i < numTaken; ++i)
+		{
+			u32 slot = taken[i];
+			Request * request = &slots[slot];
+			bytesDone[slot] = 0;
+			if(!ringReads)
+			{
+				scheduler->PerformRequest(request);
+				freeSlots[numFree++] = slot;
+				continue;
+			}
+			if(!scheduler->PrepareRequest(request))
+			{
+				scheduler->FinishRequest(request, 0);
+				freeSlots[numFree++] = slot;
+				continue;
+			}
+
+			u32 index = tail & *ring->m_sqMask;
+			io_uring_sqe * sqe = &ring->m_sqes[index];
+			memset(sqe, 0, sizeof(io_uring_sqe));
+			sqe->fd = (int)request->m_file;
+			sqe->off = request->m_offset;
+			sqe->len = request->m_bytes;
+			sqe->user_data = slot;
+			if(request->m_flags & Request_Advise)
+			{
+				sqe->opcode = IORING_OP_FADVISE;
+				sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+			}
+			else
+			{
+				sqe->opcode = IORING_OP_READ;
+				sqe->addr = (u64)(size_t)request->m_buffer;
+			}
+			ring->m_sqArray[index] = index;
+			++tail;
+		}
+		// the kernel reads the entries once it sees the new tail
+		FutureAtomicStore((volatile s32*)ring->m_sqTail, (s32)tail);
+
+		numInFlight = depth - numFree;
+		if(numInFlight == 0)
+		{
+			continue;
+		}
+
+		// entries the kernel hasn't consumed yet, left behind by an EAGAIN/EBUSY or a partial submit, go in again with the new ones
+		u32 numUnsubmitted = tail - (u32)FutureAtomicLoad((const volatile s32*)ring->m_sqHead);
+		int result = (int)syscall(__NR_io_uring_enter, ring->m_fd, numUnsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			FUTURE_LOG_ERROR(L"io_uring_enter failed with %d", errno);
+		}
+
+		u32 head = *ring->m_cqHead;
+		u32 cqTail = (u32)FutureAtomicLoad((const volatile s32*)ring->m_cqTail);
+		while(head != cqTail)
+		{
+			io_uring_cqe * cqe = &ring->m_cqes[head & *ring->m_cqMask];
+			u32 slot = (u32)cqe->user_data;
+			s32 res = cqe->res;
+			++head;
+
+			Request * request = &slots[slot];
+			if(request->m_flags & Request_Advise)
+			{
+				// kernels before 5.6 don't know IORING_OP_FADVISE either, the advice is given directly
+				bool advised = res == 0 || ((res == -EINVAL || res == -EOPNOTSUPP) && scheduler->AdviseRequest(request));
+				scheduler->FinishRequest(request, advised ? request->m_bytes : 0);
+				freeSlots[numFree++] = slot;
+				continue;
+			}
+			if(res > 0)
+			{
+				bytesDone[slot] += (u32)res;
+			}
+			if(res > 0 && bytesDone[slot] < request->m_bytes)
+			{
+				// short reads are rare, the rest is read here rather than going back through the ring
+				Request rest = *request;
+				rest.m_offset += bytesDone[slot];
+				rest.m_bytes -= bytesDone[slot];
+				rest.m_buffer = (u8*)request->m_buffer + bytesDone[slot];
+				while(rest.m_bytes > 0)
+				{
+					ssize_t count = pread((int)rest.m_file, rest.m_buffer, rest.m_bytes, (off_t)rest.m_offset);
+					if(count < 0 && errno == EINTR)
+					{
+						continue;
+					}
+					if(count <= 0)
+					{
+						break;
+					}
+					bytesDone[slot] += (u32)count;
+					rest.m_offset += count;
+					rest.m_bytes -= (u32)count;
+					rest.m_buffer = (u8*)rest.m_buffer + count;
+				}
+			}
+			else if(res == -EINVAL || res == -EOPNOTSUPP)
+			{
+				// kernels before 5.6 set up the ring but don't know IORING_OP_READ
+				if(ringReads)
+				{
+					FUTURE_LOG_DEBUG(L"io_uring doesn't support reads on this kernel, the I/O scheduler is reading directly");
+					ringReads = false;
+				}
+				ssize_t count = 0;
+				while(bytesDone[slot] < request->m_bytes)
+				{
+					count = pread((int)request->m_file, (u8*)request->m_buffer + bytesDone[slot], request->m_bytes - bytesDone[slot], (off_t)(request->m_offset + bytesDone[slot]));
+					if(count < 0 && errno == EINTR)
+					{
+						continue;
+					}
+					if(count <= 0)
+					{
+						break;
+					}
+					bytesDone[slot] += (u32)count;
+				}
+			}
+			scheduler->FinishRequest(request, bytesDone[slot]);
+			freeSlots[numFree++] = slot;
+		}
+		FutureAtomicStore((volatile s32*)ring->m_cqHead, (s32)head);
+	}
+}
+
+#endif
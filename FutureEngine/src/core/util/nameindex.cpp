@@ -0,0 +1,207 @@
+/*
+ *	Copyright 2013 by Lucas Stufflebeam mailto:info@indiegameadventures.com
+ *
+ *	Licensed under the Apache License, Version 2.0 (the "License");
+ *	you may not use this file except in compliance with the License.
+ *	You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *	Unless required by applicable law or agreed to in writing, software
+ *	distributed under the License is distributed on an "AS IS" BASIS,
+ *	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *	See the License for the specific language governing permissions and
+ *	limitations under the License.
+ *
+ */
+
+/*
+*	Implementation of FutureNameIndex
+*/
+
+#include <future/core/util/container/nameindex.h>
+#include <future/core/debug/debug.h>
+#include <string.h>
+
+FutureNameIndex::FutureNameIndex()
+	: m_count(0),
+	  m_mask(0),
+	  m_slots(NULL),
+	  m_hashes(NULL),
+	  m_nameOffsets(NULL),
+	  m_names(NULL),
+	  m_namesSize(0),
+	  m_namesCapacity(0)
+{}
+
+FutureNameIndex::~FutureNameIndex()
+{
+	Clear();
+}
+
+u64 FutureNameIndex::Hash(const char * name)
+{
+	u64 hash = 14695981039346656037ull;
+	for(const u8 * c = (const u8*)name; *c; ++c)
+	{
+		hash = (hash ^ *c) * 1099511628211ull;
+	}
+	// 0 marks an id without a name
+	return hash == 0 ? 1 : hash;
+}
+
+void FutureNameIndex::Reset(u32 count, bool storeNames)
+{
+	Clear();
+
+	// at most half full, so probes stay short
+	u32 slots = 16;
+	while(slots < count * 2)
+	{
+		slots <<= 1;
+	}
+	m_count = count;
+	m_mask = slots - 1;
+	m_slots = (u32*)FUTURE_ALLOC(sizeof(u32) * slots, "Name index slots");
+	memset(m_slots, 0, sizeof(u32) * slots);
+	if(count > 0)
+	{
+		m_hashes = (u64*)FUTURE_ALLOC(sizeof(u64) * count, "Name index hashes");
+		memset(m_hashes, 0, sizeof(u64) * count);
+		if(storeNames)
+		{
+			m_nameOffsets = (u32*)FUTURE_ALLOC(sizeof(u32) * count, "Name index name offsets");
+			memset(m_nameOffsets, 0xFF, sizeof(u32) * count);
+		}
+	}
+}
+
+void FutureNameIndex::Clear()
+{
+	if(m_slots)
+	{
+		FUTURE_FREE(m_slots);
+		m_slots = NULL;
+	}
+	if(m_hashes)
+	{
+		FUTURE_FREE(m_hashes);
+		m_hashes = NULL;
+	}
+	if(m_nameOffsets)
+	{
+		FUTURE_FREE(m_nameOffsets);
+		m_nameOffsets = NULL;
+	}
+	if(m_names)
+	{
+		FUTURE_FREE(m_names);
+		m_names = NULL;
+	}
+	m_count = 0;
+	m_mask = 0;
+	m_namesSize = 0;
+	m_namesCapacity = 0;
+}
+
+bool FutureNameIndex::SetName(u32 id, const char * name)
+{
+	FUTURE_ASSERT(id < m_count);
+	if(!name)
+	{
+		return true;
+	}
+
+	if(m_nameOffsets)
+	{
+		u32 length = (u32)strlen(name) + 1;
+		if(m_namesSize + length > m_namesCapacity)
+		{
+			u32 capacity = m_namesCapacity > 0 ? m_namesCapacity : 256;
+			while(capacity < m_namesSize + length)
+			{
+				capacity <<= 1;
+			}
+			m_names = (char*)FUTURE_REALLOC(m_names, capacity, "Name index names");
+			m_namesCapacity = capacity;
+		}
+		memcpy(m_names + m_namesSize, name, length);
+		m_nameOffsets[id] = m_namesSize;
+		m_namesSize += length;
+	}
+	return Insert(id, Hash(name));
+}
+
+bool FutureNameIndex::SetHash(u32 id, u64 hash)
+{
+	FUTURE_ASSERT(id < m_count);
+	return Insert(id, hash == 0 ? 1 : hash);
+}
+
+bool FutureNameIndex::Insert(u32 id, u64 hash)
+{
+	FUTURE_ASSERT(m_hashes[id] == 0);
+
+	u32 slot = (u32)hash & m_mask;
+	while(m_slots[slot] != 0)
+	{
+		if(m_hashes[m_slots[slot] - 1] == hash)
+		{
+			// the id is still findable through its name if names are stored, without them it's ambiguous
+			FUTURE_LOG_WARNING(L"Name index ids %u and %u have the same name hash", m_slots[slot] - 1, id);
+			if(!m_nameOffsets)
+			{
+				return false;
+			}
+		}
+		slot = (slot + 1) & m_mask;
+	}
+	m_slots[slot] = id + 1;
+	m_hashes[id] = hash;
+	return true;
+}
+
+u32 FutureNameIndex::Find(const char * name) const
+{
+	if(!name || m_count == 0)
+	{
+		return FUTURE_NAME_INDEX_NULL;
+	}
+
+	u64 hash = Hash(name);
+	u32 slot = (u32)hash & m_mask;
+	while(m_slots[slot] != 0)
+	{
+		u32 id = m_slots[slot] - 1;
+		if(m_hashes[id] == hash)
+		{
+			const char * stored = Name(id);
+			if(!stored || strcmp(stored, name) == 0)
+			{
+				return id;
+			}
+		}
+		slot = (slot + 1) & m_mask;
+	}
+	return FUTURE_NAME_INDEX_NULL;
+}
+
+const char * FutureNameIndex::Name(u32 id) const
+{
+	if(!m_nameOffsets || id >= m_count || m_nameOffsets[id] == FUTURE_NAME_INDEX_NULL)
+	{
+		return NULL;
+	}
+	return m_names + m_nameOffsets[id];
+}
+
+u32 FutureNameIndex::MemoryUsage() const
+{
+	u32 bytes = m_slots ? sizeof(u32) * (m_mask + 1) : 0;
+	bytes += sizeof(u64) * m_count;
+	if(m_nameOffsets)
+	{
+		bytes += sizeof(u32) * m_count + m_namesCapacity;
+	}
+	return bytes;
+}
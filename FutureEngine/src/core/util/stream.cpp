@@ -22,6 +22,7 @@
 #include <future/core/util/stream.h>
 #include <future/core/util/file.h>
 #include <future/core/thread/thread.h>
+#include <future/core/thread/pool/threadpool.h>
 
 FutureBufferedInputStream::FutureBufferedInputStream()
 	: m_open(false),
@@ -73,6 +74,25 @@ void FutureBufferedInputStream::Skip(u32 bytes)
 	Read(bytes, NULL);
 }
 
+const void * FutureBufferedInputStream::ReadInPlace(u32 bytes)
+{
+	CheckBuffer();
+	if(m_bufferSize < bytes || m_buffer == NULL)
+	{
+		return NULL;
+	}
+	const void * out = m_buffer;
+	m_bufferSize -= bytes;
+	m_buffer += bytes;
+	return out;
+}
+const void * FutureBufferedInputStream::ReadArrayInPlace(u32 elementSize, u32 * elementsOut)
+{
+	u16 size = ReadU16();
+	*elementsOut = size;
+	return ReadInPlace(size * elementSize);
+}
+
 char FutureBufferedInputStream::ReadChar()
 {
 	char out;
@@ -349,6 +369,74 @@ void FutureMemoryInputStream::UpdateBuffer()
 }
 
 
+FutureMappedInputStream::FutureMappedInputStream()
+	: FutureBufferedInputStream(),
+	  m_ownedFile(NULL),
+	  m_data(NULL),
+	  m_size(0)
+{}
+FutureMappedInputStream::~FutureMappedInputStream()
+{}
+
+bool FutureMappedInputStream::Open(const char * file)
+{
+	FUTURE_ASSERT(!m_open && file);
+
+	FutureMappedFile * mapped = new FutureMappedFile();
+	if(!mapped->Map(file) || mapped->Size() > 0xFFFFFFFF)
+	{
+		delete mapped;
+		return false;
+	}
+	m_ownedFile = mapped;
+	m_data = mapped->Data();
+	m_size = (u32)mapped->Size();
+	m_open = true;
+	return true;
+}
+
+bool FutureMappedInputStream::Open(const FutureMappedFile * file, u64 offset, u32 size)
+{
+	FUTURE_ASSERT(!m_open && file && file->IsMapped());
+	if(offset > file->Size() || size > file->Size() - offset)
+	{
+		return false;
+	}
+	m_ownedFile = NULL;
+	m_data = file->Data() + offset;
+	m_size = size;
+	m_open = true;
+	return true;
+}
+
+void FutureMappedInputStream::Close()
+{
+	FutureBufferedInputStream::Close();
+	if(m_ownedFile)
+	{
+		delete m_ownedFile;
+		m_ownedFile = NULL;
+	}
+	m_data = NULL;
+	m_size = 0;
+}
+
+void FutureMappedInputStream::UpdateBuffer()
+{
+	if(m_data && m_size > 0)
+	{
+		m_bufferSize = m_size;
+		m_buffer = (u8*)m_data;
+		m_size = 0;
+	}
+	else
+	{
+		m_bufferSize = 0;
+		m_buffer = NULL;
+	}
+}
+
+
 void ReadFileAsync(void * data)
 {
 	FutureFileInputStream * stream = dynamic_cast<FutureFileInputStream*>(data);
@@ -364,7 +452,7 @@ FutureFileInputStream::FutureFileInputStream()
 	  m_isEOF(false),
 	  m_nextChunkSize(0),
 	  m_nextChunk(NULL),
-	  m_waitingForRead(false),
+	  m_waitingForRead(0),
 	  m_waitingForBuffer(false),
 	  m_thread(NULL),
 	  m_readAsync(true)
@@ -385,7 +473,7 @@ bool FutureFileInputStream::Open(const char * file, u32 chuckSize, bool async)
 #endif
 	m_isEOF = false;
 	m_waitingForBuffer = false;
-	m_waitingForRead = false;
+	m_waitingForRead = 0;
 
 	bool result = m_file->OpenForRead(file);
 	if(result)
@@ -446,11 +534,11 @@ void FutureFileInputStream::ProcessReadAsync()
 				return;
 			}
 		}
-		m_waitingForRead = true;
+		FutureAtomicStore(&m_waitingForRead, 1);
 		FUTURE_ASSERT(m_open && m_file && m_nextChunk)
 		m_nextChunkSize = m_file->Read(m_chunkSize, m_nextChunk);
 		m_waitingForBuffer = true;
-		m_waitingForRead = false;
+		FutureAtomicStore(&m_waitingForRead, 0);
 	}
 }
 
@@ -467,10 +555,8 @@ void FutureFileInputStream::UpdateBuffer()
 
 	if(m_readAsync)
 	{
-		while(m_waitingForRead)
-		{
-			Sleep(1);
-		}
+		// a job reading the stream is suspended instead of holding on to its worker
+		FutureJobWait(&m_waitingForRead);
 		if(m_nextChunkSize < m_chunkSize)
 		{
 			m_isEOF = true;
@@ -23,6 +23,12 @@
 
 #include <ctime>
 
+#if FUTURE_PLATFORM_WINDOWS
+#	include <windows.h>
+#elif FUTURE_PLATFORM_MAC || FUTURE_PLATFORM_IOS
+#	include <mach/mach_time.h>
+#endif
+
 /*******************************************************************/
 
 f32	FutureTimer::CurrentTime()
@@ -35,6 +41,31 @@ f32	FutureTimer::TimeSince(f32 start)
 	return CurrentTime() - start;
 }; 
 
+u64	FutureTimer::CurrentNanoseconds()
+{
+#if FUTURE_PLATFORM_WINDOWS
+	static LARGE_INTEGER frequency = {0};
+	if(frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (u64)((f64)counter.QuadPart * (1000000000.0 / (f64)frequency.QuadPart));
+#elif FUTURE_PLATFORM_MAC || FUTURE_PLATFORM_IOS
+	static mach_timebase_info_data_t timebase = {0, 0};
+	if(timebase.denom == 0)
+	{
+		mach_timebase_info(&timebase);
+	}
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (u64)time.tv_sec * 1000000000 + (u64)time.tv_nsec;
+#endif
+}
+
 f32	FutureTimer::MilliToSeconds(s64 milliSeconds)
 {
 	return (f32)milliSeconds / 1000.f;
@@ -21,6 +21,7 @@
 #include <future/core/tests/debugtests.hpp>
 #include <future/core/tests/allocatortests.hpp>
 #include <future/core/tests/memorysystemtests.hpp>
+#include <future/core/tests/resourcetests.hpp>
 #include <future/core/tests/threadtests.hpp>
 #include <future/core/tests/threadpooltests.hpp>
 
@@ -34,9 +35,36 @@ void FutureMain()
 	//FutureAllocatorTests::TestMallocAllocator();
 	//FutureAllocatorTests::TestPoolAllocator();
 	//FutureAllocatorTests::TestHeapAllocator();
+	//FutureAllocatorTests::TestHeapFragmentation();
 	//FutureAllocatorTests::TestStackAllocator();
+	//FutureAllocatorTests::TestFrameAllocator();
+	//FutureAllocatorTests::TestThreadCache();
+	//FutureAllocatorTests::TestPoolContention();
+	//FutureAllocatorTests::TestVirtualAllocator();
+
+	//FutureMemoryTests::TestSizeClasses();
+	//FutureMemoryTests::TestHeaderlessBlocks();
+	//FutureMemoryTests::TestAlignedAllocations();
+	//FutureMemoryTests::TestRealloc();
+	//FutureMemoryTests::TestMemoryBudgets();
+	//FutureMemoryTests::TestMemorySampling();
+
+	//FutureResourceTests::TestResourcePack();
+	//FutureResourceTests::TestIOScheduler();
+	//FutureResourceTests::TestNameIndex();
+	//FutureResourceTests::TestResidency();
 
 	//FutureThreadTests::TestThreads();
 
 	FutureThreadPoolTests::TestThreadPool();
+	//FutureThreadPoolTests::TestThreadPoolScaling();
+	//FutureThreadPoolTests::TestThreadPoolEnqueue();
+	//FutureThreadPoolTests::TestJobDependencies();
+	//FutureThreadPoolTests::TestParallelFor();
+	//FutureThreadPoolTests::TestThreadPoolLatency();
+	//FutureThreadPoolTests::TestJobAllocations();
+	//FutureThreadPoolTests::TestJobWait();
+	//FutureThreadPoolTests::TestThreadPoolAffinity();
+	//FutureThreadPoolTests::TestThreadPoolProfile();
+	//FutureThreadPoolTests::TestJobTrace();
 }